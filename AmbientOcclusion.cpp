@@ -0,0 +1,322 @@
+//-----------------------------------------------------------------------------
+// File: AmbientOcclusion.cpp
+//
+// Keep the arithmetic in sync with the SSAO techniques in DirectDepthAccess.fx.
+//-----------------------------------------------------------------------------
+#include "AmbientOcclusion.h"
+#include <math.h>
+
+// Directions at 45 degree steps with increasing distance, same literals as AOKernel
+const float AmbientOcclusion::s_kernel[KERNEL_SIZE][3] =
+{
+	{  1.0f,			0.0f,			0.125f },
+	{  0.70710678f,		0.70710678f,	0.25f },
+	{  0.0f,			1.0f,			0.375f },
+	{ -0.70710678f,		0.70710678f,	0.5f },
+	{ -1.0f,			0.0f,			0.625f },
+	{ -0.70710678f,		-0.70710678f,	0.75f },
+	{  0.0f,			-1.0f,			0.875f },
+	{  0.70710678f,		-0.70710678f,	1.0f },
+};
+
+// Gaussian with sigma 2, same literals as AOBlurWeights
+const float AmbientOcclusion::s_blurWeights[BLUR_RADIUS + 1] =
+{
+	1.0f, 0.8824969f, 0.6065307f, 0.3246525f, 0.1353353f
+};
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE float saturate(float v)
+{
+	return clampf(v, 0.0f, 1.0f);
+}
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE uint8_t quantize(float v)
+{
+	return (uint8_t)(saturate(v) * 255.0f + 0.5f);
+}
+
+//--------------------------------------------------------------------------------------
+struct AOPosition
+{
+	float x, y, z;
+};
+
+//--------------------------------------------------------------------------------------
+// HalfPosAt() in the shader
+static FORCE_INLINE AOPosition halfPosition(const DepthImage& halfDepth, int x, int y,
+	float invWidth, float invHeight, float invScaleX, float invScaleY)
+{
+	x = mini(maxi(x, 0), halfDepth.getWidth() - 1);
+	y = mini(maxi(y, 0), halfDepth.getHeight() - 1);
+	const float z = halfDepth.at(x, y);
+	const float u = (x + 0.5f) * invWidth;
+	const float v = (y + 0.5f) * invHeight;
+	AOPosition p;
+	p.x = ((u * 2.0f - 1.0f) * invScaleX) * z;
+	p.y = ((1.0f - v * 2.0f) * invScaleY) * z;
+	p.z = z;
+	return p;
+}
+
+//--------------------------------------------------------------------------------------
+AmbientOcclusion::AmbientOcclusion()
+	: m_ao( NULL )
+	, m_blurTemp( NULL )
+	, m_blurred( NULL )
+	, m_result( NULL )
+	, m_width( 0 )
+	, m_height( 0 )
+	, m_halfWidth( 0 )
+	, m_halfHeight( 0 )
+{
+	buildRotationTable(m_rotation);
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+AmbientOcclusion::~AmbientOcclusion()
+{
+	delete[] m_ao;
+	delete[] m_blurTemp;
+	delete[] m_blurred;
+	delete[] m_result;
+}
+
+//--------------------------------------------------------------------------------------
+void AmbientOcclusion::buildRotationTable(float table[16][2])
+{
+	// 4x4 Bayer order spreads neighbouring rotations as far apart as possible,
+	// the rotations only need to cover the 45 degrees between kernel directions
+	static const int bayer[16] =
+	{
+		 0,  8,  2, 10,
+		12,  4, 14,  6,
+		 3, 11,  1,  9,
+		15,  7, 13,  5
+	};
+	for (int i = 0; i < 16; ++i)
+	{
+		const float angle = bayer[i] * (2.0f * 3.14159265f / 16.0f) / 8.0f;
+		table[i][0] = cosf(angle);
+		table[i][1] = sinf(angle);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+AOCompareResult AmbientOcclusion::compare(const uint8_t* a, const uint8_t* b, int count, int tolerance)
+{
+	AOCompareResult result;
+	result.maxDifference = 0;
+	result.mismatchCount = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const int difference = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+		result.maxDifference = maxi(result.maxDifference, difference);
+		if (difference > tolerance)
+		{
+			++result.mismatchCount;
+		}
+	}
+	return result;
+}
+
+//--------------------------------------------------------------------------------------
+void AmbientOcclusion::allocate(int width, int height)
+{
+	if (width == m_width && height == m_height)
+	{
+		return;
+	}
+	delete[] m_ao;
+	delete[] m_blurTemp;
+	delete[] m_blurred;
+	delete[] m_result;
+
+	m_width = width;
+	m_height = height;
+	m_halfWidth = (width + 1) / 2;
+	m_halfHeight = (height + 1) / 2;
+	m_halfDepth.resize(m_halfWidth, m_halfHeight);
+	m_ao = new uint8_t[m_halfWidth * m_halfHeight];
+	m_blurTemp = new uint8_t[m_halfWidth * m_halfHeight];
+	m_blurred = new uint8_t[m_halfWidth * m_halfHeight];
+	m_result = new uint8_t[width * height];
+}
+
+//--------------------------------------------------------------------------------------
+// SSAODownsample: nearest of each 2x2 quad in view space
+void AmbientOcclusion::downsample(const DepthImage& depth, const DepthProjection& projection)
+{
+	for (int y = 0; y < m_halfHeight; ++y)
+	{
+		const int y0 = 2 * y;
+		const int y1 = mini(2 * y + 1, m_height - 1);
+		for (int x = 0; x < m_halfWidth; ++x)
+		{
+			const int x0 = 2 * x;
+			const int x1 = mini(2 * x + 1, m_width - 1);
+			const float z00 = linearizeDepth(depth.at(x0, y0), projection);
+			const float z10 = linearizeDepth(depth.at(x1, y0), projection);
+			const float z01 = linearizeDepth(depth.at(x0, y1), projection);
+			const float z11 = linearizeDepth(depth.at(x1, y1), projection);
+			m_halfDepth.at(x, y) = minf(minf(z00, z10), minf(z01, z11));
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// SSAOCompute
+void AmbientOcclusion::computeAO(const DepthProjection& projection, const AOParams& params)
+{
+	const float invWidth = 1.0f / m_halfWidth;
+	const float invHeight = 1.0f / m_halfHeight;
+	const float invScaleX = 1.0f / projection.scaleX;
+	const float invScaleY = 1.0f / projection.scaleY;
+	const float projScale = projection.scaleY * m_halfHeight * 0.5f;
+	const float invRadius2 = 1.0f / (params.radius * params.radius);
+
+	for (int y = 0; y < m_halfHeight; ++y)
+	{
+		for (int x = 0; x < m_halfWidth; ++x)
+		{
+			const AOPosition p = halfPosition(m_halfDepth, x, y, invWidth, invHeight, invScaleX, invScaleY);
+			const AOPosition pl = halfPosition(m_halfDepth, x - 1, y, invWidth, invHeight, invScaleX, invScaleY);
+			const AOPosition pr = halfPosition(m_halfDepth, x + 1, y, invWidth, invHeight, invScaleX, invScaleY);
+			const AOPosition pu = halfPosition(m_halfDepth, x, y - 1, invWidth, invHeight, invScaleX, invScaleY);
+			const AOPosition pd = halfPosition(m_halfDepth, x, y + 1, invWidth, invHeight, invScaleX, invScaleY);
+
+			// Pick the smoother side so the normal does not straddle a discontinuity
+			const bool useRight = (fabsf(pr.z - p.z) < fabsf(p.z - pl.z) && x < m_halfWidth - 1) || x < 1;
+			const bool useDown = (fabsf(pd.z - p.z) < fabsf(p.z - pu.z) && y < m_halfHeight - 1) || y < 1;
+			const float tx[3] = { useRight ? pr.x - p.x : p.x - pl.x, useRight ? pr.y - p.y : p.y - pl.y, useRight ? pr.z - p.z : p.z - pl.z };
+			const float ty[3] = { useDown ? pd.x - p.x : p.x - pu.x, useDown ? pd.y - p.y : p.y - pu.y, useDown ? pd.z - p.z : p.z - pu.z };
+
+			float n[3] =
+			{
+				tx[1] * ty[2] - tx[2] * ty[1],
+				tx[2] * ty[0] - tx[0] * ty[2],
+				tx[0] * ty[1] - tx[1] * ty[0]
+			};
+			const float invLength = 1.0f / sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			n[0] *= invLength;
+			n[1] *= invLength;
+			n[2] *= invLength;
+
+			const float* rotation = m_rotation[(y & 3) * 4 + (x & 3)];
+			const float radiusPixels = minf(params.radius * projScale / p.z, params.maxRadiusPixels);
+
+			float occlusion = 0.0f;
+			for (int i = 0; i < KERNEL_SIZE; ++i)
+			{
+				const float distance = s_kernel[i][2] * radiusPixels;
+				const float ox = (s_kernel[i][0] * rotation[0] - s_kernel[i][1] * rotation[1]) * distance;
+				const float oy = (s_kernel[i][0] * rotation[1] + s_kernel[i][1] * rotation[0]) * distance;
+				const int sx = (int)floorf(x + 0.5f + ox);
+				const int sy = (int)floorf(y + 0.5f + oy);
+
+				const AOPosition s = halfPosition(m_halfDepth, sx, sy, invWidth, invHeight, invScaleX, invScaleY);
+				const float vx = s.x - p.x;
+				const float vy = s.y - p.y;
+				const float vz = s.z - p.z;
+				const float d2 = vx * vx + vy * vy + vz * vz;
+				const float cosine = (n[0] * vx + n[1] * vy + n[2] * vz) / sqrtf(d2 + 1e-6f);
+				occlusion += saturate(cosine - params.bias) * saturate(1.0f - d2 * invRadius2);
+			}
+
+			m_ao[y * m_halfWidth + x] = quantize(1.0f - params.intensity * occlusion / KERNEL_SIZE);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// SSAOBlurH / SSAOBlurV
+void AmbientOcclusion::blur(const uint8_t* src, uint8_t* dst, int dx, int dy, const AOParams& params)
+{
+	for (int y = 0; y < m_halfHeight; ++y)
+	{
+		for (int x = 0; x < m_halfWidth; ++x)
+		{
+			const float z0 = m_halfDepth.at(x, y);
+			const float sharpness = params.blurSharpness / z0;
+			float sum = (src[y * m_halfWidth + x] / 255.0f) * s_blurWeights[0];
+			float weightSum = s_blurWeights[0];
+
+			for (int k = 1; k <= BLUR_RADIUS; ++k)
+			{
+				for (int side = -1; side <= 1; side += 2)
+				{
+					const int sx = mini(maxi(x + side * k * dx, 0), m_halfWidth - 1);
+					const int sy = mini(maxi(y + side * k * dy, 0), m_halfHeight - 1);
+					const float z = m_halfDepth.at(sx, sy);
+					const float w = s_blurWeights[k] * saturate(1.0f - fabsf(z - z0) * sharpness);
+					sum += (src[sy * m_halfWidth + sx] / 255.0f) * w;
+					weightSum += w;
+				}
+			}
+			dst[y * m_halfWidth + x] = quantize(sum / weightSum);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// SSAOUpsample
+void AmbientOcclusion::upsample(const DepthImage& depth, const DepthProjection& projection, const AOParams& params)
+{
+	for (int y = 0; y < m_height; ++y)
+	{
+		const float ly = (y + 0.5f) * 0.5f - 0.5f;
+		const float by = floorf(ly);
+		const float fy = ly - by;
+		const int y0 = mini(maxi((int)by, 0), m_halfHeight - 1);
+		const int y1 = mini(maxi((int)by + 1, 0), m_halfHeight - 1);
+
+		for (int x = 0; x < m_width; ++x)
+		{
+			const float lx = (x + 0.5f) * 0.5f - 0.5f;
+			const float bx = floorf(lx);
+			const float fx = lx - bx;
+			const int x0 = mini(maxi((int)bx, 0), m_halfWidth - 1);
+			const int x1 = mini(maxi((int)bx + 1, 0), m_halfWidth - 1);
+
+			const float z = linearizeDepth(depth.at(x, y), projection);
+			const int tapX[4] = { x0, x1, x0, x1 };
+			const int tapY[4] = { y0, y0, y1, y1 };
+			const float bilinear[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+
+			float sum = 0.0f;
+			float weightSum = 0.0f;
+			for (int i = 0; i < 4; ++i)
+			{
+				const float w = bilinear[i] / (params.upsampleEpsilon + fabsf(m_halfDepth.at(tapX[i], tapY[i]) - z));
+				sum += (m_blurred[tapY[i] * m_halfWidth + tapX[i]] / 255.0f) * w;
+				weightSum += w;
+			}
+			m_result[y * m_width + x] = quantize(sum / weightSum);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void AmbientOcclusion::compute(const DepthImage& depth, const DepthProjection& projection, const AOParams& params)
+{
+	allocate(depth.getWidth(), depth.getHeight());
+
+	CpuTimer timer;
+	downsample(depth, projection);
+	m_stats.downsampleMs = timer.elapsedMs();
+
+	timer.start();
+	computeAO(projection, params);
+	m_stats.aoMs = timer.elapsedMs();
+
+	timer.start();
+	blur(m_ao, m_blurTemp, 1, 0, params);
+	blur(m_blurTemp, m_blurred, 0, 1, params);
+	m_stats.blurMs = timer.elapsedMs();
+
+	timer.start();
+	upsample(depth, projection, params);
+	m_stats.upsampleMs = timer.elapsedMs();
+}
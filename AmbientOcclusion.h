@@ -0,0 +1,93 @@
+//-----------------------------------------------------------------------------
+// File: AmbientOcclusion.h
+//
+// CPU reference of the SSAO pipeline in DirectDepthAccess.fx. Every stage
+// follows the shader arithmetic step by step and quantizes to 8 bits where
+// the GPU writes an A8R8G8B8 target, so the two can be compared per pixel.
+//
+// Stages: half resolution min depth, AO with a 4x4 interleaved rotation
+// pattern, separable depth aware blur, depth aware upsample to full size.
+//-----------------------------------------------------------------------------
+#ifndef AMBIENT_OCCLUSION_H
+#define AMBIENT_OCCLUSION_H
+
+#include "DepthImage.h"
+#include "DepthMath.h"
+
+//--------------------------------------------------------------------------------------
+struct AOParams
+{
+	float					radius;				// view space sampling radius
+	float					bias;				// cosine below which samples do not occlude
+	float					intensity;
+	float					maxRadiusPixels;	// half resolution pixels
+	float					blurSharpness;		// relative depth difference that zeroes a blur tap
+	float					upsampleEpsilon;	// view space depth difference added to upsample weights
+};
+
+//--------------------------------------------------------------------------------------
+struct AOStats
+{
+	double					downsampleMs;
+	double					aoMs;
+	double					blurMs;
+	double					upsampleMs;
+};
+
+//--------------------------------------------------------------------------------------
+struct AOCompareResult
+{
+	int						maxDifference;		// in 8 bit steps
+	int						mismatchCount;		// pixels differing by more than the tolerance
+};
+
+//--------------------------------------------------------------------------------------
+class AmbientOcclusion
+{
+public:
+	static const int		KERNEL_SIZE = 8;
+	static const int		BLUR_RADIUS = 4;
+	static const float		s_kernel[KERNEL_SIZE][3];		// direction x, y and distance fraction
+	static const float		s_blurWeights[BLUR_RADIUS + 1];
+
+private:
+	DepthImage				m_halfDepth;
+	uint8_t*				m_ao;
+	uint8_t*				m_blurTemp;
+	uint8_t*				m_blurred;
+	uint8_t*				m_result;
+	float					m_rotation[16][2];
+	int						m_width;
+	int						m_height;
+	int						m_halfWidth;
+	int						m_halfHeight;
+	AOStats					m_stats;
+
+	AmbientOcclusion(const AmbientOcclusion&);
+	AmbientOcclusion& operator=(const AmbientOcclusion&);
+
+	void				allocate(int width, int height);
+	void				downsample(const DepthImage& depth, const DepthProjection& projection);
+	void				computeAO(const DepthProjection& projection, const AOParams& params);
+	void				blur(const uint8_t* src, uint8_t* dst, int dx, int dy, const AOParams& params);
+	void				upsample(const DepthImage& depth, const DepthProjection& projection, const AOParams& params);
+public:
+
+	AmbientOcclusion();
+	~AmbientOcclusion();
+
+	// Rotation (cos, sin) per pixel of the 4x4 interleaved pattern, row major
+	static void			buildRotationTable(float table[16][2]);
+	static AOCompareResult compare(const uint8_t* a, const uint8_t* b, int count, int tolerance);
+
+	void				compute(const DepthImage& depth, const DepthProjection& projection, const AOParams& params);
+
+	const DepthImage&	getHalfDepth() const	{ return m_halfDepth; }
+	const uint8_t*		getHalfAO() const		{ return m_blurred; }
+	const uint8_t*		getResult() const		{ return m_result; }
+	int					getWidth() const		{ return m_width; }
+	int					getHeight() const		{ return m_height; }
+	const AOStats&		getStats() const		{ return m_stats; }
+};
+
+#endif // AMBIENT_OCCLUSION_H
@@ -0,0 +1,515 @@
+//-----------------------------------------------------------------------------
+// File: ClusterCuller.cpp
+//-----------------------------------------------------------------------------
+#include "ClusterCuller.h"
+
+//--------------------------------------------------------------------------------------
+// Unit cross(p1 - p0, p2 - p0), facing the eye on triangles clockwise on screen,
+// the ones CULL_CCW keeps. Zero for degenerate triangles.
+static void triangleNormal(const float* positions, const uint32_t* triangle, float* normal)
+{
+	const float* p0 = positions + triangle[0] * 3;
+	const float* p1 = positions + triangle[1] * 3;
+	const float* p2 = positions + triangle[2] * 3;
+	const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	const float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	for (int a = 0; a < 3; ++a)
+	{
+		normal[a] = length > 0.0f ? normal[a] / length : 0.0f;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Sphere around the bounding box center, cone around the mean triangle normal
+static void computeMeshletBounds(const uint32_t* indices, const float* positions, Meshlet& meshlet)
+{
+	const uint32_t* triangles = indices + meshlet.firstTriangle * 3;
+	float lowest[3];
+	float highest[3];
+	for (int a = 0; a < 3; ++a)
+	{
+		lowest[a] = highest[a] = positions[triangles[0] * 3 + a];
+	}
+	for (int i = 0; i < meshlet.triangleCount * 3; ++i)
+	{
+		const float* p = positions + triangles[i] * 3;
+		for (int a = 0; a < 3; ++a)
+		{
+			lowest[a] = minf(lowest[a], p[a]);
+			highest[a] = maxf(highest[a], p[a]);
+		}
+	}
+	float radiusSquared = 0.0f;
+	for (int a = 0; a < 3; ++a)
+	{
+		meshlet.center[a] = (lowest[a] + highest[a]) * 0.5f;
+	}
+	for (int i = 0; i < meshlet.triangleCount * 3; ++i)
+	{
+		const float* p = positions + triangles[i] * 3;
+		const float dx = p[0] - meshlet.center[0];
+		const float dy = p[1] - meshlet.center[1];
+		const float dz = p[2] - meshlet.center[2];
+		radiusSquared = maxf(radiusSquared, dx * dx + dy * dy + dz * dz);
+	}
+	// Rounding in the distance must not leave a vertex outside
+	meshlet.radius = sqrtf(radiusSquared) * 1.0001f;
+
+	float normals[MESHLET_MAX_TRIANGLES][3];
+	bool valid[MESHLET_MAX_TRIANGLES];
+	float axis[3] = { 0.0f, 0.0f, 0.0f };
+	for (int t = 0; t < meshlet.triangleCount; ++t)
+	{
+		float* n = normals[t];
+		triangleNormal(positions, triangles + t * 3, n);
+		valid[t] = n[0] != 0.0f || n[1] != 0.0f || n[2] != 0.0f;
+		for (int a = 0; a < 3; ++a)
+		{
+			axis[a] += n[a];
+		}
+	}
+	const float axisLength = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	float minDot = axisLength > 0.0f ? 1.0f : -1.0f;
+	for (int a = 0; a < 3; ++a)
+	{
+		meshlet.coneAxis[a] = axisLength > 0.0f ? axis[a] / axisLength : 0.0f;
+	}
+	for (int t = 0; t < meshlet.triangleCount; ++t)
+	{
+		if (valid[t])
+		{
+			minDot = minf(minDot, normals[t][0] * meshlet.coneAxis[0] + normals[t][1] * meshlet.coneAxis[1] +
+				normals[t][2] * meshlet.coneAxis[2]);
+		}
+	}
+	// Normals spread over a half space or more leave no direction to cull from
+	meshlet.coneCutoff = minDot > 0.0f ? sqrtf(1.0f - minDot * minDot) : 1.0f;
+}
+
+//--------------------------------------------------------------------------------------
+int buildMeshlets(uint32_t* indices, int triangleCount, const float* positions, int vertexCount,
+	int maxVertices, int maxTriangles, Meshlet* meshlets)
+{
+	// Triangles around every vertex
+	int* adjacencyStart = new int[vertexCount + 1];
+	int* adjacency = new int[triangleCount * 3 + 1];
+	memset(adjacencyStart, 0, sizeof(int) * (vertexCount + 1));
+	for (int i = 0; i < triangleCount * 3; ++i)
+	{
+		++adjacencyStart[indices[i] + 1];
+	}
+	for (int v = 0; v < vertexCount; ++v)
+	{
+		adjacencyStart[v + 1] += adjacencyStart[v];
+	}
+	int* fill = new int[vertexCount > 0 ? vertexCount : 1];
+	memcpy(fill, adjacencyStart, sizeof(int) * vertexCount);
+	for (int i = 0; i < triangleCount * 3; ++i)
+	{
+		adjacency[fill[indices[i]]++] = i / 3;
+	}
+
+	float* normals = new float[triangleCount * 3 + 1];
+	for (int t = 0; t < triangleCount; ++t)
+	{
+		triangleNormal(positions, indices + t * 3, normals + t * 3);
+	}
+
+	uint32_t* ordered = new uint32_t[triangleCount * 3 + 1];
+	bool* emitted = new bool[triangleCount + 1];
+	memset(emitted, 0, sizeof(bool) * triangleCount);
+	int* owner = fill;							// meshlet that last took each vertex
+	for (int v = 0; v < vertexCount; ++v)
+	{
+		owner[v] = -1;
+	}
+	int* meshletVertices = new int[maxVertices];
+
+	int meshletCount = 0;
+	int emittedCount = 0;
+	int seed = 0;
+	while (emittedCount < triangleCount)
+	{
+		// Seeds follow the order the triangles came in
+		while (emitted[seed])
+		{
+			++seed;
+		}
+		Meshlet& meshlet = meshlets[meshletCount];
+		meshlet.subset = 0;
+		meshlet.firstTriangle = emittedCount;
+		meshlet.triangleCount = 0;
+		meshlet.vertexCount = 0;
+		float normalSum[3] = { 0.0f, 0.0f, 0.0f };
+
+		int next = seed;
+		while (next >= 0)
+		{
+			const uint32_t* triangle = indices + next * 3;
+			for (int k = 0; k < 3; ++k)
+			{
+				if (owner[triangle[k]] != meshletCount)
+				{
+					owner[triangle[k]] = meshletCount;
+					meshletVertices[meshlet.vertexCount++] = (int)triangle[k];
+				}
+				ordered[emittedCount * 3 + k] = triangle[k];
+			}
+			for (int a = 0; a < 3; ++a)
+			{
+				normalSum[a] += normals[next * 3 + a];
+			}
+			emitted[next] = true;
+			++emittedCount;
+			if (++meshlet.triangleCount == maxTriangles)
+			{
+				break;
+			}
+
+			// Of the triangles around the meshlet's vertices the one adding the
+			// fewest vertices, then the one closest to its mean normal
+			const float normalLength = sqrtf(normalSum[0] * normalSum[0] + normalSum[1] * normalSum[1] + normalSum[2] * normalSum[2]);
+			const float invLength = normalLength > 0.0f ? 1.0f / normalLength : 0.0f;
+			float bestScore = 1e30f;
+			next = -1;
+			for (int i = 0; i < meshlet.vertexCount; ++i)
+			{
+				const int v = meshletVertices[i];
+				for (int j = adjacencyStart[v]; j < adjacencyStart[v + 1]; ++j)
+				{
+					const int t = adjacency[j];
+					if (emitted[t])
+					{
+						continue;
+					}
+					const uint32_t* candidate = indices + t * 3;
+					const int added = (owner[candidate[0]] != meshletCount) +
+						(owner[candidate[1]] != meshletCount && candidate[1] != candidate[0]) +
+						(owner[candidate[2]] != meshletCount && candidate[2] != candidate[0] && candidate[2] != candidate[1]);
+					if (meshlet.vertexCount + added > maxVertices)
+					{
+						continue;
+					}
+					const float* n = normals + t * 3;
+					const float alignment = (n[0] * normalSum[0] + n[1] * normalSum[1] + n[2] * normalSum[2]) * invLength;
+					const float score = added + (1.0f - alignment);
+					if (score < bestScore)
+					{
+						bestScore = score;
+						next = t;
+					}
+				}
+			}
+		}
+
+		meshlet.minVertex = meshletVertices[0];
+		meshlet.maxVertex = meshletVertices[0];
+		for (int i = 1; i < meshlet.vertexCount; ++i)
+		{
+			meshlet.minVertex = mini(meshlet.minVertex, meshletVertices[i]);
+			meshlet.maxVertex = maxi(meshlet.maxVertex, meshletVertices[i]);
+		}
+		++meshletCount;
+	}
+	memcpy(indices, ordered, sizeof(uint32_t) * triangleCount * 3);
+	for (int m = 0; m < meshletCount; ++m)
+	{
+		computeMeshletBounds(indices, positions, meshlets[m]);
+	}
+
+	delete[] adjacencyStart;
+	delete[] adjacency;
+	delete[] fill;
+	delete[] normals;
+	delete[] ordered;
+	delete[] emitted;
+	delete[] meshletVertices;
+	return meshletCount;
+}
+
+//--------------------------------------------------------------------------------------
+ClusterCuller::ClusterCuller()
+	: m_meshlets( NULL )
+	, m_meshletCount( 0 )
+	, m_indices( NULL )
+	, m_triangleCount( 0 )
+	, m_ranges( NULL )
+	, m_rangeCount( 0 )
+	, m_hiz( NULL )
+	, m_hizLevels( 0 )
+	, m_hizCapacity( 0 )
+	, m_reversed( false )
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+ClusterCuller::~ClusterCuller()
+{
+	delete[] m_meshlets;
+	delete[] m_indices;
+	delete[] m_ranges;
+	alignedFree(m_hiz);
+}
+
+//--------------------------------------------------------------------------------------
+void ClusterCuller::setMesh(const float* positions, const uint32_t* indices, int vertexCount,
+	const XSubset* subsets, int subsetCount)
+{
+	m_triangleCount = 0;
+	for (int i = 0; i < subsetCount; ++i)
+	{
+		m_triangleCount += subsets[i].triangleCount;
+	}
+	delete[] m_meshlets;
+	delete[] m_indices;
+	delete[] m_ranges;
+	m_meshlets = new Meshlet[m_triangleCount > 0 ? m_triangleCount : 1];
+	m_indices = new uint32_t[m_triangleCount * 3 + 1];
+	memcpy(m_indices, indices, sizeof(uint32_t) * m_triangleCount * 3);
+	m_meshletCount = 0;
+	for (int i = 0; i < subsetCount; ++i)
+	{
+		Meshlet* meshlets = m_meshlets + m_meshletCount;
+		const int count = buildMeshlets(m_indices + subsets[i].firstTriangle * 3, subsets[i].triangleCount, positions,
+			vertexCount, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES, meshlets);
+		for (int m = 0; m < count; ++m)
+		{
+			meshlets[m].subset = i;
+			meshlets[m].firstTriangle += subsets[i].firstTriangle;
+		}
+		m_meshletCount += count;
+	}
+	m_ranges = new ClusterRange[m_meshletCount > 0 ? m_meshletCount : 1];
+	m_rangeCount = 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Level 0 is the image itself, every further level keeps the farthest of up
+// to 2x2 texels of the one before
+void ClusterCuller::buildHiZ(const DepthImage& depth)
+{
+	CpuTimer timer;
+	int width = depth.getWidth();
+	int height = depth.getHeight();
+	int total = 0;
+	m_hizLevels = 0;
+	while (m_hizLevels < MAX_HIZ_LEVELS)
+	{
+		m_hizOffset[m_hizLevels] = total;
+		m_hizWidth[m_hizLevels] = width;
+		m_hizHeight[m_hizLevels] = height;
+		total += width * height;
+		++m_hizLevels;
+		if (width == 1 && height == 1)
+		{
+			break;
+		}
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+	if (total > m_hizCapacity)
+	{
+		alignedFree(m_hiz);
+		m_hiz = (float*)alignedAlloc(sizeof(float) * total, 16);
+		m_hizCapacity = total;
+	}
+
+	for (int y = 0; y < depth.getHeight(); ++y)
+	{
+		memcpy(m_hiz + y * depth.getWidth(), depth.row(y), sizeof(float) * depth.getWidth());
+	}
+	for (int level = 1; level < m_hizLevels; ++level)
+	{
+		const float* src = m_hiz + m_hizOffset[level - 1];
+		const int srcWidth = m_hizWidth[level - 1];
+		const int srcHeight = m_hizHeight[level - 1];
+		float* dst = m_hiz + m_hizOffset[level];
+		for (int y = 0; y < m_hizHeight[level]; ++y)
+		{
+			const float* row0 = src + y * 2 * srcWidth;
+			const float* row1 = src + mini(y * 2 + 1, srcHeight - 1) * srcWidth;
+			for (int x = 0; x < m_hizWidth[level]; ++x)
+			{
+				const int x1 = mini(x * 2 + 1, srcWidth - 1);
+				dst[y * m_hizWidth[level] + x] = fartherDepth(fartherDepth(row0[x * 2], row0[x1], m_reversed),
+					fartherDepth(row1[x * 2], row1[x1], m_reversed), m_reversed);
+			}
+		}
+	}
+	m_stats.hizMs = timer.elapsedMs();
+}
+
+//--------------------------------------------------------------------------------------
+// The corners of the box around the sphere bound its screen rectangle and its
+// nearest depth. Meshlets reaching out of the depth range are kept.
+bool ClusterCuller::isOccluded(const Meshlet& meshlet, const DepthMatrix& worldViewProj, int width, int height) const
+{
+	const DepthMatrix& m = worldViewProj;
+	float minX = 0.0f, maxX = 0.0f, minY = 0.0f, maxY = 0.0f;
+	float nearest = farDepth(m_reversed);
+	for (int i = 0; i < 8; ++i)
+	{
+		const float px = meshlet.center[0] + ((i & 1) ? meshlet.radius : -meshlet.radius);
+		const float py = meshlet.center[1] + ((i & 2) ? meshlet.radius : -meshlet.radius);
+		const float pz = meshlet.center[2] + ((i & 4) ? meshlet.radius : -meshlet.radius);
+		const float x = px * m.m[0][0] + py * m.m[1][0] + pz * m.m[2][0] + m.m[3][0];
+		const float y = px * m.m[0][1] + py * m.m[1][1] + pz * m.m[2][1] + m.m[3][1];
+		const float z = px * m.m[0][2] + py * m.m[1][2] + pz * m.m[2][2] + m.m[3][2];
+		const float w = px * m.m[0][3] + py * m.m[1][3] + pz * m.m[2][3] + m.m[3][3];
+		if (w <= 0.0f || z < 0.0f || z > w)
+		{
+			return false;
+		}
+		const float screenX = (x / w + 1.0f) * width * 0.5f;
+		const float screenY = (1.0f - y / w) * height * 0.5f;
+		minX = i == 0 ? screenX : minf(minX, screenX);
+		maxX = i == 0 ? screenX : maxf(maxX, screenX);
+		minY = i == 0 ? screenY : minf(minY, screenY);
+		maxY = i == 0 ? screenY : maxf(maxY, screenY);
+		nearest = i == 0 || isNearerDepth(z / w, nearest, m_reversed) ? z / w : nearest;
+	}
+
+	// Pixels are sampled at integer positions
+	const int x0 = maxi((int)floorf(minX), 0);
+	const int y0 = maxi((int)floorf(minY), 0);
+	const int x1 = mini((int)ceilf(maxX), width - 1);
+	const int y1 = mini((int)ceilf(maxY), height - 1);
+	if (x0 > x1 || y0 > y1)
+	{
+		return false;
+	}
+	int level = 0;
+	while (level + 1 < m_hizLevels && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+	{
+		++level;
+	}
+	const float* texels = m_hiz + m_hizOffset[level];
+	for (int y = y0 >> level; y <= (y1 >> level); ++y)
+	{
+		for (int x = x0 >> level; x <= (x1 >> level); ++x)
+		{
+			if (!isNearerDepth(texels[y * m_hizWidth[level] + x], nearest, m_reversed))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+int ClusterCuller::cull(const DepthMatrix& worldViewProj, int width, int height)
+{
+	CpuTimer timer;
+	const DepthMatrix& m = worldViewProj;
+
+	// Planes from the columns of the matrix, D3D clip space keeps 0 <= z <= w
+	float planes[6][4];
+	const int columns[6] = { 0, 0, 1, 1, 2, 2 };
+	for (int p = 0; p < 6; ++p)
+	{
+		const int c = columns[p];
+		const float sign = (p & 1) ? -1.0f : 1.0f;
+		for (int j = 0; j < 4; ++j)
+		{
+			planes[p][j] = p == 4 ? m.m[j][2] : m.m[j][3] + sign * m.m[j][c];
+		}
+		const float length = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+		for (int j = 0; j < 4; ++j)
+		{
+			planes[p][j] = length > 0.0f ? planes[p][j] / length : 0.0f;
+		}
+	}
+
+	// The eye is the point clip x, y and w all vanish at
+	const float a[3][3] =
+	{
+		{ m.m[0][0], m.m[1][0], m.m[2][0] },
+		{ m.m[0][1], m.m[1][1], m.m[2][1] },
+		{ m.m[0][3], m.m[1][3], m.m[2][3] },
+	};
+	const float b[3] = { -m.m[3][0], -m.m[3][1], -m.m[3][3] };
+	const float determinant = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) -
+		a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0]) + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+	const bool hasEye = fabsf(determinant) > 1e-12f;
+	float eye[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 3 && hasEye; ++i)
+	{
+		float column[3][3];
+		memcpy(column, a, sizeof(column));
+		for (int r = 0; r < 3; ++r)
+		{
+			column[r][i] = b[r];
+		}
+		eye[i] = (column[0][0] * (column[1][1] * column[2][2] - column[1][2] * column[2][1]) -
+			column[0][1] * (column[1][0] * column[2][2] - column[1][2] * column[2][0]) +
+			column[0][2] * (column[1][0] * column[2][1] - column[1][1] * column[2][0])) / determinant;
+	}
+
+	const bool useHiZ = m_hizLevels > 0 && m_hizWidth[0] == width && m_hizHeight[0] == height;
+	const double hizMs = m_stats.hizMs;
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_stats.hizMs = useHiZ ? hizMs : 0.0;
+	m_stats.trianglesTotal = m_triangleCount;
+	m_rangeCount = 0;
+	int rangeEnd = 0;
+	for (int i = 0; i < m_meshletCount; ++i)
+	{
+		const Meshlet& meshlet = m_meshlets[i];
+		++m_stats.meshletsTested;
+
+		bool outside = false;
+		for (int p = 0; p < 6 && !outside; ++p)
+		{
+			outside = planes[p][0] * meshlet.center[0] + planes[p][1] * meshlet.center[1] +
+				planes[p][2] * meshlet.center[2] + planes[p][3] < -meshlet.radius;
+		}
+		if (outside)
+		{
+			++m_stats.frustumCulled;
+			continue;
+		}
+		if (hasEye)
+		{
+			const float toCenter[3] = { meshlet.center[0] - eye[0], meshlet.center[1] - eye[1], meshlet.center[2] - eye[2] };
+			const float distance = sqrtf(toCenter[0] * toCenter[0] + toCenter[1] * toCenter[1] + toCenter[2] * toCenter[2]);
+			if (toCenter[0] * meshlet.coneAxis[0] + toCenter[1] * meshlet.coneAxis[1] + toCenter[2] * meshlet.coneAxis[2] >=
+				meshlet.coneCutoff * distance + meshlet.radius)
+			{
+				++m_stats.backfaceCulled;
+				continue;
+			}
+		}
+		if (useHiZ && isOccluded(meshlet, worldViewProj, width, height))
+		{
+			++m_stats.occlusionCulled;
+			continue;
+		}
+
+		m_stats.trianglesSubmitted += meshlet.triangleCount;
+		ClusterRange* last = m_rangeCount > 0 ? &m_ranges[m_rangeCount - 1] : NULL;
+		if (last != NULL && last->subset == meshlet.subset && last->firstTriangle + last->triangleCount == meshlet.firstTriangle)
+		{
+			last->triangleCount += meshlet.triangleCount;
+			rangeEnd = maxi(rangeEnd, meshlet.maxVertex + 1);
+			last->minVertex = mini(last->minVertex, meshlet.minVertex);
+			last->vertexCount = rangeEnd - last->minVertex;
+			continue;
+		}
+		ClusterRange& range = m_ranges[m_rangeCount++];
+		range.subset = meshlet.subset;
+		range.firstTriangle = meshlet.firstTriangle;
+		range.triangleCount = meshlet.triangleCount;
+		range.minVertex = meshlet.minVertex;
+		range.vertexCount = meshlet.maxVertex + 1 - meshlet.minVertex;
+		rangeEnd = meshlet.maxVertex + 1;
+	}
+	m_stats.rangesEmitted = m_rangeCount;
+	m_stats.cullMs = timer.elapsedMs();
+	return m_rangeCount;
+}
@@ -0,0 +1,143 @@
+//-----------------------------------------------------------------------------
+// File: ClusterCuller.h
+//
+// Culls a mesh below subset granularity. buildMeshlets() grows meshlets of at
+// most MESHLET_MAX_VERTICES distinct vertices and MESHLET_MAX_TRIANGLES
+// triangles over shared vertices, preferring triangles that face the way the
+// meshlet already does so its cone stays narrow, and reorders the triangles
+// so every meshlet is a range of the index buffer. Seeds are taken in the
+// order the triangles come in, after XMesh::optimize() that is cache order.
+//
+// Every meshlet has a bounding sphere and a cone around its triangle normals.
+// ClusterCuller::cull() then tests each one per frame against
+//
+//   the frustum    the sphere against the six planes of worldViewProj
+//   its cone       all triangles face away from the eye, after Barczak and
+//                  Kapoulkine: dot(center - eye, axis) >= cutoff * |center - eye| + radius
+//   a Hi-Z         the nearest depth of the sphere's screen rectangle behind
+//                  the farthest depth of the pyramid level where that
+//                  rectangle covers at most 2x2 texels
+//
+// and joins the surviving meshlets that follow each other in the same subset
+// into index ranges, one DrawIndexedPrimitive() each.
+//
+// The pyramid is built from a depth image the caller provides, for the
+// current frame that is a prediction like DepthReprojection's: its depth has
+// to be no nearer than the frame will be, or visible meshlets are dropped.
+// Everything is in object space, the eye comes out of worldViewProj.
+//-----------------------------------------------------------------------------
+#ifndef CLUSTER_CULLER_H
+#define CLUSTER_CULLER_H
+
+#include "DepthImage.h"
+#include "DepthMath.h"
+#include "XMesh.h"
+
+// Mesh shader sized, 124 leaves room for a 4 byte count in 128 primitives
+const int					MESHLET_MAX_VERTICES = 64;
+const int					MESHLET_MAX_TRIANGLES = 124;
+
+//--------------------------------------------------------------------------------------
+struct Meshlet
+{
+	int						subset;
+	int						firstTriangle;
+	int						triangleCount;
+	int						vertexCount;		// distinct
+	int						minVertex;			// lowest and
+	int						maxVertex;			// highest index referenced
+	float					center[3];
+	float					radius;
+	float					coneAxis[3];
+	float					coneCutoff;			// sine of the cone's half angle, 1 when it can never be culled
+};
+
+//--------------------------------------------------------------------------------------
+// Consecutive surviving meshlets of one subset
+struct ClusterRange
+{
+	int						subset;
+	int						firstTriangle;
+	int						triangleCount;
+	int						minVertex;
+	int						vertexCount;		// from minVertex on, as DrawIndexedPrimitive() takes it
+};
+
+//--------------------------------------------------------------------------------------
+struct ClusterCullStats
+{
+	double					hizMs;
+	double					cullMs;
+	int						meshletsTested;
+	int						frustumCulled;
+	int						backfaceCulled;
+	int						occlusionCulled;
+	int						trianglesTotal;
+	int						trianglesSubmitted;
+	int						rangesEmitted;
+};
+
+//--------------------------------------------------------------------------------------
+// Reorders the triangles in place. meshlets needs room for triangleCount
+// entries, the triangles of each are then those at indices + 3 * firstTriangle.
+// Returns the meshlet count.
+int					buildMeshlets(uint32_t* indices, int triangleCount, const float* positions, int vertexCount,
+						int maxVertices, int maxTriangles, Meshlet* meshlets);
+
+//--------------------------------------------------------------------------------------
+class ClusterCuller
+{
+public:
+	static const int		MAX_HIZ_LEVELS = 16;
+
+private:
+	Meshlet*				m_meshlets;
+	int						m_meshletCount;
+	uint32_t*				m_indices;			// triangles in meshlet order within every subset
+	int						m_triangleCount;
+	ClusterRange*			m_ranges;
+	int						m_rangeCount;
+
+	float*					m_hiz;				// farthest depth, every level after the last
+	int						m_hizOffset[MAX_HIZ_LEVELS];
+	int						m_hizWidth[MAX_HIZ_LEVELS];
+	int						m_hizHeight[MAX_HIZ_LEVELS];
+	int						m_hizLevels;		// 0 without a pyramid
+	int						m_hizCapacity;
+	bool					m_reversed;
+	ClusterCullStats		m_stats;
+
+	ClusterCuller(const ClusterCuller&);
+	ClusterCuller& operator=(const ClusterCuller&);
+
+	bool				isOccluded(const Meshlet& meshlet, const DepthMatrix& worldViewProj, int width, int height) const;
+public:
+
+	ClusterCuller();
+	~ClusterCuller();
+
+	// Meshlets of every subset, in subset order. Draw with getIndices(), the
+	// triangles stay in their subset but not in their order.
+	void				setMesh(const float* positions, const uint32_t* indices, int vertexCount,
+							const XSubset* subsets, int subsetCount);
+
+	// Depth convention of the Hi-Z source, farther is smaller with reverse-Z
+	void				setReverseZ(bool reversed)	{ m_reversed = reversed; }
+
+	// Pyramid for the next cull(), the image must have the size cull() is given
+	void				buildHiZ(const DepthImage& depth);
+	void				clearHiZ()					{ m_hizLevels = 0; }
+
+	// Returns the number of ranges in getRanges()
+	int					cull(const DepthMatrix& worldViewProj, int width, int height);
+
+	const Meshlet*		getMeshlets() const			{ return m_meshlets; }
+	int					getMeshletCount() const		{ return m_meshletCount; }
+	const uint32_t*		getIndices() const			{ return m_indices; }
+	const ClusterRange*	getRanges() const			{ return m_ranges; }
+	int					getRangeCount() const		{ return m_rangeCount; }
+	bool				hasHiZ() const				{ return m_hizLevels > 0; }
+	const ClusterCullStats& getStats() const		{ return m_stats; }
+};
+
+#endif // CLUSTER_CULLER_H
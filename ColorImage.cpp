@@ -0,0 +1,130 @@
+//-----------------------------------------------------------------------------
+// File: ColorImage.cpp
+//-----------------------------------------------------------------------------
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#include "ColorImage.h"
+#include <stdio.h>
+
+//--------------------------------------------------------------------------------------
+// Little endian fields independent of the host
+static uint32_t readLE(const uint8_t* p, int bytes)
+{
+	uint32_t value = 0;
+	for (int i = bytes - 1; i >= 0; --i)
+	{
+		value = (value << 8) | p[i];
+	}
+	return value;
+}
+
+//--------------------------------------------------------------------------------------
+static void writeLE(uint8_t* p, uint32_t value, int bytes)
+{
+	for (int i = 0; i < bytes; ++i)
+	{
+		p[i] = (uint8_t)(value >> (i * 8));
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// BITMAPFILEHEADER and at least a BITMAPINFOHEADER, BI_RGB only. Rows are
+// bottom up unless the height is negative.
+bool loadBmp(const char* path, ColorImage& image)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	const long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (size < 54)
+	{
+		fclose(file);
+		return false;
+	}
+	uint8_t* data = new uint8_t[size];
+	const bool read = fread(data, 1, size, file) == (size_t)size;
+	fclose(file);
+
+	const uint32_t offset = readLE(data + 10, 4);
+	const uint32_t headerSize = readLE(data + 14, 4);
+	const int width = (int)readLE(data + 18, 4);
+	const int signedHeight = (int)readLE(data + 22, 4);
+	const int height = signedHeight < 0 ? -signedHeight : signedHeight;
+	const int bits = (int)readLE(data + 28, 2);
+	const uint32_t compression = readLE(data + 30, 4);
+	uint32_t paletteSize = readLE(data + 46, 4);
+	paletteSize = paletteSize == 0 && bits == 8 ? 256 : paletteSize;
+	const long pitch = ((long)width * bits / 8 + 3) & ~3L;
+	const uint8_t* palette = data + 14 + headerSize;
+	bool ok = read && data[0] == 'B' && data[1] == 'M' && headerSize >= 40 && compression == 0 &&
+		(bits == 8 || bits == 24 || bits == 32) && width > 0 && height > 0 && paletteSize <= 256 &&
+		(long)offset + pitch * height <= size && (bits != 8 || 14 + headerSize + paletteSize * 4 <= offset);
+	if (ok)
+	{
+		image.resize(width, height);
+		for (int y = 0; y < height; ++y)
+		{
+			const uint8_t* src = data + offset + pitch * (signedHeight < 0 ? y : height - 1 - y);
+			uint32_t* dst = image.row(y);
+			for (int x = 0; x < width; ++x)
+			{
+				if (bits == 8)
+				{
+					// Palette entries are blue, green, red, reserved
+					const uint32_t index = src[x] < paletteSize ? src[x] : 0;
+					dst[x] = 0xFF000000 | (readLE(palette + index * 4, 3));
+				}
+				else
+				{
+					dst[x] = 0xFF000000 | readLE(src + x * (bits / 8), 3);
+				}
+			}
+		}
+	}
+	delete[] data;
+	return ok;
+}
+
+//--------------------------------------------------------------------------------------
+bool saveBmp(const char* path, const ColorImage& image)
+{
+	const int width = image.getWidth();
+	const int height = image.getHeight();
+	const int pitch = (width * 3 + 3) & ~3;
+	const int size = 54 + pitch * height;
+	uint8_t* data = new uint8_t[size];
+	memset(data, 0, size);
+	data[0] = 'B';
+	data[1] = 'M';
+	writeLE(data + 2, size, 4);
+	writeLE(data + 10, 54, 4);
+	writeLE(data + 14, 40, 4);
+	writeLE(data + 18, width, 4);
+	writeLE(data + 22, height, 4);
+	writeLE(data + 26, 1, 2);
+	writeLE(data + 28, 24, 2);
+	writeLE(data + 34, pitch * height, 4);
+	for (int y = 0; y < height; ++y)
+	{
+		const uint32_t* src = image.row(y);
+		uint8_t* dst = data + 54 + pitch * (height - 1 - y);
+		for (int x = 0; x < width; ++x)
+		{
+			writeLE(dst + x * 3, src[x], 3);
+		}
+	}
+
+	FILE* file = fopen(path, "wb");
+	bool ok = file != NULL && fwrite(data, 1, size, file) == (size_t)size;
+	if (file != NULL)
+	{
+		ok = fclose(file) == 0 && ok;
+	}
+	delete[] data;
+	return ok;
+}
@@ -0,0 +1,90 @@
+//-----------------------------------------------------------------------------
+// File: ColorImage.h
+//
+// CPU color target in the layout of a locked D3DFMT_X8R8G8B8 surface: one
+// uint32_t per pixel, blue in the low byte. Rows are 16 byte aligned and the
+// pitch is padded to a multiple of four pixels like DepthImage.
+//
+// loadBmp() reads uncompressed 8, 24 and 32 bit .bmp files, saveBmp() writes
+// 24 bit ones, so golden frames open in any image viewer.
+//-----------------------------------------------------------------------------
+#ifndef COLOR_IMAGE_H
+#define COLOR_IMAGE_H
+
+#include "Platform.h"
+#include <string.h>
+
+//--------------------------------------------------------------------------------------
+class ColorImage
+{
+	uint32_t*				m_data;
+	int						m_width;
+	int						m_height;
+	int						m_pitch;	// in pixels
+
+	ColorImage(const ColorImage&);
+	ColorImage& operator=(const ColorImage&);
+public:
+
+	ColorImage()
+		: m_data( NULL ), m_width( 0 ), m_height( 0 ), m_pitch( 0 )
+	{
+	}
+
+	ColorImage(int width, int height)
+		: m_data( NULL ), m_width( 0 ), m_height( 0 ), m_pitch( 0 )
+	{
+		resize(width, height);
+	}
+
+	~ColorImage()
+	{
+		alignedFree(m_data);
+	}
+
+	void resize(int width, int height)
+	{
+		if (width == m_width && height == m_height)
+		{
+			return;
+		}
+		alignedFree(m_data);
+		m_width = width;
+		m_height = height;
+		m_pitch = (width + 3) & ~3;
+		m_data = (uint32_t*)alignedAlloc(sizeof(uint32_t) * m_pitch * height, 16);
+		memset(m_data, 0, sizeof(uint32_t) * m_pitch * height);
+	}
+
+	void fill(uint32_t value)
+	{
+		for (int i = 0; i < m_pitch * m_height; ++i)
+		{
+			m_data[i] = value;
+		}
+	}
+
+	void copyFrom(const ColorImage& other)
+	{
+		resize(other.m_width, other.m_height);
+		memcpy(m_data, other.m_data, sizeof(uint32_t) * m_pitch * m_height);
+	}
+
+	uint32_t*			row(int y)				{ return m_data + y * m_pitch; }
+	const uint32_t*		row(int y) const		{ return m_data + y * m_pitch; }
+	uint32_t&			at(int x, int y)		{ return m_data[y * m_pitch + x]; }
+	uint32_t			at(int x, int y) const	{ return m_data[y * m_pitch + x]; }
+
+	uint32_t*			getData()				{ return m_data; }
+	const uint32_t*		getData() const			{ return m_data; }
+	int					getWidth() const		{ return m_width; }
+	int					getHeight() const		{ return m_height; }
+	int					getPitch() const		{ return m_pitch; }
+	bool				isEmpty() const			{ return m_data == NULL; }
+};
+
+//--------------------------------------------------------------------------------------
+bool					loadBmp(const char* path, ColorImage& image);
+bool					saveBmp(const char* path, const ColorImage& image);
+
+#endif // COLOR_IMAGE_H
@@ -0,0 +1,315 @@
+//-----------------------------------------------------------------------------
+// File: ColorRasterizer.cpp
+//-----------------------------------------------------------------------------
+#include "ColorRasterizer.h"
+
+static const int				VERTEX_FLOATS = 8;
+
+//--------------------------------------------------------------------------------------
+ColorRasterizer::ColorRasterizer()
+	: m_screen( NULL )
+	, m_capacity( 0 )
+	, m_spanU( NULL )
+	, m_spanV( NULL )
+	, m_spanX( NULL )
+	, m_spanColor( NULL )
+	, m_spanCapacity( 0 )
+	, m_cullMode( DepthRasterizer::CULL_CCW )
+	, m_reversed( false )
+{
+	resetStats();
+}
+
+//--------------------------------------------------------------------------------------
+ColorRasterizer::~ColorRasterizer()
+{
+	alignedFree(m_screen);
+	alignedFree(m_spanU);
+}
+
+//--------------------------------------------------------------------------------------
+void ColorRasterizer::resetStats()
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+// One allocation for the four span arrays, padded to whole groups of four
+void ColorRasterizer::reserveSpan(int width)
+{
+	const int capacity = (width + 3) & ~3;
+	if (capacity <= m_spanCapacity)
+	{
+		return;
+	}
+	alignedFree(m_spanU);
+	m_spanCapacity = capacity;
+	m_spanU = (float*)alignedAlloc(sizeof(float) * 4 * capacity, 16);
+	m_spanV = m_spanU + capacity;
+	m_spanX = (int*)(m_spanV + capacity);
+	m_spanColor = (uint32_t*)(m_spanX + capacity);
+}
+
+//--------------------------------------------------------------------------------------
+uint32_t ColorRasterizer::getLitColor(const ShadeParams& params)
+{
+	uint32_t color = (uint32_t)(clampf(params.materialAlpha, 0.0f, 1.0f) * 255.0f + 0.5f) << 24;
+	for (int i = 0; i < 3; ++i)
+	{
+		const float lit = params.materialEmissive[i] + params.materialAmbient[i] * params.ambientLight[i];
+		color |= (uint32_t)(clampf(lit, 0.0f, 1.0f) * 255.0f + 0.5f) << ((2 - i) * 8);
+	}
+	return color;
+}
+
+//--------------------------------------------------------------------------------------
+// DepthRasterizer's transform plus the attributes divided by w
+void ColorRasterizer::transform(const RasterMesh& mesh, const float* texcoords, const DepthMatrix& worldViewProj,
+	int width, int height)
+{
+	if (mesh.vertexCount > m_capacity)
+	{
+		alignedFree(m_screen);
+		m_capacity = mesh.vertexCount;
+		m_screen = (float*)alignedAlloc(sizeof(float) * VERTEX_FLOATS * m_capacity, 16);
+	}
+
+	const DepthMatrix& m = worldViewProj;
+	const float halfWidth = width * 0.5f;
+	const float halfHeight = height * 0.5f;
+	for (int i = 0; i < mesh.vertexCount; ++i)
+	{
+		const float* p = mesh.positions + i * mesh.stride;
+		const float x = p[0] * m.m[0][0] + p[1] * m.m[1][0] + p[2] * m.m[2][0] + m.m[3][0];
+		const float y = p[0] * m.m[0][1] + p[1] * m.m[1][1] + p[2] * m.m[2][1] + m.m[3][1];
+		const float z = p[0] * m.m[0][2] + p[1] * m.m[1][2] + p[2] * m.m[2][2] + m.m[3][2];
+		const float w = p[0] * m.m[0][3] + p[1] * m.m[1][3] + p[2] * m.m[2][3] + m.m[3][3];
+
+		float* dst = m_screen + i * VERTEX_FLOATS;
+		const float invW = w > 0.0f ? 1.0f / w : 0.0f;
+		dst[0] = (x * invW + 1.0f) * halfWidth;
+		dst[1] = (1.0f - y * invW) * halfHeight;
+		dst[2] = z * invW;
+		dst[3] = z < 0.0f ? -1.0f : w;
+		dst[4] = texcoords != NULL ? texcoords[i * 2] * invW : 0.0f;
+		dst[5] = texcoords != NULL ? texcoords[i * 2 + 1] * invW : 0.0f;
+		dst[6] = invW;
+		dst[7] = 0.0f;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE int64_t min3(int64_t a, int64_t b, int64_t c)
+{
+	const int64_t m = a < b ? a : b;
+	return m < c ? m : c;
+}
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE int64_t max3(int64_t a, int64_t b, int64_t c)
+{
+	const int64_t m = a > b ? a : b;
+	return m > c ? m : c;
+}
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE int64_t toPixelFloor(int64_t value)
+{
+	return value >= 0 ? value >> DepthRasterizer::SUBPIXEL_BITS
+		: -((-value + (1 << DepthRasterizer::SUBPIXEL_BITS) - 1) >> DepthRasterizer::SUBPIXEL_BITS);
+}
+
+//--------------------------------------------------------------------------------------
+// Samples the span and modulates it with the lit color, c * t / 255 taken as
+// (c + c / 128) * t / 256 so 255 leaves the texture unchanged
+void ColorRasterizer::shadeSpan(int count, uint32_t litColor, const ShadeParams& params, uint32_t* row)
+{
+	if (params.texture == NULL)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			row[m_spanX[i]] = litColor;
+		}
+		return;
+	}
+
+	params.texture->sample(params.filter, m_spanU, m_spanV, count, m_spanColor);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lit = _mm_unpacklo_epi8(_mm_set1_epi32((int)litColor), zero);
+	const __m128i scale = _mm_add_epi16(lit, _mm_srli_epi16(lit, 7));
+	const __m128i round = _mm_set1_epi16(128);
+	for (int i = 0; i < count; i += 4)
+	{
+		const __m128i texels = _mm_load_si128((const __m128i*)(m_spanColor + i));
+		const __m128i low = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(texels, zero), scale), round), 8);
+		const __m128i high = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(texels, zero), scale), round), 8);
+		_mm_store_si128((__m128i*)(m_spanColor + i), _mm_packus_epi16(low, high));
+	}
+	for (int i = 0; i < count; ++i)
+	{
+		row[m_spanX[i]] = m_spanColor[i];
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Coverage and depth as DepthRasterizer::drawTriangle(), u/w, v/w and 1/w are
+// planes like z. Passing pixels are collected per row and shaded together.
+void ColorRasterizer::drawTriangle(const float* v0, const float* v1, const float* v2, uint32_t litColor,
+	const ShadeParams& params, DepthImage& depth, ColorImage& color)
+{
+	const float snap = (float)(1 << DepthRasterizer::SUBPIXEL_BITS);
+	const float guard = (float)(1 << 20);
+	const int64_t one = 1 << DepthRasterizer::SUBPIXEL_BITS;
+
+	int64_t X0 = (int64_t)floorf(clampf(v0[0], -guard, guard) * snap + 0.5f);
+	int64_t Y0 = (int64_t)floorf(clampf(v0[1], -guard, guard) * snap + 0.5f);
+	int64_t X1 = (int64_t)floorf(clampf(v1[0], -guard, guard) * snap + 0.5f);
+	int64_t Y1 = (int64_t)floorf(clampf(v1[1], -guard, guard) * snap + 0.5f);
+	int64_t X2 = (int64_t)floorf(clampf(v2[0], -guard, guard) * snap + 0.5f);
+	int64_t Y2 = (int64_t)floorf(clampf(v2[1], -guard, guard) * snap + 0.5f);
+
+	int64_t area = (X1 - X0) * (Y2 - Y0) - (Y1 - Y0) * (X2 - X0);
+	if (area == 0 || (area < 0 && m_cullMode == DepthRasterizer::CULL_CCW) ||
+		(area > 0 && m_cullMode == DepthRasterizer::CULL_CW))
+	{
+		++m_stats.trianglesCulled;
+		return;
+	}
+	if (area < 0)
+	{
+		int64_t t = X1; X1 = X2; X2 = t;
+		t = Y1; Y1 = Y2; Y2 = t;
+		const float* tv = v1; v1 = v2; v2 = tv;
+		area = -area;
+	}
+
+	const int64_t minX = toPixelFloor(min3(X0, X1, X2) + one - 1);
+	const int64_t minY = toPixelFloor(min3(Y0, Y1, Y2) + one - 1);
+	const int64_t maxX = toPixelFloor(max3(X0, X1, X2));
+	const int64_t maxY = toPixelFloor(max3(Y0, Y1, Y2));
+	const int bx0 = (int)(minX < 0 ? 0 : minX);
+	const int by0 = (int)(minY < 0 ? 0 : minY);
+	const int bx1 = (int)(maxX >= depth.getWidth() ? depth.getWidth() - 1 : maxX);
+	const int by1 = (int)(maxY >= depth.getHeight() ? depth.getHeight() - 1 : maxY);
+	if (bx0 > bx1 || by0 > by1)
+	{
+		++m_stats.trianglesCulled;
+		return;
+	}
+
+	const int64_t ax[3] = { X0, X1, X2 };
+	const int64_t ay[3] = { Y0, Y1, Y2 };
+	int64_t rowE[3];
+	int64_t stepX[3];
+	int64_t stepY[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		const int j = (i + 1) % 3;
+		const int64_t dx = ax[j] - ax[i];
+		const int64_t dy = ay[j] - ay[i];
+		const bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+		rowE[i] = dx * (by0 * one - ay[i]) - dy * (bx0 * one - ax[i]) + (topLeft ? 0 : -1);
+		stepX[i] = -dy * one;
+		stepY[i] = dx * one;
+	}
+
+	// Gradients of z, u/w, v/w and 1/w over the snapped triangle, z exactly as
+	// DepthRasterizer computes it
+	const float fx0 = X0 / snap;
+	const float fy0 = Y0 / snap;
+	const float invArea = snap * snap / (float)area;
+	float ddx[4];
+	float ddy[4];
+	float base[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		const int attribute = i == 0 ? 2 : i + 3;
+		const float a0 = v0[attribute];
+		const float d1 = v1[attribute] - a0;
+		const float d2 = v2[attribute] - a0;
+		ddx[i] = (d1 * (float)(Y2 - Y0) - d2 * (float)(Y1 - Y0)) * invArea / snap;
+		ddy[i] = (d2 * (float)(X1 - X0) - d1 * (float)(X2 - X0)) * invArea / snap;
+		base[i] = a0;
+	}
+	const float dzdx = ddx[0];
+	const float dzdy = ddy[0];
+
+	const bool greater = m_reversed;
+	for (int y = by0; y <= by1; ++y)
+	{
+		int64_t e0 = rowE[0];
+		int64_t e1 = rowE[1];
+		int64_t e2 = rowE[2];
+		float* depthRow = depth.row(y);
+		float z = base[0] + (bx0 - fx0) * dzdx + (y - fy0) * dzdy;
+		int count = 0;
+		for (int x = bx0; x <= bx1; ++x)
+		{
+			if ((e0 | e1 | e2) >= 0 && z >= 0.0f && z <= 1.0f && (greater ? z >= depthRow[x] : z <= depthRow[x]))
+			{
+				depthRow[x] = z;
+				m_spanX[count++] = x;
+			}
+			e0 += stepX[0];
+			e1 += stepX[1];
+			e2 += stepX[2];
+			z += dzdx;
+		}
+		rowE[0] += stepY[0];
+		rowE[1] += stepY[1];
+		rowE[2] += stepY[2];
+		if (count == 0)
+		{
+			continue;
+		}
+
+		// Perspective divide per pixel, four at a time. The tail repeats the
+		// last pixel so every group is whole.
+		for (int i = count; i < ((count + 3) & ~3); ++i)
+		{
+			m_spanX[i] = m_spanX[count - 1];
+		}
+		const float dy = y - fy0;
+		const __m128 s0 = _mm_set1_ps(base[1] + dy * ddy[1] - fx0 * ddx[1]);
+		const __m128 t0 = _mm_set1_ps(base[2] + dy * ddy[2] - fx0 * ddx[2]);
+		const __m128 q0 = _mm_set1_ps(base[3] + dy * ddy[3] - fx0 * ddx[3]);
+		const __m128 dsdx = _mm_set1_ps(ddx[1]);
+		const __m128 dtdx = _mm_set1_ps(ddx[2]);
+		const __m128 dqdx = _mm_set1_ps(ddx[3]);
+		for (int i = 0; i < count; i += 4)
+		{
+			const __m128 px = _mm_cvtepi32_ps(_mm_load_si128((const __m128i*)(m_spanX + i)));
+			const __m128 w = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(q0, _mm_mul_ps(px, dqdx)));
+			_mm_store_ps(m_spanU + i, _mm_mul_ps(_mm_add_ps(s0, _mm_mul_ps(px, dsdx)), w));
+			_mm_store_ps(m_spanV + i, _mm_mul_ps(_mm_add_ps(t0, _mm_mul_ps(px, dtdx)), w));
+		}
+		shadeSpan(count, litColor, params, color.row(y));
+		m_stats.pixelsShaded += count;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void ColorRasterizer::draw(const RasterMesh& mesh, const float* texcoords, const DepthMatrix& worldViewProj,
+	const ShadeParams& params, DepthImage& depth, ColorImage& color)
+{
+	CpuTimer timer;
+	transform(mesh, texcoords, worldViewProj, depth.getWidth(), depth.getHeight());
+	reserveSpan(depth.getWidth());
+	const uint32_t litColor = getLitColor(params);
+
+	for (int t = 0; t < mesh.triangleCount; ++t)
+	{
+		const float* v0 = m_screen + mesh.indices[t * 3] * VERTEX_FLOATS;
+		const float* v1 = m_screen + mesh.indices[t * 3 + 1] * VERTEX_FLOATS;
+		const float* v2 = m_screen + mesh.indices[t * 3 + 2] * VERTEX_FLOATS;
+		if (v0[3] <= 0.0f || v1[3] <= 0.0f || v2[3] <= 0.0f)
+		{
+			++m_stats.trianglesDropped;
+			continue;
+		}
+		drawTriangle(v0, v1, v2, litColor, params, depth, color);
+	}
+
+	m_stats.trianglesIn += mesh.triangleCount;
+	m_stats.rasterMs += timer.elapsedMs();
+}
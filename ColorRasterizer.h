@@ -0,0 +1,89 @@
+//-----------------------------------------------------------------------------
+// File: ColorRasterizer.h
+//
+// Software version of the whole Render() draw of the tiger: depth as
+// DepthRasterizer writes it (same snapping, top-left rule, depth test and
+// near plane handling) plus the color the fixed-function pipeline produces
+// for it. Texture coordinates are interpolated perspective-correct, as u/w,
+// v/w and 1/w planes in screen space divided per pixel, and sampled through
+// SoftwareTexture.
+//
+// Pixels are covered and depth tested one at a time, the ones that pass in
+// a row are then shaded as a batch, four at a time with SSE2.
+//-----------------------------------------------------------------------------
+#ifndef COLOR_RASTERIZER_H
+#define COLOR_RASTERIZER_H
+
+#include "DepthRasterizer.h"
+#include "SoftwareTexture.h"
+
+//--------------------------------------------------------------------------------------
+// Lighting as Render() sets it up: D3DRS_LIGHTING on without enabled lights, so
+// every vertex gets emissive + material ambient * D3DRS_AMBIENT, clamped, with
+// the diffuse alpha. Texture stage 0 modulates the texture with that color,
+// sampled with the filter stage 0 is set to.
+struct ShadeParams
+{
+	float					ambientLight[3];	// D3DRS_AMBIENT
+	float					materialAmbient[3];
+	float					materialEmissive[3];
+	float					materialAlpha;		// diffuse alpha
+	const SoftwareTexture*	texture;			// NULL draws the lit color alone
+	SoftwareTexture::Filter	filter;
+};
+
+//--------------------------------------------------------------------------------------
+struct ColorRasterStats
+{
+	double					rasterMs;
+	int						trianglesIn;
+	int						trianglesCulled;	// back facing, degenerate or off screen
+	int						trianglesDropped;	// crossing the near plane
+	int						pixelsShaded;
+};
+
+//--------------------------------------------------------------------------------------
+class ColorRasterizer
+{
+	float*					m_screen;			// x, y, z in pixels, w and u/w, v/w, 1/w per vertex
+	int						m_capacity;
+	float*					m_spanU;			// u, v and x of the pixels passing in one row
+	float*					m_spanV;
+	int*					m_spanX;
+	uint32_t*				m_spanColor;
+	int						m_spanCapacity;
+	DepthRasterizer::CullMode m_cullMode;
+	bool					m_reversed;
+	ColorRasterStats		m_stats;
+
+	ColorRasterizer(const ColorRasterizer&);
+	ColorRasterizer& operator=(const ColorRasterizer&);
+
+	void				transform(const RasterMesh& mesh, const float* texcoords, const DepthMatrix& worldViewProj,
+							int width, int height);
+	void				drawTriangle(const float* v0, const float* v1, const float* v2, uint32_t litColor,
+							const ShadeParams& params, DepthImage& depth, ColorImage& color);
+	void				shadeSpan(int count, uint32_t litColor, const ShadeParams& params, uint32_t* row);
+	void				reserveSpan(int width);
+public:
+
+	ColorRasterizer();
+	~ColorRasterizer();
+
+	void				setCullMode(DepthRasterizer::CullMode mode)	{ m_cullMode = mode; }
+	void				setReverseZ(bool reversed)	{ m_reversed = reversed; }
+	void				resetStats();
+
+	// Lit color of ShadeParams as X8R8G8B8 with alpha
+	static uint32_t		getLitColor(const ShadeParams& params);
+
+	// texcoords holds u, v per vertex, NULL samples every vertex at 0, 0. depth
+	// and color must have the same size, the caller clears depth to farDepth()
+	// and color to the background.
+	void				draw(const RasterMesh& mesh, const float* texcoords, const DepthMatrix& worldViewProj,
+							const ShadeParams& params, DepthImage& depth, ColorImage& color);
+
+	const ColorRasterStats& getStats() const		{ return m_stats; }
+};
+
+#endif // COLOR_RASTERIZER_H
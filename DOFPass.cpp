@@ -0,0 +1,108 @@
+//-----------------------------------------------------------------------------
+// File: DOFPass.cpp
+//-----------------------------------------------------------------------------
+#include "DOFPass.h"
+
+//--------------------------------------------------------------------------------------
+static void releaseTexture( LPDIRECT3DTEXTURE9& texture )
+{
+	if (texture != NULL)
+	{
+		texture->Release();
+		texture = NULL;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+DOFPass::DOFPass()
+	: m_postProcess( NULL )
+	, m_pSceneColor( NULL )
+	, m_pCoC( NULL )
+	, m_pTileMax( NULL )
+	, m_pTileDilated( NULL )
+	, m_pNearField( NULL )
+	, m_pFarField( NULL )
+{
+}
+
+//--------------------------------------------------------------------------------------
+DOFPass::~DOFPass()
+{
+	releaseTexture( m_pSceneColor );
+	releaseTexture( m_pCoC );
+	releaseTexture( m_pTileMax );
+	releaseTexture( m_pTileDilated );
+	releaseTexture( m_pNearField );
+	releaseTexture( m_pFarField );
+}
+
+//--------------------------------------------------------------------------------------
+HRESULT DOFPass::create( PostProcess* postProcess, int width, int height, bool rawz )
+{
+	m_postProcess = postProcess;
+
+	LPDIRECT3DDEVICE9 device = postProcess->getDevice();
+	ID3DXEffect* effect = postProcess->getEffect();
+	const int tilesX = (width + DepthOfField::TILE_SIZE - 1) / DepthOfField::TILE_SIZE;
+	const int tilesY = (height + DepthOfField::TILE_SIZE - 1) / DepthOfField::TILE_SIZE;
+	const int quarterWidth = (width + 3) / 4;
+	const int quarterHeight = (height + 3) / 4;
+
+	if (FAILED( device->CreateTexture( width, height, 1, D3DUSAGE_RENDERTARGET, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &m_pSceneColor, NULL ) ) ||
+		FAILED( device->CreateTexture( width, height, 1, D3DUSAGE_RENDERTARGET, D3DFMT_R32F, D3DPOOL_DEFAULT, &m_pCoC, NULL ) ) ||
+		FAILED( device->CreateTexture( tilesX, tilesY, 1, D3DUSAGE_RENDERTARGET, D3DFMT_G16R16F, D3DPOOL_DEFAULT, &m_pTileMax, NULL ) ) ||
+		FAILED( device->CreateTexture( tilesX, tilesY, 1, D3DUSAGE_RENDERTARGET, D3DFMT_G16R16F, D3DPOOL_DEFAULT, &m_pTileDilated, NULL ) ) ||
+		FAILED( device->CreateTexture( quarterWidth, quarterHeight, 1, D3DUSAGE_RENDERTARGET, D3DFMT_A16B16G16R16F, D3DPOOL_DEFAULT, &m_pNearField, NULL ) ) ||
+		FAILED( device->CreateTexture( quarterWidth, quarterHeight, 1, D3DUSAGE_RENDERTARGET, D3DFMT_A16B16G16R16F, D3DPOOL_DEFAULT, &m_pFarField, NULL ) ))
+	{
+		return E_FAIL;
+	}
+
+	m_hTCoC = effect->GetTechniqueByName( rawz ? "DOFCoCRAWZ" : "DOFCoC" );
+	m_hTTileMax = effect->GetTechniqueByName( "DOFTileMax" );
+	m_hTTileDilate = effect->GetTechniqueByName( "DOFTileDilate" );
+	m_hTSplit = effect->GetTechniqueByName( "DOFSplit" );
+	m_hTileTexture = effect->GetParameterByName( NULL, "TileTexture" );
+
+	effect->SetTexture( "SceneTexture", m_pSceneColor );
+	effect->SetTexture( "CoCTexture", m_pCoC );
+	D3DXVECTOR4 tileTexelSize( 1.0f / tilesX, 1.0f / tilesY, (float)tilesX, (float)tilesY );
+	D3DXVECTOR4 quarterTexelSize( 1.0f / quarterWidth, 1.0f / quarterHeight, (float)quarterWidth, (float)quarterHeight );
+	effect->SetVector( "TileTexelSize", &tileTexelSize );
+	effect->SetVector( "QuarterTexelSize", &quarterTexelSize );
+	return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+void DOFPass::setParams( const DOFCoCTransform& transform )
+{
+	// Near field weight reaches one at two pixels of CoC
+	D3DXVECTOR4 cocParams( transform.scale, transform.bias, transform.maxCoC, 2.0f );
+	m_postProcess->getEffect()->SetVector( "DOFCoCParams", &cocParams );
+}
+
+//--------------------------------------------------------------------------------------
+void DOFPass::render()
+{
+	LPDIRECT3DDEVICE9 device = m_postProcess->getDevice();
+	ID3DXEffect* effect = m_postProcess->getEffect();
+
+	// Resolves the multisampled back buffer
+	IDirect3DSurface9* pBackBuffer = NULL;
+	IDirect3DSurface9* pSceneSurface = NULL;
+	device->GetBackBuffer( 0, 0, D3DBACKBUFFER_TYPE_MONO, &pBackBuffer );
+	m_pSceneColor->GetSurfaceLevel( 0, &pSceneSurface );
+	device->StretchRect( pBackBuffer, NULL, pSceneSurface, NULL, D3DTEXF_NONE );
+	pSceneSurface->Release();
+	pBackBuffer->Release();
+
+	m_postProcess->renderTo( m_pCoC, m_hTCoC );
+
+	m_postProcess->renderTo( m_pTileMax, m_hTTileMax );
+	effect->SetTexture( m_hTileTexture, m_pTileMax );
+	m_postProcess->renderTo( m_pTileDilated, m_hTTileDilate );
+	effect->SetTexture( m_hTileTexture, m_pTileDilated );
+
+	// Near and far fields are written together through two render targets
+	m_postProcess->renderTo( m_pNearField, m_hTSplit, m_pFarField );
+}
@@ -0,0 +1,48 @@
+//-----------------------------------------------------------------------------
+// File: DOFPass.h
+//
+// GPU depth of field setup fed by the resolved depth: per pixel CoC, 16x16
+// tile max CoC with a 3x3 dilation to bound the gather radius, and the near /
+// far field split at quarter resolution. DepthOfField.cpp is the CPU
+// reference of the CoC and tile max stages.
+//-----------------------------------------------------------------------------
+#ifndef DOF_PASS_H
+#define DOF_PASS_H
+
+#include "PostProcess.h"
+#include "DepthOfField.h"
+
+//--------------------------------------------------------------------------------------
+class DOFPass
+{
+	PostProcess*			m_postProcess;
+	LPDIRECT3DTEXTURE9		m_pSceneColor;
+	LPDIRECT3DTEXTURE9		m_pCoC;
+	LPDIRECT3DTEXTURE9		m_pTileMax;
+	LPDIRECT3DTEXTURE9		m_pTileDilated;
+	LPDIRECT3DTEXTURE9		m_pNearField;
+	LPDIRECT3DTEXTURE9		m_pFarField;
+	D3DXHANDLE				m_hTCoC;
+	D3DXHANDLE				m_hTTileMax;
+	D3DXHANDLE				m_hTTileDilate;
+	D3DXHANDLE				m_hTSplit;
+	D3DXHANDLE				m_hTileTexture;
+public:
+
+	DOFPass();
+	~DOFPass();
+
+	HRESULT				create( PostProcess* postProcess, int width, int height, bool rawz );
+	void				setParams( const DOFCoCTransform& transform );
+
+	// Expects DepthTargetTexture of the effect to be bound to the resolved depth,
+	// the scene is taken from the current back buffer
+	void				render();
+
+	LPDIRECT3DTEXTURE9	getCoC()				{ return m_pCoC; }
+	LPDIRECT3DTEXTURE9	getTileMax()			{ return m_pTileDilated; }
+	LPDIRECT3DTEXTURE9	getNearField()			{ return m_pNearField; }
+	LPDIRECT3DTEXTURE9	getFarField()			{ return m_pFarField; }
+};
+
+#endif // DOF_PASS_H
@@ -0,0 +1,157 @@
+//-----------------------------------------------------------------------------
+// File: DepthChange.cpp
+//-----------------------------------------------------------------------------
+#include "DepthChange.h"
+
+//--------------------------------------------------------------------------------------
+DepthChange::DepthChange()
+	: m_dirty( NULL )
+	, m_tilesX( 0 )
+	, m_tilesY( 0 )
+	, m_wordsPerRow( 0 )
+{
+	memset(m_dirtyBounds, 0, sizeof(m_dirtyBounds));
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+DepthChange::~DepthChange()
+{
+	delete[] m_dirty;
+}
+
+//--------------------------------------------------------------------------------------
+void DepthChange::markAllDirty()
+{
+	// An empty reference forces a full update on the next call
+	m_reference.resize(0, 0);
+}
+
+//--------------------------------------------------------------------------------------
+// |current - reference| > tolerance over the tile, checked a row at a time so
+// changed tiles exit early. Both images share the same pitch and zeroed padding.
+bool DepthChange::compareTile(const DepthImage& depth, int tx, int ty, float tolerance) const
+{
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 tol = _mm_set1_ps(tolerance);
+	const int x0 = tx * TILE_SIZE;
+	const int x1 = mini(x0 + TILE_SIZE, depth.getPitch());
+	const int y0 = ty * TILE_SIZE;
+	const int y1 = mini(y0 + TILE_SIZE, depth.getHeight());
+
+	for (int y = y0; y < y1; ++y)
+	{
+		const float* a = depth.row(y);
+		const float* b = m_reference.row(y);
+		__m128 changed = _mm_setzero_ps();
+		for (int x = x0; x < x1; x += 4)
+		{
+			const __m128 diff = _mm_and_ps(_mm_sub_ps(_mm_load_ps(a + x), _mm_load_ps(b + x)), absMask);
+			changed = _mm_or_ps(changed, _mm_cmpgt_ps(diff, tol));
+		}
+		if (_mm_movemask_ps(changed) != 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//--------------------------------------------------------------------------------------
+void DepthChange::updateTile(const DepthImage& depth, int tx, int ty)
+{
+	const int x0 = tx * TILE_SIZE;
+	const int x1 = mini(x0 + TILE_SIZE, depth.getPitch());
+	const int y0 = ty * TILE_SIZE;
+	const int y1 = mini(y0 + TILE_SIZE, depth.getHeight());
+
+	for (int y = y0; y < y1; ++y)
+	{
+		memcpy(m_reference.row(y) + x0, depth.row(y) + x0, sizeof(float) * (x1 - x0));
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void DepthChange::update(const DepthImage& depth, float tolerance)
+{
+	CpuTimer timer;
+
+	const int tilesX = (depth.getWidth() + TILE_SIZE - 1) / TILE_SIZE;
+	const int tilesY = (depth.getHeight() + TILE_SIZE - 1) / TILE_SIZE;
+	if (tilesX != m_tilesX || tilesY != m_tilesY)
+	{
+		delete[] m_dirty;
+		m_tilesX = tilesX;
+		m_tilesY = tilesY;
+		m_wordsPerRow = (tilesX + 31) / 32;
+		m_dirty = new uint32_t[m_wordsPerRow * tilesY];
+	}
+	memset(m_dirty, 0, sizeof(uint32_t) * m_wordsPerRow * tilesY);
+
+	const bool full = m_reference.getWidth() != depth.getWidth() || m_reference.getHeight() != depth.getHeight();
+	if (full)
+	{
+		m_reference.copyFrom(depth);
+	}
+
+	int dirtyTiles = 0;
+	m_dirtyBounds[0] = tilesX;
+	m_dirtyBounds[1] = tilesY;
+	m_dirtyBounds[2] = 0;
+	m_dirtyBounds[3] = 0;
+	for (int ty = 0; ty < tilesY; ++ty)
+	{
+		uint32_t* dirtyRow = m_dirty + ty * m_wordsPerRow;
+		for (int tx = 0; tx < tilesX; ++tx)
+		{
+			if (!full && !compareTile(depth, tx, ty, tolerance))
+			{
+				continue;
+			}
+			if (!full)
+			{
+				updateTile(depth, tx, ty);
+			}
+			dirtyRow[tx >> 5] |= 1u << (tx & 31);
+			m_dirtyBounds[0] = mini(m_dirtyBounds[0], tx);
+			m_dirtyBounds[1] = mini(m_dirtyBounds[1], ty);
+			m_dirtyBounds[2] = maxi(m_dirtyBounds[2], tx + 1);
+			m_dirtyBounds[3] = maxi(m_dirtyBounds[3], ty + 1);
+			++dirtyTiles;
+		}
+	}
+
+	m_stats.dirtyTiles = dirtyTiles;
+	m_stats.tileCount = tilesX * tilesY;
+	m_stats.compareMs = timer.elapsedMs();
+}
+
+//--------------------------------------------------------------------------------------
+bool DepthChange::isDirtyAround(int tx, int ty) const
+{
+	for (int y = maxi(ty - 1, 0); y <= mini(ty + 1, m_tilesY - 1); ++y)
+	{
+		for (int x = maxi(tx - 1, 0); x <= mini(tx + 1, m_tilesX - 1); ++x)
+		{
+			if (isDirty(x, y))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+//--------------------------------------------------------------------------------------
+bool DepthChange::getDirtyRect(int& x0, int& y0, int& x1, int& y1) const
+{
+	if (m_stats.dirtyTiles == 0)
+	{
+		return false;
+	}
+	x0 = m_dirtyBounds[0] * TILE_SIZE;
+	y0 = m_dirtyBounds[1] * TILE_SIZE;
+	x1 = mini(m_dirtyBounds[2] * TILE_SIZE, m_reference.getWidth());
+	y1 = mini(m_dirtyBounds[3] * TILE_SIZE, m_reference.getHeight());
+	return true;
+}
@@ -0,0 +1,66 @@
+//-----------------------------------------------------------------------------
+// File: DepthChange.h
+//
+// Frame to frame change detection of the resolved depth. Each 32x32 tile is
+// compared against the depth it had when it was last reported dirty, so slow
+// drift below the tolerance still marks the tile once it adds up. Consumers
+// read the dirty-tile bitmap (32 tiles per word, LSB first) to restrict their
+// work to the changed regions.
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_CHANGE_H
+#define DEPTH_CHANGE_H
+
+#include "DepthImage.h"
+#include "DepthMath.h"
+
+//--------------------------------------------------------------------------------------
+struct DepthChangeStats
+{
+	double					compareMs;
+	int						dirtyTiles;
+	int						tileCount;
+};
+
+//--------------------------------------------------------------------------------------
+class DepthChange
+{
+public:
+	static const int		TILE_SIZE = 32;
+
+private:
+	DepthImage				m_reference;		// depth each tile was last reported with
+	uint32_t*				m_dirty;
+	int						m_tilesX;
+	int						m_tilesY;
+	int						m_wordsPerRow;
+	int						m_dirtyBounds[4];	// tile rectangle x0, y0, x1, y1 (exclusive)
+	DepthChangeStats		m_stats;
+
+	DepthChange(const DepthChange&);
+	DepthChange& operator=(const DepthChange&);
+
+	bool				compareTile(const DepthImage& depth, int tx, int ty, float tolerance) const;
+	void				updateTile(const DepthImage& depth, int tx, int ty);
+public:
+
+	DepthChange();
+	~DepthChange();
+
+	// Everything is dirty on the first call and after a size change
+	void				update(const DepthImage& depth, float tolerance);
+	void				markAllDirty();
+
+	bool				isDirty(int tx, int ty) const	{ return ( m_dirty[ty * m_wordsPerRow + (tx >> 5)] >> (tx & 31) & 1 ) != 0; }
+	// The tile or one of its eight neighbours, for filters reading across tile edges
+	bool				isDirtyAround(int tx, int ty) const;
+	const uint32_t*		getDirtyRow(int ty) const		{ return m_dirty + ty * m_wordsPerRow; }
+	int					getWordsPerRow() const			{ return m_wordsPerRow; }
+	int					getTilesX() const				{ return m_tilesX; }
+	int					getTilesY() const				{ return m_tilesY; }
+
+	// Pixel rectangle covering all dirty tiles, false if nothing changed
+	bool				getDirtyRect(int& x0, int& y0, int& x1, int& y1) const;
+	const DepthChangeStats& getStats() const			{ return m_stats; }
+};
+
+#endif // DEPTH_CHANGE_H
@@ -0,0 +1,710 @@
+//-----------------------------------------------------------------------------
+// File: DepthCodec.cpp
+//
+// Tile layout, first byte is mode << 6 | residual bits:
+//   raw          64 samples of 3 or 4 bytes
+//   plane        base, dx, dy as int32, 8 * bits bytes of residuals
+//   two planes   64 bit mask, two planes, 8 * bits bytes of residuals
+//
+// A plane predicts base + ((dx * x + dy * y + 128) >> 8), gradients in 24.8
+// fixed point. All arithmetic wraps modulo 2^32 identically in encoder and
+// decoder, so a poor fit only costs size, never exactness.
+//-----------------------------------------------------------------------------
+#include "DepthCodec.h"
+#include "DepthMath.h"
+
+//--------------------------------------------------------------------------------------
+struct CodecPlane
+{
+	int32_t					base;
+	int32_t					dx;
+	int32_t					dy;
+};
+
+//--------------------------------------------------------------------------------------
+struct CodecTaskContext
+{
+	const uint32_t*			depth;
+	uint32_t*				output;				// decode target
+	const uint8_t*			input;
+	uint8_t*				rows;				// encode: start of the worst case row slots
+	const uint32_t*			rowOffsets;
+	size_t					rowSlotSize;
+	size_t					inputSize;
+	int						pitch;
+	int						width;
+	int						height;
+	int						bytesPerSample;
+	uint32_t*				rowSizes;
+	int						(*rowModes)[DepthCodec::TILE_MODE_COUNT];
+	volatile long			failed;
+};
+
+static const int			TILE_SAMPLES = DepthCodec::TILE_SIZE * DepthCodec::TILE_SIZE;
+static const int			MAX_GRADIENT = 1 << 26;		// keeps dx * 7 + dy * 7 inside int32
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE uint32_t readUint32(const uint8_t* p)
+{
+	return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE void writeUint32(uint8_t* p, uint32_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+	p[2] = (uint8_t)(value >> 16);
+	p[3] = (uint8_t)(value >> 24);
+}
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE int32_t roundGradient(double value)
+{
+	const double fixed = floor(value * 256.0 + 0.5);
+	return fixed < -MAX_GRADIENT ? -MAX_GRADIENT : (fixed > MAX_GRADIENT ? MAX_GRADIENT : (int32_t)fixed);
+}
+
+//--------------------------------------------------------------------------------------
+// Tile samples with the image edge replicated into partial tiles
+static void gatherTile(const CodecTaskContext& ctx, int tx, int ty, uint32_t* tile)
+{
+	const int x0 = tx * DepthCodec::TILE_SIZE;
+	const int y0 = ty * DepthCodec::TILE_SIZE;
+	if (x0 + DepthCodec::TILE_SIZE <= ctx.width && y0 + DepthCodec::TILE_SIZE <= ctx.height)
+	{
+		for (int y = 0; y < DepthCodec::TILE_SIZE; ++y)
+		{
+			const __m128i* src = (const __m128i*)(ctx.depth + (size_t)(y0 + y) * ctx.pitch + x0);
+			_mm_store_si128((__m128i*)(tile + y * 8), _mm_loadu_si128(src));
+			_mm_store_si128((__m128i*)(tile + y * 8 + 4), _mm_loadu_si128(src + 1));
+		}
+		return;
+	}
+	for (int y = 0; y < DepthCodec::TILE_SIZE; ++y)
+	{
+		const uint32_t* src = ctx.depth + (size_t)mini(y0 + y, ctx.height - 1) * ctx.pitch;
+		for (int x = 0; x < DepthCodec::TILE_SIZE; ++x)
+		{
+			tile[y * 8 + x] = src[mini(x0 + x, ctx.width - 1)];
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Least squares plane through all 64 samples. Samples are taken relative to the
+// first one so the float sums stay exact for planar tiles.
+static CodecPlane fitPlane(const uint32_t* tile)
+{
+	const __m128i reference = _mm_set1_epi32((int)tile[0]);
+	const __m128 xLeft = _mm_setr_ps(-3.5f, -2.5f, -1.5f, -0.5f);
+	const __m128 xRight = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	__m128 sum = _mm_setzero_ps();
+	__m128 sumX = _mm_setzero_ps();
+	__m128 sumY = _mm_setzero_ps();
+	for (int y = 0; y < DepthCodec::TILE_SIZE; ++y)
+	{
+		const __m128 left = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_load_si128((const __m128i*)(tile + y * 8)), reference));
+		const __m128 right = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_load_si128((const __m128i*)(tile + y * 8 + 4)), reference));
+		const __m128 row = _mm_add_ps(left, right);
+		sum = _mm_add_ps(sum, row);
+		sumX = _mm_add_ps(sumX, _mm_add_ps(_mm_mul_ps(left, xLeft), _mm_mul_ps(right, xRight)));
+		sumY = _mm_add_ps(sumY, _mm_mul_ps(row, _mm_set1_ps(y - 3.5f)));
+	}
+	ALIGN16 float sums[3][4];
+	_mm_store_ps(sums[0], sum);
+	_mm_store_ps(sums[1], sumX);
+	_mm_store_ps(sums[2], sumY);
+
+	// Centred coordinates make the normal equations diagonal, sum of (x - 3.5)^2 is 336
+	const double mean = ((double)sums[0][0] + sums[0][1] + sums[0][2] + sums[0][3]) / TILE_SAMPLES;
+	const double gradientX = ((double)sums[1][0] + sums[1][1] + sums[1][2] + sums[1][3]) / 336.0;
+	const double gradientY = ((double)sums[2][0] + sums[2][1] + sums[2][2] + sums[2][3]) / 336.0;
+
+	CodecPlane plane;
+	plane.dx = roundGradient(gradientX);
+	plane.dy = roundGradient(gradientY);
+	plane.base = (int32_t)(tile[0] + (uint32_t)(int64_t)floor(mean - 3.5 * gradientX - 3.5 * gradientY + 0.5));
+	return plane;
+}
+
+//--------------------------------------------------------------------------------------
+// Least squares plane through the samples selected by mask (or its complement).
+// Too few or collinear samples get a constant plane.
+static CodecPlane fitMaskedPlane(const uint32_t* tile, uint64_t mask, bool selected)
+{
+	double n = 0.0, sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0, syy = 0.0;
+	double sv = 0.0, sxv = 0.0, syv = 0.0;
+	uint32_t reference = 0;
+	for (int i = 0; i < TILE_SAMPLES; ++i)
+	{
+		if (((mask >> i & 1) != 0) != selected)
+		{
+			continue;
+		}
+		if (n == 0.0)
+		{
+			reference = tile[i];
+		}
+		const double x = i & 7;
+		const double y = i >> 3;
+		const double v = (int32_t)(tile[i] - reference);
+		n += 1.0;
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+		syy += y * y;
+		sv += v;
+		sxv += x * v;
+		syv += y * v;
+	}
+
+	CodecPlane plane;
+	plane.dx = 0;
+	plane.dy = 0;
+	plane.base = (int32_t)reference;
+	if (n == 0.0)
+	{
+		return plane;
+	}
+
+	// Cramer's rule on the 3x3 normal equations for v = a + b * x + c * y
+	const double det = n * (sxx * syy - sxy * sxy) - sx * (sx * syy - sxy * sy) + sy * (sx * sxy - sxx * sy);
+	if (fabs(det) < 1e-6)
+	{
+		plane.base = (int32_t)(reference + (uint32_t)(int64_t)floor(sv / n + 0.5));
+		return plane;
+	}
+	const double a = (sv * (sxx * syy - sxy * sxy) - sx * (sxv * syy - sxy * syv) + sy * (sxv * sxy - sxx * syv)) / det;
+	const double b = (n * (sxv * syy - syv * sxy) - sv * (sx * syy - sxy * sy) + sy * (sx * syv - sxv * sy)) / det;
+	const double c = (n * (sxx * syv - sxy * sxv) - sx * (sx * syv - sxv * sy) + sv * (sx * sxy - sxx * sy)) / det;
+	plane.dx = roundGradient(b);
+	plane.dy = roundGradient(c);
+	plane.base = (int32_t)(reference + (uint32_t)(int64_t)floor(a + 0.5));
+	return plane;
+}
+
+//--------------------------------------------------------------------------------------
+// Four predictions of row y starting at column x
+static FORCE_INLINE __m128i predict4(const CodecPlane& plane, int x, int y)
+{
+	const __m128i dx = _mm_set1_epi32(plane.dx);
+	__m128i acc = _mm_set1_epi32((int32_t)((uint32_t)plane.dx * x + (uint32_t)plane.dy * y + 128));
+	acc = _mm_add_epi32(acc, _mm_slli_epi32(_mm_and_si128(dx, _mm_setr_epi32(0, 0, -1, -1)), 1));
+	acc = _mm_add_epi32(acc, _mm_and_si128(dx, _mm_setr_epi32(0, -1, 0, -1)));
+	return _mm_add_epi32(_mm_set1_epi32(plane.base), _mm_srai_epi32(acc, 8));
+}
+
+//--------------------------------------------------------------------------------------
+// All ones in the lanes whose mask bit is set, bits taken from the low nibble
+static FORCE_INLINE __m128i laneMask(uint32_t nibble)
+{
+	const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+	return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((int)nibble), bits), bits);
+}
+
+//--------------------------------------------------------------------------------------
+// Zigzag residuals against one plane, or two selected by mask. Returns the bit
+// width that holds every residual.
+static int computeResiduals(const uint32_t* tile, const CodecPlane* planes, uint64_t mask, bool twoPlanes, uint32_t* residuals)
+{
+	__m128i any = _mm_setzero_si128();
+	for (int i = 0; i < TILE_SAMPLES; i += 4)
+	{
+		const int x = i & 7;
+		const int y = i >> 3;
+		__m128i prediction = predict4(planes[0], x, y);
+		if (twoPlanes)
+		{
+			const __m128i select = laneMask((uint32_t)(mask >> i) & 15);
+			prediction = _mm_or_si128(_mm_andnot_si128(select, prediction), _mm_and_si128(select, predict4(planes[1], x, y)));
+		}
+		const __m128i r = _mm_sub_epi32(_mm_load_si128((const __m128i*)(tile + i)), prediction);
+		const __m128i zigzag = _mm_xor_si128(_mm_slli_epi32(r, 1), _mm_srai_epi32(r, 31));
+		_mm_store_si128((__m128i*)(residuals + i), zigzag);
+		any = _mm_or_si128(any, zigzag);
+	}
+	any = _mm_or_si128(any, _mm_shuffle_epi32(any, _MM_SHUFFLE(1, 0, 3, 2)));
+	any = _mm_or_si128(any, _mm_shuffle_epi32(any, _MM_SHUFFLE(2, 3, 0, 1)));
+	const uint32_t bits = (uint32_t)_mm_cvtsi128_si32(any);
+	return bits == 0 ? 0 : bitScanReverse(bits) + 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Undoes computeResiduals in place
+static void applyResiduals(uint32_t* tile, const CodecPlane* planes, uint64_t mask, bool twoPlanes)
+{
+	const __m128i one = _mm_set1_epi32(1);
+	for (int i = 0; i < TILE_SAMPLES; i += 4)
+	{
+		const int x = i & 7;
+		const int y = i >> 3;
+		__m128i prediction = predict4(planes[0], x, y);
+		if (twoPlanes)
+		{
+			const __m128i select = laneMask((uint32_t)(mask >> i) & 15);
+			prediction = _mm_or_si128(_mm_andnot_si128(select, prediction), _mm_and_si128(select, predict4(planes[1], x, y)));
+		}
+		const __m128i zigzag = _mm_load_si128((const __m128i*)(tile + i));
+		const __m128i r = _mm_xor_si128(_mm_srli_epi32(zigzag, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(zigzag, one)));
+		_mm_store_si128((__m128i*)(tile + i), _mm_add_epi32(prediction, r));
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// 64 values of bits each, LSB first, exactly 8 * bits bytes
+static uint8_t* packBits(const uint32_t* values, int bits, uint8_t* out)
+{
+	uint64_t buffer = 0;
+	int buffered = 0;
+	for (int i = 0; i < TILE_SAMPLES; ++i)
+	{
+		buffer |= (uint64_t)values[i] << buffered;
+		buffered += bits;
+		while (buffered >= 8)
+		{
+			*out++ = (uint8_t)buffer;
+			buffer >>= 8;
+			buffered -= 8;
+		}
+	}
+	return out;
+}
+
+//--------------------------------------------------------------------------------------
+static const uint8_t* unpackBits(const uint8_t* in, int bits, uint32_t* values)
+{
+	const uint64_t valueMask = bits == 32 ? 0xffffffffu : ((uint64_t)1 << bits) - 1;
+	uint64_t buffer = 0;
+	int buffered = 0;
+	for (int i = 0; i < TILE_SAMPLES; ++i)
+	{
+		while (buffered < bits)
+		{
+			buffer |= (uint64_t)*in++ << buffered;
+			buffered += 8;
+		}
+		values[i] = (uint32_t)(buffer & valueMask);
+		buffer >>= bits;
+		buffered -= bits;
+	}
+	return in;
+}
+
+//--------------------------------------------------------------------------------------
+static uint8_t* writePlane(uint8_t* out, const CodecPlane& plane)
+{
+	writeUint32(out, (uint32_t)plane.base);
+	writeUint32(out + 4, (uint32_t)plane.dx);
+	writeUint32(out + 8, (uint32_t)plane.dy);
+	return out + 12;
+}
+
+//--------------------------------------------------------------------------------------
+static const uint8_t* readPlane(const uint8_t* in, CodecPlane& plane)
+{
+	plane.base = (int32_t)readUint32(in);
+	plane.dx = (int32_t)readUint32(in + 4);
+	plane.dy = (int32_t)readUint32(in + 8);
+	return in + 12;
+}
+
+//--------------------------------------------------------------------------------------
+// Tries one plane, then two planes split at the middle of the value range when
+// the single plane leaves wide residuals, and keeps the smallest encoding
+static uint8_t* encodeTile(const uint32_t* tile, int bytesPerSample, uint8_t* out, DepthCodec::TileMode& mode)
+{
+	ALIGN16 uint32_t residuals[TILE_SAMPLES];
+	ALIGN16 uint32_t splitResiduals[TILE_SAMPLES];
+
+	CodecPlane planes[2];
+	planes[0] = fitPlane(tile);
+	const int planeBits = computeResiduals(tile, planes, 0, false, residuals);
+	const int rawSize = TILE_SAMPLES * bytesPerSample;
+	int bestSize = 12 + 8 * planeBits;
+	mode = bestSize < rawSize ? DepthCodec::TILE_PLANE : DepthCodec::TILE_RAW;
+
+	CodecPlane splitPlanes[2];
+	uint64_t mask = 0;
+	int splitBits = 0;
+	if (planeBits > 4)
+	{
+		uint32_t minValue = tile[0];
+		uint32_t maxValue = tile[0];
+		for (int i = 1; i < TILE_SAMPLES; ++i)
+		{
+			minValue = tile[i] < minValue ? tile[i] : minValue;
+			maxValue = tile[i] > maxValue ? tile[i] : maxValue;
+		}
+		const uint32_t middle = minValue + (maxValue - minValue) / 2;
+		for (int i = 0; i < TILE_SAMPLES; ++i)
+		{
+			mask |= (uint64_t)(tile[i] > middle) << i;
+		}
+		splitPlanes[0] = fitMaskedPlane(tile, mask, false);
+		splitPlanes[1] = fitMaskedPlane(tile, mask, true);
+		splitBits = computeResiduals(tile, splitPlanes, mask, true, splitResiduals);
+		if (8 + 24 + 8 * splitBits < mini(bestSize, rawSize))
+		{
+			bestSize = 8 + 24 + 8 * splitBits;
+			mode = DepthCodec::TILE_TWO_PLANES;
+		}
+	}
+
+	switch (mode)
+	{
+	case DepthCodec::TILE_RAW:
+		*out++ = (uint8_t)(DepthCodec::TILE_RAW << 6);
+		for (int i = 0; i < TILE_SAMPLES; ++i)
+		{
+			for (int b = 0; b < bytesPerSample; ++b)
+			{
+				*out++ = (uint8_t)(tile[i] >> (b * 8));
+			}
+		}
+		return out;
+	case DepthCodec::TILE_PLANE:
+		*out++ = (uint8_t)(DepthCodec::TILE_PLANE << 6 | planeBits);
+		out = writePlane(out, planes[0]);
+		return packBits(residuals, planeBits, out);
+	default:
+		*out++ = (uint8_t)(DepthCodec::TILE_TWO_PLANES << 6 | splitBits);
+		writeUint32(out, (uint32_t)mask);
+		writeUint32(out + 4, (uint32_t)(mask >> 32));
+		out = writePlane(out + 8, splitPlanes[0]);
+		out = writePlane(out, splitPlanes[1]);
+		return packBits(splitResiduals, splitBits, out);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// NULL when the tile runs past end or its header is invalid
+static const uint8_t* decodeTile(const uint8_t* in, const uint8_t* end, int bytesPerSample, uint32_t* tile)
+{
+	if (in >= end)
+	{
+		return NULL;
+	}
+	const int mode = *in >> 6;
+	const int bits = *in & 63;
+	++in;
+	if (bits > 32)
+	{
+		return NULL;
+	}
+
+	if (mode == DepthCodec::TILE_RAW)
+	{
+		if (end - in < TILE_SAMPLES * bytesPerSample)
+		{
+			return NULL;
+		}
+		for (int i = 0; i < TILE_SAMPLES; ++i)
+		{
+			uint32_t value = 0;
+			for (int b = 0; b < bytesPerSample; ++b)
+			{
+				value |= (uint32_t)*in++ << (b * 8);
+			}
+			tile[i] = value;
+		}
+		return in;
+	}
+
+	CodecPlane planes[2];
+	uint64_t mask = 0;
+	if (mode == DepthCodec::TILE_PLANE)
+	{
+		if (end - in < 12 + 8 * bits)
+		{
+			return NULL;
+		}
+		in = readPlane(in, planes[0]);
+	}
+	else if (mode == DepthCodec::TILE_TWO_PLANES)
+	{
+		if (end - in < 8 + 24 + 8 * bits)
+		{
+			return NULL;
+		}
+		mask = readUint32(in) | (uint64_t)readUint32(in + 4) << 32;
+		in = readPlane(in + 8, planes[0]);
+		in = readPlane(in, planes[1]);
+	}
+	else
+	{
+		return NULL;
+	}
+
+	if (bits == 0)
+	{
+		memset(tile, 0, TILE_SAMPLES * sizeof(uint32_t));
+	}
+	else
+	{
+		in = unpackBits(in, bits, tile);
+	}
+	applyResiduals(tile, planes, mask, mode == DepthCodec::TILE_TWO_PLANES);
+	return in;
+}
+
+//--------------------------------------------------------------------------------------
+// One tile row into its worst case slot
+static void encodeRowTask(void* context, int index)
+{
+	CodecTaskContext& ctx = *(CodecTaskContext*)context;
+	const int tilesX = (ctx.width + DepthCodec::TILE_SIZE - 1) / DepthCodec::TILE_SIZE;
+	uint8_t* const start = ctx.rows + ctx.rowSlotSize * index;
+	uint8_t* out = start;
+	int* modes = ctx.rowModes[index];
+	modes[DepthCodec::TILE_RAW] = modes[DepthCodec::TILE_PLANE] = modes[DepthCodec::TILE_TWO_PLANES] = 0;
+
+	ALIGN16 uint32_t tile[TILE_SAMPLES];
+	for (int tx = 0; tx < tilesX; ++tx)
+	{
+		gatherTile(ctx, tx, index, tile);
+		DepthCodec::TileMode mode;
+		out = encodeTile(tile, ctx.bytesPerSample, out, mode);
+		++modes[mode];
+	}
+	ctx.rowSizes[index] = (uint32_t)(out - start);
+}
+
+//--------------------------------------------------------------------------------------
+static void decodeRowTask(void* context, int index)
+{
+	CodecTaskContext& ctx = *(CodecTaskContext*)context;
+	const int tilesX = (ctx.width + DepthCodec::TILE_SIZE - 1) / DepthCodec::TILE_SIZE;
+	const uint8_t* in = ctx.input + ctx.rowOffsets[index];
+	const uint8_t* end = ctx.input + ctx.rowOffsets[index + 1];
+	const int y0 = index * DepthCodec::TILE_SIZE;
+	const int rows = mini(DepthCodec::TILE_SIZE, ctx.height - y0);
+
+	ALIGN16 uint32_t tile[TILE_SAMPLES];
+	for (int tx = 0; tx < tilesX; ++tx)
+	{
+		in = decodeTile(in, end, ctx.bytesPerSample, tile);
+		if (in == NULL)
+		{
+			atomicIncrement(&ctx.failed);
+			return;
+		}
+		const int x0 = tx * DepthCodec::TILE_SIZE;
+		const int columns = mini(DepthCodec::TILE_SIZE, ctx.width - x0);
+		for (int y = 0; y < rows; ++y)
+		{
+			uint32_t* dst = ctx.output + (size_t)(y0 + y) * ctx.pitch + x0;
+			if (columns == DepthCodec::TILE_SIZE)
+			{
+				_mm_storeu_si128((__m128i*)dst, _mm_load_si128((const __m128i*)(tile + y * 8)));
+				_mm_storeu_si128((__m128i*)(dst + 4), _mm_load_si128((const __m128i*)(tile + y * 8 + 4)));
+			}
+			else
+			{
+				memcpy(dst, tile + y * 8, columns * sizeof(uint32_t));
+			}
+		}
+	}
+	if (in != end)
+	{
+		atomicIncrement(&ctx.failed);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+DepthCodec::DepthCodec(TaskPool* pool)
+	: m_pool( pool )
+	, m_rowSizes( NULL )
+	, m_rowModes( NULL )
+	, m_rowCapacity( 0 )
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+DepthCodec::~DepthCodec()
+{
+	delete[] m_rowSizes;
+	delete[] m_rowModes;
+}
+
+//--------------------------------------------------------------------------------------
+void DepthCodec::allocateRows(int count)
+{
+	if (count > m_rowCapacity)
+	{
+		delete[] m_rowSizes;
+		delete[] m_rowModes;
+		m_rowSizes = new uint32_t[count];
+		m_rowModes = new int[count][TILE_MODE_COUNT];
+		m_rowCapacity = count;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Header, row offset table and every tile stored raw
+size_t DepthCodec::getMaxEncodedSize(int width, int height, int bitsPerSample)
+{
+	const size_t tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	const size_t tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	return HEADER_SIZE + (tilesY + 1) * 4 + tilesX * tilesY * (1 + TILE_SAMPLES * (bitsPerSample / 8));
+}
+
+//--------------------------------------------------------------------------------------
+bool DepthCodec::readHeader(const uint8_t* data, size_t size, int* width, int* height, int* bitsPerSample)
+{
+	if (size < (size_t)HEADER_SIZE || readUint32(data) != MAGIC)
+	{
+		return false;
+	}
+	*width = (int)readUint32(data + 4);
+	*height = (int)readUint32(data + 8);
+	*bitsPerSample = (int)readUint32(data + 12);
+	return *width > 0 && *height > 0 && *width < 65536 && *height < 65536 &&
+		(*bitsPerSample == 24 || *bitsPerSample == 32);
+}
+
+//--------------------------------------------------------------------------------------
+// Rows are encoded in parallel into worst case slots past the offset table, then
+// moved down in order. The move touches only compressed bytes.
+size_t DepthCodec::encode(const uint32_t* depth, int pitch, int width, int height, int bitsPerSample, uint8_t* output)
+{
+	CpuTimer timer;
+	const int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	const int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	allocateRows(tilesY);
+
+	CodecTaskContext ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.depth = depth;
+	ctx.pitch = pitch;
+	ctx.width = width;
+	ctx.height = height;
+	ctx.bytesPerSample = bitsPerSample / 8;
+	ctx.rowSlotSize = (size_t)tilesX * (1 + TILE_SAMPLES * ctx.bytesPerSample);
+	ctx.rows = output + HEADER_SIZE + (tilesY + 1) * 4;
+	ctx.rowSizes = m_rowSizes;
+	ctx.rowModes = m_rowModes;
+	TaskPool::runOn(m_pool, encodeRowTask, &ctx, tilesY);
+
+	writeUint32(output, MAGIC);
+	writeUint32(output + 4, (uint32_t)width);
+	writeUint32(output + 8, (uint32_t)height);
+	writeUint32(output + 12, (uint32_t)bitsPerSample);
+
+	uint8_t* offsets = output + HEADER_SIZE;
+	uint32_t offset = 0;
+	m_stats.rawTiles = m_stats.planeTiles = m_stats.twoPlaneTiles = 0;
+	for (int ty = 0; ty < tilesY; ++ty)
+	{
+		writeUint32(offsets + ty * 4, offset);
+		memmove(ctx.rows + offset, ctx.rows + ctx.rowSlotSize * ty, m_rowSizes[ty]);
+		offset += m_rowSizes[ty];
+		m_stats.rawTiles += m_rowModes[ty][TILE_RAW];
+		m_stats.planeTiles += m_rowModes[ty][TILE_PLANE];
+		m_stats.twoPlaneTiles += m_rowModes[ty][TILE_TWO_PLANES];
+	}
+	writeUint32(offsets + tilesY * 4, offset);
+
+	m_stats.rawBytes = (size_t)width * height * ctx.bytesPerSample;
+	m_stats.encodedBytes = HEADER_SIZE + (tilesY + 1) * 4 + offset;
+	m_stats.encodeMs = timer.elapsedMs();
+	return m_stats.encodedBytes;
+}
+
+//--------------------------------------------------------------------------------------
+bool DepthCodec::decode(const uint8_t* data, size_t size, uint32_t* depth, int pitch)
+{
+	CpuTimer timer;
+	int width, height, bitsPerSample;
+	if (!readHeader(data, size, &width, &height, &bitsPerSample))
+	{
+		return false;
+	}
+	const int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	const size_t tableSize = HEADER_SIZE + (size_t)(tilesY + 1) * 4;
+	if (size < tableSize)
+	{
+		return false;
+	}
+
+	// The table is checked up front so tasks never read outside the stream
+	allocateRows(tilesY + 1);
+	for (int ty = 0; ty <= tilesY; ++ty)
+	{
+		m_rowSizes[ty] = readUint32(data + HEADER_SIZE + ty * 4);
+		if ((ty > 0 && m_rowSizes[ty] < m_rowSizes[ty - 1]) || m_rowSizes[ty] > size - tableSize)
+		{
+			return false;
+		}
+	}
+
+	CodecTaskContext ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.output = depth;
+	ctx.input = data + tableSize;
+	ctx.inputSize = size - tableSize;
+	ctx.rowOffsets = m_rowSizes;
+	ctx.pitch = pitch;
+	ctx.width = width;
+	ctx.height = height;
+	ctx.bytesPerSample = bitsPerSample / 8;
+	TaskPool::runOn(m_pool, decodeRowTask, &ctx, tilesY);
+
+	m_stats.decodeMs = timer.elapsedMs();
+	return ctx.failed == 0;
+}
+
+//--------------------------------------------------------------------------------------
+void DepthCodec::quantizeDepth(const DepthImage& depth, int bitsPerSample, uint32_t* samples, int pitch)
+{
+	const int width = depth.getWidth();
+	const __m128 scale = _mm_set1_ps(16777215.0f);
+	for (int y = 0; y < depth.getHeight(); ++y)
+	{
+		const float* src = depth.row(y);
+		uint32_t* dst = samples + (size_t)y * pitch;
+		if (bitsPerSample == 32)
+		{
+			memcpy(dst, src, width * sizeof(float));
+			continue;
+		}
+		int x = 0;
+		for (; x + 4 <= width; x += 4)
+		{
+			const __m128 z = _mm_min_ps(_mm_max_ps(_mm_load_ps(src + x), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+			_mm_storeu_si128((__m128i*)(dst + x), _mm_cvtps_epi32(_mm_mul_ps(z, scale)));
+		}
+		for (; x < width; ++x)
+		{
+			dst[x] = (uint32_t)(clampf(src[x], 0.0f, 1.0f) * 16777215.0f + 0.5f);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void DepthCodec::dequantizeDepth(const uint32_t* samples, int pitch, int bitsPerSample, DepthImage& depth)
+{
+	const int width = depth.getWidth();
+	const __m128 scale = _mm_set1_ps(16777215.0f);
+	for (int y = 0; y < depth.getHeight(); ++y)
+	{
+		const uint32_t* src = samples + (size_t)y * pitch;
+		float* dst = depth.row(y);
+		if (bitsPerSample == 32)
+		{
+			memcpy(dst, src, width * sizeof(float));
+			continue;
+		}
+		int x = 0;
+		for (; x + 4 <= width; x += 4)
+		{
+			_mm_store_ps(dst + x, _mm_div_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(src + x))), scale));
+		}
+		for (; x < width; ++x)
+		{
+			dst[x] = (float)src[x] / 16777215.0f;
+		}
+	}
+}
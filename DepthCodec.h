@@ -0,0 +1,80 @@
+//-----------------------------------------------------------------------------
+// File: DepthCodec.h
+//
+// Lossless compression of captured depth frames modeled on hardware Z
+// compression. Every 8x8 tile is stored as one plane, two planes split by a
+// 64 bit mask, or raw samples, whichever is smallest. Plane tiles keep the
+// zigzag coded residuals against the integer plane at the smallest bit width
+// that holds all of them, so constant and planar tiles cost a few bytes.
+//
+// Input is integer depth: 24 bit unorm or the 32 bit pattern of float depth.
+// Tile rows are independent and run on a TaskPool in both directions.
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_CODEC_H
+#define DEPTH_CODEC_H
+
+#include "DepthImage.h"
+#include "TaskPool.h"
+
+//--------------------------------------------------------------------------------------
+struct DepthCodecStats
+{
+	double					encodeMs;
+	double					decodeMs;
+	size_t					rawBytes;			// 3 or 4 bytes per sample
+	size_t					encodedBytes;
+	int						rawTiles;
+	int						planeTiles;
+	int						twoPlaneTiles;
+};
+
+//--------------------------------------------------------------------------------------
+class DepthCodec
+{
+public:
+	static const int		TILE_SIZE = 8;
+	static const uint32_t	MAGIC = 0x315a4344;	// "DCZ1"
+	static const int		HEADER_SIZE = 16;	// magic, width, height, bits per sample
+
+	enum TileMode
+	{
+		TILE_RAW,
+		TILE_PLANE,
+		TILE_TWO_PLANES,
+		TILE_MODE_COUNT
+	};
+
+private:
+	TaskPool*				m_pool;
+	uint32_t*				m_rowSizes;
+	int						(*m_rowModes)[TILE_MODE_COUNT];
+	int						m_rowCapacity;
+	DepthCodecStats			m_stats;
+
+	DepthCodec(const DepthCodec&);
+	DepthCodec& operator=(const DepthCodec&);
+
+	void				allocateRows(int count);
+public:
+
+	// pool may be NULL to run on the calling thread only
+	explicit DepthCodec(TaskPool* pool = NULL);
+	~DepthCodec();
+
+	static size_t		getMaxEncodedSize(int width, int height, int bitsPerSample);
+	static bool			readHeader(const uint8_t* data, size_t size, int* width, int* height, int* bitsPerSample);
+
+	// output must hold getMaxEncodedSize bytes, returns the bytes used. 24 bit
+	// samples must be below 2^24, pitch is in samples.
+	size_t				encode(const uint32_t* depth, int pitch, int width, int height, int bitsPerSample, uint8_t* output);
+	// depth must hold the size from the header, false on a malformed stream
+	bool				decode(const uint8_t* data, size_t size, uint32_t* depth, int pitch);
+
+	// Hardware depth to codec samples and back, 24 bit rounds to unorm, 32 bit keeps the float bits
+	static void			quantizeDepth(const DepthImage& depth, int bitsPerSample, uint32_t* samples, int pitch);
+	static void			dequantizeDepth(const uint32_t* samples, int pitch, int bitsPerSample, DepthImage& depth);
+
+	const DepthCodecStats& getStats() const	{ return m_stats; }
+};
+
+#endif // DEPTH_CODEC_H
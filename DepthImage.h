@@ -0,0 +1,83 @@
+//-----------------------------------------------------------------------------
+// File: DepthImage.h
+//
+// CPU copy of a resolved depth buffer. Rows are 16 byte aligned and the pitch
+// is padded to a multiple of four floats so the SSE kernels never need a
+// scalar tail.
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_IMAGE_H
+#define DEPTH_IMAGE_H
+
+#include "Platform.h"
+#include <string.h>
+
+//--------------------------------------------------------------------------------------
+class DepthImage
+{
+	float*					m_data;
+	int						m_width;
+	int						m_height;
+	int						m_pitch;	// in floats
+
+	DepthImage(const DepthImage&);
+	DepthImage& operator=(const DepthImage&);
+public:
+
+	DepthImage()
+		: m_data( NULL ), m_width( 0 ), m_height( 0 ), m_pitch( 0 )
+	{
+	}
+
+	DepthImage(int width, int height)
+		: m_data( NULL ), m_width( 0 ), m_height( 0 ), m_pitch( 0 )
+	{
+		resize(width, height);
+	}
+
+	~DepthImage()
+	{
+		alignedFree(m_data);
+	}
+
+	void resize(int width, int height)
+	{
+		if (width == m_width && height == m_height)
+		{
+			return;
+		}
+		alignedFree(m_data);
+		m_width = width;
+		m_height = height;
+		m_pitch = (width + 3) & ~3;
+		m_data = (float*)alignedAlloc(sizeof(float) * m_pitch * height, 16);
+		memset(m_data, 0, sizeof(float) * m_pitch * height);
+	}
+
+	void fill(float value)
+	{
+		for (int i = 0; i < m_pitch * m_height; ++i)
+		{
+			m_data[i] = value;
+		}
+	}
+
+	void copyFrom(const DepthImage& other)
+	{
+		resize(other.m_width, other.m_height);
+		memcpy(m_data, other.m_data, sizeof(float) * m_pitch * m_height);
+	}
+
+	float*				row(int y)				{ return m_data + y * m_pitch; }
+	const float*		row(int y) const		{ return m_data + y * m_pitch; }
+	float&				at(int x, int y)		{ return m_data[y * m_pitch + x]; }
+	float				at(int x, int y) const	{ return m_data[y * m_pitch + x]; }
+
+	float*				getData()				{ return m_data; }
+	const float*		getData() const			{ return m_data; }
+	int					getWidth() const		{ return m_width; }
+	int					getHeight() const		{ return m_height; }
+	int					getPitch() const		{ return m_pitch; }
+	bool				isEmpty() const			{ return m_data == NULL; }
+};
+
+#endif // DEPTH_IMAGE_H
@@ -0,0 +1,257 @@
+//-----------------------------------------------------------------------------
+// File: DepthMath.h
+//
+// Conversions between hardware depth and view space distance shared by the
+// CPU depth kernels. Matches D3DXMatrixPerspectiveFovLH as used by
+// SetupMatrices().
+//
+// Reverse-Z is the same projection built with near and far swapped: depth is
+// 1 at the near plane and 0 at the far plane and for the background, tested
+// GREATEREQUAL. zNear and zFar below always hold the actual planes.
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_MATH_H
+#define DEPTH_MATH_H
+
+#include <math.h>
+#include "Platform.h"
+
+//--------------------------------------------------------------------------------------
+// Parameters of the perspective projection needed to go back to view space
+struct DepthProjection
+{
+	float					zNear;
+	float					zFar;
+	float					scaleX;		// projection _11
+	float					scaleY;		// projection _22
+	bool					reversed;	// reverse-Z, 1 near and 0 far
+};
+
+//--------------------------------------------------------------------------------------
+// Row vector convention and memory layout of D3DXMATRIX, v' = v * M
+struct DepthMatrix
+{
+	float					m[4][4];
+};
+
+//--------------------------------------------------------------------------------------
+FORCE_INLINE float minf(float a, float b)	{ return a < b ? a : b; }
+FORCE_INLINE float maxf(float a, float b)	{ return a > b ? a : b; }
+FORCE_INLINE float clampf(float v, float lo, float hi)	{ return v < lo ? lo : (v > hi ? hi : v); }
+FORCE_INLINE int mini(int a, int b)			{ return a < b ? a : b; }
+FORCE_INLINE int maxi(int a, int b)			{ return a > b ? a : b; }
+
+//--------------------------------------------------------------------------------------
+// Hardware depth [0..1] to view space z
+FORCE_INLINE float linearizeDepth(float z, const DepthProjection& proj)
+{
+	if (proj.reversed)
+	{
+		return proj.zNear * proj.zFar / (proj.zNear + z * (proj.zFar - proj.zNear));
+	}
+	return proj.zNear * proj.zFar / (proj.zFar - z * (proj.zFar - proj.zNear));
+}
+
+//--------------------------------------------------------------------------------------
+// View space z to hardware depth [0..1]
+FORCE_INLINE float delinearizeDepth(float viewZ, const DepthProjection& proj)
+{
+	if (proj.reversed)
+	{
+		return proj.zNear * (proj.zFar - viewZ) / (viewZ * (proj.zFar - proj.zNear));
+	}
+	return proj.zFar * (viewZ - proj.zNear) / (viewZ * (proj.zFar - proj.zNear));
+}
+
+//--------------------------------------------------------------------------------------
+FORCE_INLINE __m128 linearizeDepth4(__m128 z, const DepthProjection& proj)
+{
+	const __m128 nf = _mm_set1_ps(proj.zNear * proj.zFar);
+	const __m128 fn = _mm_set1_ps(proj.zFar - proj.zNear);
+	if (proj.reversed)
+	{
+		return _mm_div_ps(nf, _mm_add_ps(_mm_set1_ps(proj.zNear), _mm_mul_ps(z, fn)));
+	}
+	return _mm_div_ps(nf, _mm_sub_ps(_mm_set1_ps(proj.zFar), _mm_mul_ps(z, fn)));
+}
+
+//--------------------------------------------------------------------------------------
+// Depth of the far plane and of pixels nothing was drawn to
+FORCE_INLINE float farDepth(bool reversed)		{ return reversed ? 0.0f : 1.0f; }
+
+//--------------------------------------------------------------------------------------
+// Whether hardware depth a is in front of b, and the farther of the two
+FORCE_INLINE bool isNearerDepth(float a, float b, bool reversed)	{ return reversed ? a > b : a < b; }
+FORCE_INLINE float fartherDepth(float a, float b, bool reversed)	{ return reversed ? minf(a, b) : maxf(a, b); }
+
+//--------------------------------------------------------------------------------------
+// Lanes of the vector at x that are inside the width, clear past the end of a row
+FORCE_INLINE __m128 columnMask(int x, int width)
+{
+	const __m128i lane = _mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3));
+	return _mm_castsi128_ps(_mm_cmplt_epi32(lane, _mm_set1_epi32(width)));
+}
+
+//--------------------------------------------------------------------------------------
+FORCE_INLINE float horizontalMin(__m128 v)
+{
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(v);
+}
+
+//--------------------------------------------------------------------------------------
+FORCE_INLINE float horizontalMax(__m128 v)
+{
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(v);
+}
+
+//--------------------------------------------------------------------------------------
+// Linearizes one row, count is rounded up to a multiple of four
+inline void linearizeRow(const float* src, float* dst, int count, const DepthProjection& proj)
+{
+	for (int x = 0; x < count; x += 4)
+	{
+		_mm_storeu_ps(dst + x, linearizeDepth4(_mm_loadu_ps(src + x), proj));
+	}
+}
+
+//--------------------------------------------------------------------------------------
+inline DepthMatrix multiplyMatrix(const DepthMatrix& a, const DepthMatrix& b)
+{
+	DepthMatrix result;
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			result.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+		}
+	}
+	return result;
+}
+
+//--------------------------------------------------------------------------------------
+// Same matrices as D3DXMatrixRotationY, D3DXMatrixLookAtLH and
+// D3DXMatrixPerspectiveFovLH, for code that runs without D3DX
+inline DepthMatrix rotationYMatrix(float angle)
+{
+	const float c = cosf(angle);
+	const float s = sinf(angle);
+	DepthMatrix result =
+	{ {
+		{ c, 0.0f, -s, 0.0f },
+		{ 0.0f, 1.0f, 0.0f, 0.0f },
+		{ s, 0.0f, c, 0.0f },
+		{ 0.0f, 0.0f, 0.0f, 1.0f }
+	} };
+	return result;
+}
+
+//--------------------------------------------------------------------------------------
+inline DepthMatrix lookAtMatrixLH(const float* eye, const float* at, const float* up)
+{
+	float zAxis[3] = { at[0] - eye[0], at[1] - eye[1], at[2] - eye[2] };
+	const float zScale = 1.0f / sqrtf(zAxis[0] * zAxis[0] + zAxis[1] * zAxis[1] + zAxis[2] * zAxis[2]);
+	zAxis[0] *= zScale;
+	zAxis[1] *= zScale;
+	zAxis[2] *= zScale;
+	float xAxis[3] = { up[1] * zAxis[2] - up[2] * zAxis[1], up[2] * zAxis[0] - up[0] * zAxis[2], up[0] * zAxis[1] - up[1] * zAxis[0] };
+	const float xScale = 1.0f / sqrtf(xAxis[0] * xAxis[0] + xAxis[1] * xAxis[1] + xAxis[2] * xAxis[2]);
+	xAxis[0] *= xScale;
+	xAxis[1] *= xScale;
+	xAxis[2] *= xScale;
+	const float yAxis[3] = { zAxis[1] * xAxis[2] - zAxis[2] * xAxis[1], zAxis[2] * xAxis[0] - zAxis[0] * xAxis[2], zAxis[0] * xAxis[1] - zAxis[1] * xAxis[0] };
+
+	DepthMatrix result =
+	{ {
+		{ xAxis[0], yAxis[0], zAxis[0], 0.0f },
+		{ xAxis[1], yAxis[1], zAxis[1], 0.0f },
+		{ xAxis[2], yAxis[2], zAxis[2], 0.0f },
+		{
+			-(xAxis[0] * eye[0] + xAxis[1] * eye[1] + xAxis[2] * eye[2]),
+			-(yAxis[0] * eye[0] + yAxis[1] * eye[1] + yAxis[2] * eye[2]),
+			-(zAxis[0] * eye[0] + zAxis[1] * eye[1] + zAxis[2] * eye[2]),
+			1.0f
+		}
+	} };
+	return result;
+}
+
+//--------------------------------------------------------------------------------------
+// Reverse-Z passes zFar as zNear and zNear as zFar
+inline DepthMatrix perspectiveFovMatrixLH(float fovY, float aspect, float zNear, float zFar)
+{
+	const float yScale = 1.0f / tanf(fovY * 0.5f);
+	const float xScale = yScale / aspect;
+	DepthMatrix result =
+	{ {
+		{ xScale, 0.0f, 0.0f, 0.0f },
+		{ 0.0f, yScale, 0.0f, 0.0f },
+		{ 0.0f, 0.0f, zFar / (zFar - zNear), 1.0f },
+		{ 0.0f, 0.0f, -zNear * zFar / (zFar - zNear), 0.0f }
+	} };
+	return result;
+}
+
+//--------------------------------------------------------------------------------------
+// Gauss-Jordan with partial pivoting, returns false for a singular matrix
+inline bool invertMatrix(const DepthMatrix& src, DepthMatrix& dst)
+{
+	double a[4][8];
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			a[i][j] = src.m[i][j];
+			a[i][j + 4] = i == j ? 1.0 : 0.0;
+		}
+	}
+	for (int col = 0; col < 4; ++col)
+	{
+		int pivot = col;
+		for (int row = col + 1; row < 4; ++row)
+		{
+			if (fabs(a[row][col]) > fabs(a[pivot][col]))
+			{
+				pivot = row;
+			}
+		}
+		if (a[pivot][col] == 0.0)
+		{
+			return false;
+		}
+		for (int j = 0; j < 8; ++j)
+		{
+			const double t = a[col][j];
+			a[col][j] = a[pivot][j];
+			a[pivot][j] = t;
+		}
+		const double invPivot = 1.0 / a[col][col];
+		for (int j = 0; j < 8; ++j)
+		{
+			a[col][j] *= invPivot;
+		}
+		for (int row = 0; row < 4; ++row)
+		{
+			if (row != col && a[row][col] != 0.0)
+			{
+				const double factor = a[row][col];
+				for (int j = 0; j < 8; ++j)
+				{
+					a[row][j] -= factor * a[col][j];
+				}
+			}
+		}
+	}
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			dst.m[i][j] = (float)a[i][j + 4];
+		}
+	}
+	return true;
+}
+
+#endif // DEPTH_MATH_H
@@ -0,0 +1,235 @@
+//-----------------------------------------------------------------------------
+// File: DepthOfField.cpp
+//
+// Keep in sync with the DOF techniques in DirectDepthAccess.fx.
+//-----------------------------------------------------------------------------
+#include "DepthOfField.h"
+
+//--------------------------------------------------------------------------------------
+DepthOfField::DepthOfField()
+	: m_tileMax( NULL )
+	, m_tileNear( NULL )
+	, m_dilatedMax( NULL )
+	, m_dilatedNear( NULL )
+	, m_tilesX( 0 )
+	, m_tilesY( 0 )
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+DepthOfField::~DepthOfField()
+{
+	delete[] m_tileMax;
+	delete[] m_tileNear;
+	delete[] m_dilatedMax;
+	delete[] m_dilatedNear;
+}
+
+//--------------------------------------------------------------------------------------
+// Thin lens: coc(z) = K * (1 - focus / z) with K the aperture diameter scaled by
+// f / (focus - f), and 1 / z = 1 / near - depth * (far - near) / (near * far),
+// or 1 / far + depth * (far - near) / (near * far) with reverse-Z
+DOFCoCTransform DepthOfField::cocTransform(const DOFParams& params, const DepthProjection& projection, int imageHeight)
+{
+	const float aperture = params.focalLength / params.fNumber;
+	const float k = aperture * params.focalLength / (params.focusDistance - params.focalLength)
+		/ params.sensorHeight * imageHeight;
+	const float n = projection.zNear;
+	const float f = projection.zFar;
+
+	DOFCoCTransform transform;
+	if (projection.reversed)
+	{
+		transform.bias = k * (1.0f - params.focusDistance / f);
+		transform.scale = -k * params.focusDistance * (f - n) / (n * f);
+	}
+	else
+	{
+		transform.bias = k * (1.0f - params.focusDistance / n);
+		transform.scale = k * params.focusDistance * (f - n) / (n * f);
+	}
+	transform.maxCoC = params.maxCoC;
+	return transform;
+}
+
+//--------------------------------------------------------------------------------------
+// True when the tiles were reallocated and hold nothing yet
+bool DepthOfField::allocateTiles(int tilesX, int tilesY)
+{
+	if (tilesX == m_tilesX && tilesY == m_tilesY)
+	{
+		return false;
+	}
+	delete[] m_tileMax;
+	delete[] m_tileNear;
+	delete[] m_dilatedMax;
+	delete[] m_dilatedNear;
+
+	m_tilesX = tilesX;
+	m_tilesY = tilesY;
+	m_tileMax = new float[tilesX * tilesY];
+	m_tileNear = new float[tilesX * tilesY];
+	m_dilatedMax = new float[tilesX * tilesY];
+	m_dilatedNear = new float[tilesX * tilesY];
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// DOFCoC over a rectangle starting on a multiple of 4, a right edge at the
+// width runs on into the padding
+void DepthOfField::computeCoC(const DepthImage& depth, const DOFCoCTransform& transform, int x0, int x1, int y0, int y1)
+{
+	const __m128 scale = _mm_set1_ps(transform.scale);
+	const __m128 bias = _mm_set1_ps(transform.bias);
+	const __m128 maxCoC = _mm_set1_ps(transform.maxCoC);
+	const __m128 minCoC = _mm_set1_ps(-transform.maxCoC);
+	const int end = x1 == depth.getWidth() ? depth.getPitch() : x1;
+
+	for (int y = y0; y < y1; ++y)
+	{
+		const float* src = depth.row(y);
+		float* dst = m_coc.row(y);
+		for (int x = x0; x < end; x += 4)
+		{
+			const __m128 coc = _mm_add_ps(_mm_mul_ps(_mm_load_ps(src + x), scale), bias);
+			_mm_store_ps(dst + x, _mm_min_ps(_mm_max_ps(coc, minCoC), maxCoC));
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// DOFTileMax: far and near maxima in one sweep, 16 pixels are four SSE lanes
+void DepthOfField::computeTileMax(int tx0, int tx1, int ty0, int ty1)
+{
+	const int width = m_coc.getWidth();
+	const int height = m_coc.getHeight();
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	for (int ty = ty0; ty < ty1; ++ty)
+	{
+		const int y0 = ty * TILE_SIZE;
+		const int y1 = mini(y0 + TILE_SIZE, height);
+		for (int tx = tx0; tx < tx1; ++tx)
+		{
+			const int x0 = tx * TILE_SIZE;
+			const int x1 = mini(x0 + TILE_SIZE, width);
+			__m128 maxAbs = _mm_setzero_ps();
+			__m128 minSigned = _mm_setzero_ps();
+			float maxAbsTail = 0.0f;
+			float minSignedTail = 0.0f;
+
+			for (int y = y0; y < y1; ++y)
+			{
+				const float* row = m_coc.row(y);
+				int x = x0;
+				for (; x + 4 <= x1; x += 4)
+				{
+					const __m128 coc = _mm_load_ps(row + x);
+					maxAbs = _mm_max_ps(maxAbs, _mm_and_ps(coc, absMask));
+					minSigned = _mm_min_ps(minSigned, coc);
+				}
+				for (; x < x1; ++x)
+				{
+					maxAbsTail = maxf(maxAbsTail, row[x] < 0.0f ? -row[x] : row[x]);
+					minSignedTail = minf(minSignedTail, row[x]);
+				}
+			}
+
+			ALIGN16 float lanesAbs[4];
+			ALIGN16 float lanesSigned[4];
+			_mm_store_ps(lanesAbs, maxAbs);
+			_mm_store_ps(lanesSigned, minSigned);
+			const float tileMax = maxf(maxf(maxf(lanesAbs[0], lanesAbs[1]), maxf(lanesAbs[2], lanesAbs[3])), maxAbsTail);
+			const float tileMin = minf(minf(minf(lanesSigned[0], lanesSigned[1]), minf(lanesSigned[2], lanesSigned[3])), minSignedTail);
+
+			m_tileMax[ty * m_tilesX + tx] = tileMax;
+			m_tileNear[ty * m_tilesX + tx] = -tileMin;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// DOFTileDilate: a neighbouring tile's near field can spill into this one
+void DepthOfField::dilate(const float* src, float* dst)
+{
+	for (int ty = 0; ty < m_tilesY; ++ty)
+	{
+		for (int tx = 0; tx < m_tilesX; ++tx)
+		{
+			float value = 0.0f;
+			for (int dy = -1; dy <= 1; ++dy)
+			{
+				const int sy = mini(maxi(ty + dy, 0), m_tilesY - 1);
+				for (int dx = -1; dx <= 1; ++dx)
+				{
+					const int sx = mini(maxi(tx + dx, 0), m_tilesX - 1);
+					value = maxf(value, src[sy * m_tilesX + sx]);
+				}
+			}
+			dst[ty * m_tilesX + tx] = value;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void DepthOfField::compute(const DepthImage& depth, const DOFCoCTransform& transform, const DepthChange* change)
+{
+	const int width = depth.getWidth();
+	const int height = depth.getHeight();
+	const int changeTileSize = DepthChange::TILE_SIZE;
+	const int tilesPerChangeTile = changeTileSize / TILE_SIZE;
+	const bool resized = m_coc.getWidth() != width || m_coc.getHeight() != height;
+	m_coc.resize(width, height);
+	const bool reallocated = allocateTiles((width + TILE_SIZE - 1) / TILE_SIZE, (height + TILE_SIZE - 1) / TILE_SIZE);
+	const bool full = resized || reallocated || change == NULL ||
+		change->getTilesX() != (width + changeTileSize - 1) / changeTileSize ||
+		change->getTilesY() != (height + changeTileSize - 1) / changeTileSize;
+
+	CpuTimer timer;
+	if (full)
+	{
+		computeCoC(depth, transform, 0, width, 0, height);
+	}
+	else
+	{
+		for (int ty = 0; ty < change->getTilesY(); ++ty)
+		{
+			for (int tx = 0; tx < change->getTilesX(); ++tx)
+			{
+				if (change->isDirty(tx, ty))
+				{
+					computeCoC(depth, transform, tx * changeTileSize, mini((tx + 1) * changeTileSize, width),
+						ty * changeTileSize, mini((ty + 1) * changeTileSize, height));
+				}
+			}
+		}
+	}
+	m_stats.cocMs = timer.elapsedMs();
+
+	timer.start();
+	if (full)
+	{
+		computeTileMax(0, m_tilesX, 0, m_tilesY);
+	}
+	else
+	{
+		for (int ty = 0; ty < change->getTilesY(); ++ty)
+		{
+			for (int tx = 0; tx < change->getTilesX(); ++tx)
+			{
+				if (change->isDirty(tx, ty))
+				{
+					computeTileMax(tx * tilesPerChangeTile, mini((tx + 1) * tilesPerChangeTile, m_tilesX),
+						ty * tilesPerChangeTile, mini((ty + 1) * tilesPerChangeTile, m_tilesY));
+				}
+			}
+		}
+	}
+	m_stats.tileMaxMs = timer.elapsedMs();
+
+	timer.start();
+	dilate(m_tileMax, m_dilatedMax);
+	dilate(m_tileNear, m_dilatedNear);
+	m_stats.dilateMs = timer.elapsedMs();
+}
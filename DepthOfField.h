@@ -0,0 +1,91 @@
+//-----------------------------------------------------------------------------
+// File: DepthOfField.h
+//
+// CPU reference of the circle of confusion and tile max stages of DOFPass.
+// CoC is signed, negative in front of the focus plane (near field) and
+// positive behind it (far field), in full resolution pixels.
+//
+// Given the DepthChange the depth went through, compute() only redoes the
+// CoC and tile maxima inside dirty tiles, four DOF tiles to a DepthChange
+// tile. The dilation over the whole tile grid is cheap enough to redo.
+// A new transform has to come with DepthChange::markAllDirty().
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_OF_FIELD_H
+#define DEPTH_OF_FIELD_H
+
+#include "DepthChange.h"
+#include "DepthImage.h"
+#include "DepthMath.h"
+
+//--------------------------------------------------------------------------------------
+struct DOFParams
+{
+	float					focusDistance;		// view space distance in focus
+	float					focalLength;		// view space units
+	float					fNumber;
+	float					sensorHeight;		// view space units, maps the lens CoC to pixels
+	float					maxCoC;				// pixels
+};
+
+//--------------------------------------------------------------------------------------
+// The CoC is affine in 1 / z and therefore in hardware depth:
+// coc = scale * depth + bias, no division per pixel
+struct DOFCoCTransform
+{
+	float					scale;
+	float					bias;
+	float					maxCoC;
+};
+
+//--------------------------------------------------------------------------------------
+struct DOFStats
+{
+	double					cocMs;
+	double					tileMaxMs;
+	double					dilateMs;
+};
+
+//--------------------------------------------------------------------------------------
+class DepthOfField
+{
+public:
+	static const int		TILE_SIZE = 16;
+
+private:
+	DepthImage				m_coc;
+	float*					m_tileMax;			// max |CoC| per tile
+	float*					m_tileNear;			// max near CoC magnitude per tile
+	float*					m_dilatedMax;		// 3x3 tile neighbourhood max, bounds the gather radius
+	float*					m_dilatedNear;
+	int						m_tilesX;
+	int						m_tilesY;
+	DOFStats				m_stats;
+
+	DepthOfField(const DepthOfField&);
+	DepthOfField& operator=(const DepthOfField&);
+
+	bool				allocateTiles(int tilesX, int tilesY);
+	void				computeCoC(const DepthImage& depth, const DOFCoCTransform& transform, int x0, int x1, int y0, int y1);
+	void				computeTileMax(int tx0, int tx1, int ty0, int ty1);
+	void				dilate(const float* src, float* dst);
+public:
+
+	DepthOfField();
+	~DepthOfField();
+
+	static DOFCoCTransform cocTransform(const DOFParams& params, const DepthProjection& projection, int imageHeight);
+
+	// change NULL recomputes everything
+	void				compute(const DepthImage& depth, const DOFCoCTransform& transform, const DepthChange* change = NULL);
+
+	const DepthImage&	getCoC() const				{ return m_coc; }
+	const float*		getTileMax() const			{ return m_tileMax; }
+	const float*		getTileNear() const			{ return m_tileNear; }
+	const float*		getDilatedMax() const		{ return m_dilatedMax; }
+	const float*		getDilatedNear() const		{ return m_dilatedNear; }
+	int					getTilesX() const			{ return m_tilesX; }
+	int					getTilesY() const			{ return m_tilesY; }
+	const DOFStats&		getStats() const			{ return m_stats; }
+};
+
+#endif // DEPTH_OF_FIELD_H
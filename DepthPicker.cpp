@@ -0,0 +1,235 @@
+//-----------------------------------------------------------------------------
+// File: DepthPicker.cpp
+//-----------------------------------------------------------------------------
+#include "DepthPicker.h"
+
+//--------------------------------------------------------------------------------------
+DepthPicker::DepthPicker()
+	: m_depth( NULL )
+	, m_frameIndex( 0 )
+	, m_reversed( false )
+	, m_stamp( 1 )
+{
+	memset(&m_viewProj, 0, sizeof(m_viewProj));
+	memset(&m_invViewProj, 0, sizeof(m_invViewProj));
+	memset(m_cache, 0, sizeof(m_cache));
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+void DepthPicker::setFrame(const DepthImage* depth, unsigned int frameIndex, const DepthMatrix& viewProj)
+{
+	if (!invertMatrix(viewProj, m_invViewProj))
+	{
+		m_depth = NULL;
+		return;
+	}
+	m_depth = depth;
+	m_frameIndex = frameIndex;
+	m_viewProj = viewProj;
+
+	// Bumping the stamp empties the cache without touching it
+	++m_stamp;
+	if (m_stamp == 0)
+	{
+		memset(m_cache, 0, sizeof(m_cache));
+		m_stamp = 1;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Pixel centre and its depth back through the inverse view-projection
+void DepthPicker::computePick(int x, int y, PickResult& result) const
+{
+	result.x = x;
+	result.y = y;
+	result.frameIndex = m_frameIndex;
+	result.world[0] = result.world[1] = result.world[2] = 0.0f;
+	result.depth = farDepth(m_reversed);
+	result.hit = false;
+	if (x < 0 || y < 0 || x >= m_depth->getWidth() || y >= m_depth->getHeight())
+	{
+		return;
+	}
+
+	const float z = m_depth->at(x, y);
+	result.depth = z;
+	if (m_reversed ? z <= 0.0f : z >= 1.0f)
+	{
+		return;
+	}
+
+	const float ndc[4] = { (x + 0.5f) * 2.0f / m_depth->getWidth() - 1.0f, 1.0f - (y + 0.5f) * 2.0f / m_depth->getHeight(), z, 1.0f };
+	const DepthMatrix& m = m_invViewProj;
+	float p[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		p[i] = ndc[0] * m.m[0][i] + ndc[1] * m.m[1][i] + ndc[2] * m.m[2][i] + ndc[3] * m.m[3][i];
+	}
+	const float invW = 1.0f / p[3];
+	result.world[0] = p[0] * invW;
+	result.world[1] = p[1] * invW;
+	result.world[2] = p[2] * invW;
+	result.hit = true;
+}
+
+//--------------------------------------------------------------------------------------
+// Linear probing, a full run of the table falls back to an uncached answer.
+// Leaves the stats to the caller.
+PickResult DepthPicker::cachedPick(int x, int y, bool& cached)
+{
+	const uint32_t key = ((uint32_t)y << 16) | ((uint32_t)x & 0xffff);
+	uint32_t slot = (key * 2654435761u) >> 24 & (CACHE_SIZE - 1);
+	cached = false;
+	for (int probe = 0; probe < CACHE_SIZE; ++probe, slot = (slot + 1) & (CACHE_SIZE - 1))
+	{
+		CacheEntry& entry = m_cache[slot];
+		if (entry.stamp == m_stamp && entry.key == key)
+		{
+			cached = true;
+			return entry.result;
+		}
+		if (entry.stamp != m_stamp)
+		{
+			computePick(x, y, entry.result);
+			entry.key = key;
+			entry.stamp = m_stamp;
+			return entry.result;
+		}
+	}
+	PickResult result;
+	computePick(x, y, result);
+	return result;
+}
+
+//--------------------------------------------------------------------------------------
+PickResult DepthPicker::pick(int x, int y)
+{
+	if (m_depth == NULL)
+	{
+		PickResult result;
+		memset(&result, 0, sizeof(result));
+		result.depth = farDepth(m_reversed);
+		return result;
+	}
+	++m_stats.queries;
+	bool cached;
+	const PickResult result = cachedPick(x, y, cached);
+	if (cached)
+	{
+		++m_stats.cacheHits;
+	}
+	return result;
+}
+
+//--------------------------------------------------------------------------------------
+void DepthPicker::pickBatch(const int* pixels, int count, PickResult* results)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		results[i] = pick(pixels[i * 2], pixels[i * 2 + 1]);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// World to pixel coordinates and hardware depth, false behind the eye
+bool DepthPicker::project(const float* world, float* screen) const
+{
+	const DepthMatrix& m = m_viewProj;
+	float p[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		p[i] = world[0] * m.m[0][i] + world[1] * m.m[1][i] + world[2] * m.m[2][i] + m.m[3][i];
+	}
+	if (p[3] <= 0.0f)
+	{
+		return false;
+	}
+	const float invW = 1.0f / p[3];
+	screen[0] = (p[0] * invW + 1.0f) * 0.5f * m_depth->getWidth();
+	screen[1] = (1.0f - p[1] * invW) * 0.5f * m_depth->getHeight();
+	screen[2] = p[2] * invW;
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Fixed steps along the ray until it passes behind the stored surface, then a
+// bisection between the last two steps. Points more than thickness behind the
+// surface are treated as passing behind an object, not hitting it.
+PickResult DepthPicker::pickRay(const float* origin, const float* direction, float maxDistance, float thickness)
+{
+	PickResult result;
+	memset(&result, 0, sizeof(result));
+	result.depth = farDepth(m_reversed);
+	result.frameIndex = m_frameIndex;
+	if (m_depth == NULL)
+	{
+		return result;
+	}
+	++m_stats.queries;
+
+	const float length = sqrtf(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+	if (length == 0.0f)
+	{
+		return result;
+	}
+	const float dir[3] = { direction[0] / length, direction[1] / length, direction[2] / length };
+	const float step = maxDistance / RAY_STEPS;
+
+	float previous = 0.0f;
+	for (int i = 1; i <= RAY_STEPS; ++i)
+	{
+		const float t = i * step;
+		const float point[3] = { origin[0] + dir[0] * t, origin[1] + dir[1] * t, origin[2] + dir[2] * t };
+		float screen[3];
+		if (!project(point, screen) || screen[0] < 0.0f || screen[1] < 0.0f ||
+			screen[0] >= m_depth->getWidth() || screen[1] >= m_depth->getHeight())
+		{
+			previous = t;
+			continue;
+		}
+
+		const float surface = m_depth->at((int)screen[0], (int)screen[1]);
+		if (surface == farDepth(m_reversed) || isNearerDepth(screen[2], surface, m_reversed))
+		{
+			previous = t;
+			continue;
+		}
+
+		// Behind the surface: refine between the last point in front and this one
+		float lo = previous;
+		float hi = t;
+		for (int k = 0; k < RAY_REFINE_STEPS; ++k)
+		{
+			const float mid = (lo + hi) * 0.5f;
+			const float midPoint[3] = { origin[0] + dir[0] * mid, origin[1] + dir[1] * mid, origin[2] + dir[2] * mid };
+			float midScreen[3];
+			if (project(midPoint, midScreen) && midScreen[0] >= 0.0f && midScreen[1] >= 0.0f &&
+				midScreen[0] < m_depth->getWidth() && midScreen[1] < m_depth->getHeight() &&
+				!isNearerDepth(midScreen[2], m_depth->at((int)midScreen[0], (int)midScreen[1]), m_reversed))
+			{
+				hi = mid;
+			}
+			else
+			{
+				lo = mid;
+			}
+		}
+
+		const float hitPoint[3] = { origin[0] + dir[0] * hi, origin[1] + dir[1] * hi, origin[2] + dir[2] * hi };
+		float hitScreen[3];
+		project(hitPoint, hitScreen);
+		bool cached;
+		const PickResult surfacePick = cachedPick(mini((int)hitScreen[0], m_depth->getWidth() - 1),
+			mini((int)hitScreen[1], m_depth->getHeight() - 1), cached);
+		const float dx = surfacePick.world[0] - hitPoint[0];
+		const float dy = surfacePick.world[1] - hitPoint[1];
+		const float dz = surfacePick.world[2] - hitPoint[2];
+		if (surfacePick.hit && dx * dx + dy * dy + dz * dz <= thickness * thickness)
+		{
+			return surfacePick;
+		}
+		previous = t;
+	}
+	return result;
+}
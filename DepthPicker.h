@@ -0,0 +1,82 @@
+//-----------------------------------------------------------------------------
+// File: DepthPicker.h
+//
+// Answers "what is under pixel (x, y)" and ray queries from the most recent
+// read back depth, never from the GPU directly, so any number of queries per
+// frame costs no stall. World positions go through the inverse view-projection
+// of the frame the depth belongs to. Results are cached per frame: repeated
+// queries of the same pixel within a frame are table lookups.
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_PICKER_H
+#define DEPTH_PICKER_H
+
+#include "DepthImage.h"
+#include "DepthMath.h"
+
+//--------------------------------------------------------------------------------------
+struct PickResult
+{
+	bool					hit;				// false over the cleared background
+	float					depth;				// hardware depth
+	float					world[3];
+	int						x;					// pixel, for ray picks the one hit
+	int						y;
+	unsigned int			frameIndex;			// frame the depth was rendered in
+};
+
+//--------------------------------------------------------------------------------------
+struct PickStats
+{
+	int						queries;
+	int						cacheHits;
+};
+
+//--------------------------------------------------------------------------------------
+class DepthPicker
+{
+	static const int		CACHE_SIZE = 256;	// power of two
+	static const int		RAY_STEPS = 128;
+	static const int		RAY_REFINE_STEPS = 6;
+
+	struct CacheEntry
+	{
+		uint32_t			key;				// (y << 16) | x
+		uint32_t			stamp;				// valid when equal to the current frame stamp
+		PickResult			result;
+	};
+
+	const DepthImage*		m_depth;
+	DepthMatrix				m_viewProj;
+	DepthMatrix				m_invViewProj;
+	unsigned int			m_frameIndex;
+	bool					m_reversed;
+	uint32_t				m_stamp;
+	CacheEntry				m_cache[CACHE_SIZE];
+	PickStats				m_stats;
+
+	DepthPicker(const DepthPicker&);
+	DepthPicker& operator=(const DepthPicker&);
+
+	void				computePick(int x, int y, PickResult& result) const;
+	PickResult			cachedPick(int x, int y, bool& cached);
+	bool				project(const float* world, float* screen) const;
+public:
+
+	DepthPicker();
+
+	// depth must stay alive and unchanged until the next setFrame
+	void				setFrame(const DepthImage* depth, unsigned int frameIndex, const DepthMatrix& viewProj);
+	void				reset()						{ m_depth = NULL; }
+	void				setReverseZ(bool reversed)	{ m_reversed = reversed; }
+	bool				hasFrame() const			{ return m_depth != NULL; }
+
+	PickResult			pick(int x, int y);
+	void				pickBatch(const int* pixels, int count, PickResult* results);	// pixels holds x, y pairs
+
+	// First point along the ray in front of the depth buffer surface, within thickness in world units
+	PickResult			pickRay(const float* origin, const float* direction, float maxDistance, float thickness);
+
+	const PickStats&	getStats() const			{ return m_stats; }
+};
+
+#endif // DEPTH_PICKER_H
@@ -0,0 +1,113 @@
+//-----------------------------------------------------------------------------
+// File: DepthPrecision.cpp
+//-----------------------------------------------------------------------------
+#include "DepthPrecision.h"
+
+static const double			UNORM24_MAX = 16777215.0;
+
+//--------------------------------------------------------------------------------------
+// DepthMath conversions in double, so only the storage rounds
+static double projectDepth(double viewZ, const DepthProjection& projection)
+{
+	const double n = projection.zNear;
+	const double f = projection.zFar;
+	return projection.reversed ? n * (f - viewZ) / (viewZ * (f - n)) : f * (viewZ - n) / (viewZ * (f - n));
+}
+
+//--------------------------------------------------------------------------------------
+static double unprojectDepth(double depth, const DepthProjection& projection)
+{
+	const double n = projection.zNear;
+	const double f = projection.zFar;
+	return projection.reversed ? n * f / (n + depth * (f - n)) : n * f / (f - depth * (f - n));
+}
+
+//--------------------------------------------------------------------------------------
+const char* getDepthFormatName(DepthFormat format)
+{
+	static const char* const names[DEPTH_FORMAT_COUNT] = { "D24 unorm", "D24FS8 float", "32 bit float" };
+	return format < DEPTH_FORMAT_COUNT ? names[format] : "unknown";
+}
+
+//--------------------------------------------------------------------------------------
+// 20e4 has 20 mantissa bits and, with exponent bias 15, denormals below 2^-14.
+// Float32 denormals start at 2^-126.
+double getDepthStep(double depth, DepthFormat format)
+{
+	int exponent;
+	switch (format)
+	{
+	case DEPTH_FORMAT_FLOAT24:
+		if (depth < ldexp(1.0, -14))
+		{
+			return ldexp(1.0, -14 - 20);
+		}
+		frexp(depth, &exponent);
+		return ldexp(1.0, exponent - 1 - 20);
+	case DEPTH_FORMAT_FLOAT32:
+		if (depth < ldexp(1.0, -126))
+		{
+			return ldexp(1.0, -126 - 23);
+		}
+		frexp(depth, &exponent);
+		return ldexp(1.0, exponent - 1 - 23);
+	default:
+		return 1.0 / UNORM24_MAX;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+double storeDepth(double depth, DepthFormat format)
+{
+	depth = depth < 0.0 ? 0.0 : (depth > 1.0 ? 1.0 : depth);
+	switch (format)
+	{
+	case DEPTH_FORMAT_FLOAT24:
+		{
+			const double step = getDepthStep(depth, format);
+			return floor(depth / step + 0.5) * step;
+		}
+	case DEPTH_FORMAT_FLOAT32:
+		return (float)depth;
+	default:
+		return floor(depth * UNORM24_MAX + 0.5) / UNORM24_MAX;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// |d viewZ / d depth| = (far - near) * viewZ^2 / (near * far) for both conventions
+double getDepthResolution(double viewZ, const DepthProjection& projection, DepthFormat format)
+{
+	const double n = projection.zNear;
+	const double f = projection.zFar;
+	return (f - n) * viewZ * viewZ / (n * f) * getDepthStep(projectDepth(viewZ, projection), format);
+}
+
+//--------------------------------------------------------------------------------------
+DepthPrecisionStats measureDepthPrecision(const DepthProjection& projection, DepthFormat format, int sampleCount)
+{
+	DepthPrecisionStats stats;
+	stats.maxRelativeError = 0.0;
+	stats.meanRelativeError = 0.0;
+	stats.nearResolution = 0.0;
+	stats.farResolution = 0.0;
+	const double ratio = (double)projection.zFar / projection.zNear;
+	for (int i = 0; i < sampleCount; ++i)
+	{
+		const double viewZ = projection.zNear * pow(ratio, (i + 0.5) / sampleCount);
+		if (i == 0)
+		{
+			stats.nearResolution = getDepthResolution(viewZ, projection, format);
+		}
+		if (i == sampleCount - 1)
+		{
+			stats.farResolution = getDepthResolution(viewZ, projection, format);
+		}
+		const double stored = unprojectDepth(storeDepth(projectDepth(viewZ, projection), format), projection);
+		const double error = fabs(stored - viewZ) / viewZ;
+		stats.maxRelativeError = error > stats.maxRelativeError ? error : stats.maxRelativeError;
+		stats.meanRelativeError += error;
+	}
+	stats.meanRelativeError /= sampleCount > 0 ? sampleCount : 1;
+	return stats;
+}
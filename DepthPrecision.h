@@ -0,0 +1,48 @@
+//-----------------------------------------------------------------------------
+// File: DepthPrecision.h
+//
+// How well a depth buffer resolves view distance for a storage format and
+// depth convention. View distances spaced logarithmically from near to far
+// are projected in double precision, stored the way the format stores them
+// and linearized back. The relative error of that round trip, and the view
+// distance between adjacent stored values, show where surfaces start to
+// z-fight. Standard depth crowds its precision next to the near plane, float
+// storage crowds it next to 0, so only reverse-Z in float spreads it evenly.
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_PRECISION_H
+#define DEPTH_PRECISION_H
+
+#include "DepthMath.h"
+
+//--------------------------------------------------------------------------------------
+enum DepthFormat
+{
+	DEPTH_FORMAT_UNORM24,		// D24X8, D24S8 and INTZ
+	DEPTH_FORMAT_FLOAT24,		// D24FS8, unsigned 20e4 with 1.0 in the top binade
+	DEPTH_FORMAT_FLOAT32,		// R32F read back and the CPU rasterizers
+	DEPTH_FORMAT_COUNT
+};
+
+//--------------------------------------------------------------------------------------
+struct DepthPrecisionStats
+{
+	double					maxRelativeError;	// |stored view z - view z| / view z
+	double					meanRelativeError;
+	double					nearResolution;		// view z between adjacent stored depths at the nearest distance
+	double					farResolution;		// and at the farthest
+};
+
+//--------------------------------------------------------------------------------------
+const char*			getDepthFormatName(DepthFormat format);
+
+// Nearest value of format to depth in [0, 1], and the spacing of the values there
+double				storeDepth(double depth, DepthFormat format);
+double				getDepthStep(double depth, DepthFormat format);
+
+// View z between adjacent stored depths at viewZ
+double				getDepthResolution(double viewZ, const DepthProjection& projection, DepthFormat format);
+
+// sampleCount distances from zNear to zFar
+DepthPrecisionStats	measureDepthPrecision(const DepthProjection& projection, DepthFormat format, int sampleCount);
+
+#endif // DEPTH_PRECISION_H
@@ -0,0 +1,203 @@
+//-----------------------------------------------------------------------------
+// File: DepthRasterizer.cpp
+//-----------------------------------------------------------------------------
+#include "DepthRasterizer.h"
+
+//--------------------------------------------------------------------------------------
+DepthRasterizer::DepthRasterizer()
+	: m_screen( NULL )
+	, m_capacity( 0 )
+	, m_cullMode( CULL_CCW )
+	, m_reversed( false )
+{
+	resetStats();
+}
+
+//--------------------------------------------------------------------------------------
+DepthRasterizer::~DepthRasterizer()
+{
+	alignedFree(m_screen);
+}
+
+//--------------------------------------------------------------------------------------
+void DepthRasterizer::resetStats()
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+// Clip space to D3D9 screen space, w is kept to reject the near plane
+void DepthRasterizer::transform(const RasterMesh& mesh, const DepthMatrix& worldViewProj, int width, int height)
+{
+	if (mesh.vertexCount > m_capacity)
+	{
+		alignedFree(m_screen);
+		m_capacity = mesh.vertexCount;
+		m_screen = (float*)alignedAlloc(sizeof(float) * 4 * m_capacity, 16);
+	}
+
+	const DepthMatrix& m = worldViewProj;
+	const float halfWidth = width * 0.5f;
+	const float halfHeight = height * 0.5f;
+	for (int i = 0; i < mesh.vertexCount; ++i)
+	{
+		const float* p = mesh.positions + i * mesh.stride;
+		const float x = p[0] * m.m[0][0] + p[1] * m.m[1][0] + p[2] * m.m[2][0] + m.m[3][0];
+		const float y = p[0] * m.m[0][1] + p[1] * m.m[1][1] + p[2] * m.m[2][1] + m.m[3][1];
+		const float z = p[0] * m.m[0][2] + p[1] * m.m[1][2] + p[2] * m.m[2][2] + m.m[3][2];
+		const float w = p[0] * m.m[0][3] + p[1] * m.m[1][3] + p[2] * m.m[2][3] + m.m[3][3];
+
+		float* dst = m_screen + i * 4;
+		const float invW = w > 0.0f ? 1.0f / w : 0.0f;
+		dst[0] = (x * invW + 1.0f) * halfWidth;
+		dst[1] = (1.0f - y * invW) * halfHeight;
+		dst[2] = z * invW;
+		dst[3] = z < 0.0f ? -1.0f : w;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE int64_t min3(int64_t a, int64_t b, int64_t c)
+{
+	const int64_t m = a < b ? a : b;
+	return m < c ? m : c;
+}
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE int64_t max3(int64_t a, int64_t b, int64_t c)
+{
+	const int64_t m = a > b ? a : b;
+	return m > c ? m : c;
+}
+
+//--------------------------------------------------------------------------------------
+// Floor division by the subpixel scale, also right for negative coordinates
+static FORCE_INLINE int64_t toPixelFloor(int64_t value)
+{
+	return value >= 0 ? value >> DepthRasterizer::SUBPIXEL_BITS
+		: -((-value + (1 << DepthRasterizer::SUBPIXEL_BITS) - 1) >> DepthRasterizer::SUBPIXEL_BITS);
+}
+
+//--------------------------------------------------------------------------------------
+// Edge functions are exact in 64 bit fixed point, depth is a plane in screen space
+void DepthRasterizer::drawTriangle(const float* v0, const float* v1, const float* v2, DepthImage& target)
+{
+	const float snap = (float)(1 << SUBPIXEL_BITS);
+	const float guard = (float)(1 << 20);
+	const int64_t one = 1 << SUBPIXEL_BITS;
+
+	// Far off screen vertices are clamped before snapping, the bounds reject them anyway
+	int64_t X0 = (int64_t)floorf(clampf(v0[0], -guard, guard) * snap + 0.5f);
+	int64_t Y0 = (int64_t)floorf(clampf(v0[1], -guard, guard) * snap + 0.5f);
+	int64_t X1 = (int64_t)floorf(clampf(v1[0], -guard, guard) * snap + 0.5f);
+	int64_t Y1 = (int64_t)floorf(clampf(v1[1], -guard, guard) * snap + 0.5f);
+	int64_t X2 = (int64_t)floorf(clampf(v2[0], -guard, guard) * snap + 0.5f);
+	int64_t Y2 = (int64_t)floorf(clampf(v2[1], -guard, guard) * snap + 0.5f);
+	float z0 = v0[2];
+	float z1 = v1[2];
+	float z2 = v2[2];
+
+	// Positive area is clockwise on screen since y points down
+	int64_t area = (X1 - X0) * (Y2 - Y0) - (Y1 - Y0) * (X2 - X0);
+	if (area == 0 || (area < 0 && m_cullMode == CULL_CCW) || (area > 0 && m_cullMode == CULL_CW))
+	{
+		++m_stats.trianglesCulled;
+		return;
+	}
+	if (area < 0)
+	{
+		int64_t t = X1; X1 = X2; X2 = t;
+		t = Y1; Y1 = Y2; Y2 = t;
+		const float tz = z1; z1 = z2; z2 = tz;
+		area = -area;
+	}
+
+	// Pixels whose sample point lies inside the snapped bounds
+	const int64_t minX = toPixelFloor(min3(X0, X1, X2) + one - 1);
+	const int64_t minY = toPixelFloor(min3(Y0, Y1, Y2) + one - 1);
+	const int64_t maxX = toPixelFloor(max3(X0, X1, X2));
+	const int64_t maxY = toPixelFloor(max3(Y0, Y1, Y2));
+	const int bx0 = (int)(minX < 0 ? 0 : minX);
+	const int by0 = (int)(minY < 0 ? 0 : minY);
+	const int bx1 = (int)(maxX >= target.getWidth() ? target.getWidth() - 1 : maxX);
+	const int by1 = (int)(maxY >= target.getHeight() ? target.getHeight() - 1 : maxY);
+	if (bx0 > bx1 || by0 > by1)
+	{
+		++m_stats.trianglesCulled;
+		return;
+	}
+
+	// E(P) = (Xb - Xa) * (Py - Ya) - (Yb - Ya) * (Px - Xa), positive inside.
+	// Top edges (going right) and left edges (going up) own their samples.
+	const int64_t ax[3] = { X0, X1, X2 };
+	const int64_t ay[3] = { Y0, Y1, Y2 };
+	int64_t rowE[3];
+	int64_t stepX[3];
+	int64_t stepY[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		const int j = (i + 1) % 3;
+		const int64_t dx = ax[j] - ax[i];
+		const int64_t dy = ay[j] - ay[i];
+		const bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+		rowE[i] = dx * (by0 * one - ay[i]) - dy * (bx0 * one - ax[i]) + (topLeft ? 0 : -1);
+		stepX[i] = -dy * one;
+		stepY[i] = dx * one;
+	}
+
+	const float fx0 = X0 / snap;
+	const float fy0 = Y0 / snap;
+	const float invArea = snap * snap / (float)area;
+	const float dzdx = ((z1 - z0) * (float)(Y2 - Y0) - (z2 - z0) * (float)(Y1 - Y0)) * invArea / snap;
+	const float dzdy = ((z2 - z0) * (float)(X1 - X0) - (z1 - z0) * (float)(X2 - X0)) * invArea / snap;
+
+	const bool greater = m_reversed;
+	int written = 0;
+	for (int y = by0; y <= by1; ++y)
+	{
+		int64_t e0 = rowE[0];
+		int64_t e1 = rowE[1];
+		int64_t e2 = rowE[2];
+		float* row = target.row(y);
+		float z = z0 + (bx0 - fx0) * dzdx + (y - fy0) * dzdy;
+		for (int x = bx0; x <= bx1; ++x)
+		{
+			if ((e0 | e1 | e2) >= 0 && z >= 0.0f && z <= 1.0f && (greater ? z >= row[x] : z <= row[x]))
+			{
+				row[x] = z;
+				++written;
+			}
+			e0 += stepX[0];
+			e1 += stepX[1];
+			e2 += stepX[2];
+			z += dzdx;
+		}
+		rowE[0] += stepY[0];
+		rowE[1] += stepY[1];
+		rowE[2] += stepY[2];
+	}
+	m_stats.pixelsWritten += written;
+}
+
+//--------------------------------------------------------------------------------------
+void DepthRasterizer::draw(const RasterMesh& mesh, const DepthMatrix& worldViewProj, DepthImage& target)
+{
+	CpuTimer timer;
+	transform(mesh, worldViewProj, target.getWidth(), target.getHeight());
+
+	for (int t = 0; t < mesh.triangleCount; ++t)
+	{
+		const float* v0 = m_screen + mesh.indices[t * 3] * 4;
+		const float* v1 = m_screen + mesh.indices[t * 3 + 1] * 4;
+		const float* v2 = m_screen + mesh.indices[t * 3 + 2] * 4;
+		if (v0[3] <= 0.0f || v1[3] <= 0.0f || v2[3] <= 0.0f)
+		{
+			++m_stats.trianglesDropped;
+			continue;
+		}
+		drawTriangle(v0, v1, v2, target);
+	}
+
+	m_stats.trianglesIn += mesh.triangleCount;
+	m_stats.rasterMs += timer.elapsedMs();
+}
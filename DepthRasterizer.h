@@ -0,0 +1,81 @@
+//-----------------------------------------------------------------------------
+// File: DepthRasterizer.h
+//
+// Software depth-only rasterizer following the D3D9 rules the GPU uses for
+// the same draw: pixel (x, y) is sampled at screen position (x, y), vertices
+// are snapped to 1/16 pixel, the top-left fill rule decides shared edges and
+// the depth test is LESSEQUAL, or GREATEREQUAL for reverse-Z. Lets the depth
+// paths run and be checked without a device.
+//
+// Triangles reaching behind the near plane are dropped rather than clipped.
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_RASTERIZER_H
+#define DEPTH_RASTERIZER_H
+
+#include "DepthImage.h"
+#include "DepthMath.h"
+
+//--------------------------------------------------------------------------------------
+// Non-owning view of an indexed triangle list
+struct RasterMesh
+{
+	const float*			positions;			// x, y, z at the start of every vertex
+	int						stride;				// in floats
+	int						vertexCount;
+	const uint32_t*			indices;
+	int						triangleCount;
+};
+
+//--------------------------------------------------------------------------------------
+struct RasterStats
+{
+	double					rasterMs;
+	int						trianglesIn;
+	int						trianglesCulled;	// back facing, degenerate or off screen
+	int						trianglesDropped;	// crossing the near plane
+	int						pixelsWritten;
+};
+
+//--------------------------------------------------------------------------------------
+class DepthRasterizer
+{
+public:
+	// Same meaning as D3DCULL: CULL_CCW removes triangles counter-clockwise on screen
+	enum CullMode
+	{
+		CULL_NONE,
+		CULL_CW,
+		CULL_CCW,
+	};
+
+	static const int		SUBPIXEL_BITS = 4;
+
+private:
+	float*					m_screen;			// x, y, z in pixels and w per vertex
+	int						m_capacity;
+	CullMode				m_cullMode;
+	bool					m_reversed;
+	RasterStats				m_stats;
+
+	DepthRasterizer(const DepthRasterizer&);
+	DepthRasterizer& operator=(const DepthRasterizer&);
+
+	void				transform(const RasterMesh& mesh, const DepthMatrix& worldViewProj, int width, int height);
+	void				drawTriangle(const float* v0, const float* v1, const float* v2, DepthImage& target);
+public:
+
+	DepthRasterizer();
+	~DepthRasterizer();
+
+	void				setCullMode(CullMode mode)	{ m_cullMode = mode; }
+	void				setReverseZ(bool reversed)	{ m_reversed = reversed; }
+	void				resetStats();
+
+	// Depth tests and writes into target, which the caller clears to
+	// farDepth()
+	void				draw(const RasterMesh& mesh, const DepthMatrix& worldViewProj, DepthImage& target);
+
+	const RasterStats&	getStats() const			{ return m_stats; }
+};
+
+#endif // DEPTH_RASTERIZER_H
@@ -0,0 +1,140 @@
+//-----------------------------------------------------------------------------
+// File: DepthReadback.cpp
+//-----------------------------------------------------------------------------
+#include "DepthReadback.h"
+
+//--------------------------------------------------------------------------------------
+DepthReadback::DepthReadback()
+	: m_pTarget( NULL )
+	, m_captured( 0 )
+	, m_fetched( 0 )
+	, m_width( 0 )
+	, m_height( 0 )
+{
+	for (UINT i = 0; i < RING_SIZE; ++i)
+	{
+		m_pSysmem[i] = NULL;
+		m_pQuery[i] = NULL;
+		m_frameIndex[i] = 0;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+DepthReadback::~DepthReadback()
+{
+	for (UINT i = 0; i < RING_SIZE; ++i)
+	{
+		if (m_pSysmem[i])
+		{
+			m_pSysmem[i]->Release();
+		}
+		if (m_pQuery[i])
+		{
+			m_pQuery[i]->Release();
+		}
+	}
+	if (m_pTarget)
+	{
+		m_pTarget->Release();
+	}
+}
+
+//--------------------------------------------------------------------------------------
+HRESULT DepthReadback::create( const LPDIRECT3DDEVICE9 device, int width, int height )
+{
+	m_width = width;
+	m_height = height;
+
+	if (FAILED( device->CreateTexture( width, height, 1, D3DUSAGE_RENDERTARGET, D3DFMT_R32F,
+		D3DPOOL_DEFAULT, &m_pTarget, NULL ) ))
+	{
+		return E_FAIL;
+	}
+
+	for (UINT i = 0; i < RING_SIZE; ++i)
+	{
+		if (FAILED( device->CreateOffscreenPlainSurface( width, height, D3DFMT_R32F,
+			D3DPOOL_SYSTEMMEM, &m_pSysmem[i], NULL ) ))
+		{
+			return E_FAIL;
+		}
+		if (FAILED( device->CreateQuery( D3DQUERYTYPE_EVENT, &m_pQuery[i] ) ))
+		{
+			return E_FAIL;
+		}
+	}
+	return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+// Expects DepthTargetTexture of the effect to be bound to the resolved depth
+void DepthReadback::capture( PostProcess& postProcess, D3DXHANDLE technique, UINT frameIndex )
+{
+	if (m_pTarget == NULL)
+	{
+		return;
+	}
+
+	// Ring is full, drop the oldest copy rather than waiting for it
+	if (m_captured - m_fetched == RING_SIZE)
+	{
+		++m_fetched;
+	}
+	const UINT slot = m_captured % RING_SIZE;
+
+	postProcess.renderTo( m_pTarget, technique );
+
+	IDirect3DSurface9* pTargetSurface = NULL;
+	m_pTarget->GetSurfaceLevel( 0, &pTargetSurface );
+	postProcess.getDevice()->GetRenderTargetData( pTargetSurface, m_pSysmem[slot] );
+	pTargetSurface->Release();
+
+	m_pQuery[slot]->Issue( D3DISSUE_END );
+	m_frameIndex[slot] = frameIndex;
+	++m_captured;
+}
+
+//--------------------------------------------------------------------------------------
+// Copies the newest finished capture, returns false if the GPU has none ready yet.
+// With wait set it blocks until the most recent capture is done, for validation only.
+bool DepthReadback::fetch( DepthImage& image, UINT* frameIndex, bool wait )
+{
+	if (wait && m_captured > m_fetched)
+	{
+		while (m_pQuery[(m_captured - 1) % RING_SIZE]->GetData( NULL, 0, D3DGETDATA_FLUSH ) == S_FALSE)
+		{
+		}
+	}
+
+	// Events complete in order, so stop at the first one still in flight
+	UINT ready = m_fetched;
+	while (ready < m_captured && m_pQuery[ready % RING_SIZE]->GetData( NULL, 0, 0 ) == S_OK)
+	{
+		++ready;
+	}
+	if (ready == m_fetched)
+	{
+		return false;
+	}
+
+	const UINT slot = (ready - 1) % RING_SIZE;
+	D3DLOCKED_RECT locked;
+	if (FAILED( m_pSysmem[slot]->LockRect( &locked, NULL, D3DLOCK_READONLY ) ))
+	{
+		return false;
+	}
+
+	image.resize( m_width, m_height );
+	for (int y = 0; y < m_height; ++y)
+	{
+		memcpy( image.row(y), (const BYTE*)locked.pBits + y * locked.Pitch, sizeof(float) * m_width );
+	}
+	m_pSysmem[slot]->UnlockRect();
+
+	if (frameIndex)
+	{
+		*frameIndex = m_frameIndex[slot];
+	}
+	m_fetched = ready;
+	return true;
+}
@@ -0,0 +1,41 @@
+//-----------------------------------------------------------------------------
+// File: DepthReadback.h
+//
+// Asynchronous copy of the resolved depth texture to system memory. Depth is
+// converted to R32F by a shader pass and copied into a ring of sysmem surfaces,
+// the CPU picks up whichever copy the GPU has finished so Render() never stalls.
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_READBACK_H
+#define DEPTH_READBACK_H
+
+#include <d3dx9.h>
+#include "DepthImage.h"
+#include "PostProcess.h"
+
+//--------------------------------------------------------------------------------------
+class DepthReadback
+{
+	static const UINT		RING_SIZE = 3;
+
+	LPDIRECT3DTEXTURE9		m_pTarget;
+	IDirect3DSurface9*		m_pSysmem[RING_SIZE];
+	IDirect3DQuery9*		m_pQuery[RING_SIZE];
+	UINT					m_frameIndex[RING_SIZE];
+	UINT					m_captured;
+	UINT					m_fetched;
+	int						m_width;
+	int						m_height;
+public:
+
+	DepthReadback();
+	~DepthReadback();
+
+	HRESULT				create( const LPDIRECT3DDEVICE9 device, int width, int height );
+	void				capture( PostProcess& postProcess, D3DXHANDLE technique, UINT frameIndex );
+	bool				fetch( DepthImage& image, UINT* frameIndex, bool wait = false );
+
+	int					getWidth()		{ return m_width; }
+	int					getHeight()		{ return m_height; }
+};
+
+#endif // DEPTH_READBACK_H
@@ -0,0 +1,152 @@
+//-----------------------------------------------------------------------------
+// File: DepthReductionPass.cpp
+//-----------------------------------------------------------------------------
+#include "DepthReductionPass.h"
+
+//--------------------------------------------------------------------------------------
+DepthReductionPass::DepthReductionPass()
+	: m_postProcess( NULL )
+	, m_levelCount( 0 )
+	, m_captured( 0 )
+	, m_fetched( 0 )
+	, m_width( 0 )
+	, m_height( 0 )
+{
+	for (int i = 0; i < MAX_LEVELS; ++i)
+	{
+		m_pLevels[i] = NULL;
+	}
+	for (UINT i = 0; i < RING_SIZE; ++i)
+	{
+		m_pSysmem[i] = NULL;
+		m_pQuery[i] = NULL;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+DepthReductionPass::~DepthReductionPass()
+{
+	for (int i = 0; i < m_levelCount; ++i)
+	{
+		m_pLevels[i]->Release();
+	}
+	for (UINT i = 0; i < RING_SIZE; ++i)
+	{
+		if (m_pSysmem[i])
+		{
+			m_pSysmem[i]->Release();
+		}
+		if (m_pQuery[i])
+		{
+			m_pQuery[i]->Release();
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+HRESULT DepthReductionPass::create( PostProcess* postProcess, int width, int height, bool rawz )
+{
+	m_postProcess = postProcess;
+	m_width = width;
+	m_height = height;
+
+	LPDIRECT3DDEVICE9 device = postProcess->getDevice();
+	int levelWidth = width;
+	int levelHeight = height;
+	while ((levelWidth > 1 || levelHeight > 1) && m_levelCount < MAX_LEVELS)
+	{
+		levelWidth = (levelWidth + 3) / 4;
+		levelHeight = (levelHeight + 3) / 4;
+		if (FAILED( device->CreateTexture( levelWidth, levelHeight, 1, D3DUSAGE_RENDERTARGET, D3DFMT_G32R32F,
+			D3DPOOL_DEFAULT, &m_pLevels[m_levelCount], NULL ) ))
+		{
+			return E_FAIL;
+		}
+		m_levelWidth[m_levelCount] = levelWidth;
+		m_levelHeight[m_levelCount] = levelHeight;
+		++m_levelCount;
+	}
+	if (levelWidth > 1 || levelHeight > 1)
+	{
+		return E_FAIL;
+	}
+
+	for (UINT i = 0; i < RING_SIZE; ++i)
+	{
+		if (FAILED( device->CreateOffscreenPlainSurface( 1, 1, D3DFMT_G32R32F, D3DPOOL_SYSTEMMEM, &m_pSysmem[i], NULL ) ) ||
+			FAILED( device->CreateQuery( D3DQUERYTYPE_EVENT, &m_pQuery[i] ) ))
+		{
+			return E_FAIL;
+		}
+	}
+
+	ID3DXEffect* effect = postProcess->getEffect();
+	m_hTFirst = effect->GetTechniqueByName( rawz ? "DepthRangeFirstRAWZ" : "DepthRangeFirst" );
+	m_hTReduce = effect->GetTechniqueByName( "DepthRangeReduce" );
+	m_hReduceTexture = effect->GetParameterByName( NULL, "ReduceTexture" );
+	m_hReduceSourceSize = effect->GetParameterByName( NULL, "ReduceSourceSize" );
+	return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+void DepthReductionPass::render()
+{
+	ID3DXEffect* effect = m_postProcess->getEffect();
+
+	// Ring is full, drop the oldest result rather than waiting for it
+	if (m_captured - m_fetched == RING_SIZE)
+	{
+		++m_fetched;
+	}
+	const UINT slot = m_captured % RING_SIZE;
+
+	int sourceWidth = m_width;
+	int sourceHeight = m_height;
+	for (int i = 0; i < m_levelCount; ++i)
+	{
+		D3DXVECTOR4 sourceSize( 1.0f / sourceWidth, 1.0f / sourceHeight, (float)sourceWidth, (float)sourceHeight );
+		effect->SetVector( m_hReduceSourceSize, &sourceSize );
+		if (i > 0)
+		{
+			effect->SetTexture( m_hReduceTexture, m_pLevels[i - 1] );
+		}
+		m_postProcess->renderTo( m_pLevels[i], i == 0 ? m_hTFirst : m_hTReduce );
+		sourceWidth = m_levelWidth[i];
+		sourceHeight = m_levelHeight[i];
+	}
+
+	IDirect3DSurface9* pLastSurface = NULL;
+	m_pLevels[m_levelCount - 1]->GetSurfaceLevel( 0, &pLastSurface );
+	m_postProcess->getDevice()->GetRenderTargetData( pLastSurface, m_pSysmem[slot] );
+	pLastSurface->Release();
+
+	m_pQuery[slot]->Issue( D3DISSUE_END );
+	++m_captured;
+}
+
+//--------------------------------------------------------------------------------------
+bool DepthReductionPass::fetch( float* minZ, float* maxZ )
+{
+	// Events complete in order, so stop at the first one still in flight
+	UINT ready = m_fetched;
+	while (ready < m_captured && m_pQuery[ready % RING_SIZE]->GetData( NULL, 0, 0 ) == S_OK)
+	{
+		++ready;
+	}
+	if (ready == m_fetched)
+	{
+		return false;
+	}
+	m_fetched = ready;
+
+	D3DLOCKED_RECT locked;
+	if (FAILED( m_pSysmem[(ready - 1) % RING_SIZE]->LockRect( &locked, NULL, D3DLOCK_READONLY ) ))
+	{
+		return false;
+	}
+	const float* range = (const float*)locked.pBits;
+	*minZ = range[0];
+	*maxZ = range[1];
+	m_pSysmem[(ready - 1) % RING_SIZE]->UnlockRect();
+	return *minZ <= *maxZ;
+}
@@ -0,0 +1,48 @@
+//-----------------------------------------------------------------------------
+// File: DepthReductionPass.h
+//
+// GPU path of the view z range used by ShadowCascades: the resolved depth is
+// reduced 4x4 at a time into G32R32F levels down to a single texel, which is
+// read back through a ring of system memory copies like DepthReadback so the
+// CPU never waits. The range arrives a few frames late.
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_REDUCTION_PASS_H
+#define DEPTH_REDUCTION_PASS_H
+
+#include "PostProcess.h"
+
+//--------------------------------------------------------------------------------------
+class DepthReductionPass
+{
+	static const int		MAX_LEVELS = 8;
+	static const UINT		RING_SIZE = 3;
+
+	PostProcess*			m_postProcess;
+	LPDIRECT3DTEXTURE9		m_pLevels[MAX_LEVELS];
+	int						m_levelWidth[MAX_LEVELS];
+	int						m_levelHeight[MAX_LEVELS];
+	int						m_levelCount;
+	IDirect3DSurface9*		m_pSysmem[RING_SIZE];
+	IDirect3DQuery9*		m_pQuery[RING_SIZE];
+	UINT					m_captured;
+	UINT					m_fetched;
+	D3DXHANDLE				m_hTFirst;
+	D3DXHANDLE				m_hTReduce;
+	D3DXHANDLE				m_hReduceTexture;
+	D3DXHANDLE				m_hReduceSourceSize;
+	int						m_width;
+	int						m_height;
+public:
+
+	DepthReductionPass();
+	~DepthReductionPass();
+
+	HRESULT				create( PostProcess* postProcess, int width, int height, bool rawz );
+
+	// Expects DepthTargetTexture of the effect to be bound to the resolved depth
+	void				render();
+	// Newest finished range in view z, false if none is ready or nothing but background was visible
+	bool				fetch( float* minZ, float* maxZ );
+};
+
+#endif // DEPTH_REDUCTION_PASS_H
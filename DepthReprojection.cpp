@@ -0,0 +1,203 @@
+//-----------------------------------------------------------------------------
+// File: DepthReprojection.cpp
+//-----------------------------------------------------------------------------
+#include "DepthReprojection.h"
+
+//--------------------------------------------------------------------------------------
+DepthReprojection::DepthReprojection()
+	: m_reversed( false )
+{
+	memset(&m_reprojection, 0, sizeof(m_reprojection));
+	for (int i = 0; i < 4; ++i)
+	{
+		m_reprojection.m[i][i] = 1.0f;
+	}
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+bool DepthReprojection::setMatrices(const DepthMatrix& previous, const DepthMatrix& current)
+{
+	DepthMatrix inverse;
+	if (!invertMatrix(previous, inverse))
+	{
+		return false;
+	}
+	m_reprojection = multiplyMatrix(inverse, current);
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Four source pixels are transformed at once in SoA form, the scatter is scalar
+void DepthReprojection::splat(const DepthImage& depth)
+{
+	const int width = depth.getWidth();
+	const int height = depth.getHeight();
+	const DepthMatrix& m = m_reprojection;
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const bool reversed = m_reversed;
+	const __m128 m0x = _mm_set1_ps(m.m[0][0]), m0y = _mm_set1_ps(m.m[0][1]), m0z = _mm_set1_ps(m.m[0][2]), m0w = _mm_set1_ps(m.m[0][3]);
+	const __m128 m2x = _mm_set1_ps(m.m[2][0]), m2y = _mm_set1_ps(m.m[2][1]), m2z = _mm_set1_ps(m.m[2][2]), m2w = _mm_set1_ps(m.m[2][3]);
+	const __m128 targetW = _mm_set1_ps((float)width);
+	const __m128 targetH = _mm_set1_ps((float)height);
+	const __m128 ndcStep = _mm_set1_ps(8.0f / width);
+
+	ALIGN16 float tx[4];
+	ALIGN16 float ty[4];
+	ALIGN16 float tz[4];
+	int splatCount = 0;
+
+	for (int y = 0; y < height; ++y)
+	{
+		// Row constant part: ndcY * M1 + M3
+		const float ndcY = 1.0f - (y + 0.5f) * 2.0f / height;
+		const __m128 rowX = _mm_set1_ps(ndcY * m.m[1][0] + m.m[3][0]);
+		const __m128 rowY = _mm_set1_ps(ndcY * m.m[1][1] + m.m[3][1]);
+		const __m128 rowZ = _mm_set1_ps(ndcY * m.m[1][2] + m.m[3][2]);
+		const __m128 rowW = _mm_set1_ps(ndcY * m.m[1][3] + m.m[3][3]);
+
+		const float* src = depth.row(y);
+		__m128 ndcX = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		ndcX = _mm_sub_ps(_mm_mul_ps(ndcX, _mm_set1_ps(2.0f / width)), one);
+
+		for (int x = 0; x < width; x += 4, ndcX = _mm_add_ps(ndcX, ndcStep))
+		{
+			const __m128 z = _mm_load_ps(src + x);
+			const __m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ndcX, m0x), _mm_mul_ps(z, m2x)), rowX);
+			const __m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ndcX, m0y), _mm_mul_ps(z, m2y)), rowY);
+			const __m128 cz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ndcX, m0z), _mm_mul_ps(z, m2z)), rowZ);
+			const __m128 cw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ndcX, m0w), _mm_mul_ps(z, m2w)), rowW);
+
+			// Background is never splatted, neither is anything that ends up behind the eye
+			const __m128 foreground = reversed ? _mm_cmpgt_ps(z, zero) : _mm_cmplt_ps(z, one);
+			int valid = _mm_movemask_ps(_mm_and_ps(foreground, _mm_cmpgt_ps(cw, zero)));
+			if (x + 4 > width)
+			{
+				valid &= (1 << (width - x)) - 1;
+			}
+			if (valid == 0)
+			{
+				continue;
+			}
+
+			const __m128 invW = _mm_div_ps(one, cw);
+			_mm_store_ps(tx, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(cx, invW), half), half), targetW));
+			_mm_store_ps(ty, _mm_mul_ps(_mm_sub_ps(half, _mm_mul_ps(_mm_mul_ps(cy, invW), half)), targetH));
+			_mm_store_ps(tz, _mm_mul_ps(cz, invW));
+
+			while (valid != 0)
+			{
+				const unsigned int lane = bitScanForward(valid);
+				valid &= valid - 1;
+				if (tx[lane] < 0.0f || ty[lane] < 0.0f || tx[lane] >= width || ty[lane] >= height ||
+					tz[lane] < 0.0f || tz[lane] > 1.0f)
+				{
+					continue;
+				}
+				float& dst = m_splat.at((int)tx[lane], (int)ty[lane]);
+				dst = dst < 0.0f ? tz[lane] : fartherDepth(dst, tz[lane], reversed);
+				++splatCount;
+			}
+		}
+	}
+	m_stats.splatCount = splatCount;
+}
+
+//--------------------------------------------------------------------------------------
+// Written pixels are copied four at a time, holes take the farthest written
+// neighbour if enough of the 3x3 neighbourhood was hit
+void DepthReprojection::fillHoles()
+{
+	const int width = m_splat.getWidth();
+	const int height = m_splat.getHeight();
+	const __m128 zero = _mm_setzero_ps();
+	int holesFilled = 0;
+
+	for (int y = 0; y < height; ++y)
+	{
+		const float* src = m_splat.row(y);
+		float* dst = m_predicted.row(y);
+		for (int x = 0; x < width; x += 4)
+		{
+			const __m128 v = _mm_load_ps(src + x);
+			_mm_store_ps(dst + x, v);
+			int holes = _mm_movemask_ps(_mm_cmplt_ps(v, zero));
+			if (x + 4 > width)
+			{
+				holes &= (1 << (width - x)) - 1;
+			}
+
+			while (holes != 0)
+			{
+				const int hx = x + bitScanForward(holes);
+				holes &= holes - 1;
+
+				int written = 0;
+				float farthest = m_reversed ? 1.0f : 0.0f;
+				for (int ny = maxi(y - 1, 0); ny <= mini(y + 1, height - 1); ++ny)
+				{
+					const float* row = m_splat.row(ny);
+					for (int nx = maxi(hx - 1, 0); nx <= mini(hx + 1, width - 1); ++nx)
+					{
+						if (row[nx] >= 0.0f)
+						{
+							farthest = fartherDepth(farthest, row[nx], m_reversed);
+							++written;
+						}
+					}
+				}
+				if (written >= MIN_FILL_NEIGHBOURS)
+				{
+					dst[hx] = farthest;
+					++holesFilled;
+				}
+				else
+				{
+					dst[hx] = farDepth(m_reversed);
+				}
+			}
+		}
+	}
+	m_stats.holesFilled = holesFilled;
+}
+
+//--------------------------------------------------------------------------------------
+void DepthReprojection::reproject(const DepthImage& previousDepth)
+{
+	m_splat.resize(previousDepth.getWidth(), previousDepth.getHeight());
+	m_predicted.resize(previousDepth.getWidth(), previousDepth.getHeight());
+
+	CpuTimer timer;
+	m_splat.fill(-1.0f);
+	splat(previousDepth);
+	m_stats.splatMs = timer.elapsedMs();
+
+	timer.start();
+	fillHoles();
+	m_stats.fillMs = timer.elapsedMs();
+}
+
+//--------------------------------------------------------------------------------------
+bool DepthReprojection::isOccluded(int x0, int y0, int x1, int y1, float nearestDepth) const
+{
+	x0 = maxi(x0, 0);
+	y0 = maxi(y0, 0);
+	x1 = mini(x1, m_predicted.getWidth());
+	y1 = mini(y1, m_predicted.getHeight());
+
+	for (int y = y0; y < y1; ++y)
+	{
+		const float* row = m_predicted.row(y);
+		for (int x = x0; x < x1; ++x)
+		{
+			if (!isNearerDepth(row[x], nearestDepth, m_reversed))
+			{
+				return false;
+			}
+		}
+	}
+	return x0 < x1 && y0 < y1;
+}
@@ -0,0 +1,63 @@
+//-----------------------------------------------------------------------------
+// File: DepthReprojection.h
+//
+// Predicts the depth buffer of the frame about to be drawn from an older one.
+// Every pixel of the old depth is moved to its new position with the two
+// world-view-projection matrices and splatted keeping the farthest depth, so
+// the prediction only ever occludes less than the real frame. Small holes
+// opened by the motion are closed from their neighbours, anything larger
+// stays at the far plane.
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_REPROJECTION_H
+#define DEPTH_REPROJECTION_H
+
+#include "DepthImage.h"
+#include "DepthMath.h"
+
+//--------------------------------------------------------------------------------------
+struct ReprojectionStats
+{
+	double					splatMs;
+	double					fillMs;
+	int						splatCount;
+	int						holesFilled;
+};
+
+//--------------------------------------------------------------------------------------
+class DepthReprojection
+{
+public:
+	// Written pixels out of 8 needed around a hole before it is filled
+	static const int		MIN_FILL_NEIGHBOURS = 5;
+
+private:
+	DepthImage				m_splat;			// negative where nothing landed
+	DepthImage				m_predicted;
+	DepthMatrix				m_reprojection;		// previous clip space to current clip space
+	bool					m_reversed;
+	ReprojectionStats		m_stats;
+
+	DepthReprojection(const DepthReprojection&);
+	DepthReprojection& operator=(const DepthReprojection&);
+
+	void				splat(const DepthImage& depth);
+	void				fillHoles();
+public:
+
+	DepthReprojection();
+
+	// Depth convention of the frames, farther is smaller with reverse-Z
+	void				setReverseZ(bool reversed)	{ m_reversed = reversed; }
+
+	// Matrices the two frames were rendered with, false if previous is singular
+	bool				setMatrices(const DepthMatrix& previous, const DepthMatrix& current);
+	void				reproject(const DepthImage& previousDepth);
+
+	// True if the predicted depth in [x0, x1) x [y0, y1) is everywhere in front of nearestDepth
+	bool				isOccluded(int x0, int y0, int x1, int y1, float nearestDepth) const;
+
+	const DepthImage&	getPredicted() const	{ return m_predicted; }
+	const ReprojectionStats& getStats() const	{ return m_stats; }
+};
+
+#endif // DEPTH_REPROJECTION_H
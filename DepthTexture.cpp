@@ -52,6 +52,20 @@ void DepthTexture::createTexture( const LPDIRECT3DDEVICE9 device, int width, int
 	}
 }
 
+//--------------------------------------------------------------------------------------
+LPDIRECT3DTEXTURE9 DepthTexture::createDepthTarget( const LPDIRECT3DDEVICE9 device, int width, int height )
+{
+	LPDIRECT3DTEXTURE9 texture = NULL;
+	if (m_isINTZ || m_isRAWZ)
+	{
+		device->CreateTexture(width, height, 1,
+			D3DUSAGE_DEPTHSTENCIL, m_isINTZ ? FOURCC_INTZ : FOURCC_RAWZ,
+			D3DPOOL_DEFAULT, &texture,
+			NULL);
+	}
+	return texture;
+}
+
 //--------------------------------------------------------------------------------------
 DepthTexture::~DepthTexture()
 {
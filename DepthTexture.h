@@ -22,6 +22,9 @@ public:
 
 	void				createTexture( const LPDIRECT3DDEVICE9 device, int width, int height );
 	void				resolveDepth(const LPDIRECT3DDEVICE9 device);
+	// Readable depth texture in the detected format, rendered to directly as the
+	// depth stencil surface so it needs no resolve
+	LPDIRECT3DTEXTURE9	createDepthTarget( const LPDIRECT3DDEVICE9 device, int width, int height );
 
 	LPDIRECT3DTEXTURE9	getTexture()	{ return m_pTexture; }
 	bool				isINTZ()		{ return m_isINTZ; }
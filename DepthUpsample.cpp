@@ -0,0 +1,182 @@
+//-----------------------------------------------------------------------------
+// File: DepthUpsample.cpp
+//
+// Keep in sync with RenderDepthUpsample in DirectDepthAccess.fx.
+//-----------------------------------------------------------------------------
+#include "DepthUpsample.h"
+
+//--------------------------------------------------------------------------------------
+DepthUpsample::DepthUpsample()
+	: m_columnX0( NULL )
+	, m_columnX1( NULL )
+	, m_columnFx( NULL )
+	, m_linear( NULL )
+	, m_width( 0 )
+	, m_factor( 0 )
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+DepthUpsample::~DepthUpsample()
+{
+	delete[] m_columnX0;
+	delete[] m_columnX1;
+	alignedFree(m_columnFx);
+	alignedFree(m_linear);
+}
+
+//--------------------------------------------------------------------------------------
+void DepthUpsample::buildColumns(int width, int pitch, int lowWidth, int factor)
+{
+	if (width == m_width && factor == m_factor)
+	{
+		return;
+	}
+	delete[] m_columnX0;
+	delete[] m_columnX1;
+	alignedFree(m_columnFx);
+	alignedFree(m_linear);
+
+	m_width = width;
+	m_factor = factor;
+	m_columnX0 = new int[pitch];
+	m_columnX1 = new int[pitch];
+	m_columnFx = (float*)alignedAlloc(sizeof(float) * pitch, 16);
+	m_linear = (float*)alignedAlloc(sizeof(float) * pitch, 16);
+
+	// Padding columns repeat the last one so the SSE loop needs no tail
+	const float scale = 1.0f / factor;
+	for (int x = 0; x < pitch; ++x)
+	{
+		const float lx = (mini(x, width - 1) + 0.5f) * scale - 0.5f;
+		const float bx = floorf(lx);
+		m_columnFx[x] = lx - bx;
+		m_columnX0[x] = mini(maxi((int)bx, 0), lowWidth - 1);
+		m_columnX1[x] = mini(maxi((int)bx + 1, 0), lowWidth - 1);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void DepthUpsample::downsampleMin(const DepthImage& depth, const DepthProjection& projection, int factor, DepthImage& lowDepth)
+{
+	const int width = depth.getWidth();
+	const int height = depth.getHeight();
+	const int lowWidth = (width + factor - 1) / factor;
+	const int lowHeight = (height + factor - 1) / factor;
+	lowDepth.resize(lowWidth, lowHeight);
+	lowDepth.fill(projection.zFar);
+
+	for (int y = 0; y < height; ++y)
+	{
+		const float* src = depth.row(y);
+		float* dst = lowDepth.row(y / factor);
+		for (int x = 0; x < width; ++x)
+		{
+			dst[x / factor] = minf(dst[x / factor], linearizeDepth(src[x], projection));
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Four output pixels per iteration, the low resolution taps are gathered into
+// SSE registers and the weights computed for all four at once
+void DepthUpsample::upsample(const DepthImage& depth, const DepthProjection& projection, const DepthImage& lowDepth,
+	const DepthImage& lowSignal, const UpsampleParams& params, DepthImage& result)
+{
+	CpuTimer timer;
+
+	const int width = depth.getWidth();
+	const int height = depth.getHeight();
+	const int pitch = depth.getPitch();
+	const int lowHeight = lowDepth.getHeight();
+	buildColumns(width, pitch, lowDepth.getWidth(), params.factor);
+	result.resize(width, height);
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 epsilon = _mm_set1_ps(params.epsilon);
+	const __m128 threshold = _mm_set1_ps(params.threshold);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const bool nearest = params.mode == UPSAMPLE_NEAREST_DEPTH;
+	const float scale = 1.0f / params.factor;
+	const int* cx0 = m_columnX0;
+	const int* cx1 = m_columnX1;
+
+	for (int y = 0; y < height; ++y)
+	{
+		const float ly = (y + 0.5f) * scale - 0.5f;
+		const float by = floorf(ly);
+		const int y0 = mini(maxi((int)by, 0), lowHeight - 1);
+		const int y1 = mini(maxi((int)by + 1, 0), lowHeight - 1);
+		const __m128 fy = _mm_set1_ps(ly - by);
+		const __m128 fy1 = _mm_sub_ps(one, fy);
+
+		const float* d0 = lowDepth.row(y0);
+		const float* d1 = lowDepth.row(y1);
+		const float* s0 = lowSignal.row(y0);
+		const float* s1 = lowSignal.row(y1);
+		float* dst = result.row(y);
+		linearizeRow(depth.row(y), m_linear, width, projection);
+
+		for (int x = 0; x < width; x += 4)
+		{
+			const __m128 z = _mm_load_ps(m_linear + x);
+			const __m128 fx = _mm_load_ps(m_columnFx + x);
+			const __m128 fx1 = _mm_sub_ps(one, fx);
+
+			const __m128 z00 = _mm_setr_ps(d0[cx0[x]], d0[cx0[x + 1]], d0[cx0[x + 2]], d0[cx0[x + 3]]);
+			const __m128 z10 = _mm_setr_ps(d0[cx1[x]], d0[cx1[x + 1]], d0[cx1[x + 2]], d0[cx1[x + 3]]);
+			const __m128 z01 = _mm_setr_ps(d1[cx0[x]], d1[cx0[x + 1]], d1[cx0[x + 2]], d1[cx0[x + 3]]);
+			const __m128 z11 = _mm_setr_ps(d1[cx1[x]], d1[cx1[x + 1]], d1[cx1[x + 2]], d1[cx1[x + 3]]);
+			const __m128 v00 = _mm_setr_ps(s0[cx0[x]], s0[cx0[x + 1]], s0[cx0[x + 2]], s0[cx0[x + 3]]);
+			const __m128 v10 = _mm_setr_ps(s0[cx1[x]], s0[cx1[x + 1]], s0[cx1[x + 2]], s0[cx1[x + 3]]);
+			const __m128 v01 = _mm_setr_ps(s1[cx0[x]], s1[cx0[x + 1]], s1[cx0[x + 2]], s1[cx0[x + 3]]);
+			const __m128 v11 = _mm_setr_ps(s1[cx1[x]], s1[cx1[x + 1]], s1[cx1[x + 2]], s1[cx1[x + 3]]);
+
+			__m128 w00 = _mm_mul_ps(fx1, fy1);
+			__m128 w10 = _mm_mul_ps(fx, fy1);
+			__m128 w01 = _mm_mul_ps(fx1, fy);
+			__m128 w11 = _mm_mul_ps(fx, fy);
+			const __m128 dz00 = _mm_and_ps(_mm_sub_ps(z00, z), absMask);
+			const __m128 dz10 = _mm_and_ps(_mm_sub_ps(z10, z), absMask);
+			const __m128 dz01 = _mm_and_ps(_mm_sub_ps(z01, z), absMask);
+			const __m128 dz11 = _mm_and_ps(_mm_sub_ps(z11, z), absMask);
+
+			if (!nearest)
+			{
+				w00 = _mm_div_ps(w00, _mm_add_ps(epsilon, dz00));
+				w10 = _mm_div_ps(w10, _mm_add_ps(epsilon, dz10));
+				w01 = _mm_div_ps(w01, _mm_add_ps(epsilon, dz01));
+				w11 = _mm_div_ps(w11, _mm_add_ps(epsilon, dz11));
+			}
+
+			const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v00, w00), _mm_mul_ps(v10, w10)),
+				_mm_add_ps(_mm_mul_ps(v01, w01), _mm_mul_ps(v11, w11)));
+			const __m128 weightSum = _mm_add_ps(_mm_add_ps(w00, w10), _mm_add_ps(w01, w11));
+			__m128 value = _mm_div_ps(sum, weightSum);
+
+			if (nearest)
+			{
+				// Closest tap wins, ties keep the earlier one like the shader
+				__m128 best = v00;
+				__m128 bestDz = dz00;
+				__m128 closer = _mm_cmplt_ps(dz10, bestDz);
+				best = _mm_or_ps(_mm_and_ps(closer, v10), _mm_andnot_ps(closer, best));
+				bestDz = _mm_min_ps(bestDz, dz10);
+				closer = _mm_cmplt_ps(dz01, bestDz);
+				best = _mm_or_ps(_mm_and_ps(closer, v01), _mm_andnot_ps(closer, best));
+				bestDz = _mm_min_ps(bestDz, dz01);
+				closer = _mm_cmplt_ps(dz11, bestDz);
+				best = _mm_or_ps(_mm_and_ps(closer, v11), _mm_andnot_ps(closer, best));
+
+				const __m128 maxDz = _mm_max_ps(_mm_max_ps(dz00, dz10), _mm_max_ps(dz01, dz11));
+				const __m128 continuous = _mm_cmplt_ps(maxDz, _mm_mul_ps(threshold, z));
+				value = _mm_or_ps(_mm_and_ps(continuous, value), _mm_andnot_ps(continuous, best));
+			}
+			_mm_store_ps(dst + x, value);
+		}
+	}
+
+	m_stats.upsampleMs = timer.elapsedMs();
+	m_stats.msPerMegapixel = m_stats.upsampleMs * 1000000.0 / ((double)width * height);
+}
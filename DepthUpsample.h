@@ -0,0 +1,71 @@
+//-----------------------------------------------------------------------------
+// File: DepthUpsample.h
+//
+// Depth aware upsampling of a reduced resolution signal to the full depth
+// resolution, CPU side of the DepthUpsample techniques in DirectDepthAccess.fx.
+//
+// Bilateral: bilinear weights divided by (epsilon + |low z - z|).
+// Nearest depth: plain bilinear where all four low resolution depths are
+// within threshold * z of the full resolution depth, otherwise the signal of
+// the closest depth, so edges never mix foreground and background.
+//-----------------------------------------------------------------------------
+#ifndef DEPTH_UPSAMPLE_H
+#define DEPTH_UPSAMPLE_H
+
+#include "DepthImage.h"
+#include "DepthMath.h"
+
+//--------------------------------------------------------------------------------------
+enum UpsampleMode
+{
+	UPSAMPLE_BILATERAL,
+	UPSAMPLE_NEAREST_DEPTH,
+};
+
+//--------------------------------------------------------------------------------------
+struct UpsampleParams
+{
+	int						factor;				// 2 or 4
+	UpsampleMode			mode;
+	float					epsilon;			// bilateral, view space depth added to the difference
+	float					threshold;			// nearest depth, relative depth difference treated as continuous
+};
+
+//--------------------------------------------------------------------------------------
+struct UpsampleStats
+{
+	double					upsampleMs;
+	double					msPerMegapixel;
+};
+
+//--------------------------------------------------------------------------------------
+class DepthUpsample
+{
+	int*					m_columnX0;			// per output column, low resolution taps and weight
+	int*					m_columnX1;
+	float*					m_columnFx;
+	float*					m_linear;			// one row of full resolution view z
+	int						m_width;
+	int						m_factor;
+	UpsampleStats			m_stats;
+
+	DepthUpsample(const DepthUpsample&);
+	DepthUpsample& operator=(const DepthUpsample&);
+
+	void				buildColumns(int width, int pitch, int lowWidth, int factor);
+public:
+
+	DepthUpsample();
+	~DepthUpsample();
+
+	// Nearest view z of each factor x factor block, the low resolution depth both paths expect
+	static void			downsampleMin(const DepthImage& depth, const DepthProjection& projection, int factor, DepthImage& lowDepth);
+
+	// depth is full resolution hardware depth, lowDepth is view z, result gets the size of depth
+	void				upsample(const DepthImage& depth, const DepthProjection& projection, const DepthImage& lowDepth,
+							const DepthImage& lowSignal, const UpsampleParams& params, DepthImage& result);
+
+	const UpsampleStats& getStats() const		{ return m_stats; }
+};
+
+#endif // DEPTH_UPSAMPLE_H
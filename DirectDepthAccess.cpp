@@ -3,12 +3,35 @@
 #pragma warning( disable : 4996 ) // disable deprecated warning 
 #include <strsafe.h>
 #include "DepthTexture.h"
+#include "DepthReadback.h"
+#include "EdgeMask.h"
+#include "SSAOPass.h"
+#include "DOFPass.h"
+#include "DepthReprojection.h"
+#include "DepthChange.h"
+#include "DepthUpsample.h"
+#include "ShadowMap.h"
+#include "DepthRasterizer.h"
+#include "TiledRasterizer.h"
+#include "MsaaDepth.h"
+#include "VertexPipeline.h"
+#include "ShadowCascades.h"
+#include "DepthReductionPass.h"
+#include "DepthPicker.h"
+#include "DepthCodec.h"
+#include "PointCloudExport.h"
+#include "FroxelFog.h"
+#include "DepthPrecision.h"
+#include "ColorRasterizer.h"
+#include "XMesh.h"
+#include "VertexQuantizer.h"
+#include "ClusterCuller.h"
+#include "SceneSetup.h"
 
 //-----------------------------------------------------------------------------
 // Global variables
 //-----------------------------------------------------------------------------
-const int						SCREEN_WIDTH = 640;
-const int						SCREEN_HEIGHT = 480;
+HWND							g_hWnd = NULL;
 
 LPDIRECT3D9						g_pD3D = NULL; // Used to create the D3DDevice
 LPDIRECT3DDEVICE9				g_pd3dDevice = NULL; // Our rendering device
@@ -17,33 +40,246 @@ LPD3DXMESH						g_pMesh = NULL; // Our mesh object in sysmem
 D3DMATERIAL9*					g_pMeshMaterials = NULL; // Materials for our mesh
 LPDIRECT3DTEXTURE9*				g_pMeshTextures = NULL; // Textures for our mesh
 DWORD							g_dwNumMaterials = 0L;   // Number of mesh materials
+D3DXATTRIBUTERANGE*				g_meshRanges = NULL;	// Attribute table of g_pMesh
+DWORD							g_meshRangeCount = 0;
 
-IDirect3DVertexDeclaration9*    g_pVertDeclPP = NULL; // Vertex decl for post-processing
 ID3DXEffect*                    g_pEffect = NULL;        // D3DX effect interface
-D3DXHANDLE                      g_hTShowUnmodified;       // Handle to ShowUnmodified technique
+PostProcess*					g_postProcess = NULL;    // Quad drawing for post-processing
 D3DXHANDLE                      g_hTextureDepthTexture;
+D3DXHANDLE                      g_hTextureDisplay;
+D3DXHANDLE                      g_hTCopyDepth;            // Handle to CopyDepth technique
 
 DepthTexture*					g_depthTexture = NULL;
 
 //--------------------------------------------------------------------------------------
-// This is the vertex format used with the quad during post-process.
-struct PPVERT
+// What the corner quad shows, cycled with space
+enum DisplayMode
 {
-	float x, y, z, rhw;
-	float tu, tv;       // Texcoord for post-process source
-	float tu2, tv2;     // Texcoord for the original scene
+	DISPLAY_DEPTH,
+	DISPLAY_EDGES,
+	DISPLAY_AO,
+	DISPLAY_AO_NEAREST,		// half resolution AO through the nearest depth upsample
+	DISPLAY_SHADOW,
+	DISPLAY_COC,
+	DISPLAY_NEAR_FIELD,
+	DISPLAY_FAR_FIELD,
+	DISPLAY_COUNT
+};
 
-	const static D3DVERTEXELEMENT9 Decl[4];
+// Technique names for INTZ and RAWZ depth
+const char*						g_displayTechniques[DISPLAY_COUNT][2] =
+{
+	{ "ShowUnmodified",	"ShowUnmodifiedRAWZ" },
+	{ "EdgeMask",		"EdgeMaskRAWZ" },
+	{ "ShowTexture",	"ShowTexture" },
+	{ "DepthUpsampleNearest",	"DepthUpsampleNearestRAWZ" },
+	{ "ShadowMask",		"ShadowMaskRAWZ" },
+	{ "ShowCoC",		"ShowCoC" },
+	{ "ShowTexture",	"ShowTexture" },
+	{ "ShowTexture",	"ShowTexture" },
 };
 
-// Vertex declaration for post-processing
-const D3DVERTEXELEMENT9 PPVERT::Decl[4] =
+DisplayMode						g_displayMode = DISPLAY_DEPTH;
+D3DXHANDLE						g_hTDisplay[DISPLAY_COUNT];
+
+//--------------------------------------------------------------------------------------
+// CPU side depth consumers, toggled with 'C'
+bool							g_cpuDepthEnabled = false;
+UINT							g_frameIndex = 0;
+DepthReadback*					g_depthReadback = NULL;
+DepthImage						g_cpuDepth;
+UINT							g_cpuDepthFrame = 0;
+EdgeMask						g_edgeMask;
+DepthChange						g_depthChange;			// consumers only redo dirty tiles
+DWORD							g_lastStatsTime = 0;
+
+//--------------------------------------------------------------------------------------
+// SSAO, shown in the corner with DISPLAY_AO. 'V' checks it against the CPU reference.
+SSAOPass*						g_ssaoPass = NULL;
+AmbientOcclusion				g_ambientOcclusion;
+AOParams						g_aoParams = { 0.5f, 0.1f, 1.5f, 32.0f, 8.0f, 0.01f };
+bool							g_validate = false;			// 'V', checks the displayed mode against its CPU reference
+WCHAR							g_aoValidation[128] = L"";
+
+//--------------------------------------------------------------------------------------
+// With DISPLAY_DEPTH, 'V' shades the frame on the CPU and compares it with the back buffer
+SoftwareTexture*				g_softwareTextures = NULL;	// per material, empty without a texture
+SoftwareTexture::Filter			g_textureFilter = SoftwareTexture::FILTER_POINT;	// 'B' switches to bilinear
+const int						COLOR_TOLERANCE = 8;
+WCHAR							g_colorValidation[128] = L"";
+
+//--------------------------------------------------------------------------------------
+// Shadow map shown with DISPLAY_SHADOW, 'V' checks it against the software rasterizer
+const int						SHADOW_MAP_SIZE = 1024;
+ShadowMap*						g_shadowMap = NULL;
+DepthReadback*					g_shadowReadback = NULL;
+WCHAR							g_shadowValidation[128] = L"";
+
+// The tiger stays loaded, or mapped from its cache, for the whole run. The CPU
+// rasterizer reads its positions with the meshlet order indices of g_clusterCuller.
+XMesh							g_xMesh;
+const float*					g_meshPositions = NULL;
+RasterMesh						g_rasterMesh;
+
+//--------------------------------------------------------------------------------------
+// 'T' draws the tiger from vertices transformed by VertexPipeline instead of the
+// runtime's software vertex processing
+const DWORD						PRETRANSFORMED_FVF = D3DFVF_XYZRHW | D3DFVF_TEX1;
+const int						PRETRANSFORMED_STRIDE = 6;		// floats
+VertexPipeline*					g_vertexPipeline = NULL;
+LPDIRECT3DVERTEXBUFFER9			g_pretransformedVB = NULL;
+const float*					g_meshTexcoords = NULL;			// NULL when tiger.x has none
+bool							g_pretransformed = false;
+bool							g_pretransformedDrawn = false;	// false when the frame fell back to DrawSubset
+
+//--------------------------------------------------------------------------------------
+// 'Q' cycles the main pass through the float mesh and the VertexQuantizer
+// formats with 8 and 16 bit octahedral normals
+enum VertexFormat
 {
-	{ 0, 0,  D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITIONT, 0 },
-	{ 0, 16, D3DDECLTYPE_FLOAT2, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD,  0 },
-	{ 0, 24, D3DDECLTYPE_FLOAT2, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD,  1 },
-	D3DDECL_END()
+	VERTEX_FORMAT_FLOAT,
+	VERTEX_FORMAT_OCT8,
+	VERTEX_FORMAT_OCT16,
+	VERTEX_FORMAT_COUNT
 };
+VertexFormat					g_vertexFormat = VERTEX_FORMAT_FLOAT;
+const float*					g_meshNormals = NULL;			// NULL when tiger.x has none
+const XSubset*					g_meshSubsets = NULL;
+VertexQuantizer					g_vertexQuantizer;
+LPDIRECT3DVERTEXBUFFER9			g_quantizedVB = NULL;
+LPDIRECT3DVERTEXDECLARATION9	g_quantizedDecl = NULL;
+D3DXHANDLE						g_hTQuantizedMesh = NULL;
+D3DXHANDLE						g_hTQuantizedMeshPacked = NULL;
+D3DXHANDLE						g_hTQuantizedMeshOct16 = NULL;
+WCHAR							g_vertexFormatReport[192] = L"";
+
+//--------------------------------------------------------------------------------------
+// 'K' draws the tiger as the index ranges of the meshlets ClusterCuller keeps,
+// occlusion tested against the read back depth predicted for the frame
+ClusterCuller					g_clusterCuller;
+DepthReprojection				g_clusterReprojection;
+bool							g_clusterCulling = false;
+bool							g_clustersDrawn = false;
+
+//--------------------------------------------------------------------------------------
+// Cascade splits fitted to the read back depth in DISPLAY_SHADOW, 'G' takes the
+// depth range from the GPU reduction instead of the CPU one
+TaskPool*						g_taskPool = NULL;
+ShadowCascades*					g_shadowCascades = NULL;
+DepthReductionPass*				g_depthReduction = NULL;
+CascadeParams					g_cascadeParams = { 4, 0.7f, 5.0f };
+bool							g_gpuDepthRange = false;
+D3DXMATRIXA16					g_matView;
+WCHAR							g_cascadeReport[192] = L"";
+
+//--------------------------------------------------------------------------------------
+// 'U' times the CPU upsampler on the read back depth
+bool							g_benchmarkUpsample = false;
+WCHAR							g_upsampleReport[192] = L"";
+
+//--------------------------------------------------------------------------------------
+// 'Z' compresses the read back depth as a capture would be archived
+DepthCodec*						g_depthCodec = NULL;
+bool							g_benchmarkCodec = false;
+WCHAR							g_codecReport[192] = L"";
+
+//--------------------------------------------------------------------------------------
+// 'M' rasterizes the read back frame with 4x MSAA on the CPU and finds the resolve
+// policy closest to the RESZ depth
+MsaaDepth*						g_msaaDepth = NULL;
+bool							g_compareMsaa = false;
+WCHAR							g_msaaReport[192] = L"";
+
+//--------------------------------------------------------------------------------------
+// Depth of field setup, shown with DISPLAY_COC and the near / far field modes
+DOFPass*						g_dofPass = NULL;
+DepthOfField					g_depthOfField;
+DOFParams						g_dofParams = { 5.8f, 0.05f, 1.4f, 0.024f, 16.0f };
+DOFCoCTransform					g_dofTransform;
+
+//--------------------------------------------------------------------------------------
+// Read back depth is a few frames old, it is reprojected with the matrices it was
+// rendered with into a prediction for the frame being drawn
+const UINT						MATRIX_HISTORY = 8;
+DepthMatrix						g_frameMatrices[MATRIX_HISTORY];
+DepthReprojection				g_depthReprojection;
+UINT							g_reprojectedFrames = 0;
+
+//--------------------------------------------------------------------------------------
+// Picking under the cursor and at the last click, answered from read back depth
+// with the view-projection of the frame it was rendered in
+DepthMatrix						g_frameViewProj[MATRIX_HISTORY];
+DepthPicker						g_depthPicker;
+int								g_pickPixels[4] = { -1, -1, -1, -1 };	// cursor x, y, click x, y
+WCHAR							g_pickReport[192] = L"";
+
+//--------------------------------------------------------------------------------------
+// 'P' toggles streaming every read back frame out as a point cloud
+PointCloudExport				g_pointCloudExport;
+PointCloudParams				g_pointCloudParams = { POINT_CLOUD_PLY, 2, 0.0f };
+
+//--------------------------------------------------------------------------------------
+// 'F' toggles the froxel fog grid, lit by the shadow light and one point light
+FroxelFog*						g_froxelFog = NULL;
+bool							g_froxelFogEnabled = false;
+FogParams						g_fogParams =
+{
+	50.0f, 0.08f, -1.0f, 0.4f, 0.6f,
+	{ 0.05f, 0.06f, 0.08f },
+	{ -0.3637f, 0.7274f, -0.5819f },	// towards the shadow light
+	{ 1.0f, 0.95f, 0.85f },
+	{ { { 0.0f, 1.5f, -1.5f }, 3.0f, { 4.0f, 2.0f, 0.5f } } },
+	1
+};
+
+//--------------------------------------------------------------------------------------
+// 'R' cycles the depth convention of the main pass. Reverse-Z swaps near and far in
+// the projection, clears to 0 and tests GREATEREQUAL, the float mode also renders
+// into D24FS8 where the device has it at 4x MSAA. RESZ still resolves into the INTZ
+// texture, so the read back keeps 24 bit unorm precision in every mode.
+enum DepthMode
+{
+	DEPTH_MODE_STANDARD,
+	DEPTH_MODE_REVERSED,
+	DEPTH_MODE_REVERSED_FLOAT,
+	DEPTH_MODE_COUNT
+};
+DepthMode						g_depthMode = DEPTH_MODE_STANDARD;
+UINT							g_depthModeFrame = 0;			// older read backs have the previous convention
+LPDIRECT3DSURFACE9				g_autoDepthSurface = NULL;
+LPDIRECT3DSURFACE9				g_floatDepthSurface = NULL;		// NULL where D24FS8 is unsupported
+WCHAR							g_depthModeReport[192] = L"";
+WCHAR							g_meshLoadReport[64] = L"";		// start up cost of tiger.x, parsed or cached
+
+//-----------------------------------------------------------------------------
+DepthProjection GetDepthProjection()
+{
+	return getSceneProjection( g_depthMode != DEPTH_MODE_STANDARD );
+}
+
+//-----------------------------------------------------------------------------
+// Effect constants that follow the depth convention
+VOID SetDepthConstants()
+{
+	const DepthProjection projection = GetDepthProjection();
+	D3DXVECTOR4 projParams( projection.reversed ? Z_FAR : Z_NEAR, projection.reversed ? Z_NEAR : Z_FAR,
+		1.0f / projection.scaleX, 1.0f / projection.scaleY );
+	g_pEffect->SetVector( "ProjParams", &projParams );
+	g_pEffect->SetFloat( "ClearDepth", farDepth( projection.reversed ) );
+}
+
+//-----------------------------------------------------------------------------
+// Filter of texture stage 0 and of the QuantizedMesh techniques, which the CPU
+// color frame samples with as well
+VOID SetTextureFilter( SoftwareTexture::Filter filter )
+{
+	g_textureFilter = filter;
+	const DWORD d3dFilter = filter == SoftwareTexture::FILTER_LINEAR ? D3DTEXF_LINEAR : D3DTEXF_POINT;
+	g_pd3dDevice->SetSamplerState( 0, D3DSAMP_MINFILTER, d3dFilter );
+	g_pd3dDevice->SetSamplerState( 0, D3DSAMP_MAGFILTER, d3dFilter );
+	if( g_pEffect != NULL )
+		g_pEffect->SetInt( "MeshFilter", (INT)d3dFilter );
+}
 
 //-----------------------------------------------------------------------------
 // Name: InitD3D()
@@ -77,18 +313,26 @@ HRESULT InitD3D( HWND hWnd )
 		return E_FAIL;
 	}
 
+	// Reverse-Z in float needs D24FS8 with the back buffer and its 4x MSAA
+	g_pd3dDevice->GetDepthStencilSurface( &g_autoDepthSurface );
+	if( SUCCEEDED( g_pD3D->CheckDeviceFormat( D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, D3DFMT_X8R8G8B8,
+			D3DUSAGE_DEPTHSTENCIL, D3DRTYPE_SURFACE, D3DFMT_D24FS8 ) ) &&
+		SUCCEEDED( g_pD3D->CheckDepthStencilMatch( D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, D3DFMT_X8R8G8B8,
+			D3DFMT_X8R8G8B8, D3DFMT_D24FS8 ) ) &&
+		SUCCEEDED( g_pD3D->CheckDeviceMultiSampleType( D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, D3DFMT_D24FS8,
+			TRUE, D3DMULTISAMPLE_4_SAMPLES, NULL ) ) )
+	{
+		if( FAILED( g_pd3dDevice->CreateDepthStencilSurface( SCREEN_WIDTH, SCREEN_HEIGHT, D3DFMT_D24FS8,
+			D3DMULTISAMPLE_4_SAMPLES, 0, TRUE, &g_floatDepthSurface, NULL ) ) )
+			g_floatDepthSurface = NULL;
+	}
+
 	// Turn on the zbuffer
 	g_pd3dDevice->SetRenderState( D3DRS_ZENABLE, TRUE );
 	g_pd3dDevice->SetRenderState( D3DRS_ZWRITEENABLE, TRUE);
 
 	// Turn on ambient lighting 
-	g_pd3dDevice->SetRenderState( D3DRS_AMBIENT, 0xffffffff );
-
-	// Create vertex declaration for post-process
-	if( FAILED( g_pd3dDevice->CreateVertexDeclaration( PPVERT::Decl, &g_pVertDeclPP ) ) )
-	{
-		return E_FAIL;
-	}
+	g_pd3dDevice->SetRenderState( D3DRS_AMBIENT, AMBIENT_LIGHT );
 
 	DWORD dwShaderFlags = 0;
 	dwShaderFlags |= D3DXSHADER_DEBUG;
@@ -97,15 +341,89 @@ HRESULT InitD3D( HWND hWnd )
 	{
 		D3DXCreateEffectFromFile( g_pd3dDevice, L"DirectDepthAccess.fx", NULL, NULL, dwShaderFlags, NULL, &g_pEffect, NULL );
 	}
+	g_postProcess = new PostProcess( g_pd3dDevice, g_pEffect );
+	g_hTQuantizedMesh = g_pEffect->GetTechniqueByName( "QuantizedMesh" );
+	g_hTQuantizedMeshPacked = g_pEffect->GetTechniqueByName( "QuantizedMeshPacked" );
+	g_hTQuantizedMeshOct16 = g_pEffect->GetTechniqueByName( "QuantizedMeshOct16" );
+
+	// Point sampled, the device default, until 'B' switches to bilinear
+	SetTextureFilter( g_textureFilter );
 
 	g_depthTexture = new DepthTexture(g_pD3D);
 	if (g_depthTexture->isSupported())
 	{
 		g_depthTexture->createTexture(g_pd3dDevice, SCREEN_WIDTH, SCREEN_HEIGHT);
 
-		const char* techniqueName = g_depthTexture->isINTZ() ? "ShowUnmodified" : "ShowUnmodifiedRAWZ";
-		g_hTShowUnmodified = g_pEffect->GetTechniqueByName( techniqueName );
+		const int formatIndex = g_depthTexture->isINTZ() ? 0 : 1;
+		for( int i = 0; i < DISPLAY_COUNT; ++i )
+		{
+			g_hTDisplay[i] = g_pEffect->GetTechniqueByName( g_displayTechniques[i][formatIndex] );
+		}
+		g_hTCopyDepth = g_pEffect->GetTechniqueByName( g_depthTexture->isINTZ() ? "CopyDepth" : "CopyDepthRAWZ" );
 		g_hTextureDepthTexture = g_pEffect->GetParameterByName( NULL, "DepthTargetTexture" );
+		g_hTextureDisplay = g_pEffect->GetParameterByName( NULL, "DisplayTexture" );
+
+		// Constants shared by all depth consuming techniques
+		const DepthProjection projection = GetDepthProjection();
+		D3DXVECTOR4 texelSize( 1.0f / SCREEN_WIDTH, 1.0f / SCREEN_HEIGHT, (float)SCREEN_WIDTH, (float)SCREEN_HEIGHT );
+		SetDepthConstants();
+		g_pEffect->SetVector( "DepthTexelSize", &texelSize );
+
+		g_depthReadback = new DepthReadback();
+		if( FAILED( g_depthReadback->create( g_pd3dDevice, SCREEN_WIDTH, SCREEN_HEIGHT ) ) )
+		{
+			delete g_depthReadback;
+			g_depthReadback = NULL;
+		}
+
+		g_ssaoPass = new SSAOPass();
+		if( FAILED( g_ssaoPass->create( g_postProcess, SCREEN_WIDTH, SCREEN_HEIGHT, !g_depthTexture->isINTZ() ) ) )
+		{
+			delete g_ssaoPass;
+			g_ssaoPass = NULL;
+		}
+		else
+		{
+			g_ssaoPass->setParams( g_aoParams, projection );
+
+			const int halfWidth = ( SCREEN_WIDTH + 1 ) / 2;
+			const int halfHeight = ( SCREEN_HEIGHT + 1 ) / 2;
+			D3DXVECTOR4 lowTexelSize( 1.0f / halfWidth, 1.0f / halfHeight, (float)halfWidth, (float)halfHeight );
+			D3DXVECTOR4 upsampleParams( 0.5f, g_aoParams.upsampleEpsilon, 0.1f, 0.0f );
+			g_pEffect->SetVector( "LowTexelSize", &lowTexelSize );
+			g_pEffect->SetVector( "UpsampleParams", &upsampleParams );
+		}
+
+		g_shadowMap = new ShadowMap();
+		if( FAILED( g_shadowMap->create( g_postProcess, *g_depthTexture, SHADOW_MAP_SIZE ) ) )
+		{
+			delete g_shadowMap;
+			g_shadowMap = NULL;
+		}
+
+		g_depthReduction = new DepthReductionPass();
+		if( FAILED( g_depthReduction->create( g_postProcess, SCREEN_WIDTH, SCREEN_HEIGHT, !g_depthTexture->isINTZ() ) ) )
+		{
+			delete g_depthReduction;
+			g_depthReduction = NULL;
+		}
+		g_taskPool = new TaskPool();
+		g_shadowCascades = new ShadowCascades( g_taskPool );
+		g_depthCodec = new DepthCodec( g_taskPool );
+		g_msaaDepth = new MsaaDepth( g_taskPool );
+		g_froxelFog = new FroxelFog( g_taskPool );
+
+		g_dofTransform = DepthOfField::cocTransform( g_dofParams, projection, SCREEN_HEIGHT );
+		g_dofPass = new DOFPass();
+		if( FAILED( g_dofPass->create( g_postProcess, SCREEN_WIDTH, SCREEN_HEIGHT, !g_depthTexture->isINTZ() ) ) )
+		{
+			delete g_dofPass;
+			g_dofPass = NULL;
+		}
+		else
+		{
+			g_dofPass->setParams( g_dofTransform );
+		}
 	}
 
 	return S_OK;
@@ -114,57 +432,137 @@ HRESULT InitD3D( HWND hWnd )
 //-----------------------------------------------------------------------------
 HRESULT InitGeometry()
 {
-	LPD3DXBUFFER pD3DXMtrlBuffer;
-
-	// Load the mesh from the specified file
-	if( FAILED( D3DXLoadMeshFromX( L"Tiger.x", D3DXMESH_SYSTEMMEM,
-		g_pd3dDevice, NULL,
-		&pD3DXMtrlBuffer, NULL, &g_dwNumMaterials,
-		&g_pMesh ) ) )
-	{
-		// If model is not in current folder, try parent folder
-		if( FAILED( D3DXLoadMeshFromX( L"..\\Tiger.x", D3DXMESH_SYSTEMMEM,
-			g_pd3dDevice, NULL,
-			&pD3DXMtrlBuffer, NULL, &g_dwNumMaterials,
-			&g_pMesh ) ) )
+	// Load the mesh from the specified file, or the parent folder. The binary
+	// cache next to it is mapped instead of parsing once it has been written.
+	CpuTimer loadTimer;
+	if( !g_xMesh.loadCached( "Tiger.x", "Tiger.x.cache" ) && !g_xMesh.loadCached( "..\\Tiger.x", "..\\Tiger.x.cache" ) )
+	{
+		MessageBox( NULL, L"Could not find tiger.x", L"Meshes.exe", MB_OK );
+		return E_FAIL;
+	}
+	StringCchPrintfW( g_meshLoadReport, 64, L" - tiger.x %s in %.2f ms", g_xMesh.isMapped() ? L"mapped" : L"parsed",
+		loadTimer.elapsedMs() );
+
+	// Vertices and faces go straight into a mesh of the FVF the file provides,
+	// the subsets are already sorted by material
+	const DWORD vertexCount = g_xMesh.getVertexCount();
+	const DWORD faceCount = g_xMesh.getTriangleCount();
+	const bool indices32 = vertexCount > 0xFFFF;
+	const bool hasNormals = g_xMesh.getNormals() != NULL;
+	const DWORD fvf = D3DFVF_XYZ | ( hasNormals ? D3DFVF_NORMAL : 0 ) | D3DFVF_TEX1;
+	if( FAILED( D3DXCreateMeshFVF( faceCount, vertexCount, D3DXMESH_SYSTEMMEM | ( indices32 ? D3DXMESH_32BIT : 0 ),
+		fvf, g_pd3dDevice, &g_pMesh ) ) )
+		return E_FAIL;
+
+	const float* positions = g_xMesh.getPositions();
+	const float* normals = g_xMesh.getNormals();
+	const float* texcoords = g_xMesh.getTexcoords();
+	float* pVertices = NULL;
+	if( FAILED( g_pMesh->LockVertexBuffer( 0, (LPVOID*)&pVertices ) ) )
+		return E_FAIL;
+	for( DWORD i = 0; i < vertexCount; i++ )
+	{
+		memcpy( pVertices, positions + i * 3, sizeof( float ) * 3 );
+		pVertices += 3;
+		if( hasNormals )
 		{
-			MessageBox( NULL, L"Could not find tiger.x", L"Meshes.exe", MB_OK );
-			return E_FAIL;
+			memcpy( pVertices, normals + i * 3, sizeof( float ) * 3 );
+			pVertices += 3;
 		}
+		pVertices[0] = texcoords != NULL ? texcoords[i * 2] : 0.0f;
+		pVertices[1] = texcoords != NULL ? texcoords[i * 2 + 1] : 0.0f;
+		pVertices += 2;
 	}
+	g_pMesh->UnlockVertexBuffer();
 
-	// We need to extract the material properties and texture names from the 
-	// pD3DXMtrlBuffer
-	D3DXMATERIAL* d3dxMaterials = ( D3DXMATERIAL* )pD3DXMtrlBuffer->GetBufferPointer();
+	// Triangles in meshlet order, each subset keeps its range
+	g_clusterCuller.setMesh( positions, g_xMesh.getIndices(), vertexCount, g_xMesh.getSubsets(), g_xMesh.getMaterialCount() );
+	const uint32_t* indices = g_clusterCuller.getIndices();
+	void* pIndices = NULL;
+	if( FAILED( g_pMesh->LockIndexBuffer( 0, &pIndices ) ) )
+		return E_FAIL;
+	for( DWORD i = 0; i < faceCount * 3; i++ )
+	{
+		if( indices32 )
+			( (DWORD*)pIndices )[i] = indices[i];
+		else
+			( (WORD*)pIndices )[i] = (WORD)indices[i];
+	}
+	g_pMesh->UnlockIndexBuffer();
+
+	// The attribute table is kept for the draws that bypass DrawSubset(),
+	// without materials the whole mesh is the first subset
+	g_dwNumMaterials = g_xMesh.getMaterialCount();
+	const XSubset* subsets = g_xMesh.getSubsets();
+	g_meshRanges = new D3DXATTRIBUTERANGE[g_dwNumMaterials > 0 ? g_dwNumMaterials : 1];
+	DWORD* pAttributes = NULL;
+	if( FAILED( g_pMesh->LockAttributeBuffer( 0, &pAttributes ) ) )
+		return E_FAIL;
+	for( DWORD i = 0; i < g_dwNumMaterials; i++ )
+	{
+		g_meshRanges[i].AttribId = subsets[i].material;
+		g_meshRanges[i].FaceStart = subsets[i].firstTriangle;
+		g_meshRanges[i].FaceCount = subsets[i].triangleCount;
+		g_meshRanges[i].VertexStart = subsets[i].firstVertex;
+		g_meshRanges[i].VertexCount = subsets[i].vertexCount;
+		for( int t = 0; t < subsets[i].triangleCount; t++ )
+			pAttributes[subsets[i].firstTriangle + t] = subsets[i].material;
+	}
+	g_pMesh->UnlockAttributeBuffer();
+	g_meshRangeCount = g_dwNumMaterials;
+	if( g_meshRangeCount > 0 )
+	{
+		g_pMesh->SetAttributeTable( g_meshRanges, g_meshRangeCount );
+	}
+	else
+	{
+		g_meshRanges[0].AttribId = 0;
+		g_meshRanges[0].FaceStart = 0;
+		g_meshRanges[0].FaceCount = faceCount;
+		g_meshRanges[0].VertexStart = 0;
+		g_meshRanges[0].VertexCount = vertexCount;
+		g_meshRangeCount = 1;
+	}
+
+	// Material properties and texture names of every subset
+	const XMaterial* materials = g_xMesh.getMaterials();
 	g_pMeshMaterials = new D3DMATERIAL9[g_dwNumMaterials];
 	if( g_pMeshMaterials == NULL )
 		return E_OUTOFMEMORY;
 	g_pMeshTextures = new LPDIRECT3DTEXTURE9[g_dwNumMaterials];
 	if( g_pMeshTextures == NULL )
 		return E_OUTOFMEMORY;
+	g_softwareTextures = new SoftwareTexture[g_dwNumMaterials];
 
 	for( DWORD i = 0; i < g_dwNumMaterials; i++ )
 	{
 		// Copy the material
-		g_pMeshMaterials[i] = d3dxMaterials[i].MatD3D;
+		ZeroMemory( &g_pMeshMaterials[i], sizeof( D3DMATERIAL9 ) );
+		g_pMeshMaterials[i].Diffuse = D3DXCOLOR( materials[i].diffuse[0], materials[i].diffuse[1],
+			materials[i].diffuse[2], materials[i].diffuse[3] );
+		g_pMeshMaterials[i].Specular = D3DXCOLOR( materials[i].specular[0], materials[i].specular[1],
+			materials[i].specular[2], 1.0f );
+		g_pMeshMaterials[i].Emissive = D3DXCOLOR( materials[i].emissive[0], materials[i].emissive[1],
+			materials[i].emissive[2], 1.0f );
+		g_pMeshMaterials[i].Power = materials[i].power;
 
-		// Set the ambient color for the material (D3DX does not do this)
+		// Set the ambient color for the material (the file does not store one)
 		g_pMeshMaterials[i].Ambient = g_pMeshMaterials[i].Diffuse;
 
 		g_pMeshTextures[i] = NULL;
-		if( d3dxMaterials[i].pTextureFilename != NULL &&
-			lstrlenA( d3dxMaterials[i].pTextureFilename ) > 0 )
+		const CHAR* textureFilename = materials[i].textureFilename;
+		if( lstrlenA( textureFilename ) > 0 )
 		{
 			// Create the texture
 			if( FAILED( D3DXCreateTextureFromFileA( g_pd3dDevice,
-				d3dxMaterials[i].pTextureFilename,
+				textureFilename,
 				&g_pMeshTextures[i] ) ) )
 			{
 				// If texture is not in current folder, try parent folder
 				const CHAR* strPrefix = "..\\";
 				CHAR strTexture[MAX_PATH];
 				strcpy_s( strTexture, MAX_PATH, strPrefix );
-				strcat_s( strTexture, MAX_PATH, d3dxMaterials[i].pTextureFilename );
+				strcat_s( strTexture, MAX_PATH, textureFilename );
 				// If texture is not in current folder, try parent folder
 				if( FAILED( D3DXCreateTextureFromFileA( g_pd3dDevice,
 					strTexture,
@@ -172,12 +570,42 @@ HRESULT InitGeometry()
 				{
 					MessageBox( NULL, L"Could not find texture map", L"Meshes.exe", MB_OK );
 				}
+				else
+					g_softwareTextures[i].load( strTexture );
 			}
+			else
+				g_softwareTextures[i].load( textureFilename );
 		}
 	}
 
-	// Done with the material buffer
-	pD3DXMtrlBuffer->Release();
+	// The CPU side reads the arrays of g_xMesh in place
+	g_meshPositions = positions;
+	g_meshTexcoords = texcoords;
+	g_meshNormals = normals;
+	g_meshSubsets = subsets;
+
+	g_rasterMesh.positions = g_meshPositions;
+	g_rasterMesh.stride = 3;
+	g_rasterMesh.vertexCount = vertexCount;
+	g_rasterMesh.indices = indices;
+	g_rasterMesh.triangleCount = faceCount;
+
+	g_vertexPipeline = new VertexPipeline( g_taskPool );
+	g_vertexPipeline->setMesh( g_rasterMesh );
+	if( FAILED( g_pd3dDevice->CreateVertexBuffer( vertexCount * PRETRANSFORMED_STRIDE * sizeof( float ),
+		D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, PRETRANSFORMED_FVF, D3DPOOL_DEFAULT, &g_pretransformedVB, NULL ) ) )
+	{
+		g_pretransformedVB = NULL;
+	}
+
+	// The tiger spins around the origin, the light frustum has to hold every orientation
+	if( g_shadowMap != NULL )
+	{
+		D3DXVECTOR3 center;
+		FLOAT radius;
+		D3DXComputeBoundingSphere( (const D3DXVECTOR3*)g_meshPositions, vertexCount, sizeof( float ) * 3, &center, &radius );
+		g_shadowMap->setLight( D3DXVECTOR3( 0.5f, -1.0f, 0.8f ), D3DXVec3Length( &center ) + radius );
+	}
 
 	return S_OK;
 }
@@ -197,23 +625,90 @@ VOID Cleanup()
 		}
 		delete[] g_pMeshTextures;
 	}
+	delete[] g_softwareTextures;
+	g_softwareTextures = NULL;
 	if( g_pMesh != NULL )
 		g_pMesh->Release();
 
+	delete[] g_meshRanges;
+	g_meshRanges = NULL;
+	g_meshRangeCount = 0;
+
+	if( g_floatDepthSurface != NULL )
+		g_floatDepthSurface->Release();
+	g_floatDepthSurface = NULL;
+
+	if( g_autoDepthSurface != NULL )
+		g_autoDepthSurface->Release();
+	g_autoDepthSurface = NULL;
+
 	if( g_pd3dDevice != NULL )
 		g_pd3dDevice->Release();
 
 	if( g_pD3D != NULL )
 		g_pD3D->Release();
 
-	if (g_pVertDeclPP != NULL )
-		g_pVertDeclPP->Release();
+	delete g_postProcess;
+	g_postProcess = NULL;
 
 	if (g_pEffect != NULL )
 		g_pEffect->Release();
 
 	delete g_depthTexture;
 	g_depthTexture = NULL;
+
+	delete g_depthReadback;
+	g_depthReadback = NULL;
+
+	delete g_ssaoPass;
+	g_ssaoPass = NULL;
+
+	delete g_dofPass;
+	g_dofPass = NULL;
+
+	delete g_shadowMap;
+	g_shadowMap = NULL;
+
+	delete g_shadowReadback;
+	g_shadowReadback = NULL;
+
+	delete g_depthReduction;
+	g_depthReduction = NULL;
+
+	delete g_shadowCascades;
+	g_shadowCascades = NULL;
+
+	g_pointCloudExport.stop();
+	delete g_depthCodec;
+	g_depthCodec = NULL;
+	delete g_msaaDepth;
+	g_msaaDepth = NULL;
+	delete g_froxelFog;
+	g_froxelFog = NULL;
+	delete g_taskPool;
+	g_taskPool = NULL;
+
+	g_meshPositions = NULL;
+	g_meshTexcoords = NULL;
+	g_meshNormals = NULL;
+	g_meshSubsets = NULL;
+	g_xMesh.clear();
+
+	if( g_quantizedVB != NULL )
+		g_quantizedVB->Release();
+	g_quantizedVB = NULL;
+
+	if( g_quantizedDecl != NULL )
+		g_quantizedDecl->Release();
+	g_quantizedDecl = NULL;
+	g_vertexQuantizer.clear();
+
+	if( g_pretransformedVB != NULL )
+		g_pretransformedVB->Release();
+	g_pretransformedVB = NULL;
+
+	delete g_vertexPipeline;
+	g_vertexPipeline = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -221,19 +716,20 @@ VOID SetupMatrices()
 {
 	// Set up world matrix
 	D3DXMATRIXA16 matWorld;
-	D3DXMatrixRotationY( &matWorld, timeGetTime() / 1000.0f );
+	D3DXMatrixRotationY( &matWorld, getTigerAngle( timeGetTime() ) );
 	g_pd3dDevice->SetTransform( D3DTS_WORLD, &matWorld );
 
 	// Set up our view matrix. A view matrix can be defined given an eye point,
 	// a point to lookat, and a direction for which way is up. Here, we set the
 	// eye five units back along the z-axis and up three units, look at the 
 	// origin, and define "up" to be in the y-direction.
-	D3DXVECTOR3 vEyePt( 0.0f, 3.0f,-5.0f );
-	D3DXVECTOR3 vLookatPt( 0.0f, 0.0f, 0.0f );
-	D3DXVECTOR3 vUpVec( 0.0f, 1.0f, 0.0f );
+	D3DXVECTOR3 vEyePt( EYE_POSITION );
+	D3DXVECTOR3 vLookatPt( LOOKAT_POSITION );
+	D3DXVECTOR3 vUpVec( UP_DIRECTION );
 	D3DXMATRIXA16 matView;
 	D3DXMatrixLookAtLH( &matView, &vEyePt, &vLookatPt, &vUpVec );
 	g_pd3dDevice->SetTransform( D3DTS_VIEW, &matView );
+	g_matView = matView;
 
 	// For the projection matrix, we set up a perspective transform (which
 	// transforms geometry from 3D view space to 2D viewport space, with
@@ -241,17 +737,876 @@ VOID SetupMatrices()
 	// a perpsective transform, we need the field of view (1/4 pi is common),
 	// the aspect ratio, and the near and far clipping planes (which define at
 	// what distances geometry should be no longer be rendered).
+	// Reverse-Z swaps the two planes.
+	const bool reversed = g_depthMode != DEPTH_MODE_STANDARD;
 	D3DXMATRIXA16 matProj;
-	D3DXMatrixPerspectiveFovLH( &matProj, D3DX_PI / 4, 1.0f, 1.0f, 100.0f );
+	D3DXMatrixPerspectiveFovLH( &matProj, FOV_Y, ASPECT, reversed ? Z_FAR : Z_NEAR, reversed ? Z_NEAR : Z_FAR );
 	g_pd3dDevice->SetTransform( D3DTS_PROJECTION, &matProj );
+
+	// The tiger is the only geometry, so its world matrix is part of the reprojection
+	D3DXMATRIXA16 matWorldViewProj = matWorld * matView * matProj;
+	memcpy( &g_frameMatrices[g_frameIndex % MATRIX_HISTORY], &matWorldViewProj, sizeof( DepthMatrix ) );
+
+	// Picking reconstructs world positions, so it needs view-projection alone
+	D3DXMATRIXA16 matViewProj = matView * matProj;
+	memcpy( &g_frameViewProj[g_frameIndex % MATRIX_HISTORY], &matViewProj, sizeof( DepthMatrix ) );
+}
+
+//-----------------------------------------------------------------------------
+// Reports the CPU and GPU statistics twice a second in the window title
+VOID UpdateStats( UINT frameIndex )
+{
+	DWORD now = timeGetTime();
+	if( now - g_lastStatsTime < 500 )
+		return;
+	g_lastStatsTime = now;
+
+	WCHAR title[512];
+	WCHAR part[256];
+	StringCchCopyW( title, 512, L"Direct Depth Access" );
+	if( g_cpuDepthEnabled )
+	{
+		const DepthChangeStats& changeStats = g_depthChange.getStats();
+		const EdgeMaskStats& edgeStats = g_edgeMask.getStats();
+		StringCchPrintfW( part, 256, L" - frame %u, %d/%d dirty tiles (%.2f ms), edges %d (%.2f ms)", frameIndex,
+			changeStats.dirtyTiles, changeStats.tileCount, changeStats.compareMs, edgeStats.edgeCount,
+			edgeStats.linearizeMs + edgeStats.maskMs + edgeStats.compactMs );
+		StringCchCatW( title, 512, part );
+		StringCchCatW( title, 512, g_upsampleReport );
+		StringCchCatW( title, 512, g_codecReport );
+		StringCchCatW( title, 512, g_msaaReport );
+
+		// Tiles whose 3x3 neighbourhood has no near CoC can skip the near field gather
+		const DOFStats& dofStats = g_depthOfField.getStats();
+		const float* dilatedNear = g_depthOfField.getDilatedNear();
+		const int tileCount = g_depthOfField.getTilesX() * g_depthOfField.getTilesY();
+		int nearTiles = 0;
+		for( int i = 0; i < tileCount; ++i )
+		{
+			nearTiles += dilatedNear[i] > 0.0f;
+		}
+		StringCchPrintfW( part, 256, L", DOF %.2f/%.2f/%.2f ms, %d/%d near tiles", dofStats.cocMs,
+			dofStats.tileMaxMs, dofStats.dilateMs, nearTiles, tileCount );
+		StringCchCatW( title, 512, part );
+
+		const ReprojectionStats& reprojectionStats = g_depthReprojection.getStats();
+		StringCchPrintfW( part, 256, L", reprojected %u frames (%.2f/%.2f ms, %d holes filled)", g_reprojectedFrames,
+			reprojectionStats.splatMs, reprojectionStats.fillMs, reprojectionStats.holesFilled );
+		StringCchCatW( title, 512, part );
+		StringCchCatW( title, 512, g_pickReport );
+		// No fog without a depth texture, no froxels before its first update
+		if( g_froxelFogEnabled && g_froxelFog != NULL && g_froxelFog->getStats().froxelCount > 0 )
+		{
+			const FroxelStats& fogStats = g_froxelFog->getStats();
+			StringCchPrintfW( part, 256, L", fog %d/%d froxels (%.0f%% eliminated by depth), %.2f/%.2f ms",
+				fogStats.litCount, fogStats.froxelCount,
+				100.0 * ( fogStats.froxelCount - fogStats.litCount ) / fogStats.froxelCount,
+				fogStats.reduceMs, fogStats.injectMs );
+			StringCchCatW( title, 512, part );
+		}
+		if( g_pointCloudExport.isRunning() )
+		{
+			const PointCloudStats exportStats = g_pointCloudExport.getStats();
+			StringCchPrintfW( part, 256, L", export %d points (%.2f ms + %.2f ms write), %d written, %d dropped, %.1f MB",
+				exportStats.pointCount, exportStats.convertMs, exportStats.writeMs, exportStats.framesWritten,
+				exportStats.framesDropped, exportStats.bytesWritten / 1048576.0 );
+			StringCchCatW( title, 512, part );
+		}
+	}
+	if( g_pretransformed )
+	{
+		const VertexStats& vertexStats = g_vertexPipeline->getStats();
+		if( g_pretransformedDrawn )
+			StringCchPrintfW( part, 256, L" - pre-transformed %d vertices in %.3f ms (%.1f Mverts/s)", vertexStats.verticesTransformed,
+				vertexStats.transformMs, vertexStats.verticesTransformed / ( vertexStats.transformMs * 1000.0 ) );
+		else
+			StringCchCopyW( part, 256, L" - pre-transformed off, vertices behind the near plane" );
+		StringCchCatW( title, 512, part );
+	}
+	if( g_displayMode == DISPLAY_AO && g_ssaoPass != NULL )
+	{
+		StringCchPrintfW( part, 256, L" - SSAO GPU %.2f/%.2f/%.2f/%.2f ms%s",
+			g_ssaoPass->getStageMs( SSAOPass::STAGE_DOWNSAMPLE ), g_ssaoPass->getStageMs( SSAOPass::STAGE_AO ),
+			g_ssaoPass->getStageMs( SSAOPass::STAGE_BLUR ), g_ssaoPass->getStageMs( SSAOPass::STAGE_UPSAMPLE ),
+			g_aoValidation );
+		StringCchCatW( title, 512, part );
+	}
+	if( g_displayMode == DISPLAY_SHADOW && g_shadowMap != NULL )
+	{
+		StringCchPrintfW( part, 256, L" - shadow %d: depth texture %.1f MB vs R32F+D24 %.1f MB, GPU %.2f vs %.2f ms%s",
+			g_shadowMap->getSize(), g_shadowMap->getDepthTextureBytes() / 1048576.0, g_shadowMap->getFloatTargetBytes() / 1048576.0,
+			g_shadowMap->getStageMs( ShadowMap::STAGE_DEPTH_TEXTURE ), g_shadowMap->getStageMs( ShadowMap::STAGE_FLOAT_TARGET ),
+			g_shadowValidation );
+		StringCchCatW( title, 512, part );
+		StringCchCatW( title, 512, g_cascadeReport );
+	}
+	if( g_displayMode == DISPLAY_DEPTH )
+		StringCchCatW( title, 512, g_colorValidation );
+	StringCchCatW( title, 512, g_depthModeReport );
+	StringCchCatW( title, 512, g_vertexFormatReport );
+	if( g_clusterCulling )
+	{
+		const ClusterCullStats& clusterStats = g_clusterCuller.getStats();
+		if( g_clustersDrawn )
+			StringCchPrintfW( part, 256, L" - meshlets %d/%d triangles in %d ranges, culled %d frustum %d cone %d Hi-Z of %d (%.2f + %.2f ms)",
+				clusterStats.trianglesSubmitted, clusterStats.trianglesTotal, clusterStats.rangesEmitted, clusterStats.frustumCulled,
+				clusterStats.backfaceCulled, clusterStats.occlusionCulled, clusterStats.meshletsTested, clusterStats.hizMs,
+				clusterStats.cullMs );
+		else
+			StringCchCopyW( part, 256, L" - meshlets off, another path draws the tiger" );
+		StringCchCatW( title, 512, part );
+	}
+	StringCchCatW( title, 512, g_meshLoadReport );
+	SetWindowText( g_hWnd, title );
+}
+
+//-----------------------------------------------------------------------------
+// Switches the main pass to another depth convention from the next frame on and
+// reports its view z precision next to the standard D24 buffer
+VOID SetDepthMode( DepthMode mode )
+{
+	if( mode == DEPTH_MODE_REVERSED_FLOAT && g_floatDepthSurface == NULL )
+		mode = DEPTH_MODE_STANDARD;
+	g_depthMode = mode;
+	g_depthModeFrame = g_frameIndex;
+	const bool reversed = mode != DEPTH_MODE_STANDARD;
+	const DepthProjection projection = GetDepthProjection();
+
+	if( g_pEffect != NULL )
+		SetDepthConstants();
+	g_dofTransform = DepthOfField::cocTransform( g_dofParams, projection, SCREEN_HEIGHT );
+	if( g_dofPass != NULL )
+		g_dofPass->setParams( g_dofTransform );
+	g_depthReprojection.setReverseZ( reversed );
+	g_clusterReprojection.setReverseZ( reversed );
+	g_clusterCuller.setReverseZ( reversed );
+	g_depthPicker.setReverseZ( reversed );
+	g_depthPicker.reset();
+	g_pointCloudParams.reverseZ = reversed;
+	if( g_msaaDepth != NULL )
+		g_msaaDepth->setReverseZ( reversed );
+	if( g_vertexPipeline != NULL )
+		g_vertexPipeline->setReverseZ( reversed );
+	g_depthChange.markAllDirty();
+
+	const DepthFormat format = mode == DEPTH_MODE_REVERSED_FLOAT ? DEPTH_FORMAT_FLOAT24 : DEPTH_FORMAT_UNORM24;
+	const DepthPrecisionStats stats = measureDepthPrecision( projection, format, 1024 );
+	const DepthPrecisionStats standard = measureDepthPrecision( getSceneProjection(), DEPTH_FORMAT_UNORM24, 1024 );
+	StringCchPrintfW( g_depthModeReport, 192, L" - %s %S: view z error %.2g (D24 %.2g), %.2g apart at far (D24 %.2g)",
+		reversed ? L"reverse-Z" : L"standard", getDepthFormatName( format ), stats.meanRelativeError,
+		standard.meanRelativeError, stats.farResolution, standard.farResolution );
+	g_lastStatsTime = 0;
+	UpdateStats( g_frameIndex );
+}
+
+//-----------------------------------------------------------------------------
+// Quantizes the tiger into a new vertex buffer for the main pass and reports
+// its size and decode error next to the float vertices. Devices without the
+// declaration types of the layout stay on the float mesh: SHORT4N and FLOAT16_2
+// with 8 bit normals, SHORT2N with 16 bit ones, none for the packed SHORT4 alone.
+VOID SetVertexFormat( VertexFormat format )
+{
+	if( g_quantizedVB != NULL )
+		g_quantizedVB->Release();
+	g_quantizedVB = NULL;
+	if( g_quantizedDecl != NULL )
+		g_quantizedDecl->Release();
+	g_quantizedDecl = NULL;
+	g_vertexQuantizer.clear();
+	g_vertexFormat = format;
+	g_vertexFormatReport[0] = L'\0';
+	if( format == VERTEX_FORMAT_FLOAT || g_meshPositions == NULL )
+		return;
+
+	const int vertexCount = g_rasterMesh.vertexCount;
+	g_vertexQuantizer.quantize( g_meshPositions, g_meshNormals, g_meshTexcoords, vertexCount, g_meshSubsets,
+		g_dwNumMaterials, format == VERTEX_FORMAT_OCT16 ? NORMAL_OCT16 : NORMAL_OCT8 );
+
+	D3DCAPS9 caps;
+	g_pd3dDevice->GetDeviceCaps( &caps );
+	DWORD requiredTypes = 0;
+	if( !g_vertexQuantizer.isPacked() )
+		requiredTypes |= D3DDTCAPS_SHORT4N | D3DDTCAPS_FLOAT16_2;
+	if( g_vertexQuantizer.hasNormals() && g_vertexQuantizer.getNormalEncoding() == NORMAL_OCT16 )
+		requiredTypes |= D3DDTCAPS_SHORT2N;
+	if( ( caps.DeclTypes & requiredTypes ) != requiredTypes )
+	{
+		g_vertexQuantizer.clear();
+		g_vertexFormat = VERTEX_FORMAT_FLOAT;
+		StringCchCopyW( g_vertexFormatReport, 192, L" - quantized vertices unsupported" );
+		return;
+	}
+	const int stride = g_vertexQuantizer.getStride();
+	void* vertices = NULL;
+	if( FAILED( g_pd3dDevice->CreateVertexBuffer( vertexCount * stride, D3DUSAGE_WRITEONLY, 0, D3DPOOL_MANAGED,
+		&g_quantizedVB, NULL ) ) )
+	{
+		g_quantizedVB = NULL;
+		g_vertexFormat = VERTEX_FORMAT_FLOAT;
+		return;
+	}
+	if( SUCCEEDED( g_quantizedVB->Lock( 0, 0, &vertices, 0 ) ) )
+	{
+		memcpy( vertices, g_vertexQuantizer.getVertices(), vertexCount * stride );
+		g_quantizedVB->Unlock();
+	}
+
+	D3DVERTEXELEMENT9 elements[4];
+	int elementCount = 0;
+	const D3DVERTEXELEMENT9 position = { 0, 0, (BYTE)( g_vertexQuantizer.isPacked() ? D3DDECLTYPE_SHORT4 : D3DDECLTYPE_SHORT4N ),
+		D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 };
+	elements[elementCount++] = position;
+	if( g_vertexQuantizer.getNormalOffset() >= 0 )
+	{
+		const D3DVERTEXELEMENT9 normal = { 0, (WORD)g_vertexQuantizer.getNormalOffset(), D3DDECLTYPE_SHORT2N,
+			D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_NORMAL, 0 };
+		elements[elementCount++] = normal;
+	}
+	if( g_vertexQuantizer.getTexcoordOffset() >= 0 )
+	{
+		const D3DVERTEXELEMENT9 texcoord = { 0, (WORD)g_vertexQuantizer.getTexcoordOffset(), D3DDECLTYPE_FLOAT16_2,
+			D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 };
+		elements[elementCount++] = texcoord;
+	}
+	const D3DVERTEXELEMENT9 end = D3DDECL_END();
+	elements[elementCount++] = end;
+	if( FAILED( g_pd3dDevice->CreateVertexDeclaration( elements, &g_quantizedDecl ) ) )
+	{
+		g_quantizedDecl = NULL;
+		g_quantizedVB->Release();
+		g_quantizedVB = NULL;
+		g_vertexFormat = VERTEX_FORMAT_FLOAT;
+		return;
+	}
+
+	const QuantizationErrors errors = g_vertexQuantizer.measureErrors( g_meshPositions, g_meshNormals, g_meshTexcoords );
+	const int floatStride = g_vertexQuantizer.getFloatStride();
+	WCHAR normalReport[64] = L", no normals";
+	if( g_vertexQuantizer.hasNormals() )
+		StringCchPrintfW( normalReport, 64, L", normal max %.2f mean %.2f deg", errors.maxNormalDegrees, errors.meanNormalDegrees );
+	StringCchPrintfW( g_vertexFormatReport, 192, L" - %d vs %d B vertices (-%.0f%%), position max %.2g rms %.2g%s, uv max %.2g",
+		stride, floatStride, 100.0 * ( floatStride - stride ) / floatStride, errors.maxPositionError, errors.rmsPositionError,
+		normalReport, errors.maxTexcoordError );
+}
+
+//-----------------------------------------------------------------------------
+// Upsamples the reduced view z back to full resolution with both filters at 2x
+// and 4x. The depth itself is the signal, so the mean error against the full
+// resolution view z measures how much each filter bleeds across edges.
+VOID BenchmarkUpsample()
+{
+	g_benchmarkUpsample = false;
+	const DepthProjection projection = GetDepthProjection();
+	const int factors[2] = { 2, 4 };
+	DepthUpsample upsampler;
+	DepthImage lowDepth;
+	DepthImage result;
+
+	StringCchCopyW( g_upsampleReport, 192, L", upsample" );
+	for( int i = 0; i < 2; ++i )
+	{
+		DepthUpsample::downsampleMin( g_cpuDepth, projection, factors[i], lowDepth );
+		for( int mode = UPSAMPLE_BILATERAL; mode <= UPSAMPLE_NEAREST_DEPTH; ++mode )
+		{
+			UpsampleParams params = { factors[i], (UpsampleMode)mode, g_aoParams.upsampleEpsilon, 0.1f };
+			upsampler.upsample( g_cpuDepth, projection, lowDepth, lowDepth, params, result );
+
+			double error = 0.0;
+			for( int y = 0; y < g_cpuDepth.getHeight(); ++y )
+			{
+				for( int x = 0; x < g_cpuDepth.getWidth(); ++x )
+				{
+					error += fabsf( result.at( x, y ) - linearizeDepth( g_cpuDepth.at( x, y ), projection ) );
+				}
+			}
+			error /= (double)g_cpuDepth.getWidth() * g_cpuDepth.getHeight();
+
+			WCHAR part[48];
+			StringCchPrintfW( part, 48, L" %dx%s %.2f ms/MP err %.3f", factors[i], mode == UPSAMPLE_BILATERAL ? L"B" : L"N",
+				upsampler.getStats().msPerMegapixel, error );
+			StringCchCatW( g_upsampleReport, 192, part );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Round trips the read back depth through the codec as 24 bit unorm, what the
+// INTZ buffer holds, and as 32 bit float patterns, and checks it is lossless
+VOID BenchmarkCodec()
+{
+	g_benchmarkCodec = false;
+	const int width = g_cpuDepth.getWidth();
+	const int height = g_cpuDepth.getHeight();
+	uint32_t* samples = new uint32_t[width * height];
+	uint32_t* decoded = new uint32_t[width * height];
+	uint8_t* stream = new uint8_t[DepthCodec::getMaxEncodedSize( width, height, 32 )];
+
+	StringCchCopyW( g_codecReport, 192, L", codec" );
+	for( int bits = 24; bits <= 32; bits += 8 )
+	{
+		DepthCodec::quantizeDepth( g_cpuDepth, bits, samples, width );
+		const size_t size = g_depthCodec->encode( samples, width, width, height, bits, stream );
+		const bool lossless = g_depthCodec->decode( stream, size, decoded, width ) &&
+			memcmp( samples, decoded, width * height * sizeof( uint32_t ) ) == 0;
+
+		const DepthCodecStats& stats = g_depthCodec->getStats();
+		WCHAR part[96];
+		StringCchPrintfW( part, 96, L" %d bit %.2f:1 enc %.2f dec %.2f GB/s%s", bits,
+			(double)stats.rawBytes / size, stats.rawBytes / ( stats.encodeMs * 1.0e6 ),
+			stats.rawBytes / ( stats.decodeMs * 1.0e6 ), lossless ? L"" : L" MISMATCH" );
+		StringCchCatW( g_codecReport, 192, part );
+	}
+
+	delete[] samples;
+	delete[] decoded;
+	delete[] stream;
+}
+
+//-----------------------------------------------------------------------------
+// Resolves the CPU samples of the read back frame with every policy and times
+// each. Interior pixels differ by the depth slope across the sample pattern,
+// so the policy the driver applies has by far the lowest error.
+VOID CompareMsaaResolve( UINT frameIndex )
+{
+	g_compareMsaa = false;
+	if( g_frameIndex - frameIndex >= MATRIX_HISTORY )
+		return;
+	g_msaaDepth->draw( g_rasterMesh, g_frameMatrices[frameIndex % MATRIX_HISTORY], SCREEN_WIDTH, SCREEN_HEIGHT );
+
+	const WCHAR* names[MSAA_RESOLVE_COUNT] = { L"sample 0", L"min", L"max", L"avg" };
+	const int width = g_cpuDepth.getWidth();
+	const int height = g_cpuDepth.getHeight();
+	DepthImage resolved;
+	double bestError = 1.0e30;
+	int bestMode = 0;
+	StringCchPrintfW( g_msaaReport, 192, L", MSAA raster %.1f ms, resolve", g_msaaDepth->getStats().rasterMs );
+	for( int mode = 0; mode < MSAA_RESOLVE_COUNT; ++mode )
+	{
+		g_msaaDepth->resolve( (MsaaResolve)mode, resolved );
+
+		// More than one 24 bit step counts as a mismatch
+		double error = 0.0;
+		int mismatches = 0;
+		for( int y = 0; y < height; ++y )
+		{
+			for( int x = 0; x < width; ++x )
+			{
+				const float difference = fabsf( resolved.at( x, y ) - g_cpuDepth.at( x, y ) );
+				error += difference;
+				mismatches += difference > 1.0f / 16777215.0f;
+			}
+		}
+		if( error < bestError )
+		{
+			bestError = error;
+			bestMode = mode;
+		}
+
+		WCHAR part[48];
+		StringCchPrintfW( part, 48, L" %s %.2f ms %d off", names[mode], g_msaaDepth->getStats().resolveMs[mode], mismatches );
+		StringCchCatW( g_msaaReport, 192, part );
+	}
+	StringCchCatW( g_msaaReport, 192, L", RESZ is " );
+	StringCchCatW( g_msaaReport, 192, names[bestMode] );
+}
+
+//-----------------------------------------------------------------------------
+// Fits the cascades to the visible depth and compares their texel density with
+// fixed splits of the whole frustum at the same shadow map size
+VOID FitShadowCascades()
+{
+	D3DXMATRIXA16 invView;
+	D3DXMatrixInverse( &invView, NULL, &g_matView );
+	D3DXMATRIXA16 matViewToLight = invView * g_shadowMap->getLightView();
+	DepthMatrix viewToLight;
+	memcpy( &viewToLight, &matViewToLight, sizeof( DepthMatrix ) );
+	const DepthProjection projection = GetDepthProjection();
+
+	float minZ, maxZ;
+	if( !g_gpuDepthRange || g_depthReduction == NULL )
+	{
+		g_shadowCascades->reduceDepthRange( g_cpuDepth, projection );
+	}
+	else if( g_depthReduction->fetch( &minZ, &maxZ ) )
+	{
+		g_shadowCascades->setDepthRange( minZ, maxZ );
+	}
+	g_shadowCascades->fitCascades( g_cpuDepth, projection, viewToLight, g_cascadeParams );
+
+	Cascade fixedCascades[ShadowCascades::MAX_CASCADES];
+	ShadowCascades::fitFrustumCascades( projection, viewToLight, g_cascadeParams, fixedCascades );
+
+	const CascadeStats& stats = g_shadowCascades->getStats();
+	StringCchPrintfW( g_cascadeReport, 192, L", %s z %.2f-%.2f (%.2f/%.2f ms, %d threads), density",
+		g_gpuDepthRange ? L"GPU" : L"CPU", stats.minZ, stats.maxZ, stats.reduceMs, stats.boundsMs, g_taskPool->getThreadCount() );
+	for( int i = 0; i < g_shadowCascades->getCascadeCount(); ++i )
+	{
+		// Texels per unit scale with 1 / the larger light space extent
+		const Cascade& tight = g_shadowCascades->getCascade( i );
+		const Cascade& fixed = fixedCascades[i];
+		const float tightExtent = maxf( tight.boundsMax[0] - tight.boundsMin[0], tight.boundsMax[1] - tight.boundsMin[1] );
+		const float fixedExtent = maxf( fixed.boundsMax[0] - fixed.boundsMin[0], fixed.boundsMax[1] - fixed.boundsMin[1] );
+		WCHAR part[24];
+		StringCchPrintfW( part, 24, tight.sampleCount > 0 ? L" x%.1f" : L" -", fixedExtent / tightExtent );
+		StringCchCatW( g_cascadeReport, 192, part );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Answers the cursor and click queries in one batch. Both may repeat between
+// read backs, those are served from the picker cache.
+VOID PickCursor()
+{
+	g_pickReport[0] = L'\0';
+	if( !g_depthPicker.hasFrame() || g_pickPixels[0] < 0 )
+		return;
+
+	PickResult results[2];
+	const int count = g_pickPixels[2] < 0 ? 1 : 2;
+	g_depthPicker.pickBatch( g_pickPixels, count, results );
+
+	WCHAR part[96];
+	for( int i = 0; i < count; ++i )
+	{
+		if( results[i].hit )
+			StringCchPrintfW( part, 96, L", %s (%d, %d) = (%.2f, %.2f, %.2f)", i == 0 ? L"cursor" : L"click",
+				results[i].x, results[i].y, results[i].world[0], results[i].world[1], results[i].world[2] );
+		else
+			StringCchPrintfW( part, 96, L", %s (%d, %d) = background", i == 0 ? L"cursor" : L"click", results[i].x, results[i].y );
+		StringCchCatW( g_pickReport, 192, part );
+	}
+	const PickStats& stats = g_depthPicker.getStats();
+	StringCchPrintfW( part, 96, L" [%d/%d cached]", stats.cacheHits, stats.queries );
+	StringCchCatW( g_pickReport, 192, part );
+}
+
+//-----------------------------------------------------------------------------
+// Runs the CPU depth consumers on the newest depth the GPU has copied back
+VOID ProcessCpuDepth()
+{
+	UINT frameIndex;
+	if( !g_depthReadback->fetch( g_cpuDepth, &frameIndex ) )
+		return;
+	g_cpuDepthFrame = frameIndex;
+
+	// Rendered before the last depth mode switch
+	if( frameIndex < g_depthModeFrame )
+		return;
+
+	// Four steps of 24 bit depth, the consumers below only redo the dirty tiles
+	g_depthChange.update( g_cpuDepth, 4.0f / 16777215.0f );
+	if( g_depthChange.getStats().dirtyTiles > 0 )
+	{
+		EdgeMaskParams edgeParams;
+		edgeParams.projection = GetDepthProjection();
+		edgeParams.depthThreshold = 0.1f;
+		edgeParams.normalThreshold = 0.7f;
+		edgeParams.useNormals = true;
+		g_edgeMask.build( g_cpuDepth, edgeParams, &g_depthChange );
+		g_depthOfField.compute( g_cpuDepth, g_dofTransform, &g_depthChange );
+	}
+
+	g_reprojectedFrames = 0;
+	if( g_frameIndex - frameIndex < MATRIX_HISTORY &&
+		g_depthReprojection.setMatrices( g_frameMatrices[frameIndex % MATRIX_HISTORY], g_frameMatrices[g_frameIndex % MATRIX_HISTORY] ) )
+	{
+		g_depthReprojection.reproject( g_cpuDepth );
+		g_reprojectedFrames = g_frameIndex - frameIndex;
+	}
+
+	if( g_frameIndex - frameIndex < MATRIX_HISTORY )
+	{
+		g_depthPicker.setFrame( &g_cpuDepth, frameIndex, g_frameViewProj[frameIndex % MATRIX_HISTORY] );
+	}
+	else
+	{
+		g_depthPicker.reset();
+	}
+	PickCursor();
+
+	if( g_pointCloudExport.isRunning() && g_frameIndex - frameIndex < MATRIX_HISTORY )
+	{
+		g_pointCloudExport.submit( g_cpuDepth, frameIndex, g_frameViewProj[frameIndex % MATRIX_HISTORY], g_pointCloudParams );
+	}
+
+	if( g_benchmarkUpsample )
+	{
+		BenchmarkUpsample();
+	}
+
+	if( g_benchmarkCodec )
+	{
+		BenchmarkCodec();
+	}
+
+	if( g_compareMsaa )
+	{
+		CompareMsaaResolve( frameIndex );
+	}
+
+	if( g_froxelFogEnabled )
+	{
+		D3DXMATRIXA16 matViewToWorld;
+		D3DXMatrixInverse( &matViewToWorld, NULL, &g_matView );
+		DepthMatrix viewToWorld;
+		memcpy( &viewToWorld, &matViewToWorld, sizeof( DepthMatrix ) );
+		g_froxelFog->update( g_cpuDepth, GetDepthProjection(), viewToWorld, g_fogParams );
+	}
+
+	if( g_displayMode == DISPLAY_SHADOW && g_shadowMap != NULL )
+	{
+		FitShadowCascades();
+	}
+
+	UpdateStats( frameIndex );
+}
+
+//-----------------------------------------------------------------------------
+// Shades the frame just drawn with ColorRasterizer and compares it with the back
+// buffer before the corner quad covers it. Blocks on the GPU.
+VOID ValidateColor()
+{
+	g_validate = false;
+	LPDIRECT3DSURFACE9 backBuffer = NULL;
+	LPDIRECT3DSURFACE9 resolved = NULL;
+	LPDIRECT3DSURFACE9 copy = NULL;
+	D3DLOCKED_RECT locked;
+	ColorImage gpuColor( SCREEN_WIDTH, SCREEN_HEIGHT );
+	bool read = SUCCEEDED( g_pd3dDevice->GetBackBuffer( 0, 0, D3DBACKBUFFER_TYPE_MONO, &backBuffer ) ) &&
+		SUCCEEDED( g_pd3dDevice->CreateRenderTarget( SCREEN_WIDTH, SCREEN_HEIGHT, D3DFMT_X8R8G8B8,
+			D3DMULTISAMPLE_NONE, 0, FALSE, &resolved, NULL ) ) &&
+		SUCCEEDED( g_pd3dDevice->CreateOffscreenPlainSurface( SCREEN_WIDTH, SCREEN_HEIGHT, D3DFMT_X8R8G8B8,
+			D3DPOOL_SYSTEMMEM, &copy, NULL ) ) &&
+		SUCCEEDED( g_pd3dDevice->StretchRect( backBuffer, NULL, resolved, NULL, D3DTEXF_NONE ) ) &&
+		SUCCEEDED( g_pd3dDevice->GetRenderTargetData( resolved, copy ) ) &&
+		SUCCEEDED( copy->LockRect( &locked, NULL, D3DLOCK_READONLY ) );
+	if( read )
+	{
+		for( int y = 0; y < SCREEN_HEIGHT; ++y )
+			memcpy( gpuColor.row( y ), (const BYTE*)locked.pBits + y * locked.Pitch, SCREEN_WIDTH * sizeof( uint32_t ) );
+		copy->UnlockRect();
+	}
+	if( copy != NULL )
+		copy->Release();
+	if( resolved != NULL )
+		resolved->Release();
+	if( backBuffer != NULL )
+		backBuffer->Release();
+	if( !read )
+		return;
+
+	const bool reversed = g_depthMode != DEPTH_MODE_STANDARD;
+	DepthImage cpuDepth( SCREEN_WIDTH, SCREEN_HEIGHT );
+	ColorImage cpuColor( SCREEN_WIDTH, SCREEN_HEIGHT );
+	cpuDepth.fill( farDepth( reversed ) );
+	cpuColor.fill( BACKGROUND_COLOR );
+	ColorRasterizer rasterizer;
+	rasterizer.setReverseZ( reversed );
+
+	// Subsets in order with their own material and texture, as the GPU paths draw
+	// them. Pre-transformed vertices are not lit and have no diffuse color, so
+	// the texture passes through unmodulated.
+	for( DWORD s = 0; s < g_dwNumMaterials; ++s )
+	{
+		const XSubset& subset = g_meshSubsets[s];
+		const DWORD m = (DWORD)subset.material < g_dwNumMaterials ? (DWORD)subset.material : 0;
+		const D3DMATERIAL9& material = g_pMeshMaterials[m];
+		const float ambient[3] = { material.Ambient.r, material.Ambient.g, material.Ambient.b };
+		const float emissive[3] = { material.Emissive.r, material.Emissive.g, material.Emissive.b };
+		ShadeParams params;
+		for( int i = 0; i < 3; ++i )
+		{
+			params.ambientLight[i] = ( ( AMBIENT_LIGHT >> ( ( 2 - i ) * 8 ) ) & 0xFF ) / 255.0f;
+			params.materialAmbient[i] = g_pretransformedDrawn ? 0.0f : ambient[i];
+			params.materialEmissive[i] = g_pretransformedDrawn ? 1.0f : emissive[i];
+		}
+		params.materialAlpha = g_pretransformedDrawn ? 1.0f : material.Diffuse.a;
+		params.texture = g_softwareTextures[m].isEmpty() ? NULL : &g_softwareTextures[m];
+		params.filter = g_textureFilter;
+
+		RasterMesh subsetMesh = g_rasterMesh;
+		subsetMesh.indices += subset.firstTriangle * 3;
+		subsetMesh.triangleCount = subset.triangleCount;
+		rasterizer.draw( subsetMesh, g_meshTexcoords, g_frameMatrices[g_frameIndex % MATRIX_HISTORY], params, cpuDepth, cpuColor );
+	}
+
+	// The GPU blends silhouette pixels with the background at 4x MSAA, the CPU
+	// takes one sample per pixel, so a thin outline is expected to differ
+	int maxDifference = 0;
+	int pixelsOff = 0;
+	double totalDifference = 0.0;
+	for( int y = 0; y < SCREEN_HEIGHT; ++y )
+	{
+		for( int x = 0; x < SCREEN_WIDTH; ++x )
+		{
+			int pixelDifference = 0;
+			for( int shift = 0; shift < 24; shift += 8 )
+			{
+				const int gpu = ( gpuColor.at( x, y ) >> shift ) & 0xFF;
+				const int cpu = ( cpuColor.at( x, y ) >> shift ) & 0xFF;
+				pixelDifference = maxi( pixelDifference, gpu > cpu ? gpu - cpu : cpu - gpu );
+			}
+			maxDifference = maxi( maxDifference, pixelDifference );
+			pixelsOff += pixelDifference > COLOR_TOLERANCE;
+			totalDifference += pixelDifference;
+		}
+	}
+	StringCchPrintfW( g_colorValidation, 128, L" - CPU shaded %.1f ms, max diff %d, mean %.2f, %d px off by more than %d",
+		rasterizer.getStats().rasterMs, maxDifference, totalDifference / ( SCREEN_WIDTH * SCREEN_HEIGHT ), pixelsOff,
+		COLOR_TOLERANCE );
+	g_lastStatsTime = 0;
+	UpdateStats( g_frameIndex );
+}
+
+//-----------------------------------------------------------------------------
+// Compares this frame's SSAO against the CPU reference. Blocks on the GPU.
+VOID ValidateAO()
+{
+	g_validate = false;
+	if( g_depthReadback == NULL )
+		return;
+
+	DepthImage depth;
+	UINT frameIndex;
+	g_depthReadback->capture( *g_postProcess, g_hTCopyDepth, g_frameIndex );
+	if( !g_depthReadback->fetch( depth, &frameIndex, true ) )
+		return;
+
+	uint8_t* gpuResult = new uint8_t[SCREEN_WIDTH * SCREEN_HEIGHT];
+	if( g_ssaoPass->readResult( gpuResult ) )
+	{
+		g_ambientOcclusion.compute( depth, GetDepthProjection(), g_aoParams );
+		const AOCompareResult result = AmbientOcclusion::compare( gpuResult, g_ambientOcclusion.getResult(),
+			SCREEN_WIDTH * SCREEN_HEIGHT, 1 );
+		const AOStats& stats = g_ambientOcclusion.getStats();
+		StringCchPrintfW( g_aoValidation, 128, L", CPU %.1f/%.1f/%.1f/%.1f ms, max diff %d, %d px off by more than 1",
+			stats.downsampleMs, stats.aoMs, stats.blurMs, stats.upsampleMs,
+			result.maxDifference, result.mismatchCount );
+	}
+	delete[] gpuResult;
+}
+
+//-----------------------------------------------------------------------------
+// Compares the GPU shadow map against the software rasterizer. Blocks on the GPU.
+VOID ValidateShadowMap()
+{
+	g_validate = false;
+	if( g_shadowReadback == NULL )
+	{
+		g_shadowReadback = new DepthReadback();
+		if( FAILED( g_shadowReadback->create( g_pd3dDevice, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE ) ) )
+		{
+			delete g_shadowReadback;
+			g_shadowReadback = NULL;
+			return;
+		}
+	}
+
+	DepthImage gpuDepth;
+	UINT frameIndex;
+	g_pEffect->SetTexture( g_hTextureDepthTexture, g_shadowMap->getTexture() );
+	g_shadowReadback->capture( *g_postProcess, g_hTCopyDepth, g_frameIndex );
+	g_pEffect->SetTexture( g_hTextureDepthTexture, g_depthTexture->getTexture() );
+	if( !g_shadowReadback->fetch( gpuDepth, &frameIndex, true ) )
+		return;
+
+	DepthImage cpuDepth( SHADOW_MAP_SIZE, SHADOW_MAP_SIZE );
+	cpuDepth.fill( 1.0f );
+	TiledRasterizer rasterizer( g_taskPool );
+	rasterizer.begin( cpuDepth );
+	rasterizer.addMesh( g_rasterMesh, g_shadowMap->getWorldLightViewProj() );
+	rasterizer.end();
+
+	// 256 steps of 24 bit depth (1 / 65536). The GPU rounds its interpolated
+	// depth to 24 bits and evaluates the plane at its own precision, the CPU
+	// keeps float depth, and on the steep slopes of the light's view that is
+	// worth many steps. Coverage is compared separately.
+	float maxDifference = 0.0f;
+	int depthMismatches = 0;
+	int coverageMismatches = 0;
+	for( int y = 0; y < SHADOW_MAP_SIZE; ++y )
+	{
+		for( int x = 0; x < SHADOW_MAP_SIZE; ++x )
+		{
+			const float gpu = gpuDepth.at( x, y );
+			const float cpu = cpuDepth.at( x, y );
+			if( ( gpu < 1.0f ) != ( cpu < 1.0f ) )
+			{
+				++coverageMismatches;
+				continue;
+			}
+			const float difference = fabsf( gpu - cpu );
+			maxDifference = maxf( maxDifference, difference );
+			depthMismatches += difference > 1.0f / 65536.0f;
+		}
+	}
+	const TiledRasterStats& stats = rasterizer.getStats();
+	StringCchPrintfW( g_shadowValidation, 128, L", CPU raster %.1f ms, max diff %.2g, %d depth / %d coverage mismatches",
+		stats.binMs + stats.rasterMs, maxDifference, depthMismatches, coverageMismatches );
+}
+
+//-----------------------------------------------------------------------------
+// Transforms the tiger with this frame's matrices on the CPU and draws it as
+// D3DFVF_XYZRHW vertices with the mesh's own index buffer, one draw per
+// attribute range. Returns false to fall back to DrawSubset() when a vertex
+// is behind the near plane, since pre-transformed triangles are not clipped.
+bool DrawPretransformed()
+{
+	if( g_pretransformedVB == NULL )
+		return false;
+	g_vertexPipeline->begin( g_frameMatrices[g_frameIndex % MATRIX_HISTORY], SCREEN_WIDTH, SCREEN_HEIGHT );
+	g_vertexPipeline->transformAll();
+	const int vertexCount = g_vertexPipeline->getVertexCount();
+	const uint8_t* clipCodes = g_vertexPipeline->getClipCodes();
+	for( int i = 0; i < vertexCount; i++ )
+	{
+		if( clipCodes[i] & VertexPipeline::CLIP_NEAR )
+			return false;
+	}
+
+	float* vertices = NULL;
+	if( FAILED( g_pretransformedVB->Lock( 0, 0, (void**)&vertices, D3DLOCK_DISCARD ) ) )
+		return false;
+	g_vertexPipeline->writeTransformed( vertices, PRETRANSFORMED_STRIDE );
+	for( int i = 0; i < vertexCount; i++ )
+	{
+		vertices[i * PRETRANSFORMED_STRIDE + 4] = g_meshTexcoords != NULL ? g_meshTexcoords[i * 2] : 0.0f;
+		vertices[i * PRETRANSFORMED_STRIDE + 5] = g_meshTexcoords != NULL ? g_meshTexcoords[i * 2 + 1] : 0.0f;
+	}
+	g_pretransformedVB->Unlock();
+
+	LPDIRECT3DINDEXBUFFER9 indexBuffer = NULL;
+	if( FAILED( g_pMesh->GetIndexBuffer( &indexBuffer ) ) )
+		return false;
+	g_pd3dDevice->SetFVF( PRETRANSFORMED_FVF );
+	g_pd3dDevice->SetStreamSource( 0, g_pretransformedVB, 0, PRETRANSFORMED_STRIDE * sizeof( float ) );
+	g_pd3dDevice->SetIndices( indexBuffer );
+
+	for( DWORD i = 0; i < g_meshRangeCount; i++ )
+	{
+		const D3DXATTRIBUTERANGE& range = g_meshRanges[i];
+		const DWORD material = range.AttribId < g_dwNumMaterials ? range.AttribId : 0;
+		g_pd3dDevice->SetMaterial( &g_pMeshMaterials[material] );
+		g_pd3dDevice->SetTexture( 0, g_pMeshTextures[material] );
+		g_pd3dDevice->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, range.VertexStart, range.VertexCount,
+			range.FaceStart * 3, range.FaceCount );
+	}
+	indexBuffer->Release();
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Draws the tiger from g_quantizedVB with the mesh's own index buffer, one draw
+// per subset with its vertex decode. Returns false to fall back to
+// DrawSubset() while the float format is selected.
+bool DrawQuantized()
+{
+	if( g_quantizedVB == NULL || g_quantizedDecl == NULL )
+		return false;
+	D3DXHANDLE technique = g_hTQuantizedMesh;
+	if( g_vertexQuantizer.isPacked() )
+		technique = g_vertexQuantizer.getNormalOffset() >= 0 ? g_hTQuantizedMeshOct16 : g_hTQuantizedMeshPacked;
+	LPDIRECT3DINDEXBUFFER9 indexBuffer = NULL;
+	if( technique == NULL || FAILED( g_pMesh->GetIndexBuffer( &indexBuffer ) ) )
+		return false;
+	g_pd3dDevice->SetVertexDeclaration( g_quantizedDecl );
+	g_pd3dDevice->SetStreamSource( 0, g_quantizedVB, 0, g_vertexQuantizer.getStride() );
+	g_pd3dDevice->SetIndices( indexBuffer );
+
+	D3DXMATRIXA16 matWorldViewProj;
+	memcpy( &matWorldViewProj, &g_frameMatrices[g_frameIndex % MATRIX_HISTORY], sizeof( DepthMatrix ) );
+	g_pEffect->SetMatrix( "QuantizedWorldViewProj", &matWorldViewProj );
+
+	UINT passes;
+	g_pEffect->SetTechnique( technique );
+	g_pEffect->Begin( &passes, 0 );
+	g_pEffect->BeginPass( 0 );
+	for( DWORD i = 0; i < g_dwNumMaterials; i++ )
+	{
+		const XSubset& subset = g_meshSubsets[i];
+		if( subset.triangleCount == 0 )
+			continue;
+
+		// The fixed function lighting of the float mesh, constant over a subset
+		const D3DMATERIAL9& material = g_pMeshMaterials[i];
+		const float ambient[3] = { material.Ambient.r, material.Ambient.g, material.Ambient.b };
+		const float emissive[3] = { material.Emissive.r, material.Emissive.g, material.Emissive.b };
+		D3DXVECTOR4 color( 0.0f, 0.0f, 0.0f, material.Diffuse.a );
+		for( int c = 0; c < 3; ++c )
+		{
+			const float lit = emissive[c] + ambient[c] * ( ( AMBIENT_LIGHT >> ( ( 2 - c ) * 8 ) ) & 0xFF ) / 255.0f;
+			( (float*)color )[c] = lit < 1.0f ? lit : 1.0f;
+		}
+
+		const VertexDecode& decode = g_vertexQuantizer.getVertexDecode( i );
+		g_pEffect->SetFloatArray( "PositionOffset", decode.offset, 3 );
+		g_pEffect->SetFloatArray( "PositionScale", decode.scale, 3 );
+		g_pEffect->SetFloatArray( "TexcoordOffset", decode.texcoordOffset, 2 );
+		g_pEffect->SetFloatArray( "TexcoordScale", decode.texcoordScale, 2 );
+		g_pEffect->SetVector( "MaterialColor", &color );
+		g_pEffect->SetTexture( "MeshTexture", g_pMeshTextures[i] );
+		g_pEffect->SetBool( "MeshTextured", g_pMeshTextures[i] != NULL );
+		g_pEffect->CommitChanges();
+		g_pd3dDevice->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, subset.firstVertex, subset.vertexCount,
+			subset.firstTriangle * 3, subset.triangleCount );
+	}
+	g_pEffect->EndPass();
+	g_pEffect->End();
+	indexBuffer->Release();
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Culls the tiger's meshlets with this frame's matrices and draws the ranges
+// left with the fixed function pipeline. The Hi-Z comes from the last read
+// back depth reprojected to this frame, without 'C' or a recent read back
+// only the frustum and cone tests run.
+bool DrawClusters()
+{
+	const DepthMatrix& worldViewProj = g_frameMatrices[g_frameIndex % MATRIX_HISTORY];
+	g_clusterCuller.clearHiZ();
+	if( g_cpuDepthEnabled && !g_cpuDepth.isEmpty() && g_cpuDepthFrame >= g_depthModeFrame &&
+		g_frameIndex - g_cpuDepthFrame < MATRIX_HISTORY &&
+		g_clusterReprojection.setMatrices( g_frameMatrices[g_cpuDepthFrame % MATRIX_HISTORY], worldViewProj ) )
+	{
+		g_clusterReprojection.reproject( g_cpuDepth );
+		g_clusterCuller.buildHiZ( g_clusterReprojection.getPredicted() );
+	}
+	const int rangeCount = g_clusterCuller.cull( worldViewProj, SCREEN_WIDTH, SCREEN_HEIGHT );
+
+	LPDIRECT3DVERTEXBUFFER9 vertexBuffer = NULL;
+	LPDIRECT3DINDEXBUFFER9 indexBuffer = NULL;
+	if( FAILED( g_pMesh->GetVertexBuffer( &vertexBuffer ) ) )
+		return false;
+	if( FAILED( g_pMesh->GetIndexBuffer( &indexBuffer ) ) )
+	{
+		vertexBuffer->Release();
+		return false;
+	}
+	g_pd3dDevice->SetFVF( g_pMesh->GetFVF() );
+	g_pd3dDevice->SetStreamSource( 0, vertexBuffer, 0, g_pMesh->GetNumBytesPerVertex() );
+	g_pd3dDevice->SetIndices( indexBuffer );
+	for( int i = 0; i < rangeCount; i++ )
+	{
+		const ClusterRange& range = g_clusterCuller.getRanges()[i];
+		g_pd3dDevice->SetMaterial( &g_pMeshMaterials[range.subset] );
+		g_pd3dDevice->SetTexture( 0, g_pMeshTextures[range.subset] );
+		g_pd3dDevice->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, range.minVertex, range.vertexCount,
+			range.firstTriangle * 3, range.triangleCount );
+	}
+	indexBuffer->Release();
+	vertexBuffer->Release();
+	return true;
 }
 
 //-----------------------------------------------------------------------------
 VOID Render()
 {
 	// Clear the backbuffer and the zbuffer
+	const bool reversed = g_depthMode != DEPTH_MODE_STANDARD;
+	g_pd3dDevice->SetDepthStencilSurface( g_depthMode == DEPTH_MODE_REVERSED_FLOAT ? g_floatDepthSurface : g_autoDepthSurface );
 	g_pd3dDevice->Clear( 0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER,
-		D3DCOLOR_XRGB( 0, 0, 255 ), 1.0f, 0 );
+		BACKGROUND_COLOR, farDepth( reversed ), 0 );
 
 	// Begin the scene
 	if( SUCCEEDED( g_pd3dDevice->BeginScene() ) )
@@ -259,9 +1614,21 @@ VOID Render()
 		// Setup the world, view, and projection matrices
 		SetupMatrices();
 
+		if (g_displayMode == DISPLAY_SHADOW && g_shadowMap != NULL)
+		{
+			g_shadowMap->setCompareFloat( true );
+			g_shadowMap->render( g_pMesh, g_dwNumMaterials );
+		}
+
+		// The shadow map keeps the standard convention, only the main pass is reversed
+		g_pd3dDevice->SetRenderState( D3DRS_ZFUNC, reversed ? D3DCMP_GREATEREQUAL : D3DCMP_LESSEQUAL );
+
 		// Meshes are divided into subsets, one for each material. Render them in
 		// a loop
-		for( DWORD i = 0; i < g_dwNumMaterials; i++ )
+		g_pretransformedDrawn = g_pretransformed && DrawPretransformed();
+		const bool quantizedDrawn = !g_pretransformedDrawn && DrawQuantized();
+		g_clustersDrawn = g_clusterCulling && !g_pretransformedDrawn && !quantizedDrawn && DrawClusters();
+		for( DWORD i = 0; i < g_dwNumMaterials && !g_pretransformedDrawn && !quantizedDrawn && !g_clustersDrawn; i++ )
 		{
 			// Set the material and texture for this subset
 			g_pd3dDevice->SetMaterial( &g_pMeshMaterials[i] );
@@ -270,38 +1637,71 @@ VOID Render()
 			// Draw the mesh subset
 			g_pMesh->DrawSubset( i );
 		}
+		g_pd3dDevice->SetRenderState( D3DRS_ZFUNC, D3DCMP_LESSEQUAL );
+
+		if (g_validate && g_displayMode == DISPLAY_DEPTH)
+		{
+			ValidateColor();
+		}
 
 		if (g_depthTexture->isSupported())
 		{
 			// Resolve depth
 			g_depthTexture->resolveDepth(g_pd3dDevice);
+			g_pEffect->SetTexture( g_hTextureDepthTexture, g_depthTexture->getTexture() );
 
-			// Render a screen-sized quad
+			if (g_cpuDepthEnabled && g_depthReadback != NULL)
+			{
+				g_depthReadback->capture( *g_postProcess, g_hTCopyDepth, g_frameIndex );
+				ProcessCpuDepth();
+			}
+
+			if (g_displayMode == DISPLAY_SHADOW && g_shadowMap != NULL)
 			{
-				const float scale = 0.35f;
-				float width = SCREEN_WIDTH * scale;
-				float height = SCREEN_HEIGHT * scale;
-				PPVERT quad[4] =
+				if (g_gpuDepthRange && g_depthReduction != NULL)
+				{
+					g_depthReduction->render();
+				}
+				if (g_validate)
 				{
-					{ -0.5f,		-0.5f,          0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f },
-					{ width - 0.5f, -0.5f,			0.5f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f },
-					{ -0.5f,		height - 0.5f,	0.5f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f },
-					{ width - 0.5f, height - 0.5f,	0.5f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f }
-				};
-
-				g_pd3dDevice->SetVertexDeclaration( g_pVertDeclPP );
-				g_pEffect->SetTechnique( g_hTShowUnmodified );
-				g_pEffect->SetTexture( g_hTextureDepthTexture, g_depthTexture->getTexture() );
-				UINT cPasses;
-				g_pEffect->Begin( &cPasses, 0 );
-				for( size_t p = 0; p < cPasses; ++p )
+					ValidateShadowMap();
+				}
+				UpdateStats( g_frameIndex );
+			}
+
+			if (g_displayMode == DISPLAY_AO_NEAREST && g_ssaoPass != NULL)
+			{
+				g_ssaoPass->render();
+				g_pEffect->SetTexture( "LowDepthTexture", g_ssaoPass->getHalfDepth() );
+				g_pEffect->SetTexture( "LowSignalTexture", g_ssaoPass->getHalfAO() );
+			}
+
+			if (g_displayMode == DISPLAY_AO && g_ssaoPass != NULL)
+			{
+				g_ssaoPass->render();
+				if (g_validate)
 				{
-					g_pEffect->BeginPass( p );
-					g_pd3dDevice->DrawPrimitiveUP( D3DPT_TRIANGLESTRIP, 2, quad, sizeof( PPVERT ) );
-					g_pEffect->EndPass();
+					ValidateAO();
 				}
-				g_pEffect->End();
+				g_pEffect->SetTexture( g_hTextureDisplay, g_ssaoPass->getResult() );
+				UpdateStats( g_frameIndex );
+			}
+
+			if (g_displayMode >= DISPLAY_COC && g_dofPass != NULL)
+			{
+				g_dofPass->render();
+				LPDIRECT3DTEXTURE9 display = g_dofPass->getCoC();
+				if (g_displayMode == DISPLAY_NEAR_FIELD)
+					display = g_dofPass->getNearField();
+				else if (g_displayMode == DISPLAY_FAR_FIELD)
+					display = g_dofPass->getFarField();
+				g_pEffect->SetTexture( g_hTextureDisplay, display );
 			}
+
+			// Render a screen-sized quad
+			const float scale = 0.35f;
+			g_postProcess->drawQuad( g_hTDisplay[g_displayMode], 0.0f, 0.0f,
+				SCREEN_WIDTH * scale, SCREEN_HEIGHT * scale, (float)SCREEN_WIDTH, (float)SCREEN_HEIGHT );
 		}
 
 		// End the scene
@@ -310,6 +1710,7 @@ VOID Render()
 
 	// Present the backbuffer contents to the display
 	g_pd3dDevice->Present( NULL, NULL, NULL, NULL );
+	++g_frameIndex;
 }
 
 //-----------------------------------------------------------------------------
@@ -321,6 +1722,73 @@ LRESULT WINAPI MsgProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
 		Cleanup();
 		PostQuitMessage( 0 );
 		return 0;
+
+	case WM_KEYDOWN:
+		switch( wParam )
+		{
+		case VK_SPACE:
+			g_displayMode = (DisplayMode)( ( g_displayMode + 1 ) % DISPLAY_COUNT );
+			return 0;
+		case 'C':
+			g_cpuDepthEnabled = !g_cpuDepthEnabled;
+			g_depthChange.markAllDirty();
+			return 0;
+		case 'V':
+			g_validate = true;
+			return 0;
+		case 'U':
+			g_benchmarkUpsample = true;
+			return 0;
+		case 'G':
+			g_gpuDepthRange = !g_gpuDepthRange;
+			return 0;
+		case 'Z':
+			g_benchmarkCodec = true;
+			return 0;
+		case 'M':
+			g_compareMsaa = true;
+			return 0;
+		case 'T':
+			g_pretransformed = !g_pretransformed;
+			return 0;
+		case 'R':
+			SetDepthMode( (DepthMode)( ( g_depthMode + 1 ) % DEPTH_MODE_COUNT ) );
+			return 0;
+		case 'Q':
+			SetVertexFormat( (VertexFormat)( ( g_vertexFormat + 1 ) % VERTEX_FORMAT_COUNT ) );
+			return 0;
+		case 'K':
+			g_clusterCulling = !g_clusterCulling;
+			return 0;
+		case 'F':
+			g_froxelFogEnabled = !g_froxelFogEnabled;
+			return 0;
+		case 'B':
+			SetTextureFilter( g_textureFilter == SoftwareTexture::FILTER_POINT ? SoftwareTexture::FILTER_LINEAR
+				: SoftwareTexture::FILTER_POINT );
+			return 0;
+		case 'P':
+			if( g_pointCloudExport.isRunning() )
+				g_pointCloudExport.stop();
+			else
+				g_pointCloudExport.start( "depth_" );
+			return 0;
+		}
+		break;
+
+	case WM_MOUSEMOVE:
+	case WM_LBUTTONDOWN:
+		{
+			// Client coordinates to back buffer pixels
+			RECT client;
+			GetClientRect( hWnd, &client );
+			if( client.right <= 0 || client.bottom <= 0 )
+				break;
+			const int slot = msg == WM_MOUSEMOVE ? 0 : 2;
+			g_pickPixels[slot] = (short)LOWORD( lParam ) * SCREEN_WIDTH / client.right;
+			g_pickPixels[slot + 1] = (short)HIWORD( lParam ) * SCREEN_HEIGHT / client.bottom;
+			return 0;
+		}
 	}
 
 	return DefWindowProc( hWnd, msg, wParam, lParam );
@@ -344,6 +1812,7 @@ INT WINAPI wWinMain( HINSTANCE hInst, HINSTANCE, LPWSTR, INT )
 	HWND hWnd = CreateWindow( L"D3D Tutorial", L"Direct Depth Access",
 		WS_OVERLAPPEDWINDOW, 100, 100, SCREEN_WIDTH, SCREEN_HEIGHT,
 		NULL, NULL, wc.hInstance, NULL );
+	g_hWnd = hWnd;
 
 	// Initialize Direct3D
 	if( SUCCEEDED( InitD3D( hWnd ) ) )
@@ -373,4 +1842,4 @@ INT WINAPI wWinMain( HINSTANCE hInst, HINSTANCE, LPWSTR, INT )
 
 	UnregisterClass( L"D3D Tutorial", wc.hInstance );
 	return 0;
-}
\ No newline at end of file
+}
\ No newline at end of file
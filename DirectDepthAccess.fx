@@ -9,6 +9,43 @@
 //--------------------------------------------------------------------------------------
 texture DepthTargetTexture;
 
+float4 ProjParams;          // x = near, y = far, swapped for reverse-Z, z = 1 / proj._11, w = 1 / proj._22
+float  ClearDepth = 1.0;    // depth of the background, 0 for reverse-Z
+float4 DepthTexelSize;      // x = 1 / width, y = 1 / height, z = width, w = height
+float2 TargetSize;          // size in pixels of the render target the quad is drawn to
+float  EdgeThreshold = 0.1;         // second derivative of view z relative to z
+float  EdgeNormalThreshold = -1.0;  // cosine between neighbour normals, -1 disables
+
+texture DisplayTexture;     // any color texture shown by ShowTexture
+
+texture HalfDepthTexture;   // half resolution view z
+texture AOTexture;
+texture AORotationTexture;  // 4x4 interleaved (cos, sin)
+float4 HalfTexelSize;       // x = 1 / width, y = 1 / height, z = width, w = height
+float4 AOParams;            // x = radius, y = bias, z = intensity, w = max radius in half res pixels
+float4 AOParams2;           // x = projection scale in half res pixels, y = 1 / radius^2, z = blur sharpness, w = upsample epsilon
+float2 AOBlurDirection;
+
+texture SceneTexture;       // resolved back buffer
+texture CoCTexture;         // signed CoC in pixels, negative in the near field
+texture TileTexture;        // x = max |CoC|, y = max near CoC per 16x16 tile
+float4 DOFCoCParams;        // x = scale, y = bias (CoC = depth * x + y), z = max CoC, w = near field ramp in pixels
+float4 TileTexelSize;       // x = 1 / width, y = 1 / height, z = width, w = height
+float4 QuarterTexelSize;
+
+texture LowDepthTexture;    // reduced resolution view z
+texture LowSignalTexture;   // reduced resolution signal to upsample
+float4 LowTexelSize;        // x = 1 / width, y = 1 / height, z = width, w = height
+float4 UpsampleParams;      // x = 1 / factor, y = bilateral epsilon, z = nearest depth threshold relative to z
+
+texture ShadowTexture;      // light space INTZ / RAWZ depth
+float4x4 ViewToShadow;      // camera view space to light clip space
+float4x4 ShadowWorldViewProj;
+float4 ShadowParams;        // x = depth bias, y = shadowed intensity, z = half texel
+
+texture ReduceTexture;      // previous level of the depth range reduction, x = min view z, y = max view z
+float4 ReduceSourceSize;    // x = 1 / width, y = 1 / height, z = width, w = height of the level being reduced
+
 sampler DepthSampler = 
 sampler_state
 {
@@ -20,6 +57,161 @@ sampler_state
     AddressV = Clamp;
 };
 
+sampler DepthPointSampler = 
+sampler_state
+{
+    Texture = <DepthTargetTexture>;
+    MinFilter = POINT;
+    MagFilter = POINT;
+
+    AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+sampler DisplaySampler = 
+sampler_state
+{
+    Texture = <DisplayTexture>;
+    MinFilter = LINEAR;
+    MagFilter = LINEAR;
+
+    AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+sampler HalfDepthSampler = 
+sampler_state
+{
+    Texture = <HalfDepthTexture>;
+    MinFilter = POINT;
+    MagFilter = POINT;
+    MipFilter = NONE;
+
+    AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+sampler AOSampler = 
+sampler_state
+{
+    Texture = <AOTexture>;
+    MinFilter = POINT;
+    MagFilter = POINT;
+    MipFilter = NONE;
+
+    AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+sampler AORotationSampler = 
+sampler_state
+{
+    Texture = <AORotationTexture>;
+    MinFilter = POINT;
+    MagFilter = POINT;
+    MipFilter = NONE;
+
+    AddressU = Wrap;
+    AddressV = Wrap;
+};
+
+sampler SceneSampler = 
+sampler_state
+{
+    Texture = <SceneTexture>;
+    MinFilter = POINT;
+    MagFilter = POINT;
+    MipFilter = NONE;
+
+    AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+sampler CoCSampler = 
+sampler_state
+{
+    Texture = <CoCTexture>;
+    MinFilter = POINT;
+    MagFilter = POINT;
+    MipFilter = NONE;
+
+    AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+sampler TileSampler = 
+sampler_state
+{
+    Texture = <TileTexture>;
+    MinFilter = POINT;
+    MagFilter = POINT;
+    MipFilter = NONE;
+
+    AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+sampler LowDepthSampler = 
+sampler_state
+{
+    Texture = <LowDepthTexture>;
+    MinFilter = POINT;
+    MagFilter = POINT;
+    MipFilter = NONE;
+
+    AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+sampler LowSignalSampler = 
+sampler_state
+{
+    Texture = <LowSignalTexture>;
+    MinFilter = POINT;
+    MagFilter = POINT;
+    MipFilter = NONE;
+
+    AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+sampler ShadowPointSampler = 
+sampler_state
+{
+    Texture = <ShadowTexture>;
+    MinFilter = POINT;
+    MagFilter = POINT;
+    MipFilter = NONE;
+
+    AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+sampler ReduceSampler = 
+sampler_state
+{
+    Texture = <ReduceTexture>;
+    MinFilter = POINT;
+    MagFilter = POINT;
+    MipFilter = NONE;
+
+    AddressU = Clamp;
+    AddressV = Clamp;
+};
+
+//--------------------------------------------------------------------------------------
+// Quads are given in pixel coordinates (PPVERT), this maps them to clip space.
+// drawQuad() has already moved them by the D3D9 half pixel, so every pixel
+// center interpolates to its texel center.
+//--------------------------------------------------------------------------------------
+void VSQuad( in float4 Position : POSITION, in float2 UV : TEXCOORD0, in float2 UV2 : TEXCOORD1,
+    out float4 oPosition : POSITION, out float2 oUV : TEXCOORD0, out float2 oUV2 : TEXCOORD1 )
+{
+    oPosition = float4( Position.x / TargetSize.x * 2.0 - 1.0,
+        1.0 - Position.y / TargetSize.y * 2.0, Position.z, 1.0 );
+    oUV = UV;
+    oUV2 = UV2;
+}
 
 float4 RenderUnmodified( in float2 OriginalUV : TEXCOORD0 ) : COLOR 
 {
@@ -30,6 +222,7 @@ technique ShowUnmodified
 {
     pass P0
     {        
+        VertexShader = compile vs_2_0 VSQuad();
         PixelShader = compile ps_2_0 RenderUnmodified();
     }
 }
@@ -57,6 +250,789 @@ technique ShowUnmodifiedRAWZ
 {
     pass P0
     {        
+        VertexShader = compile vs_2_0 VSQuad();
         PixelShader = compile ps_2_0 RenderUnmodified();
     }
-}
\ No newline at end of file
+}
+
+//--------------------------------------------------------------------------------------
+// Depth helpers shared by the depth consuming techniques
+//--------------------------------------------------------------------------------------
+float DecodeRAWZ( float4 rawz )
+{
+    float3 rawval = floor( 255.0 * rawz.arg + 0.5 );
+    return dot( rawval, float3(0.996093809371817670572857294849, 
+        0.0038909914428586627756752238080039, 
+        1.5199185323666651467481343000015e-5) / 255.0 );
+}
+
+float FetchDepth( float2 uv, uniform bool rawz )
+{
+    if (rawz)
+    {
+        return DecodeRAWZ( tex2Dlod(DepthPointSampler, float4(uv, 0, 0)) );
+    }
+    return tex2Dlod(DepthPointSampler, float4(uv, 0, 0)).r;
+}
+
+float LinearizeDepth( float z )
+{
+    return ProjParams.x * ProjParams.y / (ProjParams.y - z * (ProjParams.y - ProjParams.x));
+}
+
+bool IsForeground( float z )
+{
+    return ClearDepth > 0.5 ? z < ClearDepth : z > ClearDepth;
+}
+
+float3 ViewPosition( float2 uv, float viewZ )
+{
+    return float3( (uv.x * 2.0 - 1.0) * ProjParams.z, (1.0 - uv.y * 2.0) * ProjParams.w, 1.0 ) * viewZ;
+}
+
+//--------------------------------------------------------------------------------------
+// Decodes the depth texture into a R32F target for the CPU readback
+//--------------------------------------------------------------------------------------
+float4 RenderCopyDepth( in float2 OriginalUV : TEXCOORD0, uniform bool rawz ) : COLOR 
+{
+    return FetchDepth( OriginalUV, rawz );
+}
+
+technique CopyDepth
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderCopyDepth( false );
+    }
+}
+
+technique CopyDepthRAWZ
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderCopyDepth( true );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Depth discontinuity edge mask. Same second derivative test as EdgeMask.cpp,
+// creases use one sided normals on each side of the pixel instead of the
+// neighbours' central difference normals.
+//--------------------------------------------------------------------------------------
+float4 RenderEdgeMask( in float2 OriginalUV : TEXCOORD0, uniform bool rawz ) : COLOR 
+{
+    float2 dx = float2( DepthTexelSize.x, 0 );
+    float2 dy = float2( 0, DepthTexelSize.y );
+
+    float c = LinearizeDepth( FetchDepth( OriginalUV, rawz ) );
+    float l = LinearizeDepth( FetchDepth( OriginalUV - dx, rawz ) );
+    float r = LinearizeDepth( FetchDepth( OriginalUV + dx, rawz ) );
+    float u = LinearizeDepth( FetchDepth( OriginalUV - dy, rawz ) );
+    float d = LinearizeDepth( FetchDepth( OriginalUV + dy, rawz ) );
+
+    float dd = max( abs(l + r - 2.0 * c), abs(u + d - 2.0 * c) );
+    float edge = dd > EdgeThreshold * c;
+
+    float3 pc = ViewPosition( OriginalUV, c );
+    float3 n0 = normalize( cross( ViewPosition( OriginalUV + dx, r ) - pc, ViewPosition( OriginalUV + dy, d ) - pc ) );
+    float3 n1 = normalize( cross( pc - ViewPosition( OriginalUV - dx, l ), pc - ViewPosition( OriginalUV - dy, u ) ) );
+    edge = max( edge, dot( n0, n1 ) < EdgeNormalThreshold );
+
+    return edge;
+}
+
+technique EdgeMask
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderEdgeMask( false );
+    }
+}
+
+technique EdgeMaskRAWZ
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderEdgeMask( true );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Shows DisplayTexture, used for the outputs of the post-process passes
+//--------------------------------------------------------------------------------------
+float4 RenderShowTexture( in float2 OriginalUV : TEXCOORD0 ) : COLOR 
+{
+    return tex2D(DisplaySampler, OriginalUV);
+}
+
+technique ShowTexture
+{
+    pass P0
+    {        
+        VertexShader = compile vs_2_0 VSQuad();
+        PixelShader = compile ps_2_0 RenderShowTexture();
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// SSAO. AmbientOcclusion.cpp mirrors these shaders operation by operation,
+// keep both in sync.
+//--------------------------------------------------------------------------------------
+static const float3 AOKernel[8] =
+{
+    float3(  1.0,          0.0,          0.125 ),
+    float3(  0.70710678,   0.70710678,   0.25 ),
+    float3(  0.0,          1.0,          0.375 ),
+    float3( -0.70710678,   0.70710678,   0.5 ),
+    float3( -1.0,          0.0,          0.625 ),
+    float3( -0.70710678,  -0.70710678,   0.75 ),
+    float3(  0.0,         -1.0,          0.875 ),
+    float3(  0.70710678,  -0.70710678,   1.0 ),
+};
+
+static const float AOBlurWeights[5] = { 1.0, 0.8824969, 0.6065307, 0.3246525, 0.1353353 };
+
+float HalfDepthAt( float2 pix )
+{
+    pix = clamp( pix, 0, HalfTexelSize.zw - 1.0 );
+    return tex2Dlod( HalfDepthSampler, float4( (pix + 0.5) * HalfTexelSize.xy, 0, 0 ) ).r;
+}
+
+float3 HalfPosAt( float2 pix )
+{
+    pix = clamp( pix, 0, HalfTexelSize.zw - 1.0 );
+    float2 uv = (pix + 0.5) * HalfTexelSize.xy;
+    return ViewPosition( uv, tex2Dlod( HalfDepthSampler, float4( uv, 0, 0 ) ).r );
+}
+
+float AOAt( float2 pix )
+{
+    return tex2Dlod( AOSampler, float4( (pix + 0.5) * HalfTexelSize.xy, 0, 0 ) ).r;
+}
+
+// Nearest of each 2x2 quad in view space
+float4 RenderSSAODownsample( in float2 OriginalUV : TEXCOORD0, uniform bool rawz ) : COLOR 
+{
+    float2 pix = floor( OriginalUV * HalfTexelSize.zw );
+    float2 p0 = pix * 2.0;
+    float2 p1 = min( p0 + 1.0, DepthTexelSize.zw - 1.0 );
+
+    float z00 = LinearizeDepth( FetchDepth( (float2(p0.x, p0.y) + 0.5) * DepthTexelSize.xy, rawz ) );
+    float z10 = LinearizeDepth( FetchDepth( (float2(p1.x, p0.y) + 0.5) * DepthTexelSize.xy, rawz ) );
+    float z01 = LinearizeDepth( FetchDepth( (float2(p0.x, p1.y) + 0.5) * DepthTexelSize.xy, rawz ) );
+    float z11 = LinearizeDepth( FetchDepth( (float2(p1.x, p1.y) + 0.5) * DepthTexelSize.xy, rawz ) );
+    return min( min(z00, z10), min(z01, z11) );
+}
+
+float4 RenderSSAO( in float2 OriginalUV : TEXCOORD0 ) : COLOR 
+{
+    float2 pix = floor( OriginalUV * HalfTexelSize.zw );
+    float3 p  = HalfPosAt( pix );
+    float3 pl = HalfPosAt( pix - float2(1, 0) );
+    float3 pr = HalfPosAt( pix + float2(1, 0) );
+    float3 pu = HalfPosAt( pix - float2(0, 1) );
+    float3 pd = HalfPosAt( pix + float2(0, 1) );
+
+    // Pick the smoother side so the normal does not straddle a discontinuity
+    bool useRight = (abs(pr.z - p.z) < abs(p.z - pl.z) && pix.x < HalfTexelSize.z - 1.0) || pix.x < 1.0;
+    bool useDown = (abs(pd.z - p.z) < abs(p.z - pu.z) && pix.y < HalfTexelSize.w - 1.0) || pix.y < 1.0;
+    float3 tx = useRight ? pr - p : p - pl;
+    float3 ty = useDown ? pd - p : p - pu;
+    float3 n = cross( tx, ty );
+    n *= 1.0 / sqrt( dot(n, n) );
+
+    float2 rotation = tex2Dlod( AORotationSampler, float4( (pix + 0.5) * 0.25, 0, 0 ) ).rg;
+    float radiusPixels = min( AOParams.x * AOParams2.x / p.z, AOParams.w );
+
+    float occlusion = 0.0;
+    [unroll]
+    for (int i = 0; i < 8; ++i)
+    {
+        float distance = AOKernel[i].z * radiusPixels;
+        float2 offset = float2( AOKernel[i].x * rotation.x - AOKernel[i].y * rotation.y,
+            AOKernel[i].x * rotation.y + AOKernel[i].y * rotation.x ) * distance;
+        float3 v = HalfPosAt( floor( pix + 0.5 + offset ) ) - p;
+        float d2 = dot( v, v );
+        occlusion += saturate( dot(n, v) / sqrt(d2 + 1e-6) - AOParams.y ) * saturate( 1.0 - d2 * AOParams2.y );
+    }
+
+    float ao = saturate( 1.0 - AOParams.z * occlusion / 8.0 );
+    return float4( ao, ao, ao, 1.0 );
+}
+
+float4 RenderSSAOBlur( in float2 OriginalUV : TEXCOORD0 ) : COLOR 
+{
+    float2 pix = floor( OriginalUV * HalfTexelSize.zw );
+    float z0 = HalfDepthAt( pix );
+    float sharpness = AOParams2.z / z0;
+    float sum = AOAt( pix ) * AOBlurWeights[0];
+    float weightSum = AOBlurWeights[0];
+
+    [unroll]
+    for (int k = 1; k <= 4; ++k)
+    {
+        [unroll]
+        for (int side = -1; side <= 1; side += 2)
+        {
+            float2 tap = clamp( pix + side * k * AOBlurDirection, 0, HalfTexelSize.zw - 1.0 );
+            float w = AOBlurWeights[k] * saturate( 1.0 - abs(HalfDepthAt( tap ) - z0) * sharpness );
+            sum += AOAt( tap ) * w;
+            weightSum += w;
+        }
+    }
+
+    float ao = sum / weightSum;
+    return float4( ao, ao, ao, 1.0 );
+}
+
+float4 RenderSSAOUpsample( in float2 OriginalUV : TEXCOORD0, uniform bool rawz ) : COLOR 
+{
+    float2 pix = floor( OriginalUV * DepthTexelSize.zw );
+    float z = LinearizeDepth( FetchDepth( (pix + 0.5) * DepthTexelSize.xy, rawz ) );
+
+    float2 low = (pix + 0.5) * 0.5 - 0.5;
+    float2 base = floor( low );
+    float2 f = low - base;
+    float2 p0 = clamp( base, 0, HalfTexelSize.zw - 1.0 );
+    float2 p1 = clamp( base + 1.0, 0, HalfTexelSize.zw - 1.0 );
+
+    float2 taps[4] = { float2(p0.x, p0.y), float2(p1.x, p0.y), float2(p0.x, p1.y), float2(p1.x, p1.y) };
+    float bilinear[4] = { (1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y };
+
+    float sum = 0.0;
+    float weightSum = 0.0;
+    [unroll]
+    for (int i = 0; i < 4; ++i)
+    {
+        float w = bilinear[i] / (AOParams2.w + abs(HalfDepthAt( taps[i] ) - z));
+        sum += AOAt( taps[i] ) * w;
+        weightSum += w;
+    }
+
+    float ao = sum / weightSum;
+    return float4( ao, ao, ao, 1.0 );
+}
+
+technique SSAODownsample
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderSSAODownsample( false );
+    }
+}
+
+technique SSAODownsampleRAWZ
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderSSAODownsample( true );
+    }
+}
+
+technique SSAOCompute
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderSSAO();
+    }
+}
+
+technique SSAOBlur
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderSSAOBlur();
+    }
+}
+
+technique SSAOUpsample
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderSSAOUpsample( false );
+    }
+}
+
+technique SSAOUpsampleRAWZ
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderSSAOUpsample( true );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Depth of field setup. DepthOfField.cpp is the CPU reference of DOFCoC and
+// DOFTileMax / DOFTileDilate.
+//--------------------------------------------------------------------------------------
+float CoCAt( float2 pix )
+{
+    pix = clamp( pix, 0, DepthTexelSize.zw - 1.0 );
+    return tex2Dlod( CoCSampler, float4( (pix + 0.5) * DepthTexelSize.xy, 0, 0 ) ).r;
+}
+
+// CoC is affine in hardware depth, see DepthOfField::cocTransform
+float4 RenderDOFCoC( in float2 OriginalUV : TEXCOORD0, uniform bool rawz ) : COLOR 
+{
+    float coc = FetchDepth( OriginalUV, rawz ) * DOFCoCParams.x + DOFCoCParams.y;
+    return clamp( coc, -DOFCoCParams.z, DOFCoCParams.z );
+}
+
+float4 RenderDOFTileMax( in float2 OriginalUV : TEXCOORD0 ) : COLOR 
+{
+    float2 base = floor( OriginalUV * TileTexelSize.zw ) * 16.0;
+    float maxAbs = 0.0;
+    float minSigned = 0.0;
+    for (int y = 0; y < 16; ++y)
+    {
+        for (int x = 0; x < 16; ++x)
+        {
+            float coc = CoCAt( base + float2(x, y) );
+            maxAbs = max( maxAbs, abs(coc) );
+            minSigned = min( minSigned, coc );
+        }
+    }
+    return float4( maxAbs, -minSigned, 0.0, 0.0 );
+}
+
+float4 RenderDOFTileDilate( in float2 OriginalUV : TEXCOORD0 ) : COLOR 
+{
+    float2 tile = floor( OriginalUV * TileTexelSize.zw );
+    float2 result = 0.0;
+    [unroll]
+    for (int y = -1; y <= 1; ++y)
+    {
+        [unroll]
+        for (int x = -1; x <= 1; ++x)
+        {
+            float2 t = clamp( tile + float2(x, y), 0, TileTexelSize.zw - 1.0 );
+            result = max( result, tex2Dlod( TileSampler, float4( (t + 0.5) * TileTexelSize.xy, 0, 0 ) ).rg );
+        }
+    }
+    return float4( result, 0.0, 0.0 );
+}
+
+// COLOR0 = near field, premultiplied by its coverage in alpha
+// COLOR1 = far field, alpha holds the mean far CoC relative to the max CoC
+void RenderDOFSplit( in float2 OriginalUV : TEXCOORD0, out float4 oNear : COLOR0, out float4 oFar : COLOR1 )
+{
+    float2 base = floor( OriginalUV * QuarterTexelSize.zw ) * 4.0;
+    float2 tileUV = (floor( base / 16.0 ) + 0.5) * TileTexelSize.xy;
+
+    float4 nearSum = 0.0;
+    float4 farSum = 0.0;
+    float farCoC = 0.0;
+
+    // Tiles with no near CoC around them skip the near weights entirely
+    bool hasNear = tex2Dlod( TileSampler, float4( tileUV, 0, 0 ) ).g > 0.0;
+
+    [unroll]
+    for (int y = 0; y < 4; ++y)
+    {
+        [unroll]
+        for (int x = 0; x < 4; ++x)
+        {
+            float2 pix = clamp( base + float2(x, y), 0, DepthTexelSize.zw - 1.0 );
+            float2 uv = (pix + 0.5) * DepthTexelSize.xy;
+            float3 color = tex2Dlod( SceneSampler, float4( uv, 0, 0 ) ).rgb;
+            float coc = tex2Dlod( CoCSampler, float4( uv, 0, 0 ) ).r;
+
+            float nearWeight = hasNear ? saturate( -coc / DOFCoCParams.w ) : 0.0;
+            float farWeight = coc >= 0.0;
+            nearSum += float4( color, 1.0 ) * nearWeight;
+            farSum += float4( color, 1.0 ) * farWeight;
+            farCoC += coc * farWeight;
+        }
+    }
+
+    oNear = nearSum / 16.0;
+    oFar = farSum.a > 0.0 ? float4( farSum.rgb / farSum.a, farCoC / (farSum.a * DOFCoCParams.z) ) : 0.0;
+}
+
+// Far CoC in red, near CoC in green
+float4 RenderShowCoC( in float2 OriginalUV : TEXCOORD0 ) : COLOR 
+{
+    float coc = tex2D( CoCSampler, OriginalUV ).r / DOFCoCParams.z;
+    return float4( saturate(coc), saturate(-coc), 0.0, 1.0 );
+}
+
+technique DOFCoC
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDOFCoC( false );
+    }
+}
+
+technique DOFCoCRAWZ
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDOFCoC( true );
+    }
+}
+
+technique DOFTileMax
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDOFTileMax();
+    }
+}
+
+technique DOFTileDilate
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDOFTileDilate();
+    }
+}
+
+technique DOFSplit
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDOFSplit();
+    }
+}
+
+technique ShowCoC
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderShowCoC();
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Depth aware upsample of LowSignalTexture by 2x or 4x. DepthUpsample.cpp is the
+// CPU version, keep both in sync.
+//--------------------------------------------------------------------------------------
+float4 RenderDepthUpsample( in float2 OriginalUV : TEXCOORD0, uniform bool rawz, uniform bool nearest ) : COLOR 
+{
+    float2 pix = floor( OriginalUV * DepthTexelSize.zw );
+    float z = LinearizeDepth( FetchDepth( (pix + 0.5) * DepthTexelSize.xy, rawz ) );
+
+    float2 low = (pix + 0.5) * UpsampleParams.x - 0.5;
+    float2 base = floor( low );
+    float2 f = low - base;
+    float2 p0 = clamp( base, 0, LowTexelSize.zw - 1.0 );
+    float2 p1 = clamp( base + 1.0, 0, LowTexelSize.zw - 1.0 );
+
+    float2 taps[4] = { float2(p0.x, p0.y), float2(p1.x, p0.y), float2(p0.x, p1.y), float2(p1.x, p1.y) };
+    float bilinear[4] = { (1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y };
+
+    float4 sum = 0.0;
+    float weightSum = 0.0;
+    float4 best = 0.0;
+    float bestDz = 1e30;
+    float maxDz = 0.0;
+    [unroll]
+    for (int i = 0; i < 4; ++i)
+    {
+        float4 uv = float4( (taps[i] + 0.5) * LowTexelSize.xy, 0, 0 );
+        float4 signal = tex2Dlod( LowSignalSampler, uv );
+        float dz = abs( tex2Dlod( LowDepthSampler, uv ).r - z );
+        float w = nearest ? bilinear[i] : bilinear[i] / (UpsampleParams.y + dz);
+        sum += signal * w;
+        weightSum += w;
+
+        if (dz < bestDz)
+        {
+            best = signal;
+            bestDz = dz;
+        }
+        maxDz = max( maxDz, dz );
+    }
+
+    float4 result = sum / weightSum;
+    if (nearest && maxDz >= UpsampleParams.z * z)
+    {
+        result = best;
+    }
+    return result;
+}
+
+technique DepthUpsampleBilateral
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDepthUpsample( false, false );
+    }
+}
+
+technique DepthUpsampleBilateralRAWZ
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDepthUpsample( true, false );
+    }
+}
+
+technique DepthUpsampleNearest
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDepthUpsample( false, true );
+    }
+}
+
+technique DepthUpsampleNearestRAWZ
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDepthUpsample( true, true );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Shadow map. The depth only pass renders straight into the readable depth
+// texture, ShadowCasterFloat is the R32F color target path kept for comparison.
+//--------------------------------------------------------------------------------------
+float FetchShadowDepth( float2 uv, uniform bool rawz )
+{
+    if (rawz)
+    {
+        return DecodeRAWZ( tex2Dlod(ShadowPointSampler, float4(uv, 0, 0)) );
+    }
+    return tex2Dlod(ShadowPointSampler, float4(uv, 0, 0)).r;
+}
+
+void VSShadowCaster( in float4 Position : POSITION, out float4 oPosition : POSITION, out float oDepth : TEXCOORD0 )
+{
+    oPosition = mul( Position, ShadowWorldViewProj );
+    oDepth = oPosition.z / oPosition.w;
+}
+
+float4 RenderShadowCasterFloat( in float Depth : TEXCOORD0 ) : COLOR 
+{
+    return Depth;
+}
+
+// Lit pixels are white, background is never shadowed
+float4 RenderShadowMask( in float2 OriginalUV : TEXCOORD0, uniform bool rawz ) : COLOR 
+{
+    float z = FetchDepth( OriginalUV, rawz );
+    float4 shadowPos = mul( float4( ViewPosition( OriginalUV, LinearizeDepth( z ) ), 1.0 ), ViewToShadow );
+    shadowPos.xyz /= shadowPos.w;
+    // D3D9 samples pixel i at screen position i, which is texel i only after the half texel shift
+    float2 shadowUV = shadowPos.xy * float2( 0.5, -0.5 ) + 0.5 + ShadowParams.z;
+
+    float lit = 1.0;
+    if (IsForeground( z ) && all( saturate( shadowUV ) == shadowUV ))
+    {
+        lit = shadowPos.z - ShadowParams.x > FetchShadowDepth( shadowUV, rawz ) ? ShadowParams.y : 1.0;
+    }
+    return float4( lit, lit, lit, 1.0 );
+}
+
+technique ShadowCasterFloat
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSShadowCaster();
+        PixelShader = compile ps_3_0 RenderShadowCasterFloat();
+    }
+}
+
+technique ShadowMask
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderShadowMask( false );
+    }
+}
+
+technique ShadowMaskRAWZ
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderShadowMask( true );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Depth range reduction for the shadow cascades, 4x4 texels per output texel
+// down to 1x1. The cleared background is left out of the range.
+//--------------------------------------------------------------------------------------
+float4 RenderDepthRange( in float2 OriginalUV : TEXCOORD0, uniform bool rawz, uniform bool first ) : COLOR 
+{
+    float2 base = floor( OriginalUV * ceil( ReduceSourceSize.zw / 4.0 ) ) * 4.0;
+    float2 range = float2( 1e30, 0.0 );
+    [unroll]
+    for (int y = 0; y < 4; ++y)
+    {
+        [unroll]
+        for (int x = 0; x < 4; ++x)
+        {
+            float2 uv = (min( base + float2(x, y), ReduceSourceSize.zw - 1.0 ) + 0.5) * ReduceSourceSize.xy;
+            if (first)
+            {
+                float z = FetchDepth( uv, rawz );
+                if (IsForeground( z ))
+                {
+                    float viewZ = LinearizeDepth( z );
+                    range = float2( min( range.x, viewZ ), max( range.y, viewZ ) );
+                }
+            }
+            else
+            {
+                float2 level = tex2Dlod( ReduceSampler, float4( uv, 0, 0 ) ).rg;
+                range = float2( min( range.x, level.x ), max( range.y, level.y ) );
+            }
+        }
+    }
+    return float4( range, 0.0, 0.0 );
+}
+
+technique DepthRangeFirst
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDepthRange( false, true );
+    }
+}
+
+technique DepthRangeFirstRAWZ
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDepthRange( true, true );
+    }
+}
+
+technique DepthRangeReduce
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuad();
+        PixelShader = compile ps_3_0 RenderDepthRange( false, false );
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// Main pass from the compact vertices of VertexQuantizer.h, shaded as the fixed
+// function pipeline does with D3DRS_AMBIENT alone: the lit color is the same
+// for every vertex, texture stage 0 modulates the texture with it.
+//--------------------------------------------------------------------------------------
+texture MeshTexture;
+float4x4 QuantizedWorldViewProj;
+float3 PositionOffset;      // center of the subset bounds
+float3 PositionScale;       // half extent of the subset bounds
+float2 TexcoordOffset;      // texture coordinate bounds likewise, packed formats only
+float2 TexcoordScale;
+float4 MaterialColor;       // rgb = saturate(emissive + ambient * D3DRS_AMBIENT), a = diffuse alpha
+bool   MeshTextured;
+int    MeshFilter = 1;      // D3DTEXF_POINT or D3DTEXF_LINEAR, the stage 0 filter of SetTextureFilter()
+
+sampler MeshSampler = 
+sampler_state
+{
+    Texture = <MeshTexture>;
+    MinFilter = <MeshFilter>;
+    MagFilter = <MeshFilter>;
+    MipFilter = NONE;
+
+    AddressU = Wrap;
+    AddressV = Wrap;
+};
+
+// Unit normal from octahedral coordinates in [-1, 1]
+float3 DecodeOctahedral( float2 e )
+{
+    float3 n = float3( e, 1.0 - abs( e.x ) - abs( e.y ) );
+    float t = saturate( -n.z );
+    n.xy += n.xy >= 0.0 ? -t : t;
+    return normalize( n );
+}
+
+// Two 255 level values packed as x + 255 y - 32512 into the SHORT4N w
+float3 DecodeOctahedral8( float packedSnorm )
+{
+    float packed = floor( packedSnorm * 32767.0 + 0.5 ) + 32512.0;
+    float high = floor( packed / 255.0 );
+    return DecodeOctahedral( (float2( packed - high * 255.0, high ) - 127.0) / 127.0 );
+}
+
+void VSQuantizedMesh( in float4 Position : POSITION, in float2 Normal : NORMAL, in float2 UV : TEXCOORD0,
+                      out float4 oPosition : POSITION, out float2 oUV : TEXCOORD0, out float3 oNormal : TEXCOORD1,
+                      uniform bool packed, uniform bool oct16 )
+{
+    float3 position = Position.xyz;
+    oUV = UV;
+    if (packed)
+    {
+        // SHORT4 words: x, y, z in the top 14 bits, u in the top 11 bits of w,
+        // v from the low 5 bits of w and the low 2 bits of z, y and x
+        float4 word = Position + 32768.0;
+        float3 high = floor( word.xyz * 0.25 );
+        float3 low = word.xyz - high * 4.0;
+        float u = floor( word.w * ( 1.0 / 32.0 ) );
+        float v = ( word.w - u * 32.0 ) * 64.0 + dot( low, float3( 1.0, 4.0, 16.0 ) );
+        position = ( high - 8191.0 ) / 8191.0;
+        oUV = TexcoordOffset + TexcoordScale * ( ( float2( u, v ) - 1023.0 ) / 1023.0 );
+    }
+    oPosition = mul( float4( PositionOffset + PositionScale * position, 1.0 ), QuantizedWorldViewProj );
+    oNormal = oct16 ? DecodeOctahedral( Normal ) : packed ? float3( 0.0, 0.0, 1.0 ) : DecodeOctahedral8( Position.w );
+}
+
+float4 RenderQuantizedMesh( in float2 UV : TEXCOORD0 ) : COLOR 
+{
+    if (MeshTextured)
+    {
+        float4 texel = tex2D( MeshSampler, UV );
+        return float4( texel.rgb * MaterialColor.rgb, texel.a );
+    }
+    return MaterialColor;
+}
+
+technique QuantizedMesh
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuantizedMesh( false, false );
+        PixelShader = compile ps_3_0 RenderQuantizedMesh();
+    }
+}
+
+technique QuantizedMeshPacked
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuantizedMesh( true, false );
+        PixelShader = compile ps_3_0 RenderQuantizedMesh();
+    }
+}
+
+technique QuantizedMeshOct16
+{
+    pass P0
+    {        
+        VertexShader = compile vs_3_0 VSQuantizedMesh( true, true );
+        PixelShader = compile ps_3_0 RenderQuantizedMesh();
+    }
+}
@@ -0,0 +1,319 @@
+//-----------------------------------------------------------------------------
+// File: EdgeMask.cpp
+//-----------------------------------------------------------------------------
+#include "EdgeMask.h"
+
+//--------------------------------------------------------------------------------------
+// Next run of tiles in row ty from tx on that are dirty, or have a dirty
+// neighbour with around, false when the row has none left
+static bool nextDirtyRun(const DepthChange& change, int ty, bool around, int& tx, int& runEnd)
+{
+	while (tx < change.getTilesX() && !(around ? change.isDirtyAround(tx, ty) : change.isDirty(tx, ty)))
+	{
+		++tx;
+	}
+	runEnd = tx;
+	while (runEnd < change.getTilesX() && (around ? change.isDirtyAround(runEnd, ty) : change.isDirty(runEnd, ty)))
+	{
+		++runEnd;
+	}
+	return tx < runEnd;
+}
+
+//--------------------------------------------------------------------------------------
+EdgeMask::EdgeMask()
+	: m_mask( NULL )
+	, m_edgePixels( NULL )
+	, m_linear( NULL )
+	, m_normals( NULL )
+	, m_width( 0 )
+	, m_height( 0 )
+	, m_wordsPerRow( 0 )
+	, m_linearPitch( 0 )
+	, m_normalPitch( 0 )
+	, m_edgeCount( 0 )
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+EdgeMask::~EdgeMask()
+{
+	alignedFree(m_mask);
+	alignedFree(m_edgePixels);
+	alignedFree(m_linear);
+	alignedFree(m_normals);
+}
+
+//--------------------------------------------------------------------------------------
+// True when the buffers were reallocated and hold nothing yet
+bool EdgeMask::allocate(int width, int height)
+{
+	if (width == m_width && height == m_height)
+	{
+		return false;
+	}
+	alignedFree(m_mask);
+	alignedFree(m_edgePixels);
+	alignedFree(m_linear);
+	alignedFree(m_normals);
+
+	m_width = width;
+	m_height = height;
+	m_wordsPerRow = (width + 31) >> 5;
+	// four floats of guard band on the left keep the row start aligned
+	m_linearPitch = ((width + 3) & ~3) + 8;
+	m_normalPitch = ((width + 3) & ~3) + 4;
+
+	m_mask = (uint32_t*)alignedAlloc(sizeof(uint32_t) * m_wordsPerRow * height, 16);
+	m_edgePixels = (uint32_t*)alignedAlloc(sizeof(uint32_t) * width * height, 16);
+	m_linear = (float*)alignedAlloc(sizeof(float) * m_linearPitch * (height + 2), 16);
+	m_normals = (float*)alignedAlloc(sizeof(float) * m_normalPitch * 6, 16);
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// The guard rows above and below are left to build()
+void EdgeMask::linearize(const DepthImage& depth, const DepthProjection& projection, int x0, int x1, int y0, int y1)
+{
+	const int alignedWidth = (m_width + 3) & ~3;
+	const int end = x1 == m_width ? alignedWidth : x1;
+	for (int y = y0; y < y1; ++y)
+	{
+		float* dst = m_linear + (y + 1) * m_linearPitch + 4;
+		linearizeRow(depth.row(y) + x0, dst + x0, end - x0, projection);
+
+		// replicate the border so the derivatives vanish outside the image
+		if (x0 == 0)
+		{
+			dst[-1] = dst[0];
+		}
+		if (x1 == m_width)
+		{
+			for (int x = m_width; x < alignedWidth + 4; ++x)
+			{
+				dst[x] = dst[m_width - 1];
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// View space normal from central differences of the reconstructed positions
+void EdgeMask::buildNormalRow(int y, float* normals, const DepthProjection& projection, int x0, int x1)
+{
+	const float* center = m_linear + (y + 1) * m_linearPitch + 4;
+	const float* up = center - m_linearPitch;
+	const float* down = center + m_linearPitch;
+
+	const float du = 2.0f / (m_width * projection.scaleX);
+	const float dv = 2.0f / (m_height * projection.scaleY);
+	const float v = (1.0f - (y + 0.5f) * 2.0f / m_height) / projection.scaleY;
+
+	const __m128 vUp = _mm_set1_ps(v + dv);
+	const __m128 vDown = _mm_set1_ps(v - dv);
+	const __m128 vCenter = _mm_set1_ps(v);
+	const __m128 du4 = _mm_set1_ps(du);
+	const __m128 eps = _mm_set1_ps(1e-20f);
+	// not stepped, so a span gives the normals the whole row would
+	const __m128 uLane = _mm_sub_ps(_mm_setr_ps(0.5f * du, 1.5f * du, 2.5f * du, 3.5f * du), _mm_set1_ps(1.0f / projection.scaleX));
+
+	float* nx = normals;
+	float* ny = normals + m_normalPitch;
+	float* nz = normals + 2 * m_normalPitch;
+
+	for (int x = x0; x < x1; x += 4)
+	{
+		const __m128 u = _mm_add_ps(uLane, _mm_set1_ps(x * du));
+		const __m128 lL = _mm_loadu_ps(center + x - 1);
+		const __m128 lR = _mm_loadu_ps(center + x + 1);
+		const __m128 lU = _mm_load_ps(up + x);
+		const __m128 lD = _mm_load_ps(down + x);
+
+		const __m128 tx_x = _mm_sub_ps(_mm_mul_ps(lR, _mm_add_ps(u, du4)), _mm_mul_ps(lL, _mm_sub_ps(u, du4)));
+		const __m128 tx_z = _mm_sub_ps(lR, lL);
+		const __m128 tx_y = _mm_mul_ps(vCenter, tx_z);
+		const __m128 ty_z = _mm_sub_ps(lD, lU);
+		const __m128 ty_x = _mm_mul_ps(u, ty_z);
+		const __m128 ty_y = _mm_sub_ps(_mm_mul_ps(lD, vDown), _mm_mul_ps(lU, vUp));
+
+		__m128 cx = _mm_sub_ps(_mm_mul_ps(tx_y, ty_z), _mm_mul_ps(tx_z, ty_y));
+		__m128 cy = _mm_sub_ps(_mm_mul_ps(tx_z, ty_x), _mm_mul_ps(tx_x, ty_z));
+		__m128 cz = _mm_sub_ps(_mm_mul_ps(tx_x, ty_y), _mm_mul_ps(tx_y, ty_x));
+		__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy)), _mm_mul_ps(cz, cz));
+		const __m128 invLen = _mm_rsqrt_ps(_mm_max_ps(len2, eps));
+
+		_mm_store_ps(nx + x, _mm_mul_ps(cx, invLen));
+		_mm_store_ps(ny + x, _mm_mul_ps(cy, invLen));
+		_mm_store_ps(nz + x, _mm_mul_ps(cz, invLen));
+	}
+	if (x1 < m_width)
+	{
+		return;
+	}
+	// replicate the last normal into the guard lane used by the right neighbour
+	const int last = m_width - 1;
+	for (int x = m_width; x < m_normalPitch; ++x)
+	{
+		nx[x] = nx[last];
+		ny[x] = ny[last];
+		nz[x] = nz[last];
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void EdgeMask::buildMask(const EdgeMaskParams& params, int x0, int x1, int y0, int y1)
+{
+	const __m128 threshold = _mm_set1_ps(params.depthThreshold);
+	const __m128 cosThreshold = _mm_set1_ps(params.normalThreshold);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 two = _mm_set1_ps(2.0f);
+	const uint32_t tailMask = (m_width & 31) ? (1u << (m_width & 31)) - 1 : 0xffffffffu;
+
+	// one block past the span for the right neighbour of its last pixel
+	const int normalEnd = mini(x1 + 4, m_width);
+	float* normalsCurrent = m_normals;
+	float* normalsNext = m_normals + 3 * m_normalPitch;
+	if (params.useNormals)
+	{
+		buildNormalRow(y0, normalsCurrent, params.projection, x0, normalEnd);
+	}
+
+	for (int y = y0; y < y1; ++y)
+	{
+		const float* center = m_linear + (y + 1) * m_linearPitch + 4;
+		const float* up = center - m_linearPitch;
+		const float* down = center + m_linearPitch;
+		uint32_t* maskRow = m_mask + y * m_wordsPerRow;
+
+		if (params.useNormals)
+		{
+			buildNormalRow(mini(y + 1, m_height - 1), normalsNext, params.projection, x0, normalEnd);
+		}
+
+		uint32_t word = 0;
+		for (int x = x0; x < x1; x += 4)
+		{
+			const __m128 l = _mm_load_ps(center + x);
+			const __m128 l2 = _mm_mul_ps(l, two);
+			const __m128 ddx = _mm_and_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(center + x - 1), _mm_loadu_ps(center + x + 1)), l2), absMask);
+			const __m128 ddy = _mm_and_ps(_mm_sub_ps(_mm_add_ps(_mm_load_ps(up + x), _mm_load_ps(down + x)), l2), absMask);
+			__m128 edge = _mm_cmpgt_ps(_mm_max_ps(ddx, ddy), _mm_mul_ps(l, threshold));
+
+			if (params.useNormals)
+			{
+				const float* nx = normalsCurrent;
+				const float* ny = normalsCurrent + m_normalPitch;
+				const float* nz = normalsCurrent + 2 * m_normalPitch;
+				const __m128 cx = _mm_load_ps(nx + x);
+				const __m128 cy = _mm_load_ps(ny + x);
+				const __m128 cz = _mm_load_ps(nz + x);
+
+				const __m128 dotRight = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(cx, _mm_loadu_ps(nx + x + 1)),
+					_mm_mul_ps(cy, _mm_loadu_ps(ny + x + 1))),
+					_mm_mul_ps(cz, _mm_loadu_ps(nz + x + 1)));
+				const __m128 dotDown = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(cx, _mm_load_ps(normalsNext + x)),
+					_mm_mul_ps(cy, _mm_load_ps(normalsNext + m_normalPitch + x))),
+					_mm_mul_ps(cz, _mm_load_ps(normalsNext + 2 * m_normalPitch + x)));
+				edge = _mm_or_ps(edge, _mm_cmplt_ps(_mm_min_ps(dotRight, dotDown), cosThreshold));
+			}
+
+			word |= (uint32_t)_mm_movemask_ps(edge) << (x & 31);
+			if ((x & 31) == 28)
+			{
+				maskRow[x >> 5] = word;
+				word = 0;
+			}
+		}
+		if (x1 == m_width && (m_width & 31))
+		{
+			maskRow[m_wordsPerRow - 1] = word & tailMask;
+		}
+
+		float* swap = normalsCurrent;
+		normalsCurrent = normalsNext;
+		normalsNext = swap;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void EdgeMask::compact()
+{
+	int count = 0;
+	for (int y = 0; y < m_height; ++y)
+	{
+		const uint32_t* maskRow = m_mask + y * m_wordsPerRow;
+		for (int w = 0; w < m_wordsPerRow; ++w)
+		{
+			uint32_t bits = maskRow[w];
+			while (bits)
+			{
+				const unsigned int bit = bitScanForward(bits);
+				m_edgePixels[count++] = ((uint32_t)y << 16) | (uint32_t)(w * 32 + bit);
+				bits &= bits - 1;
+			}
+		}
+	}
+	m_edgeCount = count;
+}
+
+//--------------------------------------------------------------------------------------
+void EdgeMask::build(const DepthImage& depth, const EdgeMaskParams& params, const DepthChange* change)
+{
+	const int tileSize = DepthChange::TILE_SIZE;
+	const bool reallocated = allocate(depth.getWidth(), depth.getHeight());
+	const bool full = reallocated || change == NULL ||
+		change->getTilesX() != (m_width + tileSize - 1) / tileSize ||
+		change->getTilesY() != (m_height + tileSize - 1) / tileSize;
+
+	CpuTimer timer;
+	if (full)
+	{
+		linearize(depth, params.projection, 0, m_width, 0, m_height);
+	}
+	else
+	{
+		for (int ty = 0; ty < change->getTilesY(); ++ty)
+		{
+			const int y0 = ty * tileSize;
+			const int y1 = mini(y0 + tileSize, m_height);
+			int tx = 0;
+			int runEnd;
+			for (; nextDirtyRun(*change, ty, false, tx, runEnd); tx = runEnd)
+			{
+				linearize(depth, params.projection, tx * tileSize, mini(runEnd * tileSize, m_width), y0, y1);
+			}
+		}
+	}
+	memcpy(m_linear, m_linear + m_linearPitch, sizeof(float) * m_linearPitch);
+	memcpy(m_linear + (m_height + 1) * m_linearPitch, m_linear + m_height * m_linearPitch, sizeof(float) * m_linearPitch);
+	m_stats.linearizeMs = timer.elapsedMs();
+
+	timer.start();
+	if (full)
+	{
+		buildMask(params, 0, m_width, 0, m_height);
+	}
+	else
+	{
+		for (int ty = 0; ty < change->getTilesY(); ++ty)
+		{
+			const int y0 = ty * tileSize;
+			const int y1 = mini(y0 + tileSize, m_height);
+			int tx = 0;
+			int runEnd;
+			for (; nextDirtyRun(*change, ty, true, tx, runEnd); tx = runEnd)
+			{
+				buildMask(params, tx * tileSize, mini(runEnd * tileSize, m_width), y0, y1);
+			}
+		}
+	}
+	m_stats.maskMs = timer.elapsedMs();
+
+	timer.start();
+	compact();
+	m_stats.compactMs = timer.elapsedMs();
+	m_stats.edgeCount = m_edgeCount;
+}
@@ -0,0 +1,79 @@
+//-----------------------------------------------------------------------------
+// File: EdgeMask.h
+//
+// Depth-discontinuity edge detection on the CPU. Produces a 1 bit per pixel
+// mask (32 pixels per word, LSB first) and a compacted list of edge pixels
+// packed as (y << 16) | x so later passes only touch geometric edges.
+//
+// Given the DepthChange the depth went through, build() only linearizes the
+// dirty tiles and redoes the mask of tiles within one tile of a dirty one,
+// a mask bit reads depth up to two pixels away. DepthChange tiles are 32
+// pixels wide, so every span starts on a mask word. Parameter changes have
+// to come with DepthChange::markAllDirty().
+//-----------------------------------------------------------------------------
+#ifndef EDGE_MASK_H
+#define EDGE_MASK_H
+
+#include "DepthChange.h"
+#include "DepthImage.h"
+#include "DepthMath.h"
+
+//--------------------------------------------------------------------------------------
+struct EdgeMaskParams
+{
+	DepthProjection			projection;
+	float					depthThreshold;		// second derivative of view z relative to z
+	float					normalThreshold;	// cosine, smaller dot between neighbours is an edge
+	bool					useNormals;			// also detect creases from reconstructed normals
+};
+
+//--------------------------------------------------------------------------------------
+struct EdgeMaskStats
+{
+	double					linearizeMs;
+	double					maskMs;
+	double					compactMs;
+	int						edgeCount;
+};
+
+//--------------------------------------------------------------------------------------
+class EdgeMask
+{
+	uint32_t*				m_mask;
+	uint32_t*				m_edgePixels;
+	float*					m_linear;		// padded view z, one guard row/column on each side
+	float*					m_normals;		// two rows of SoA normals (x, y, z)
+	int						m_width;
+	int						m_height;
+	int						m_wordsPerRow;
+	int						m_linearPitch;
+	int						m_normalPitch;
+	int						m_edgeCount;
+	EdgeMaskStats			m_stats;
+
+	EdgeMask(const EdgeMask&);
+	EdgeMask& operator=(const EdgeMask&);
+
+	// Spans start on a multiple of 32 and end on one or at the image width
+	bool				allocate(int width, int height);
+	void				linearize(const DepthImage& depth, const DepthProjection& projection, int x0, int x1, int y0, int y1);
+	void				buildNormalRow(int y, float* normals, const DepthProjection& projection, int x0, int x1);
+	void				buildMask(const EdgeMaskParams& params, int x0, int x1, int y0, int y1);
+	void				compact();
+public:
+
+	EdgeMask();
+	~EdgeMask();
+
+	// change NULL rebuilds everything
+	void				build(const DepthImage& depth, const EdgeMaskParams& params, const DepthChange* change = NULL);
+
+	bool				isEdge(int x, int y) const	{ return ( m_mask[y * m_wordsPerRow + (x >> 5)] >> (x & 31) & 1 ) != 0; }
+	const uint32_t*		getMaskRow(int y) const		{ return m_mask + y * m_wordsPerRow; }
+	int					getWordsPerRow() const		{ return m_wordsPerRow; }
+	const uint32_t*		getEdgePixels() const		{ return m_edgePixels; }
+	int					getEdgeCount() const		{ return m_edgeCount; }
+	const EdgeMaskStats& getStats() const			{ return m_stats; }
+};
+
+#endif // EDGE_MASK_H
@@ -0,0 +1,307 @@
+//-----------------------------------------------------------------------------
+// File: FroxelFog.cpp
+//-----------------------------------------------------------------------------
+#include "FroxelFog.h"
+
+//--------------------------------------------------------------------------------------
+struct FroxelTaskContext
+{
+	const FroxelFog*		fog;
+	const DepthImage*		depth;
+	DepthProjection			projection;
+	DepthMatrix				viewToWorld;
+	FogParams				params;
+	float*					extinction;
+	float*					scatter[3];
+	int*					sliceCount;
+	int*					nearSlice;
+	int						tilesX;
+	int						tilesY;
+	int						tilePitch;
+};
+
+//--------------------------------------------------------------------------------------
+// 2^x, floor by truncation corrected for negatives and a degree 4 polynomial for
+// the fraction, relative error around 1e-5
+static FORCE_INLINE __m128 exp2Fast(__m128 x)
+{
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-126.0f)), _mm_set1_ps(126.0f));
+	__m128i xi = _mm_cvttps_epi32(x);
+	xi = _mm_sub_epi32(xi, _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(xi), x)), _mm_set1_epi32(1)));
+	const __m128 f = _mm_sub_ps(x, _mm_cvtepi32_ps(xi));
+	__m128 p = _mm_add_ps(_mm_mul_ps(f, _mm_set1_ps(0.0096181f)), _mm_set1_ps(0.0555041f));
+	p = _mm_add_ps(_mm_mul_ps(f, p), _mm_set1_ps(0.2402265f));
+	p = _mm_add_ps(_mm_mul_ps(f, p), _mm_set1_ps(0.6931472f));
+	p = _mm_add_ps(_mm_mul_ps(f, p), _mm_set1_ps(1.0f));
+	return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(xi, _mm_set1_epi32(127)), 23)));
+}
+
+//--------------------------------------------------------------------------------------
+// Hardware depth min / max of every tile in one tile row. The background counts
+// as depth 1, fog in front of it runs to the end of the grid.
+static void reduceTilesTask(void* context, int index)
+{
+	const FroxelTaskContext& ctx = *(const FroxelTaskContext*)context;
+	const DepthImage& depth = *ctx.depth;
+	const int width = depth.getWidth();
+	const int y0 = index * FroxelFog::TILE_SIZE;
+	const int y1 = mini(y0 + FroxelFog::TILE_SIZE, depth.getHeight());
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	for (int tx = 0; tx < ctx.tilePitch; ++tx)
+	{
+		const int tile = index * ctx.tilePitch + tx;
+		if (tx >= ctx.tilesX)
+		{
+			ctx.sliceCount[tile] = 0;
+			ctx.nearSlice[tile] = 0;
+			continue;
+		}
+
+		const int x0 = tx * FroxelFog::TILE_SIZE;
+		const int x1 = mini(x0 + FroxelFog::TILE_SIZE, width);
+		__m128 minZ = one;
+		__m128 maxZ = _mm_setzero_ps();
+		for (int y = y0; y < y1; ++y)
+		{
+			const float* row = depth.row(y);
+			for (int x = x0; x < x1; x += 4)
+			{
+				const __m128 valid = columnMask(x, width);
+				const __m128 z = _mm_load_ps(row + x);
+				minZ = _mm_min_ps(minZ, _mm_or_ps(_mm_and_ps(valid, z), _mm_andnot_ps(valid, one)));
+				maxZ = _mm_max_ps(maxZ, _mm_and_ps(valid, z));
+			}
+		}
+
+		// Hardware depth is monotonic in view z, linearize only the two extremes.
+		// It decreases with distance under reverse-Z.
+		const bool reversed = ctx.projection.reversed;
+		const float nearZ = linearizeDepth(reversed ? horizontalMax(maxZ) : horizontalMin(minZ), ctx.projection);
+		const float farZ = linearizeDepth(reversed ? horizontalMin(minZ) : horizontalMax(maxZ), ctx.projection);
+		ctx.sliceCount[tile] = ctx.fog->getSlice(farZ) + 1;
+		ctx.nearSlice[tile] = ctx.fog->getSlice(nearZ);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// One depth slice, four neighbouring tiles per vector. Froxels past the slice
+// count of their tile are cleared rather than lit.
+static void injectSliceTask(void* context, int slice)
+{
+	const FroxelTaskContext& ctx = *(const FroxelTaskContext*)context;
+	const FogParams& params = ctx.params;
+	const DepthMatrix& m = ctx.viewToWorld;
+	const int sliceOffset = slice * ctx.tilesY * ctx.tilePitch;
+	const float z = 0.5f * (ctx.fog->getSliceDepth(slice) + ctx.fog->getSliceDepth(slice + 1));
+	const float width = (float)ctx.depth->getWidth();
+	const float height = (float)ctx.depth->getHeight();
+
+	// Tile centre to view space at the slice centre
+	const float stepX = FroxelFog::TILE_SIZE * 2.0f / width * z / ctx.projection.scaleX;
+	const __m128 viewX0 = _mm_mul_ps(_mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), _mm_set1_ps(stepX));
+	const __m128 viewXStart = _mm_sub_ps(viewX0, _mm_set1_ps(z / ctx.projection.scaleX));
+	const __m128 viewZ = _mm_set1_ps(z);
+
+	const float g = params.anisotropy;
+	const __m128 phaseScale = _mm_set1_ps((1.0f - g * g) / (4.0f * 3.14159265f));
+	const __m128 phaseBase = _mm_set1_ps(1.0f + g * g);
+	const __m128 phaseCos = _mm_set1_ps(2.0f * g);
+	const __m128 isotropic = _mm_set1_ps(1.0f / (4.0f * 3.14159265f));
+	const __m128 densityExponent = _mm_set1_ps(-params.heightFalloff * 1.44269504f);	// log2(e)
+	const __m128 baseHeight = _mm_set1_ps(params.baseHeight);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	for (int ty = 0; ty < ctx.tilesY; ++ty)
+	{
+		const float ndcY = 1.0f - (ty + 0.5f) * FroxelFog::TILE_SIZE * 2.0f / height;
+		const __m128 viewY = _mm_set1_ps(ndcY * z / ctx.projection.scaleY);
+		const int rowOffset = sliceOffset + ty * ctx.tilePitch;
+		const int* sliceCount = ctx.sliceCount + ty * ctx.tilePitch;
+		__m128 viewX = viewXStart;
+
+		for (int tx = 0; tx < ctx.tilePitch; tx += 4, viewX = _mm_add_ps(viewX, _mm_set1_ps(stepX * 4)))
+		{
+			const __m128i counts = _mm_loadu_si128((const __m128i*)(sliceCount + tx));
+			const __m128 active = _mm_castsi128_ps(_mm_cmpgt_epi32(counts, _mm_set1_epi32(slice)));
+			if (_mm_movemask_ps(active) == 0)
+			{
+				_mm_store_ps(ctx.extinction + rowOffset + tx, zero);
+				for (int c = 0; c < 3; ++c)
+				{
+					_mm_store_ps(ctx.scatter[c] + rowOffset + tx, zero);
+				}
+				continue;
+			}
+
+			__m128 world[3];
+			for (int i = 0; i < 3; ++i)
+			{
+				world[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(viewX, _mm_set1_ps(m.m[0][i])), _mm_mul_ps(viewY, _mm_set1_ps(m.m[1][i]))),
+					_mm_add_ps(_mm_mul_ps(viewZ, _mm_set1_ps(m.m[2][i])), _mm_set1_ps(m.m[3][i])));
+			}
+
+			// Exponential height fog
+			const __m128 density = _mm_and_ps(active, _mm_mul_ps(_mm_set1_ps(params.density),
+				exp2Fast(_mm_mul_ps(densityExponent, _mm_sub_ps(world[1], baseHeight)))));
+
+			// Henyey-Greenstein for the sun, cosine between the view ray and the sun direction
+			__m128 dir[3];
+			for (int i = 0; i < 3; ++i)
+			{
+				dir[i] = _mm_sub_ps(world[i], _mm_set1_ps(m.m[3][i]));
+			}
+			const __m128 invLength = _mm_rsqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dir[0], dir[0]), _mm_mul_ps(dir[1], dir[1])), _mm_mul_ps(dir[2], dir[2])));
+			const __m128 cosTheta = _mm_mul_ps(invLength, _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(dir[0], _mm_set1_ps(params.sunDirection[0])), _mm_mul_ps(dir[1], _mm_set1_ps(params.sunDirection[1]))),
+				_mm_mul_ps(dir[2], _mm_set1_ps(params.sunDirection[2]))));
+			const __m128 denominator = _mm_max_ps(_mm_sub_ps(phaseBase, _mm_mul_ps(phaseCos, cosTheta)), _mm_set1_ps(1e-4f));
+			const __m128 phase = _mm_mul_ps(phaseScale, _mm_mul_ps(_mm_rsqrt_ps(denominator), _mm_rcp_ps(denominator)));
+
+			__m128 light[3];
+			for (int c = 0; c < 3; ++c)
+			{
+				light[c] = _mm_add_ps(_mm_set1_ps(params.ambient[c]), _mm_mul_ps(phase, _mm_set1_ps(params.sunColor[c])));
+			}
+
+			// Point lights, isotropic phase and a windowed falloff reaching zero at the radius
+			for (int l = 0; l < params.lightCount; ++l)
+			{
+				const FogLight& fogLight = params.lights[l];
+				const __m128 dx = _mm_sub_ps(world[0], _mm_set1_ps(fogLight.position[0]));
+				const __m128 dy = _mm_sub_ps(world[1], _mm_set1_ps(fogLight.position[1]));
+				const __m128 dz = _mm_sub_ps(world[2], _mm_set1_ps(fogLight.position[2]));
+				const __m128 distanceSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+				const __m128 window = _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(distanceSq, _mm_set1_ps(1.0f / (fogLight.radius * fogLight.radius)))), zero);
+				const __m128 attenuation = _mm_mul_ps(_mm_mul_ps(window, window), _mm_mul_ps(isotropic, _mm_rcp_ps(_mm_add_ps(distanceSq, one))));
+				for (int c = 0; c < 3; ++c)
+				{
+					light[c] = _mm_add_ps(light[c], _mm_mul_ps(attenuation, _mm_set1_ps(fogLight.color[c])));
+				}
+			}
+
+			_mm_store_ps(ctx.extinction + rowOffset + tx, density);
+			for (int c = 0; c < 3; ++c)
+			{
+				_mm_store_ps(ctx.scatter[c] + rowOffset + tx, _mm_mul_ps(density, light[c]));
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+FroxelFog::FroxelFog(TaskPool* pool)
+	: m_pool( pool )
+	, m_extinction( NULL )
+	, m_sliceCount( NULL )
+	, m_nearSlice( NULL )
+	, m_tilesX( 0 )
+	, m_tilesY( 0 )
+	, m_tilePitch( 0 )
+	, m_capacity( 0 )
+	, m_fogFar( 1.0f )
+{
+	m_scatter[0] = m_scatter[1] = m_scatter[2] = NULL;
+	memset(&m_projection, 0, sizeof(m_projection));
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+FroxelFog::~FroxelFog()
+{
+	alignedFree(m_extinction);
+	for (int c = 0; c < 3; ++c)
+	{
+		alignedFree(m_scatter[c]);
+	}
+	delete[] m_sliceCount;
+	delete[] m_nearSlice;
+}
+
+//--------------------------------------------------------------------------------------
+void FroxelFog::allocate(int width, int height)
+{
+	m_tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	m_tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	m_tilePitch = (m_tilesX + 3) & ~3;
+	const int tiles = m_tilesY * m_tilePitch;
+	if (tiles <= m_capacity)
+	{
+		return;
+	}
+
+	alignedFree(m_extinction);
+	m_extinction = (float*)alignedAlloc(tiles * SLICE_COUNT * sizeof(float), 16);
+	for (int c = 0; c < 3; ++c)
+	{
+		alignedFree(m_scatter[c]);
+		m_scatter[c] = (float*)alignedAlloc(tiles * SLICE_COUNT * sizeof(float), 16);
+	}
+	delete[] m_sliceCount;
+	delete[] m_nearSlice;
+	m_sliceCount = new int[tiles];
+	m_nearSlice = new int[tiles];
+	m_capacity = tiles;
+}
+
+//--------------------------------------------------------------------------------------
+float FroxelFog::getSliceDepth(int slice) const
+{
+	return m_projection.zNear * powf(m_fogFar / m_projection.zNear, (float)slice / SLICE_COUNT);
+}
+
+//--------------------------------------------------------------------------------------
+int FroxelFog::getSlice(float viewZ) const
+{
+	if (viewZ <= m_projection.zNear)
+	{
+		return 0;
+	}
+	const int slice = (int)(SLICE_COUNT * logf(viewZ / m_projection.zNear) / logf(m_fogFar / m_projection.zNear));
+	return mini(slice, SLICE_COUNT - 1);
+}
+
+//--------------------------------------------------------------------------------------
+void FroxelFog::update(const DepthImage& depth, const DepthProjection& projection,
+	const DepthMatrix& viewToWorld, const FogParams& params)
+{
+	allocate(depth.getWidth(), depth.getHeight());
+	m_projection = projection;
+	m_fogFar = minf(params.fogFar, projection.zFar);
+
+	FroxelTaskContext ctx;
+	ctx.fog = this;
+	ctx.depth = &depth;
+	ctx.projection = projection;
+	ctx.viewToWorld = viewToWorld;
+	ctx.params = params;
+	ctx.params.lightCount = mini(params.lightCount, FogParams::MAX_LIGHTS);
+	ctx.extinction = m_extinction;
+	for (int c = 0; c < 3; ++c)
+	{
+		ctx.scatter[c] = m_scatter[c];
+	}
+	ctx.sliceCount = m_sliceCount;
+	ctx.nearSlice = m_nearSlice;
+	ctx.tilesX = m_tilesX;
+	ctx.tilesY = m_tilesY;
+	ctx.tilePitch = m_tilePitch;
+
+	CpuTimer timer;
+	TaskPool::runOn(m_pool, reduceTilesTask, &ctx, m_tilesY);
+	m_stats.reduceMs = timer.elapsedMs();
+
+	timer.start();
+	TaskPool::runOn(m_pool, injectSliceTask, &ctx, SLICE_COUNT);
+	m_stats.injectMs = timer.elapsedMs();
+
+	m_stats.froxelCount = m_tilesX * m_tilesY * SLICE_COUNT;
+	m_stats.litCount = 0;
+	m_stats.fullyVisibleCount = 0;
+	for (int i = 0; i < m_tilesY * m_tilePitch; ++i)
+	{
+		m_stats.litCount += m_sliceCount[i];
+		m_stats.fullyVisibleCount += m_nearSlice[i];
+	}
+}
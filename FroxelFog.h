@@ -0,0 +1,102 @@
+//-----------------------------------------------------------------------------
+// File: FroxelFog.h
+//
+// View aligned froxel grid for volumetric fog: 16x16 pixel tiles by 64
+// exponential depth slices. The slices of each tile stop at the farthest
+// depth the tile shows, froxels behind the visible surface can never reach
+// the screen and are not lit, only cleared. The grid itself is allocated in
+// full, tiles x 64 slices, so every froxel keeps a fixed place in it.
+// Light injection writes extinction and in-scattered light per froxel, four
+// tiles per SSE vector, one TaskPool job per slice.
+//-----------------------------------------------------------------------------
+#ifndef FROXEL_FOG_H
+#define FROXEL_FOG_H
+
+#include "DepthImage.h"
+#include "DepthMath.h"
+#include "TaskPool.h"
+
+//--------------------------------------------------------------------------------------
+struct FogLight
+{
+	float					position[3];		// world space
+	float					radius;
+	float					color[3];
+};
+
+//--------------------------------------------------------------------------------------
+struct FogParams
+{
+	static const int		MAX_LIGHTS = 4;
+
+	float					fogFar;				// view z where the grid ends
+	float					density;			// extinction at baseHeight
+	float					baseHeight;
+	float					heightFalloff;		// per world unit above baseHeight
+	float					anisotropy;			// Henyey-Greenstein g of the sun phase
+	float					ambient[3];
+	float					sunDirection[3];	// world space, towards the sun
+	float					sunColor[3];
+	FogLight				lights[MAX_LIGHTS];
+	int						lightCount;
+};
+
+//--------------------------------------------------------------------------------------
+struct FroxelStats
+{
+	double					reduceMs;
+	double					injectMs;
+	int						froxelCount;		// full grid
+	int						litCount;			// in front of the farthest depth of their tile
+	int						fullyVisibleCount;	// in front of the nearest depth of their tile
+};
+
+//--------------------------------------------------------------------------------------
+class FroxelFog
+{
+public:
+	static const int		TILE_SIZE = 16;
+	static const int		SLICE_COUNT = 64;
+
+private:
+	TaskPool*				m_pool;
+	float*					m_extinction;		// slice major, rows of m_tilePitch tiles
+	float*					m_scatter[3];
+	int*					m_sliceCount;		// lit slices per tile
+	int*					m_nearSlice;		// slice holding the nearest depth per tile
+	int						m_tilesX;
+	int						m_tilesY;
+	int						m_tilePitch;
+	int						m_capacity;
+	DepthProjection			m_projection;
+	float					m_fogFar;
+	FroxelStats				m_stats;
+
+	FroxelFog(const FroxelFog&);
+	FroxelFog& operator=(const FroxelFog&);
+
+	void				allocate(int width, int height);
+public:
+
+	// pool may be NULL to run on the calling thread only
+	explicit FroxelFog(TaskPool* pool = NULL);
+	~FroxelFog();
+
+	// Per tile depth bounds from the resolved depth, then light injection into
+	// the lit froxels. viewToWorld is the inverse of the view matrix.
+	void				update(const DepthImage& depth, const DepthProjection& projection,
+							const DepthMatrix& viewToWorld, const FogParams& params);
+
+	float				getSliceDepth(int slice) const;	// view z of the near side of a slice
+	int					getSlice(float viewZ) const;
+
+	int					getTilesX() const						{ return m_tilesX; }
+	int					getTilesY() const						{ return m_tilesY; }
+	int					getTilePitch() const					{ return m_tilePitch; }
+	int					getSliceCount(int tx, int ty) const		{ return m_sliceCount[ty * m_tilePitch + tx]; }
+	const float*		getExtinction(int slice) const			{ return m_extinction + slice * m_tilesY * m_tilePitch; }
+	const float*		getScatter(int channel, int slice) const	{ return m_scatter[channel] + slice * m_tilesY * m_tilePitch; }
+	const FroxelStats&	getStats() const						{ return m_stats; }
+};
+
+#endif // FROXEL_FOG_H
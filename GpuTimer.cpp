@@ -0,0 +1,161 @@
+//-----------------------------------------------------------------------------
+// File: GpuTimer.cpp
+//-----------------------------------------------------------------------------
+#include "GpuTimer.h"
+
+//--------------------------------------------------------------------------------------
+GpuTimer::GpuTimer()
+	: m_current( 0 )
+	, m_stageCount( 0 )
+	, m_active( false )
+	, m_supported( false )
+{
+	ZeroMemory( m_frames, sizeof( m_frames ) );
+	ZeroMemory( m_stageMs, sizeof( m_stageMs ) );
+}
+
+//--------------------------------------------------------------------------------------
+GpuTimer::~GpuTimer()
+{
+	for (int i = 0; i < LATENCY; ++i)
+	{
+		Frame& frame = m_frames[i];
+		if (frame.pDisjoint)
+		{
+			frame.pDisjoint->Release();
+		}
+		if (frame.pFrequency)
+		{
+			frame.pFrequency->Release();
+		}
+		for (int s = 0; s <= MAX_STAGES; ++s)
+		{
+			if (frame.pStamps[s])
+			{
+				frame.pStamps[s]->Release();
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+HRESULT GpuTimer::create( const LPDIRECT3DDEVICE9 device )
+{
+	// Creating with a NULL query only checks for support
+	if (FAILED( device->CreateQuery( D3DQUERYTYPE_TIMESTAMP, NULL ) ) ||
+		FAILED( device->CreateQuery( D3DQUERYTYPE_TIMESTAMPDISJOINT, NULL ) ) ||
+		FAILED( device->CreateQuery( D3DQUERYTYPE_TIMESTAMPFREQ, NULL ) ))
+	{
+		return E_FAIL;
+	}
+
+	for (int i = 0; i < LATENCY; ++i)
+	{
+		Frame& frame = m_frames[i];
+		device->CreateQuery( D3DQUERYTYPE_TIMESTAMPDISJOINT, &frame.pDisjoint );
+		device->CreateQuery( D3DQUERYTYPE_TIMESTAMPFREQ, &frame.pFrequency );
+		for (int s = 0; s <= MAX_STAGES; ++s)
+		{
+			device->CreateQuery( D3DQUERYTYPE_TIMESTAMP, &frame.pStamps[s] );
+		}
+	}
+	m_supported = true;
+	return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+void GpuTimer::beginFrame()
+{
+	m_active = false;
+	if (!m_supported)
+	{
+		return;
+	}
+
+	// All frames still in flight, skip timing this one instead of waiting
+	collect();
+	Frame& frame = m_frames[m_current];
+	if (frame.pending)
+	{
+		return;
+	}
+
+	frame.pDisjoint->Issue( D3DISSUE_BEGIN );
+	frame.pStamps[0]->Issue( D3DISSUE_END );
+	frame.stageCount = 0;
+	m_active = true;
+}
+
+//--------------------------------------------------------------------------------------
+void GpuTimer::endStage()
+{
+	if (!m_active)
+	{
+		return;
+	}
+	Frame& frame = m_frames[m_current];
+	if (frame.stageCount < MAX_STAGES)
+	{
+		frame.pStamps[++frame.stageCount]->Issue( D3DISSUE_END );
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void GpuTimer::endFrame()
+{
+	if (!m_active)
+	{
+		return;
+	}
+	Frame& frame = m_frames[m_current];
+	frame.pFrequency->Issue( D3DISSUE_END );
+	frame.pDisjoint->Issue( D3DISSUE_END );
+	frame.pending = true;
+	m_current = (m_current + 1) % LATENCY;
+	m_active = false;
+}
+
+//--------------------------------------------------------------------------------------
+bool GpuTimer::resolveFrame( Frame& frame )
+{
+	BOOL disjoint;
+	UINT64 frequency;
+	if (frame.pDisjoint->GetData( &disjoint, sizeof( disjoint ), 0 ) != S_OK ||
+		frame.pFrequency->GetData( &frequency, sizeof( frequency ), 0 ) != S_OK)
+	{
+		return false;
+	}
+
+	UINT64 stamps[MAX_STAGES + 1];
+	for (int s = 0; s <= frame.stageCount; ++s)
+	{
+		if (frame.pStamps[s]->GetData( &stamps[s], sizeof( UINT64 ), 0 ) != S_OK)
+		{
+			return false;
+		}
+	}
+
+	if (!disjoint && frequency != 0)
+	{
+		for (int s = 0; s < frame.stageCount; ++s)
+		{
+			m_stageMs[s] = (double)( stamps[s + 1] - stamps[s] ) * 1000.0 / (double)frequency;
+		}
+		m_stageCount = frame.stageCount;
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+void GpuTimer::collect()
+{
+	// Oldest first so newer results overwrite older ones
+	for (int i = 1; i <= LATENCY; ++i)
+	{
+		Frame& frame = m_frames[(m_current + i) % LATENCY];
+		if (frame.pending && resolveFrame( frame ))
+		{
+			frame.pending = false;
+		}
+	}
+}
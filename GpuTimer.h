@@ -0,0 +1,55 @@
+//-----------------------------------------------------------------------------
+// File: GpuTimer.h
+//
+// Per-stage GPU timings from D3D9 timestamp queries. Results are read a few
+// frames later without stalling; frames the driver marks disjoint are skipped.
+//-----------------------------------------------------------------------------
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <d3dx9.h>
+
+//--------------------------------------------------------------------------------------
+class GpuTimer
+{
+public:
+	static const int		MAX_STAGES = 8;
+
+private:
+	static const int		LATENCY = 4;
+
+	struct Frame
+	{
+		IDirect3DQuery9*	pDisjoint;
+		IDirect3DQuery9*	pFrequency;
+		IDirect3DQuery9*	pStamps[MAX_STAGES + 1];
+		int					stageCount;
+		bool				pending;
+	};
+
+	Frame					m_frames[LATENCY];
+	int						m_current;
+	int						m_stageCount;
+	bool					m_active;
+	bool					m_supported;
+	double					m_stageMs[MAX_STAGES];
+
+	bool				resolveFrame( Frame& frame );
+public:
+
+	GpuTimer();
+	~GpuTimer();
+
+	HRESULT				create( const LPDIRECT3DDEVICE9 device );
+
+	void				beginFrame();
+	void				endStage();
+	void				endFrame();
+	void				collect();
+
+	bool				isSupported()				{ return m_supported; }
+	int					getStageCount()				{ return m_stageCount; }
+	double				getStageMs( int stage )		{ return m_stageMs[stage]; }
+};
+
+#endif // GPU_TIMER_H
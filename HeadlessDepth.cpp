@@ -0,0 +1,1176 @@
+//-----------------------------------------------------------------------------
+// File: HeadlessDepth.cpp
+//
+// Command line depth renderer for machines without a D3D9 device. Loads
+// tiger.x, applies the SetupMatrices() transforms for a given timeGetTime()
+// value and rasterizes a SCREEN_WIDTH x SCREEN_HEIGHT depth buffer with
+// DepthRasterizer. Writes the result as a golden image and reports the CPU
+// cost of a frame.
+//
+//   headless_depth [-mesh tiger.x] [-time ms] [-frames n] [-pfm out.pfm] [-d24 out.d24]
+//                  [-scaling threads] [-vertices copies] [-clipping steps]
+//                  [-reversez 0|1] [-precision samples]
+//                  [-texture tiger.bmp] [-bilinear 0|1] [-bmp out.bmp]
+//                  [-compare golden.bmp] [-xload gridsize] [-optimize views]
+//                  [-quantize views] [-clusters views]
+//
+// .pfm is the float depth (bottom row first, as the format requires), .d24
+// is the 24 bit unorm value per pixel as little endian uint32, top row first.
+//
+// -scaling n times TiledRasterizer with 1 to n threads (0 for every hardware
+// thread) on the tiger frame and on a stress scene of 100 tigers at 3840x2160,
+// after timing its scalar, SSE2 and AVX2 block loops on one thread. AVX2 is
+// skipped on CPUs without it.
+//
+// -vertices n transforms n copies of the mesh per frame with a scalar loop
+// like DepthRasterizer's and with VertexPipeline, and reports vertices per
+// second.
+//
+// -clipping n walks the camera through the stress scene at tiger height in n
+// steps, so tigers cross the near plane and leave the viewport, and reports
+// how many triangles TiledRasterizer rejects, sets up directly or clips.
+//
+// -reversez 1 renders the golden image and the -clipping scene with near and
+// far swapped, cleared to 0 and tested GREATEREQUAL, as the 'R' key does.
+//
+// -precision n compares standard and reverse-Z depth in every storage format
+// over n view distances from Z_NEAR to Z_FAR.
+//
+// -bmp and -compare also render the frame in color with ColorRasterizer, the
+// tiger textured and lit as Render() draws it. -bmp writes it, -compare checks
+// it against an earlier golden image or a screenshot of the same frame and
+// exits with 3 if any pixel is off by more than COLOR_TOLERANCE. Every subset
+// is shaded with its material from the .x file, the texture is the one named
+// by the first material unless -texture gives another. It is point sampled
+// like the app's default, -bilinear 1 filters it as the 'B' key does.
+//
+// -xload n writes a synthetic .x file of an n x n vertex grid with normals,
+// texture coordinates and four materials, and reports how fast XMesh loads it
+// next to strtod reading the same numbers, then the start up time without and
+// with a binary cache of it.
+//
+// -optimize n compares the mesh as loaded with the same mesh after
+// XMesh::optimize(): post-transform cache misses per triangle and per vertex,
+// vertex buffer overfetch, and overdraw, the depth writes per covered pixel
+// DepthRasterizer makes over n views around the tiger.
+//
+// -quantize n reports the vertex size and the decode error of position,
+// normal and texture coordinates of VertexQuantizer with 8 and 16 bit normals,
+// computed from the triangles where the mesh has none, and without normals, and
+// how far the depth of the packed positions is off over n views around the tiger.
+//
+// -clusters n splits the optimized mesh into meshlets and culls them with
+// ClusterCuller over n views around the tiger, the Hi-Z built from the depth
+// of the frame 16 ms earlier reprojected as Render() does with the read back
+// depth. Reports the triangles submitted against those with a pixel in the
+// final depth, and any visible triangle that was culled.
+//
+// Linux: g++ -O2 -msse2 HeadlessDepth.cpp XMesh.cpp DepthRasterizer.cpp
+//            TiledRasterizer.cpp TiledRasterizerAvx2.cpp VertexPipeline.cpp
+//            VertexPipelineAvx2.cpp DepthCodec.cpp TaskPool.cpp
+//            DepthPrecision.cpp ColorRasterizer.cpp SoftwareTexture.cpp
+//            ColorImage.cpp MeshOptimizer.cpp VertexQuantizer.cpp
+//            ClusterCuller.cpp DepthReprojection.cpp -lpthread -o headless_depth
+//-----------------------------------------------------------------------------
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "SceneSetup.h"
+#include "XMesh.h"
+#include "DepthRasterizer.h"
+#include "TiledRasterizer.h"
+#include "VertexPipeline.h"
+#include "DepthCodec.h"
+#include "DepthPrecision.h"
+#include "ColorRasterizer.h"
+#include "MeshOptimizer.h"
+#include "VertexQuantizer.h"
+#include "ClusterCuller.h"
+#include "DepthReprojection.h"
+
+const int						STRESS_GRID = 10;
+const int						STRESS_WIDTH = 3840;
+const int						STRESS_HEIGHT = 2160;
+const float						STRESS_EYE[3] = { 0.0f, 9.0f, -12.0f };
+const float						STRESS_AT[3] = { 0.0f, 0.0f, 5.0f };
+
+const int						COLOR_TOLERANCE = 8;	// per channel, bilinear weight rounding and MSAA edges aside
+
+//--------------------------------------------------------------------------------------
+struct HeadlessOptions
+{
+	const char*				meshPath;
+	unsigned long			timeMs;
+	int						frames;
+	const char*				pfmPath;
+	const char*				d24Path;
+	int						scalingThreads;		// -1 without -scaling
+	int						vertexCopies;		// 0 without -vertices
+	int						clippingSteps;		// 0 without -clipping
+	bool					reverseZ;
+	int						precisionSamples;	// 0 without -precision
+	const char*				texturePath;
+	bool					bilinear;
+	const char*				bmpPath;
+	const char*				comparePath;
+	int						xloadGrid;			// 0 without -xload
+	int						optimizeViews;		// 0 without -optimize
+	int						quantizeViews;		// 0 without -quantize
+	int						clusterViews;		// 0 without -clusters
+};
+
+//-----------------------------------------------------------------------------
+bool ParseOptions( int argc, char** argv, HeadlessOptions& options )
+{
+	options.meshPath = NULL;
+	options.timeMs = 0;
+	options.frames = 100;
+	options.pfmPath = NULL;
+	options.d24Path = NULL;
+	options.scalingThreads = -1;
+	options.vertexCopies = 0;
+	options.clippingSteps = 0;
+	options.reverseZ = false;
+	options.precisionSamples = 0;
+	options.texturePath = NULL;
+	options.bilinear = false;
+	options.bmpPath = NULL;
+	options.comparePath = NULL;
+	options.xloadGrid = 0;
+	options.optimizeViews = 0;
+	options.quantizeViews = 0;
+	options.clusterViews = 0;
+	for( int i = 1; i + 1 < argc; i += 2 )
+	{
+		if( strcmp( argv[i], "-mesh" ) == 0 )
+			options.meshPath = argv[i + 1];
+		else if( strcmp( argv[i], "-time" ) == 0 )
+			options.timeMs = strtoul( argv[i + 1], NULL, 10 );
+		else if( strcmp( argv[i], "-frames" ) == 0 )
+			options.frames = atoi( argv[i + 1] );
+		else if( strcmp( argv[i], "-pfm" ) == 0 )
+			options.pfmPath = argv[i + 1];
+		else if( strcmp( argv[i], "-d24" ) == 0 )
+			options.d24Path = argv[i + 1];
+		else if( strcmp( argv[i], "-scaling" ) == 0 )
+			options.scalingThreads = atoi( argv[i + 1] );
+		else if( strcmp( argv[i], "-vertices" ) == 0 )
+			options.vertexCopies = atoi( argv[i + 1] );
+		else if( strcmp( argv[i], "-clipping" ) == 0 )
+			options.clippingSteps = atoi( argv[i + 1] );
+		else if( strcmp( argv[i], "-reversez" ) == 0 )
+			options.reverseZ = atoi( argv[i + 1] ) != 0;
+		else if( strcmp( argv[i], "-precision" ) == 0 )
+			options.precisionSamples = atoi( argv[i + 1] );
+		else if( strcmp( argv[i], "-texture" ) == 0 )
+			options.texturePath = argv[i + 1];
+		else if( strcmp( argv[i], "-bilinear" ) == 0 )
+			options.bilinear = atoi( argv[i + 1] ) != 0;
+		else if( strcmp( argv[i], "-bmp" ) == 0 )
+			options.bmpPath = argv[i + 1];
+		else if( strcmp( argv[i], "-compare" ) == 0 )
+			options.comparePath = argv[i + 1];
+		else if( strcmp( argv[i], "-xload" ) == 0 )
+			options.xloadGrid = atoi( argv[i + 1] );
+		else if( strcmp( argv[i], "-optimize" ) == 0 )
+			options.optimizeViews = atoi( argv[i + 1] );
+		else if( strcmp( argv[i], "-quantize" ) == 0 )
+			options.quantizeViews = atoi( argv[i + 1] );
+		else if( strcmp( argv[i], "-clusters" ) == 0 )
+			options.clusterViews = atoi( argv[i + 1] );
+		else
+			return false;
+	}
+	return ( argc & 1 ) != 0 && options.frames > 0 && options.vertexCopies >= 0 && options.clippingSteps >= 0 &&
+		options.precisionSamples >= 0 && options.xloadGrid >= 0 && options.xloadGrid <= 4096 &&
+		options.optimizeViews >= 0 && options.quantizeViews >= 0 && options.clusterViews >= 0;
+}
+
+//-----------------------------------------------------------------------------
+// The per vertex loop the rasterizers used before VertexPipeline, AoS in and out
+void TransformScalar( const float* positions, int vertexCount, const DepthMatrix& m, float* screen )
+{
+	const float halfWidth = SCREEN_WIDTH * 0.5f;
+	const float halfHeight = SCREEN_HEIGHT * 0.5f;
+	for( int i = 0; i < vertexCount; i++ )
+	{
+		const float* p = positions + i * 3;
+		const float x = p[0] * m.m[0][0] + p[1] * m.m[1][0] + p[2] * m.m[2][0] + m.m[3][0];
+		const float y = p[0] * m.m[0][1] + p[1] * m.m[1][1] + p[2] * m.m[2][1] + m.m[3][1];
+		const float z = p[0] * m.m[0][2] + p[1] * m.m[1][2] + p[2] * m.m[2][2] + m.m[3][2];
+		const float w = p[0] * m.m[0][3] + p[1] * m.m[1][3] + p[2] * m.m[2][3] + m.m[3][3];
+		const float invW = w > 0.0f ? 1.0f / w : 0.0f;
+		float* dst = screen + i * 4;
+		dst[0] = ( x * invW + 1.0f ) * halfWidth;
+		dst[1] = ( 1.0f - y * invW ) * halfHeight;
+		dst[2] = z * invW;
+		dst[3] = z < 0.0f ? -1.0f : w;
+	}
+}
+
+//-----------------------------------------------------------------------------
+void MeasureVertices( const XMesh& mesh, const HeadlessOptions& options )
+{
+	const int meshVertices = mesh.getVertexCount();
+	const int vertexCount = meshVertices * options.vertexCopies;
+	float* positions = new float[vertexCount * 3];
+	for( int i = 0; i < options.vertexCopies; i++ )
+		memcpy( positions + i * meshVertices * 3, mesh.getPositions(), meshVertices * 3 * sizeof( float ) );
+	float* screen = new float[vertexCount * 4];
+	const RasterMesh copies = { positions, 3, vertexCount, NULL, 0 };
+
+	DepthMatrix world, view, proj;
+	getSceneMatrices( options.timeMs, world, view, proj );
+	const DepthMatrix worldViewProj = multiplyMatrix( multiplyMatrix( world, view ), proj );
+	printf( "%d vertices per frame\n", vertexCount );
+
+	double scalarMs = 0.0;
+	for( int frame = 0; frame < options.frames; frame++ )
+	{
+		CpuTimer timer;
+		TransformScalar( positions, vertexCount, worldViewProj, screen );
+		scalarMs += timer.elapsedMs();
+	}
+	printf( "  scalar AoS:           %8.1f Mverts/s\n", vertexCount * options.frames / ( scalarMs * 1000.0 ) );
+
+	// SoA streams are filled once, as for a static mesh
+	TaskPool pool;
+	for( int pass = 0; pass < 2; pass++ )
+	{
+		VertexPipeline pipeline( pass == 0 ? NULL : &pool );
+		pipeline.setMesh( copies );
+		double ms = 0.0;
+		for( int frame = 0; frame < options.frames; frame++ )
+		{
+			pipeline.begin( worldViewProj, SCREEN_WIDTH, SCREEN_HEIGHT );
+			pipeline.transformAll();
+			ms += pipeline.getStats().transformMs;
+		}
+		printf( "  VertexPipeline, %2d threads: %8.1f Mverts/s, %5.2fx over scalar\n", pass == 0 ? 1 : pool.getThreadCount(),
+			vertexCount * options.frames / ( ms * 1000.0 ), scalarMs / ms );
+	}
+	delete[] positions;
+	delete[] screen;
+}
+
+//-----------------------------------------------------------------------------
+// Tigers on a grid, by default in front of a camera pulled back to see all of them
+void GetStressScene( unsigned long timeMs, DepthMatrix* worldViewProj, bool reversed = false,
+	const float* eye = STRESS_EYE, const float* at = STRESS_AT )
+{
+	const float aspect = (float)STRESS_WIDTH / STRESS_HEIGHT;
+	const DepthMatrix view = lookAtMatrixLH( eye, at, UP_DIRECTION );
+	const DepthMatrix proj = reversed ? perspectiveFovMatrixLH( FOV_Y, aspect, Z_FAR, Z_NEAR ) :
+		perspectiveFovMatrixLH( FOV_Y, aspect, Z_NEAR, Z_FAR );
+	const DepthMatrix viewProj = multiplyMatrix( view, proj );
+	for( int i = 0; i < STRESS_GRID * STRESS_GRID; i++ )
+	{
+		DepthMatrix world = rotationYMatrix( getTigerAngle( timeMs ) + i * 0.7f );
+		world.m[3][0] = ( ( i % STRESS_GRID ) - ( STRESS_GRID - 1 ) * 0.5f ) * 1.6f;
+		world.m[3][2] = ( i / STRESS_GRID ) * 1.4f;
+		worldViewProj[i] = multiplyMatrix( world, viewProj );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Average ms of one frame of the scene, 0 threads means DepthRasterizer
+double TimeScene( const RasterMesh& mesh, int instanceCount, int width, int height, int threads,
+	TiledRasterizer::Kernel kernel, const HeadlessOptions& options, int& pixelsWritten )
+{
+	DepthMatrix* worldViewProj = new DepthMatrix[instanceCount];
+	DepthImage depth( width, height );
+	TaskPool* pool = threads > 0 ? new TaskPool( threads ) : NULL;
+	TiledRasterizer tiled( pool );
+	tiled.setKernel( kernel );
+	DepthRasterizer rasterizer;
+	double totalMs = 0.0;
+	for( int frame = 0; frame < options.frames; frame++ )
+	{
+		if( instanceCount == 1 )
+		{
+			DepthMatrix world, view, proj;
+			getSceneMatrices( options.timeMs + frame * 16, world, view, proj );
+			worldViewProj[0] = multiplyMatrix( multiplyMatrix( world, view ), proj );
+		}
+		else
+		{
+			GetStressScene( options.timeMs + frame * 16, worldViewProj );
+		}
+
+		CpuTimer timer;
+		depth.fill( 1.0f );
+		if( threads > 0 )
+		{
+			tiled.begin( depth );
+			for( int i = 0; i < instanceCount; i++ )
+				tiled.addMesh( mesh, worldViewProj[i] );
+			tiled.end();
+			pixelsWritten = tiled.getStats().pixelsWritten;
+		}
+		else
+		{
+			rasterizer.resetStats();
+			for( int i = 0; i < instanceCount; i++ )
+				rasterizer.draw( mesh, worldViewProj[i], depth );
+			pixelsWritten = rasterizer.getStats().pixelsWritten;
+		}
+		totalMs += timer.elapsedMs();
+	}
+	delete pool;
+	delete[] worldViewProj;
+	return totalMs / options.frames;
+}
+
+//-----------------------------------------------------------------------------
+void MeasureScaling( const RasterMesh& mesh, const HeadlessOptions& options )
+{
+	const int maxThreads = options.scalingThreads > 0 ? options.scalingThreads : hardwareThreadCount();
+	for( int scene = 0; scene < 2; scene++ )
+	{
+		const int instanceCount = scene == 0 ? 1 : STRESS_GRID * STRESS_GRID;
+		const int width = scene == 0 ? SCREEN_WIDTH : STRESS_WIDTH;
+		const int height = scene == 0 ? SCREEN_HEIGHT : STRESS_HEIGHT;
+		int pixels = 0;
+		const double scalarMs = TimeScene( mesh, instanceCount, width, height, 0, TiledRasterizer::KERNEL_SCALAR,
+			options, pixels );
+		printf( "%s, %d meshes at %dx%d: DepthRasterizer %.3f ms, %d pixels written\n",
+			scene == 0 ? "tiger" : "stress", instanceCount, width, height, scalarMs, pixels );
+
+		// Block loops on one thread against the scalar ones
+		const char* kernelNames[] = { "scalar", "SSE2", "AVX2" };
+		double scalarKernelMs = 0.0;
+		for( int kernel = TiledRasterizer::KERNEL_SCALAR; kernel <= TiledRasterizer::KERNEL_AVX2; kernel++ )
+		{
+			if( !TiledRasterizer::isKernelSupported( (TiledRasterizer::Kernel)kernel ) )
+			{
+				printf( "  tiled, %s blocks: not supported\n", kernelNames[kernel] );
+				continue;
+			}
+			const double ms = TimeScene( mesh, instanceCount, width, height, 1, (TiledRasterizer::Kernel)kernel,
+				options, pixels );
+			if( kernel == TiledRasterizer::KERNEL_SCALAR )
+				scalarKernelMs = ms;
+			printf( "  tiled, %s blocks, 1 thread: %8.3f ms, %5.2fx over scalar blocks\n",
+				kernelNames[kernel], ms, scalarKernelMs / ms );
+		}
+
+		double singleMs = 0.0;
+		for( int threads = 1; threads <= maxThreads; threads++ )
+		{
+			const double ms = TimeScene( mesh, instanceCount, width, height, threads, TiledRasterizer::KERNEL_AVX2,
+				options, pixels );
+			if( threads == 1 )
+				singleMs = ms;
+			printf( "  tiled, %2d threads: %8.3f ms, %5.2fx over 1 thread, %5.2fx over DepthRasterizer\n",
+				threads, ms, singleMs / ms, scalarMs / ms );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+void MeasureClipping( const RasterMesh& mesh, const HeadlessOptions& options )
+{
+	const int instanceCount = STRESS_GRID * STRESS_GRID;
+	DepthMatrix* worldViewProj = new DepthMatrix[instanceCount];
+	DepthImage depth( STRESS_WIDTH, STRESS_HEIGHT );
+	TaskPool pool( hardwareThreadCount() );
+	TiledRasterizer tiled( &pool );
+	tiled.setReverseZ( options.reverseZ );
+	printf( "%d tigers at %dx%d, camera at tiger height from z = -2 to z = %.0f%s:\n", instanceCount,
+		STRESS_WIDTH, STRESS_HEIGHT, STRESS_GRID * 1.4f, options.reverseZ ? ", reverse-Z" : "" );
+	printf( "      z       ms       in rejected backface   inside guard band  near  guard -> tris   culled\n" );
+	for( int step = 0; step < options.clippingSteps; step++ )
+	{
+		const float z = -2.0f + ( STRESS_GRID * 1.4f + 2.0f ) * step / maxi( options.clippingSteps - 1, 1 );
+		const float eye[3] = { 0.3f, 0.5f, z };
+		const float at[3] = { 0.0f, 0.4f, z + 5.0f };
+		GetStressScene( options.timeMs, worldViewProj, options.reverseZ, eye, at );
+
+		double totalMs = 0.0;
+		for( int frame = 0; frame < options.frames; frame++ )
+		{
+			CpuTimer timer;
+			depth.fill( farDepth( options.reverseZ ) );
+			tiled.begin( depth );
+			for( int i = 0; i < instanceCount; i++ )
+				tiled.addMesh( mesh, worldViewProj[i] );
+			tiled.end();
+			totalMs += timer.elapsedMs();
+		}
+
+		const TiledRasterStats& stats = tiled.getStats();
+		printf( "  %5.1f %8.3f %8d %8d %8d %8d %10d %5d %6d -> %4d %8d\n", z, totalMs / options.frames, stats.trianglesIn,
+			stats.trianglesRejected, stats.trianglesBackfacing, stats.trianglesInside, stats.trianglesGuardBand,
+			stats.trianglesNearClipped, stats.trianglesGuardClipped, stats.clippedTriangles, stats.trianglesCulled );
+	}
+	delete[] worldViewProj;
+}
+
+//-----------------------------------------------------------------------------
+// Relative view z error of a depth round trip and the view z step between
+// adjacent stored depths at the nearest and farthest distance
+void MeasurePrecision( const HeadlessOptions& options )
+{
+	printf( "near %g, far %g, %d distances:\n", Z_NEAR, Z_FAR, options.precisionSamples );
+	printf( "  convention  format          max error   mean error   step at near  step at far\n" );
+	for( int reversed = 0; reversed < 2; reversed++ )
+	{
+		const DepthProjection projection = getSceneProjection( reversed != 0 );
+		for( int format = 0; format < DEPTH_FORMAT_COUNT; format++ )
+		{
+			const DepthPrecisionStats stats = measureDepthPrecision( projection, (DepthFormat)format, options.precisionSamples );
+			printf( "  %-10s  %-14s %10.3g %12.3g %14.3g %12.3g\n", reversed ? "reverse-Z" : "standard",
+				getDepthFormatName( (DepthFormat)format ), stats.maxRelativeError, stats.meanRelativeError,
+				stats.nearResolution, stats.farResolution );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Grid of quads in the layout exporters write, one material per band of rows
+bool WriteSyntheticX( const char* path, int grid )
+{
+	FILE* file = fopen( path, "wb" );
+	if( file == NULL )
+		return false;
+	const int vertexCount = grid * grid;
+	const int faceCount = ( grid - 1 ) * ( grid - 1 );
+	const int materialCount = 4;
+	fprintf( file, "xof 0302txt 0032\n"
+		"template Mesh {\n <3D82AB44-62DA-11cf-AB39-0020AF71E433>\n DWORD nVertices;\n array Vector vertices[nVertices];\n"
+		" DWORD nFaces;\n array MeshFace faces[nFaces];\n [...]\n}\n\n" );
+	fprintf( file, "Frame Grid {\n FrameTransformMatrix {\n  1.000000,0.000000,0.000000,0.000000,0.000000,1.000000,0.000000,0.000000,"
+		"0.000000,0.000000,1.000000,0.000000,0.000000,0.000000,0.000000,1.000000;;\n }\nMesh Surface {\n %d;\n", vertexCount );
+	for( int i = 0; i < vertexCount; i++ )
+	{
+		const float x = ( i % grid ) / (float)grid - 0.5f;
+		const float z = ( i / grid ) / (float)grid - 0.5f;
+		fprintf( file, " %f;%f;%f;%s\n", x, 0.05f * sinf( x * 40.0f ) * cosf( z * 30.0f ), z, i + 1 < vertexCount ? "," : ";" );
+	}
+	fprintf( file, " %d;\n", faceCount );
+	for( int i = 0; i < faceCount; i++ )
+	{
+		const int v = i / ( grid - 1 ) * grid + i % ( grid - 1 );
+		fprintf( file, " 4;%d,%d,%d,%d;%s\n", v, v + grid, v + grid + 1, v + 1, i + 1 < faceCount ? "," : ";" );
+	}
+	fprintf( file, " MeshNormals {\n  %d;\n", vertexCount );
+	for( int i = 0; i < vertexCount; i++ )
+		fprintf( file, "  %f;%f;%f;%s\n", 0.0f, 1.0f, 0.0f, i + 1 < vertexCount ? "," : ";" );
+	fprintf( file, "  %d;\n", faceCount );
+	for( int i = 0; i < faceCount; i++ )
+	{
+		const int v = i / ( grid - 1 ) * grid + i % ( grid - 1 );
+		fprintf( file, "  4;%d,%d,%d,%d;%s\n", v, v + grid, v + grid + 1, v + 1, i + 1 < faceCount ? "," : ";" );
+	}
+	fprintf( file, " }\n MeshTextureCoords {\n  %d;\n", vertexCount );
+	for( int i = 0; i < vertexCount; i++ )
+		fprintf( file, "  %f;%f;%s\n", ( i % grid ) / (float)grid, ( i / grid ) / (float)grid, i + 1 < vertexCount ? "," : ";" );
+	fprintf( file, " }\n MeshMaterialList {\n  %d;\n  %d;\n", materialCount, faceCount );
+	for( int i = 0; i < faceCount; i++ )
+		fprintf( file, "  %d%s\n", i * materialCount / faceCount, i + 1 < faceCount ? "," : ";" );
+	for( int m = 0; m < materialCount; m++ )
+		fprintf( file, "  Material {\n   %f;%f;%f;1.000000;;\n   50.000000;\n   1.000000;1.000000;1.000000;;\n"
+			"   0.000000;0.000000;0.000000;;\n   TextureFilename {\n    \"grid%d.bmp\";\n   }\n  }\n", 0.25f * m, 0.5f, 1.0f - 0.25f * m, m );
+	fprintf( file, " }\n}\n}\n" );
+	return fclose( file ) == 0;
+}
+
+//-----------------------------------------------------------------------------
+// Load time of a synthetic n x n grid, the first load and the best of the rest.
+// strtod over every number of the same file is what parsing cost before XMesh
+// read numbers in place.
+bool MeasureXLoad( const HeadlessOptions& options )
+{
+	const char* path = "xload_synthetic.x";
+	if( !WriteSyntheticX( path, options.xloadGrid ) )
+	{
+		fprintf( stderr, "could not write %s\n", path );
+		return false;
+	}
+
+	const int runs = 5;
+	XMesh mesh;
+	double firstMs = 0.0;
+	double bestMs = 1.0e30;
+	bool loaded = true;
+	for( int run = 0; run < runs && loaded; run++ )
+	{
+		CpuTimer timer;
+		loaded = mesh.load( path );
+		const double ms = timer.elapsedMs();
+		firstMs = run == 0 ? ms : firstMs;
+		bestMs = minf( (float)bestMs, (float)ms );
+	}
+
+	double strtodMs = 1.0e30;
+	int numbers = 0;
+	MappedFile file;
+	if( loaded && file.open( path ) )
+	{
+		char* text = new char[file.getSize() + 1];
+		memcpy( text, file.getData(), file.getSize() );
+		text[file.getSize()] = '\0';
+		volatile double sum = 0.0;
+		for( int run = 0; run < runs; run++ )
+		{
+			CpuTimer timer;
+			numbers = 0;
+			for( char* p = text + 16; *p != '\0'; )
+			{
+				if( ( *p >= '0' && *p <= '9' ) || *p == '-' )
+				{
+					sum = sum + strtod( p, &p );
+					numbers++;
+				}
+				else if( *p == '"' || *p == '<' )
+				{
+					// Names in strings and GUIDs are not numbers
+					const char close = *p == '"' ? '"' : '>';
+					for( p++; *p != '\0' && *p != close; p++ )
+					{
+					}
+					p += *p != '\0';
+				}
+				else if( ( *p >= 'A' && *p <= 'Z' ) || ( *p >= 'a' && *p <= 'z' ) || *p == '_' )
+				{
+					while( ( *p >= 'A' && *p <= 'Z' ) || ( *p >= 'a' && *p <= 'z' ) || ( *p >= '0' && *p <= '9' ) || *p == '_' )
+						p++;
+				}
+				else
+					p++;
+			}
+			strtodMs = minf( (float)strtodMs, (float)timer.elapsedMs() );
+		}
+		delete[] text;
+	}
+	const double megabytes = file.getSize() / ( 1024.0 * 1024.0 );
+	file.close();
+
+	// A cold start parses and writes the cache, warm starts hash the .x file and
+	// map the cache. Mapped pages are read on first touch, which a bounds pass
+	// over the arrays pays for.
+	const char* cachePath = "xload_synthetic.x.cache";
+	double coldMs = 0.0;
+	double warmMs = 1.0e30;
+	double touchMs = 0.0;
+	if( loaded )
+	{
+		remove( cachePath );
+		CpuTimer coldTimer;
+		loaded = mesh.loadCached( path, cachePath );
+		coldMs = coldTimer.elapsedMs();
+		for( int run = 0; run < runs && loaded; run++ )
+		{
+			CpuTimer timer;
+			loaded = mesh.loadCached( path, cachePath ) && mesh.isMapped();
+			warmMs = minf( (float)warmMs, (float)timer.elapsedMs() );
+		}
+		if( loaded )
+		{
+			CpuTimer timer;
+			float bounds[2] = { 1.0e30f, -1.0e30f };
+			for( int i = 0; i < mesh.getVertexCount() * 3; i++ )
+			{
+				bounds[0] = minf( bounds[0], mesh.getPositions()[i] );
+				bounds[1] = maxf( bounds[1], mesh.getPositions()[i] );
+			}
+			uint32_t highest = 0;
+			for( int i = 0; i < mesh.getTriangleCount() * 3; i++ )
+				highest = mesh.getIndices()[i] > highest ? mesh.getIndices()[i] : highest;
+			touchMs = timer.elapsedMs();
+			loaded = bounds[0] <= bounds[1] && highest < (uint32_t)mesh.getVertexCount();
+		}
+	}
+	const int vertexCount = mesh.getVertexCount();
+	const int triangleCount = mesh.getTriangleCount();
+	const int subsetCount = mesh.getMaterialCount();
+	mesh.clear();
+	remove( cachePath );
+	remove( path );
+	if( !loaded )
+	{
+		fprintf( stderr, "could not load %s\n", path );
+		return false;
+	}
+
+	printf( "%dx%d grid: %.1f MB, %d vertices, %d triangles, %d subsets\n", options.xloadGrid, options.xloadGrid,
+		megabytes, vertexCount, triangleCount, subsetCount );
+	printf( "XMesh::load: %.2f ms first, %.2f ms best of %d, %.0f MB/s, %.2f M vertices/s\n", firstMs, bestMs, runs,
+		megabytes / ( bestMs * 0.001 ), vertexCount / ( bestMs * 1000.0 ) );
+	printf( "strtod over the same %d numbers: %.2f ms best\n", numbers, strtodMs );
+	printf( "cache: %.2f ms cold start, %.2f ms warm start, %.2f ms first pass over the mapped arrays\n", coldMs, warmMs,
+		touchMs );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Depth writes per covered pixel over views spread around one turn of the
+// tiger, with the cull mode of Render(). Depth of every view goes into depths.
+double MeasureOverdraw( const XMesh& mesh, int views, DepthImage* depths )
+{
+	DepthRasterizer rasterizer;
+	rasterizer.setCullMode( DepthRasterizer::CULL_CCW );
+	int64_t written = 0;
+	int64_t covered = 0;
+	for( int i = 0; i < views; i++ )
+	{
+		DepthMatrix world, view, proj;
+		getSceneMatrices( (unsigned long)( i * 2000.0 * 3.14159265 / views ), world, view, proj );
+		depths[i].resize( SCREEN_WIDTH, SCREEN_HEIGHT );
+		depths[i].fill( farDepth( false ) );
+		rasterizer.resetStats();
+		rasterizer.draw( mesh.getRasterMesh(), multiplyMatrix( multiplyMatrix( world, view ), proj ), depths[i] );
+		written += rasterizer.getStats().pixelsWritten;
+		for( int y = 0; y < SCREEN_HEIGHT; y++ )
+		{
+			for( int x = 0; x < SCREEN_WIDTH; x++ )
+				covered += depths[i].row( y )[x] != farDepth( false );
+		}
+	}
+	return covered > 0 ? written / (double)covered : 0.0;
+}
+
+//-----------------------------------------------------------------------------
+// Cache, fetch and overdraw figures of the mesh as loaded and after optimize().
+// The depth images have to come out the same, only the order changed.
+bool MeasureOptimization( const XMesh& mesh, const char* path, const HeadlessOptions& options )
+{
+	XMesh optimized;
+	if( !optimized.load( path ) )
+		return false;
+	CpuTimer timer;
+	optimized.optimize();
+	const double optimizeMs = timer.elapsedMs();
+
+	const int views = options.optimizeViews;
+	const int vertexSize = ( 3 + ( mesh.getNormals() != NULL ? 3 : 0 ) + 2 ) * sizeof( float );
+	DepthImage* depths[2] = { new DepthImage[views], new DepthImage[views] };
+	printf( "%s: %d vertices, %d triangles, %d subsets, optimized in %.2f ms\n", path, mesh.getVertexCount(),
+		mesh.getTriangleCount(), mesh.getMaterialCount(), optimizeMs );
+	printf( "             ACMR/ATVR %d entries  ACMR/ATVR 32 entries  overfetch  overdraw (%d views)\n",
+		VERTEX_CACHE_SIZE, views );
+	for( int pass = 0; pass < 2; pass++ )
+	{
+		const XMesh& measured = pass == 0 ? mesh : optimized;
+		const VertexCacheStats small = analyzeVertexCache( measured.getIndices(), measured.getTriangleCount(),
+			measured.getVertexCount(), VERTEX_CACHE_SIZE );
+		const VertexCacheStats large = analyzeVertexCache( measured.getIndices(), measured.getTriangleCount(),
+			measured.getVertexCount(), 32 );
+		const double overfetch = analyzeVertexFetch( measured.getIndices(), measured.getTriangleCount(),
+			measured.getVertexCount(), vertexSize );
+		const double overdraw = MeasureOverdraw( measured, views, depths[pass] );
+		printf( "  %-9s  %6.3f / %5.3f        %6.3f / %5.3f        %6.3f     %6.3f\n", pass == 0 ? "as loaded" : "optimized",
+			small.acmr, small.atvr, large.acmr, large.atvr, overfetch, overdraw );
+	}
+
+	int differentViews = 0;
+	for( int i = 0; i < views; i++ )
+	{
+		bool same = true;
+		for( int y = 0; y < SCREEN_HEIGHT && same; y++ )
+			same = memcmp( depths[0][i].row( y ), depths[1][i].row( y ), SCREEN_WIDTH * sizeof( float ) ) == 0;
+		differentViews += !same;
+	}
+	printf( "depth images: %d of %d views differ\n", differentViews, views );
+	delete[] depths[0];
+	delete[] depths[1];
+	return differentViews == 0;
+}
+
+//-----------------------------------------------------------------------------
+// Area weighted vertex normals, for meshes that come without any
+void ComputeNormals( const XMesh& mesh, float* normals )
+{
+	const float* positions = mesh.getPositions();
+	const uint32_t* indices = mesh.getIndices();
+	memset( normals, 0, mesh.getVertexCount() * 3 * sizeof( float ) );
+	for( int t = 0; t < mesh.getTriangleCount(); t++ )
+	{
+		const float* p0 = positions + indices[t * 3] * 3;
+		const float* p1 = positions + indices[t * 3 + 1] * 3;
+		const float* p2 = positions + indices[t * 3 + 2] * 3;
+		const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		const float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		for( int k = 0; k < 3; k++ )
+		{
+			for( int a = 0; a < 3; a++ )
+				normals[indices[t * 3 + k] * 3 + a] += n[a];
+		}
+	}
+	for( int v = 0; v < mesh.getVertexCount(); v++ )
+	{
+		float* n = normals + v * 3;
+		const float length = sqrtf( n[0] * n[0] + n[1] * n[1] + n[2] * n[2] );
+		for( int a = 0; a < 3; a++ )
+			n[a] = length > 0.0f ? n[a] / length : ( a == 2 ? 1.0f : 0.0f );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Vertex size and decode error of the VertexQuantizer formats with both normal
+// encodings and without normals, then the depth of the packed positions against
+// the float mesh over options.quantizeViews views with the cull mode of Render().
+void MeasureQuantization( const XMesh& mesh, const HeadlessOptions& options )
+{
+	const int vertexCount = mesh.getVertexCount();
+	const float* normals = mesh.getNormals();
+	float* computedNormals = NULL;
+	if( normals == NULL )
+	{
+		computedNormals = new float[vertexCount * 3];
+		ComputeNormals( mesh, computedNormals );
+		normals = computedNormals;
+	}
+	printf( "%d vertices, %d subsets, normals %s\n", vertexCount, mesh.getMaterialCount(),
+		computedNormals != NULL ? "computed from the triangles" : "from the file" );
+	printf( "           bytes    position max / rms    normal max / mean deg    uv max / mean        quantize\n" );
+
+	VertexQuantizer quantizer;
+	const NormalEncoding encodings[3] = { NORMAL_OCT8, NORMAL_OCT16, NORMAL_OCT16 };
+	const char* names[3] = { "oct8", "oct16", "none" };
+	for( int e = 0; e < 3; e++ )
+	{
+		const float* formatNormals = e < 2 ? normals : NULL;
+		CpuTimer timer;
+		quantizer.quantize( mesh.getPositions(), formatNormals, mesh.getTexcoords(), vertexCount, mesh.getSubsets(),
+			mesh.getMaterialCount(), encodings[e] );
+		const double quantizeMs = timer.elapsedMs();
+		const QuantizationErrors errors = quantizer.measureErrors( mesh.getPositions(), formatNormals, mesh.getTexcoords() );
+		printf( "  %-6s  %2d vs %2d   %8.2g / %8.2g   %8.4f / %8.4f    %8.2g / %8.2g   %.2f ms\n",
+			names[e], quantizer.getStride(), quantizer.getFloatStride(),
+			errors.maxPositionError, errors.rmsPositionError, errors.maxNormalDegrees, errors.meanNormalDegrees,
+			errors.maxTexcoordError, errors.meanTexcoordError, quantizeMs );
+	}
+	printf( "vertex buffer without normals %d bytes float, %d quantized (%.2fx smaller)\n",
+		vertexCount * quantizer.getFloatStride(), vertexCount * quantizer.getStride(),
+		quantizer.getFloatStride() / (double)quantizer.getStride() );
+
+	// The oct16 and normal free formats pack the positions alike
+	float* decodedPositions = new float[vertexCount * 3];
+	float* decodedTexcoords = new float[vertexCount * 2];
+	quantizer.decode( decodedPositions, NULL, decodedTexcoords );
+	RasterMesh decodedMesh = mesh.getRasterMesh();
+	decodedMesh.positions = decodedPositions;
+
+	DepthRasterizer rasterizer;
+	rasterizer.setCullMode( DepthRasterizer::CULL_CCW );
+	DepthImage reference( SCREEN_WIDTH, SCREEN_HEIGHT );
+	DepthImage decoded( SCREEN_WIDTH, SCREEN_HEIGHT );
+	const int views = options.quantizeViews;
+	float maxDifference = 0.0f;
+	double differenceSum = 0.0;
+	int coveredPixels = 0;
+	int differentPixels = 0;
+	int coverageMismatches = 0;
+	for( int i = 0; i < views; i++ )
+	{
+		DepthMatrix world, view, proj;
+		getSceneMatrices( (unsigned long)( i * 2000.0 * 3.14159265 / views ), world, view, proj );
+		const DepthMatrix worldViewProj = multiplyMatrix( multiplyMatrix( world, view ), proj );
+		reference.fill( farDepth( false ) );
+		decoded.fill( farDepth( false ) );
+		rasterizer.draw( mesh.getRasterMesh(), worldViewProj, reference );
+		rasterizer.draw( decodedMesh, worldViewProj, decoded );
+		for( int y = 0; y < SCREEN_HEIGHT; y++ )
+		{
+			for( int x = 0; x < SCREEN_WIDTH; x++ )
+			{
+				const float a = reference.row( y )[x];
+				const float b = decoded.row( y )[x];
+				if( ( a == farDepth( false ) ) != ( b == farDepth( false ) ) )
+				{
+					coverageMismatches++;
+					continue;
+				}
+				coveredPixels += a != farDepth( false );
+				differentPixels += a != b;
+				differenceSum += fabsf( a - b );
+				maxDifference = fabsf( a - b ) > maxDifference ? fabsf( a - b ) : maxDifference;
+			}
+		}
+	}
+	printf( "depth over %d views: max difference %.3g, mean %.3g over %d covered pixels, %d differ, %d coverage mismatches\n",
+		views, maxDifference, coveredPixels > 0 ? differenceSum / coveredPixels : 0.0, coveredPixels, differentPixels,
+		coverageMismatches );
+
+	delete[] decodedPositions;
+	delete[] decodedTexcoords;
+	delete[] computedNormals;
+}
+
+//-----------------------------------------------------------------------------
+// Meshlet culling over views around the tiger. A triangle is visible when
+// drawing it alone again passes the LESSEQUAL test somewhere in the depth of
+// the whole mesh, so the ones culled that are visible are the culling errors.
+bool MeasureClusters( const char* path, const HeadlessOptions& options )
+{
+	XMesh mesh;
+	if( !mesh.load( path ) )
+		return false;
+	mesh.optimize();
+	ClusterCuller culler;
+	CpuTimer buildTimer;
+	culler.setMesh( mesh.getPositions(), mesh.getIndices(), mesh.getVertexCount(), mesh.getSubsets(), mesh.getMaterialCount() );
+	const double buildMs = buildTimer.elapsedMs();
+	culler.setReverseZ( options.reverseZ );
+	const int triangleCount = mesh.getTriangleCount();
+	const int meshletCount = culler.getMeshletCount();
+	int meshletVertices = 0;
+	for( int i = 0; i < meshletCount; i++ )
+		meshletVertices += culler.getMeshlets()[i].vertexCount;
+	printf( "%s: %d triangles, %d meshlets of %.1f vertices and %.1f triangles on average, built in %.2f ms\n", path,
+		triangleCount, meshletCount, meshletVertices / (double)maxi( meshletCount, 1 ),
+		triangleCount / (double)maxi( meshletCount, 1 ), buildMs );
+
+	DepthRasterizer rasterizer;
+	rasterizer.setCullMode( DepthRasterizer::CULL_CCW );
+	rasterizer.setReverseZ( options.reverseZ );
+	DepthReprojection reprojection;
+	reprojection.setReverseZ( options.reverseZ );
+	DepthImage previous( SCREEN_WIDTH, SCREEN_HEIGHT );
+	DepthImage depth( SCREEN_WIDTH, SCREEN_HEIGHT );
+	bool* submitted = new bool[triangleCount];
+	RasterMesh rasterMesh = mesh.getRasterMesh();
+	rasterMesh.indices = culler.getIndices();
+	const int views = options.clusterViews;
+	ClusterCullStats totals;
+	memset( &totals, 0, sizeof( totals ) );
+	int visibleTriangles = 0;
+	int lostTriangles = 0;
+	for( int i = 0; i < views; i++ )
+	{
+		const unsigned long timeMs = options.timeMs + (unsigned long)( i * 2000.0 * 3.14159265 / views );
+		DepthMatrix world, view, proj;
+		getSceneMatrices( timeMs - 16, world, view, proj, options.reverseZ );
+		const DepthMatrix previousMatrix = multiplyMatrix( multiplyMatrix( world, view ), proj );
+		getSceneMatrices( timeMs, world, view, proj, options.reverseZ );
+		const DepthMatrix worldViewProj = multiplyMatrix( multiplyMatrix( world, view ), proj );
+
+		previous.fill( farDepth( options.reverseZ ) );
+		rasterizer.draw( rasterMesh, previousMatrix, previous );
+		culler.clearHiZ();
+		if( reprojection.setMatrices( previousMatrix, worldViewProj ) )
+		{
+			reprojection.reproject( previous );
+			culler.buildHiZ( reprojection.getPredicted() );
+		}
+		const int rangeCount = culler.cull( worldViewProj, SCREEN_WIDTH, SCREEN_HEIGHT );
+		const ClusterCullStats& stats = culler.getStats();
+		totals.hizMs += stats.hizMs;
+		totals.cullMs += stats.cullMs;
+		totals.meshletsTested += stats.meshletsTested;
+		totals.frustumCulled += stats.frustumCulled;
+		totals.backfaceCulled += stats.backfaceCulled;
+		totals.occlusionCulled += stats.occlusionCulled;
+		totals.trianglesSubmitted += stats.trianglesSubmitted;
+		totals.rangesEmitted += stats.rangesEmitted;
+
+		memset( submitted, 0, triangleCount * sizeof( bool ) );
+		for( int r = 0; r < rangeCount; r++ )
+		{
+			const ClusterRange& range = culler.getRanges()[r];
+			for( int t = 0; t < range.triangleCount; t++ )
+				submitted[range.firstTriangle + t] = true;
+		}
+
+		depth.fill( farDepth( options.reverseZ ) );
+		rasterizer.draw( rasterMesh, worldViewProj, depth );
+		for( int t = 0; t < triangleCount; t++ )
+		{
+			float corners[9];
+			for( int k = 0; k < 3; k++ )
+				memcpy( corners + k * 3, mesh.getPositions() + culler.getIndices()[t * 3 + k] * 3, sizeof( float ) * 3 );
+			const uint32_t triangleIndices[3] = { 0, 1, 2 };
+			const RasterMesh triangle = { corners, 3, 3, triangleIndices, 1 };
+			rasterizer.resetStats();
+			rasterizer.draw( triangle, worldViewProj, depth );
+			const bool visible = rasterizer.getStats().pixelsWritten > 0;
+			visibleTriangles += visible;
+			lostTriangles += visible && !submitted[t];
+		}
+	}
+
+	printf( "over %d views, per view: %.1f meshlets outside the frustum, %.1f back facing, %.1f occluded of %d\n", views,
+		totals.frustumCulled / (double)views, totals.backfaceCulled / (double)views, totals.occlusionCulled / (double)views,
+		meshletCount );
+	printf( "  triangles %d, submitted %.1f in %.1f ranges, visible %.1f, visible but culled %.1f\n", triangleCount,
+		totals.trianglesSubmitted / (double)views, totals.rangesEmitted / (double)views, visibleTriangles / (double)views,
+		lostTriangles / (double)views );
+	printf( "  Hi-Z %.3f ms, cull %.3f ms\n", totals.hizMs / views, totals.cullMs / views );
+	delete[] submitted;
+	return lostTriangles == 0;
+}
+
+//-----------------------------------------------------------------------------
+// Shades options.frames frames like the depth loop in main(), the first is the
+// golden image. Subsets are drawn in order like DrawSubset() in Render(), the
+// texture on those whose material names one.
+void RenderColor( const XMesh& mesh, const SoftwareTexture* texture, const HeadlessOptions& options, ColorImage& golden )
+{
+	// Render() copies the diffuse color into the ambient one
+	const XMaterial* materials = mesh.getMaterials();
+	ShadeParams* params = new ShadeParams[mesh.getMaterialCount()];
+	for( int m = 0; m < mesh.getMaterialCount(); m++ )
+	{
+		for( int i = 0; i < 3; i++ )
+		{
+			params[m].ambientLight[i] = ( ( AMBIENT_LIGHT >> ( ( 2 - i ) * 8 ) ) & 0xFF ) / 255.0f;
+			params[m].materialAmbient[i] = materials[m].diffuse[i];
+			params[m].materialEmissive[i] = materials[m].emissive[i];
+		}
+		params[m].materialAlpha = materials[m].diffuse[3];
+		params[m].texture = materials[m].textureFilename[0] != '\0' ? texture : NULL;
+		params[m].filter = options.bilinear ? SoftwareTexture::FILTER_LINEAR : SoftwareTexture::FILTER_POINT;
+	}
+
+	ColorRasterizer rasterizer;
+	rasterizer.setCullMode( DepthRasterizer::CULL_CCW );
+	rasterizer.setReverseZ( options.reverseZ );
+	DepthImage depth( SCREEN_WIDTH, SCREEN_HEIGHT );
+	ColorImage color( SCREEN_WIDTH, SCREEN_HEIGHT );
+	double totalMs = 0.0;
+	double bestMs = 1.0e30;
+	for( int frame = 0; frame < options.frames; frame++ )
+	{
+		DepthMatrix world, view, proj;
+		getSceneMatrices( options.timeMs + frame * 16, world, view, proj, options.reverseZ );
+		const DepthMatrix worldViewProj = multiplyMatrix( multiplyMatrix( world, view ), proj );
+
+		CpuTimer timer;
+		depth.fill( farDepth( options.reverseZ ) );
+		color.fill( BACKGROUND_COLOR );
+		rasterizer.resetStats();
+		for( int s = 0; s < mesh.getMaterialCount(); s++ )
+		{
+			const XSubset& subset = mesh.getSubsets()[s];
+			RasterMesh subsetMesh = mesh.getRasterMesh();
+			subsetMesh.indices += subset.firstTriangle * 3;
+			subsetMesh.triangleCount = subset.triangleCount;
+			rasterizer.draw( subsetMesh, mesh.getTexcoords(), worldViewProj, params[subset.material], depth, color );
+		}
+		const double ms = timer.elapsedMs();
+		totalMs += ms;
+		bestMs = minf( (float)bestMs, (float)ms );
+		if( frame == 0 )
+			golden.copyFrom( color );
+	}
+	printf( "color: %d pixels shaded, %.3f ms average, %.3f ms best%s\n", rasterizer.getStats().pixelsShaded,
+		totalMs / options.frames, bestMs, texture != NULL ? "" : ", untextured" );
+	delete[] params;
+}
+
+//-----------------------------------------------------------------------------
+// Number of pixels with a channel off by more than COLOR_TOLERANCE, -1 if the
+// reference can not be read or has another size
+int CompareColor( const ColorImage& image, const char* path )
+{
+	ColorImage reference;
+	if( !loadBmp( path, reference ) || reference.getWidth() != image.getWidth() || reference.getHeight() != image.getHeight() )
+		return -1;
+
+	int maxDifference = 0;
+	int pixelsOff = 0;
+	double totalDifference = 0.0;
+	for( int y = 0; y < image.getHeight(); y++ )
+	{
+		for( int x = 0; x < image.getWidth(); x++ )
+		{
+			int pixelDifference = 0;
+			for( int shift = 0; shift < 24; shift += 8 )
+			{
+				const int a = ( image.at( x, y ) >> shift ) & 0xFF;
+				const int b = ( reference.at( x, y ) >> shift ) & 0xFF;
+				pixelDifference = maxi( pixelDifference, a > b ? a - b : b - a );
+			}
+			maxDifference = maxi( maxDifference, pixelDifference );
+			pixelsOff += pixelDifference > COLOR_TOLERANCE;
+			totalDifference += pixelDifference;
+		}
+	}
+	printf( "compared with %s: max difference %d, mean %.3f, %d pixels off by more than %d\n", path, maxDifference,
+		totalDifference / ( image.getWidth() * image.getHeight() ), pixelsOff, COLOR_TOLERANCE );
+	return pixelsOff;
+}
+
+//-----------------------------------------------------------------------------
+bool WritePfm( const char* path, const DepthImage& depth )
+{
+	FILE* file = fopen( path, "wb" );
+	if( file == NULL )
+		return false;
+	bool ok = fprintf( file, "Pf\n%d %d\n-1.0\n", depth.getWidth(), depth.getHeight() ) > 0;
+	for( int y = depth.getHeight() - 1; y >= 0 && ok; --y )
+	{
+		ok = fwrite( depth.row( y ), sizeof( float ), depth.getWidth(), file ) == (size_t)depth.getWidth();
+	}
+	return fclose( file ) == 0 && ok;
+}
+
+//-----------------------------------------------------------------------------
+bool WriteD24( const char* path, const DepthImage& depth )
+{
+	const int count = depth.getWidth() * depth.getHeight();
+	uint32_t* samples = new uint32_t[count];
+	DepthCodec::quantizeDepth( depth, 24, samples, depth.getWidth() );
+
+	// Byte order fixed independent of the host
+	uint8_t* bytes = new uint8_t[count * 4];
+	for( int i = 0; i < count; i++ )
+	{
+		bytes[i * 4] = (uint8_t)samples[i];
+		bytes[i * 4 + 1] = (uint8_t)( samples[i] >> 8 );
+		bytes[i * 4 + 2] = (uint8_t)( samples[i] >> 16 );
+		bytes[i * 4 + 3] = 0;
+	}
+
+	FILE* file = fopen( path, "wb" );
+	bool ok = file != NULL && fwrite( bytes, 4, count, file ) == (size_t)count;
+	if( file != NULL )
+		ok = fclose( file ) == 0 && ok;
+	delete[] samples;
+	delete[] bytes;
+	return ok;
+}
+
+//-----------------------------------------------------------------------------
+int main( int argc, char** argv )
+{
+	HeadlessOptions options;
+	if( !ParseOptions( argc, argv, options ) )
+	{
+		fprintf( stderr, "usage: %s [-mesh tiger.x] [-time ms] [-frames n] [-pfm out.pfm] [-d24 out.d24] [-scaling threads] [-vertices copies] [-clipping steps] [-reversez 0|1] [-precision samples] [-texture tiger.bmp] [-bilinear 0|1] [-bmp out.bmp] [-compare golden.bmp] [-xload gridsize] [-optimize views] [-quantize views] [-clusters views]\n", argv[0] );
+		return 2;
+	}
+	if( options.precisionSamples > 0 )
+	{
+		MeasurePrecision( options );
+		return 0;
+	}
+	if( options.xloadGrid > 0 )
+		return MeasureXLoad( options ) ? 0 : 1;
+
+	// Same search order as InitGeometry()
+	XMesh mesh;
+	const char* meshPath = options.meshPath != NULL ? options.meshPath : "tiger.x";
+	bool loaded = mesh.load( meshPath );
+	if( !loaded && options.meshPath == NULL )
+	{
+		meshPath = "../tiger.x";
+		loaded = mesh.load( meshPath );
+	}
+	if( !loaded )
+	{
+		fprintf( stderr, "could not load %s\n", options.meshPath != NULL ? options.meshPath : "tiger.x" );
+		return 1;
+	}
+	const RasterMesh rasterMesh = mesh.getRasterMesh();
+	if( options.optimizeViews > 0 )
+		return MeasureOptimization( mesh, meshPath, options ) ? 0 : 1;
+	if( options.quantizeViews > 0 )
+	{
+		MeasureQuantization( mesh, options );
+		return 0;
+	}
+	if( options.clusterViews > 0 )
+		return MeasureClusters( meshPath, options ) ? 0 : 1;
+	if( options.vertexCopies > 0 )
+	{
+		MeasureVertices( mesh, options );
+		return 0;
+	}
+	if( options.scalingThreads >= 0 )
+	{
+		MeasureScaling( rasterMesh, options );
+		return 0;
+	}
+	if( options.clippingSteps > 0 )
+	{
+		MeasureClipping( rasterMesh, options );
+		return 0;
+	}
+
+	// The D3D9 default cull mode is D3DCULL_CCW, Render() never changes it
+	DepthRasterizer rasterizer;
+	rasterizer.setCullMode( DepthRasterizer::CULL_CCW );
+	rasterizer.setReverseZ( options.reverseZ );
+	DepthImage depth( SCREEN_WIDTH, SCREEN_HEIGHT );
+
+	// Frames after the first advance the animation by 16 ms so every frame differs,
+	// the golden image is the first one
+	DepthImage golden;
+	double totalMs = 0.0;
+	double bestMs = 1.0e30;
+	for( int frame = 0; frame < options.frames; frame++ )
+	{
+		DepthMatrix world, view, proj;
+		getSceneMatrices( options.timeMs + frame * 16, world, view, proj, options.reverseZ );
+		const DepthMatrix worldViewProj = multiplyMatrix( multiplyMatrix( world, view ), proj );
+
+		CpuTimer timer;
+		depth.fill( farDepth( options.reverseZ ) );
+		rasterizer.resetStats();
+		rasterizer.draw( rasterMesh, worldViewProj, depth );
+		const double ms = timer.elapsedMs();
+		totalMs += ms;
+		bestMs = minf( (float)bestMs, (float)ms );
+		if( frame == 0 )
+			golden.copyFrom( depth );
+	}
+
+	const RasterStats& stats = rasterizer.getStats();
+	printf( "%s: %d vertices, %d triangles\n", options.meshPath != NULL ? options.meshPath : "tiger.x",
+		mesh.getVertexCount(), mesh.getTriangleCount() );
+	printf( "last frame: %d culled, %d dropped at the near plane, %d pixels written\n",
+		stats.trianglesCulled, stats.trianglesDropped, stats.pixelsWritten );
+	printf( "%d frames at %dx%d: %.3f ms average, %.3f ms best\n", options.frames, SCREEN_WIDTH, SCREEN_HEIGHT,
+		totalMs / options.frames, bestMs );
+
+	if( options.pfmPath != NULL && !WritePfm( options.pfmPath, golden ) )
+	{
+		fprintf( stderr, "could not write %s\n", options.pfmPath );
+		return 1;
+	}
+	if( options.d24Path != NULL && !WriteD24( options.d24Path, golden ) )
+	{
+		fprintf( stderr, "could not write %s\n", options.d24Path );
+		return 1;
+	}
+
+	if( options.bmpPath != NULL || options.comparePath != NULL )
+	{
+		// A missing texture leaves the lit color alone, as D3D draws without one.
+		// The parent folder is searched like InitGeometry() does.
+		const char* texturePath = options.texturePath != NULL ? options.texturePath : mesh.getMaterials()[0].textureFilename;
+		char parentPath[XMaterial::MAX_PATH_LENGTH + 3];
+		sprintf( parentPath, "../%s", texturePath );
+		SoftwareTexture texture;
+		const bool textured = texturePath[0] != '\0' && ( texture.load( texturePath ) ||
+			( options.texturePath == NULL && texture.load( parentPath ) ) );
+		if( !textured && texturePath[0] != '\0' )
+			fprintf( stderr, "could not load %s\n", texturePath );
+		ColorImage color;
+		RenderColor( mesh, textured ? &texture : NULL, options, color );
+		if( options.bmpPath != NULL && !saveBmp( options.bmpPath, color ) )
+		{
+			fprintf( stderr, "could not write %s\n", options.bmpPath );
+			return 1;
+		}
+		if( options.comparePath != NULL )
+		{
+			const int pixelsOff = CompareColor( color, options.comparePath );
+			if( pixelsOff < 0 )
+			{
+				fprintf( stderr, "could not compare with %s\n", options.comparePath );
+				return 1;
+			}
+			if( pixelsOff > 0 )
+				return 3;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,389 @@
+//-----------------------------------------------------------------------------
+// File: MeshOptimizer.cpp
+//-----------------------------------------------------------------------------
+#include "MeshOptimizer.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int			FETCH_CACHE_LINES = 256;
+static const int			FETCH_LINE_SIZE = 64;
+
+//--------------------------------------------------------------------------------------
+// FIFO cache as timestamps: a vertex is cached while fewer than cacheSize
+// misses came after its own
+struct FifoCache
+{
+	int*					stamps;
+	int						time;
+	int						size;
+
+	FifoCache(int vertexCount, int cacheSize)
+		: stamps( new int[vertexCount] )
+		, time( cacheSize + 1 )
+		, size( cacheSize )
+	{
+		memset(stamps, 0, vertexCount * sizeof(int));
+	}
+
+	~FifoCache()
+	{
+		delete[] stamps;
+	}
+
+	// Forgets every vertex
+	void flush()
+	{
+		time += size + 1;
+	}
+
+	// Misses of one triangle
+	int add(const uint32_t* triangle)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			if (time - stamps[triangle[k]] > size)
+			{
+				stamps[triangle[k]] = time++;
+				++misses;
+			}
+		}
+		return misses;
+	}
+};
+
+//--------------------------------------------------------------------------------------
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, int triangleCount, int vertexCount, int cacheSize)
+{
+	FifoCache cache(vertexCount, cacheSize);
+	bool* used = new bool[vertexCount];
+	memset(used, 0, vertexCount * sizeof(bool));
+	VertexCacheStats stats;
+	stats.verticesTransformed = 0;
+	int usedCount = 0;
+	for (int t = 0; t < triangleCount; ++t)
+	{
+		stats.verticesTransformed += cache.add(indices + t * 3);
+		for (int k = 0; k < 3; ++k)
+		{
+			usedCount += !used[indices[t * 3 + k]];
+			used[indices[t * 3 + k]] = true;
+		}
+	}
+	delete[] used;
+	stats.acmr = triangleCount > 0 ? stats.verticesTransformed / (double)triangleCount : 0.0;
+	stats.atvr = usedCount > 0 ? stats.verticesTransformed / (double)usedCount : 0.0;
+	return stats;
+}
+
+//--------------------------------------------------------------------------------------
+double analyzeVertexFetch(const uint32_t* indices, int triangleCount, int vertexCount, int vertexSize)
+{
+	int64_t tags[FETCH_CACHE_LINES];
+	for (int i = 0; i < FETCH_CACHE_LINES; ++i)
+	{
+		tags[i] = -1;
+	}
+	bool* used = new bool[vertexCount];
+	memset(used, 0, vertexCount * sizeof(bool));
+	int64_t fetched = 0;
+	int64_t usedBytes = 0;
+	for (int i = 0; i < triangleCount * 3; ++i)
+	{
+		const int64_t start = (int64_t)indices[i] * vertexSize;
+		for (int64_t line = start / FETCH_LINE_SIZE; line <= (start + vertexSize - 1) / FETCH_LINE_SIZE; ++line)
+		{
+			int64_t& tag = tags[line % FETCH_CACHE_LINES];
+			if (tag != line)
+			{
+				tag = line;
+				fetched += FETCH_LINE_SIZE;
+			}
+		}
+		usedBytes += used[indices[i]] ? 0 : vertexSize;
+		used[indices[i]] = true;
+	}
+	delete[] used;
+	return usedBytes > 0 ? fetched / (double)usedBytes : 0.0;
+}
+
+//--------------------------------------------------------------------------------------
+int optimizeVertexCache(uint32_t* indices, int triangleCount, int vertexCount, int cacheSize, int* clusters)
+{
+	if (triangleCount == 0)
+	{
+		return 0;
+	}
+
+	// Triangles around every vertex, and how many of them are left to emit
+	int* live = new int[vertexCount];
+	int* firstAdjacent = new int[vertexCount + 1];
+	int* adjacent = new int[triangleCount * 3];
+	memset(live, 0, vertexCount * sizeof(int));
+	for (int i = 0; i < triangleCount * 3; ++i)
+	{
+		++live[indices[i]];
+	}
+	firstAdjacent[0] = 0;
+	for (int v = 0; v < vertexCount; ++v)
+	{
+		firstAdjacent[v + 1] = firstAdjacent[v] + live[v];
+	}
+	int* fill = new int[vertexCount];
+	memcpy(fill, firstAdjacent, vertexCount * sizeof(int));
+	for (int i = 0; i < triangleCount * 3; ++i)
+	{
+		adjacent[fill[indices[i]]++] = i / 3;
+	}
+	delete[] fill;
+
+	// cacheTime is the time a vertex last entered the cache, it is cached while
+	// time - cacheTime <= cacheSize
+	int* cacheTime = new int[vertexCount];
+	memset(cacheTime, 0, vertexCount * sizeof(int));
+	bool* emitted = new bool[triangleCount];
+	memset(emitted, 0, triangleCount * sizeof(bool));
+	int* deadEnds = new int[triangleCount * 3];
+	int deadEndCount = 0;
+	int* candidates = new int[triangleCount * 3];
+	uint32_t* output = new uint32_t[triangleCount * 3];
+	int outputCount = 0;
+	int clusterCount = 0;
+	int time = cacheSize + 1;
+	int cursor = 0;
+
+	// Start at the first vertex of the first triangle
+	int fanning = (int)indices[0];
+	while (fanning >= 0)
+	{
+		if (time - cacheTime[fanning] > cacheSize)
+		{
+			clusters[clusterCount++] = outputCount;
+		}
+		int candidateCount = 0;
+		for (int a = firstAdjacent[fanning]; a < firstAdjacent[fanning + 1]; ++a)
+		{
+			const int t = adjacent[a];
+			if (emitted[t])
+			{
+				continue;
+			}
+			for (int k = 0; k < 3; ++k)
+			{
+				const int v = (int)indices[t * 3 + k];
+				output[outputCount * 3 + k] = (uint32_t)v;
+				deadEnds[deadEndCount++] = v;
+				candidates[candidateCount++] = v;
+				--live[v];
+				if (time - cacheTime[v] > cacheSize)
+				{
+					cacheTime[v] = time++;
+				}
+			}
+			emitted[t] = true;
+			++outputCount;
+		}
+
+		// Cached candidates that will still be cached after fanning around them
+		// are best, the oldest first as it is about to drop out. Anything with
+		// triangles left comes next.
+		int next = -1;
+		int bestPriority = -1;
+		for (int c = 0; c < candidateCount; ++c)
+		{
+			const int v = candidates[c];
+			if (live[v] > 0)
+			{
+				const int priority = time - cacheTime[v] + 2 * live[v] <= cacheSize ? time - cacheTime[v] : 0;
+				if (priority > bestPriority)
+				{
+					bestPriority = priority;
+					next = v;
+				}
+			}
+		}
+
+		// Dead end: the most recent vertex with triangles left, else the next
+		// one in input order
+		while (next < 0 && deadEndCount > 0)
+		{
+			const int v = deadEnds[--deadEndCount];
+			next = live[v] > 0 ? v : -1;
+		}
+		for (; next < 0 && cursor < vertexCount; ++cursor)
+		{
+			next = live[cursor] > 0 ? cursor : -1;
+		}
+		fanning = next;
+	}
+	memcpy(indices, output, triangleCount * 3 * sizeof(uint32_t));
+
+	delete[] live;
+	delete[] firstAdjacent;
+	delete[] adjacent;
+	delete[] cacheTime;
+	delete[] emitted;
+	delete[] deadEnds;
+	delete[] candidates;
+	delete[] output;
+	return clusterCount;
+}
+
+//--------------------------------------------------------------------------------------
+struct ClusterKey
+{
+	float					key;
+	int						cluster;
+};
+
+//--------------------------------------------------------------------------------------
+// Largest key first, ties in the original order
+static int compareClusterKeys(const void* a, const void* b)
+{
+	const ClusterKey& x = *(const ClusterKey*)a;
+	const ClusterKey& y = *(const ClusterKey*)b;
+	if (x.key != y.key)
+	{
+		return x.key > y.key ? -1 : 1;
+	}
+	return x.cluster - y.cluster;
+}
+
+//--------------------------------------------------------------------------------------
+void optimizeOverdraw(uint32_t* indices, int triangleCount, const float* positions, int stride, int vertexCount,
+	const int* clusters, int clusterCount, int cacheSize, float threshold)
+{
+	if (triangleCount == 0 || clusterCount == 0)
+	{
+		return;
+	}
+
+	// Cut a cluster wherever the miss rate of the part since the last cut is
+	// within threshold of the whole cluster's, the cut costs about that much
+	int* starts = new int[triangleCount + 1];
+	int startCount = 0;
+	FifoCache cache(vertexCount, cacheSize);
+	for (int c = 0; c < clusterCount; ++c)
+	{
+		const int first = clusters[c];
+		const int end = c + 1 < clusterCount ? clusters[c + 1] : triangleCount;
+		cache.flush();
+		int clusterMisses = 0;
+		for (int t = first; t < end; ++t)
+		{
+			clusterMisses += cache.add(indices + t * 3);
+		}
+		const float limit = threshold * clusterMisses / (float)(end - first);
+
+		cache.flush();
+		starts[startCount++] = first;
+		int misses = 0;
+		int count = 0;
+		for (int t = first; t < end - 1; ++t)
+		{
+			misses += cache.add(indices + t * 3);
+			++count;
+			if (misses <= limit * count)
+			{
+				starts[startCount++] = t + 1;
+				cache.flush();
+				misses = 0;
+				count = 0;
+			}
+		}
+	}
+	starts[startCount] = triangleCount;
+
+	// Area weighted centroid and normal of every cluster against the centroid
+	// of the mesh, larger when the cluster faces away from the center
+	double center[3] = { 0.0, 0.0, 0.0 };
+	for (int i = 0; i < triangleCount * 3; ++i)
+	{
+		for (int a = 0; a < 3; ++a)
+		{
+			center[a] += positions[indices[i] * stride + a];
+		}
+	}
+	for (int a = 0; a < 3; ++a)
+	{
+		center[a] /= triangleCount * 3;
+	}
+	ClusterKey* keys = new ClusterKey[startCount];
+	for (int c = 0; c < startCount; ++c)
+	{
+		double centroid[3] = { 0.0, 0.0, 0.0 };
+		double normal[3] = { 0.0, 0.0, 0.0 };
+		double area = 0.0;
+		for (int t = starts[c]; t < starts[c + 1]; ++t)
+		{
+			const float* p0 = positions + indices[t * 3] * stride;
+			const float* p1 = positions + indices[t * 3 + 1] * stride;
+			const float* p2 = positions + indices[t * 3 + 2] * stride;
+			const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			const double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			const double triangleArea = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (int a = 0; a < 3; ++a)
+			{
+				centroid[a] += (p0[a] + p1[a] + p2[a]) * (triangleArea / 3.0);
+				normal[a] += n[a];
+			}
+			area += triangleArea;
+		}
+		const double normalLength = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		double key = 0.0;
+		if (area > 0.0 && normalLength > 0.0)
+		{
+			for (int a = 0; a < 3; ++a)
+			{
+				key += (centroid[a] / area - center[a]) * normal[a] / normalLength;
+			}
+		}
+		keys[c].key = (float)key;
+		keys[c].cluster = c;
+	}
+	qsort(keys, startCount, sizeof(ClusterKey), compareClusterKeys);
+
+	uint32_t* output = new uint32_t[triangleCount * 3];
+	int outputCount = 0;
+	for (int c = 0; c < startCount; ++c)
+	{
+		const int first = starts[keys[c].cluster];
+		const int count = starts[keys[c].cluster + 1] - first;
+		memcpy(output + outputCount * 3, indices + first * 3, count * 3 * sizeof(uint32_t));
+		outputCount += count;
+	}
+	memcpy(indices, output, triangleCount * 3 * sizeof(uint32_t));
+	delete[] output;
+	delete[] keys;
+	delete[] starts;
+}
+
+//--------------------------------------------------------------------------------------
+int optimizeVertexFetch(uint32_t* indices, int triangleCount, int vertexCount, uint32_t* remap)
+{
+	const uint32_t unused = 0xFFFFFFFF;
+	for (int v = 0; v < vertexCount; ++v)
+	{
+		remap[v] = unused;
+	}
+	uint32_t next = 0;
+	for (int i = 0; i < triangleCount * 3; ++i)
+	{
+		if (remap[indices[i]] == unused)
+		{
+			remap[indices[i]] = next++;
+		}
+		indices[i] = remap[indices[i]];
+	}
+	const int usedCount = (int)next;
+	for (int v = 0; v < vertexCount; ++v)
+	{
+		if (remap[v] == unused)
+		{
+			remap[v] = next++;
+		}
+	}
+	return usedCount;
+}
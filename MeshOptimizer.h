@@ -0,0 +1,61 @@
+//-----------------------------------------------------------------------------
+// File: MeshOptimizer.h
+//
+// Load time reordering of indexed triangle lists, after Sander, Nehab and
+// Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw" (2007):
+//
+// optimizeVertexCache() is Tipsify. It fans around one vertex at a time and
+// picks the next among the vertices just emitted that will still be in a
+// FIFO cache of cacheSize entries, falling back to recent dead ends. Where it
+// has to start over from a vertex no longer cached the cache is effectively
+// flushed, and those points split the triangles into clusters.
+//
+// optimizeOverdraw() splits the clusters further where their cache hit rate
+// allows and sorts them so the ones facing away from the mesh center, which
+// tend to hide the rest, are drawn first. A cluster keeps its triangle order.
+//
+// optimizeVertexFetch() numbers vertices in the order the indices first use
+// them, so the vertex buffer is read front to back.
+//-----------------------------------------------------------------------------
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "Platform.h"
+
+// Post-transform cache entries of D3D9 class hardware, which keeps 16 to 24
+const int					VERTEX_CACHE_SIZE = 16;
+
+// Cluster cache miss rate allowed above the rate of the unsplit cluster
+const float					OVERDRAW_THRESHOLD = 1.05f;
+
+//--------------------------------------------------------------------------------------
+struct VertexCacheStats
+{
+	int						verticesTransformed;	// cache misses
+	double					acmr;				// misses per triangle, 0.5 at best, 3 at worst
+	double					atvr;				// misses per referenced vertex, 1 at best
+};
+
+//--------------------------------------------------------------------------------------
+// FIFO cache of cacheSize vertices replayed over the indices
+VertexCacheStats	analyzeVertexCache(const uint32_t* indices, int triangleCount, int vertexCount, int cacheSize);
+
+// Bytes read through a 16 KB direct mapped cache of 64 byte lines per byte of
+// the referenced vertices, vertexSize bytes each. 1 when every line is read once.
+double				analyzeVertexFetch(const uint32_t* indices, int triangleCount, int vertexCount, int vertexSize);
+
+// Reorders the triangles in place. clusters, room for triangleCount entries,
+// receives the first triangle of every cluster. Returns the cluster count.
+int					optimizeVertexCache(uint32_t* indices, int triangleCount, int vertexCount, int cacheSize, int* clusters);
+
+// Reorders the clusters optimizeVertexCache() returned, positions are x, y, z
+// at the start of every stride floats
+void				optimizeOverdraw(uint32_t* indices, int triangleCount, const float* positions, int stride, int vertexCount,
+						const int* clusters, int clusterCount, int cacheSize, float threshold);
+
+// Renumbers the indices, remap receives the new number of every old vertex.
+// Vertices no index uses are numbered after the rest. Returns how many are used.
+int					optimizeVertexFetch(uint32_t* indices, int triangleCount, int vertexCount, uint32_t* remap);
+
+#endif // MESH_OPTIMIZER_H
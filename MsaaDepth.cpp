@@ -0,0 +1,107 @@
+//-----------------------------------------------------------------------------
+// File: MsaaDepth.cpp
+//-----------------------------------------------------------------------------
+#include "MsaaDepth.h"
+
+// Standard 4x pattern of D3D10.1 and later, what current D3D9 drivers use as well
+const int MsaaDepth::SAMPLE_POSITIONS[SAMPLE_COUNT][2] =
+{
+	{ -2, -6 },
+	{ 6, -2 },
+	{ -6, 2 },
+	{ 2, 6 }
+};
+
+//--------------------------------------------------------------------------------------
+MsaaDepth::MsaaDepth(TaskPool* pool)
+	: m_pool( pool )
+	, m_rasterizer( pool )
+	, m_reversed( false )
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+void MsaaDepth::draw(const RasterMesh& mesh, const DepthMatrix& worldViewProj, int width, int height)
+{
+	CpuTimer timer;
+	m_stats.pixelsWritten = 0;
+	for (int i = 0; i < SAMPLE_COUNT; ++i)
+	{
+		m_samples[i].resize(width, height);
+		m_samples[i].fill(farDepth(m_reversed));
+		m_rasterizer.setSampleOffset(SAMPLE_POSITIONS[i][0], SAMPLE_POSITIONS[i][1]);
+		m_rasterizer.begin(m_samples[i]);
+		m_rasterizer.addMesh(mesh, worldViewProj);
+		m_rasterizer.end();
+		m_stats.pixelsWritten += m_rasterizer.getStats().pixelsWritten;
+	}
+	m_stats.rasterMs = timer.elapsedMs();
+}
+
+//--------------------------------------------------------------------------------------
+// Four aligned samples of each plane per step, the padded pitch needs no tail
+void MsaaDepth::resolveTask(void* context, int index)
+{
+	const ResolveContext& ctx = *(const ResolveContext*)context;
+	const DepthImage* samples = ctx.msaa->m_samples;
+	const int pitch = samples[0].getPitch();
+	const int y0 = index * ROWS_PER_TASK;
+	const int y1 = mini(y0 + ROWS_PER_TASK, samples[0].getHeight());
+	const __m128 quarter = _mm_set1_ps(0.25f);
+
+	for (int y = y0; y < y1; ++y)
+	{
+		const float* s0 = samples[0].row(y);
+		const float* s1 = samples[1].row(y);
+		const float* s2 = samples[2].row(y);
+		const float* s3 = samples[3].row(y);
+		float* dst = ctx.result->row(y);
+		switch (ctx.mode)
+		{
+		case MSAA_RESOLVE_SAMPLE0:
+			memcpy(dst, s0, pitch * sizeof(float));
+			break;
+		case MSAA_RESOLVE_MIN:
+			for (int x = 0; x < pitch; x += 4)
+			{
+				const __m128 a = _mm_min_ps(_mm_load_ps(s0 + x), _mm_load_ps(s1 + x));
+				const __m128 b = _mm_min_ps(_mm_load_ps(s2 + x), _mm_load_ps(s3 + x));
+				_mm_store_ps(dst + x, _mm_min_ps(a, b));
+			}
+			break;
+		case MSAA_RESOLVE_MAX:
+			for (int x = 0; x < pitch; x += 4)
+			{
+				const __m128 a = _mm_max_ps(_mm_load_ps(s0 + x), _mm_load_ps(s1 + x));
+				const __m128 b = _mm_max_ps(_mm_load_ps(s2 + x), _mm_load_ps(s3 + x));
+				_mm_store_ps(dst + x, _mm_max_ps(a, b));
+			}
+			break;
+		default:
+			for (int x = 0; x < pitch; x += 4)
+			{
+				const __m128 a = _mm_add_ps(_mm_load_ps(s0 + x), _mm_load_ps(s1 + x));
+				const __m128 b = _mm_add_ps(_mm_load_ps(s2 + x), _mm_load_ps(s3 + x));
+				_mm_store_ps(dst + x, _mm_mul_ps(_mm_add_ps(a, b), quarter));
+			}
+			break;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void MsaaDepth::resolve(MsaaResolve mode, DepthImage& result)
+{
+	CpuTimer timer;
+	const int height = m_samples[0].getHeight();
+	result.resize(m_samples[0].getWidth(), height);
+
+	ResolveContext ctx;
+	ctx.msaa = this;
+	ctx.mode = mode;
+	ctx.result = &result;
+	const int taskCount = (height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+	TaskPool::runOn(m_pool, resolveTask, &ctx, taskCount);
+	m_stats.resolveMs[mode] = timer.elapsedMs();
+}
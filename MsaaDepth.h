@@ -0,0 +1,80 @@
+//-----------------------------------------------------------------------------
+// File: MsaaDepth.h
+//
+// CPU emulation of a 4x multisampled depth buffer and of the ways a resolve
+// can collapse it. Every sample is rasterized at the standard D3D 4x sample
+// position with the same coverage rules as TiledRasterizer, then resolved
+// per pixel to sample 0, the smallest, the largest or the mean depth, the
+// nearest being the largest with reverse-Z. The read back RESZ depth matches
+// exactly one of them on the edge pixels, which tells what the driver does.
+//-----------------------------------------------------------------------------
+#ifndef MSAA_DEPTH_H
+#define MSAA_DEPTH_H
+
+#include "TiledRasterizer.h"
+
+//--------------------------------------------------------------------------------------
+enum MsaaResolve
+{
+	MSAA_RESOLVE_SAMPLE0,
+	MSAA_RESOLVE_MIN,
+	MSAA_RESOLVE_MAX,
+	MSAA_RESOLVE_AVERAGE,
+	MSAA_RESOLVE_COUNT
+};
+
+//--------------------------------------------------------------------------------------
+struct MsaaStats
+{
+	double					rasterMs;							// all samples
+	double					resolveMs[MSAA_RESOLVE_COUNT];		// last resolve of each mode
+	int						pixelsWritten;						// sample writes
+};
+
+//--------------------------------------------------------------------------------------
+class MsaaDepth
+{
+public:
+	static const int		SAMPLE_COUNT = 4;
+	static const int		ROWS_PER_TASK = 16;
+
+	// 1/16 pixel from the pixel center, y down, in sample index order
+	static const int		SAMPLE_POSITIONS[SAMPLE_COUNT][2];
+
+private:
+	struct ResolveContext
+	{
+		const MsaaDepth*	msaa;
+		MsaaResolve			mode;
+		DepthImage*			result;
+	};
+
+	TaskPool*				m_pool;
+	TiledRasterizer			m_rasterizer;
+	bool					m_reversed;
+	DepthImage				m_samples[SAMPLE_COUNT];
+	MsaaStats				m_stats;
+
+	MsaaDepth(const MsaaDepth&);
+	MsaaDepth& operator=(const MsaaDepth&);
+
+	static void			resolveTask(void* context, int index);
+public:
+
+	// pool may be NULL to run on the calling thread only
+	explicit MsaaDepth(TaskPool* pool = NULL);
+
+	void				setCullMode(DepthRasterizer::CullMode mode)	{ m_rasterizer.setCullMode(mode); }
+	void				setReverseZ(bool reversed)	{ m_reversed = reversed; m_rasterizer.setReverseZ(reversed); }
+
+	// Clears every sample to farDepth() and rasterizes the mesh into all of them
+	void				draw(const RasterMesh& mesh, const DepthMatrix& worldViewProj, int width, int height);
+
+	// result gets the size of the samples
+	void				resolve(MsaaResolve mode, DepthImage& result);
+
+	const DepthImage&	getSample(int index) const	{ return m_samples[index]; }
+	const MsaaStats&	getStats() const			{ return m_stats; }
+};
+
+#endif // MSAA_DEPTH_H
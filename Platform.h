@@ -0,0 +1,346 @@
+//-----------------------------------------------------------------------------
+// File: Platform.h
+//
+// Small portability layer for the CPU-side depth kernels: aligned allocation,
+// bit scanning, atomics, AVX2 detection, a high resolution timer, read-only
+// file mapping and replacing a file in one step.
+//-----------------------------------------------------------------------------
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <malloc.h>
+#include <intrin.h>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifndef _MSC_VER
+#include <cpuid.h>
+#endif
+#include <stddef.h>
+#include <stdint.h>
+#include <emmintrin.h>
+
+#ifdef _MSC_VER
+#define FORCE_INLINE	__forceinline
+#define ALIGN16			__declspec(align(16))
+#else
+#define FORCE_INLINE	inline __attribute__((always_inline))
+#define ALIGN16			__attribute__((aligned(16)))
+#endif
+
+//--------------------------------------------------------------------------------------
+inline void* alignedAlloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else
+	void* ptr = NULL;
+	if (posix_memalign(&ptr, alignment, size) != 0)
+	{
+		return NULL;
+	}
+	return ptr;
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+inline void alignedFree(void* ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// Index of the lowest set bit, value must be non zero
+FORCE_INLINE unsigned int bitScanForward(uint32_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return index;
+#else
+	return __builtin_ctz(value);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// Index of the highest set bit, value must be non zero
+FORCE_INLINE unsigned int bitScanReverse(uint32_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, value);
+	return index;
+#else
+	return 31 - __builtin_clz(value);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+FORCE_INLINE unsigned int popCount(uint32_t value)
+{
+	value = value - ((value >> 1) & 0x55555555);
+	value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+	return (((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+//--------------------------------------------------------------------------------------
+// Returns the incremented value, full barrier
+FORCE_INLINE long atomicIncrement(volatile long* value)
+{
+#ifdef _WIN32
+	return InterlockedIncrement(value);
+#else
+	return __sync_add_and_fetch(value, 1);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+FORCE_INLINE long atomicAdd(volatile long* value, long amount)
+{
+#ifdef _WIN32
+	return InterlockedExchangeAdd(value, amount) + amount;
+#else
+	return __sync_add_and_fetch(value, amount);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+inline int hardwareThreadCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	const long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// AVX2 kernels sit in translation units of their own, the rest of the build
+// stays SSE2. MSVC compiles those files with /arch:AVX2, GCC and Clang mark
+// each kernel AVX2_TARGET instead. AVX2_BUILT is 0 when neither applies.
+// Header inline functions must not be called from them, the linker could pick
+// their AVX2 copies for every caller.
+#if defined(__AVX2__)
+#define AVX2_TARGET
+#define AVX2_BUILT		1
+#elif defined(__GNUC__)
+#define AVX2_TARGET		__attribute__((target("avx2")))
+#define AVX2_BUILT		1
+#else
+#define AVX2_TARGET
+#define AVX2_BUILT		0
+#endif
+
+//--------------------------------------------------------------------------------------
+// The AVX2 cpuid bit, and YMM state enabled by the OS in XCR0 so the upper
+// halves survive context switches
+inline bool cpuSupportsAvx2()
+{
+	static int supported = -1;
+	if (supported >= 0)
+	{
+		return supported != 0;
+	}
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+	__cpuid(info, 1);
+	const unsigned int features = (unsigned int)info[2];
+	unsigned int extended = 0;
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		extended = (unsigned int)info[1];
+	}
+#else
+	unsigned int eax, ebx, ecx, edx;
+	const unsigned int maxLeaf = __get_cpuid_max(0, NULL);
+	__cpuid(1, eax, ebx, ecx, edx);
+	const unsigned int features = ecx;
+	unsigned int extended = 0;
+	if (maxLeaf >= 7)
+	{
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		extended = ebx;
+	}
+#endif
+	const bool osxsave = (features & (1u << 27)) != 0;
+	const bool avx = (features & (1u << 28)) != 0;
+	bool ymmState = false;
+	if (osxsave && avx)
+	{
+#ifdef _MSC_VER
+		ymmState = (_xgetbv(0) & 6) == 6;
+#else
+		unsigned int xcr0, xcr0High;
+		__asm__ __volatile__("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+		ymmState = (xcr0 & 6) == 6;
+#endif
+	}
+	supported = ymmState && (extended & (1u << 5)) != 0 ? 1 : 0;
+	return supported != 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Wall clock timer used for the per-stage statistics of the CPU kernels
+class CpuTimer
+{
+	int64_t					m_start;
+
+	static int64_t now()
+	{
+#ifdef _WIN32
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		return counter.QuadPart;
+#else
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+	}
+
+	static double ticksPerMs()
+	{
+#ifdef _WIN32
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		return frequency.QuadPart / 1000.0;
+#else
+		return 1000000.0;
+#endif
+	}
+
+public:
+	CpuTimer()						{ m_start = now(); }
+
+	void				start()		{ m_start = now(); }
+	double				elapsedMs()	const { return (now() - m_start) / ticksPerMs(); }
+};
+
+//--------------------------------------------------------------------------------------
+// Whole file mapped read-only, pages are read on first touch. The view is not
+// zero terminated, parsers must stop at getData() + getSize().
+class MappedFile
+{
+	const char*				m_data;
+	size_t					m_size;
+#ifdef _WIN32
+	HANDLE					m_mapping;
+#endif
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+public:
+
+	MappedFile()
+		: m_data( NULL ), m_size( 0 )
+#ifdef _WIN32
+		, m_mapping( NULL )
+#endif
+	{
+	}
+
+	~MappedFile()					{ close(); }
+
+	// Fails for empty files, they cannot be mapped
+	bool open(const char* path)
+	{
+		close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER size;
+		if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && (uint64_t)size.QuadPart <= (size_t)-1)
+		{
+			m_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			m_size = (size_t)size.QuadPart;
+		}
+		CloseHandle(file);
+		if (m_mapping != NULL)
+		{
+			m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+#else
+		const int file = ::open(path, O_RDONLY);
+		if (file < 0)
+		{
+			return false;
+		}
+		struct stat info;
+		if (fstat(file, &info) == 0 && info.st_size > 0)
+		{
+			void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (data != MAP_FAILED)
+			{
+				m_data = (const char*)data;
+				m_size = (size_t)info.st_size;
+			}
+		}
+		::close(file);
+#endif
+		if (m_data == NULL)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (m_data != NULL)
+		{
+			UnmapViewOfFile(m_data);
+		}
+		if (m_mapping != NULL)
+		{
+			CloseHandle(m_mapping);
+		}
+		m_mapping = NULL;
+#else
+		if (m_data != NULL)
+		{
+			munmap((void*)m_data, m_size);
+		}
+#endif
+		m_data = NULL;
+		m_size = 0;
+	}
+
+	const char*			getData() const	{ return m_data; }
+	size_t				getSize() const	{ return m_size; }
+};
+
+//--------------------------------------------------------------------------------------
+// Renames from over to, readers of to see either file whole and never a mix
+inline bool replaceFile(const char* from, const char* to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+#endif // PLATFORM_H
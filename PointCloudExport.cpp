@@ -0,0 +1,415 @@
+//-----------------------------------------------------------------------------
+// File: PointCloudExport.cpp
+//-----------------------------------------------------------------------------
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#include "PointCloudExport.h"
+#include <stdio.h>
+
+//--------------------------------------------------------------------------------------
+PointCloudExport::PointCloudExport()
+	: m_running( false )
+	, m_quit( false )
+	, m_queued( -1 )
+	, m_writing( -1 )
+	, m_voxels( NULL )
+	, m_voxelCapacity( 0 )
+	, m_voxelStamp( 0 )
+{
+	memset(m_buffers, 0, sizeof(m_buffers));
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_prefix[0] = '\0';
+#ifdef _WIN32
+	m_thread = NULL;
+	InitializeCriticalSection(&m_lock);
+	InitializeConditionVariable(&m_wake);
+	InitializeConditionVariable(&m_done);
+#else
+	pthread_mutex_init(&m_lock, NULL);
+	pthread_cond_init(&m_wake, NULL);
+	pthread_cond_init(&m_done, NULL);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+PointCloudExport::~PointCloudExport()
+{
+	stop();
+	for (int i = 0; i < BUFFER_COUNT; ++i)
+	{
+		alignedFree(m_buffers[i].points);
+	}
+	delete[] m_voxels;
+#ifdef _WIN32
+	DeleteCriticalSection(&m_lock);
+#else
+	pthread_cond_destroy(&m_wake);
+	pthread_cond_destroy(&m_done);
+	pthread_mutex_destroy(&m_lock);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+void PointCloudExport::lock()
+{
+#ifdef _WIN32
+	EnterCriticalSection(&m_lock);
+#else
+	pthread_mutex_lock(&m_lock);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+void PointCloudExport::unlock()
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&m_lock);
+#else
+	pthread_mutex_unlock(&m_lock);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// Lock must be held
+void PointCloudExport::signal(bool done)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(done ? &m_done : &m_wake);
+#else
+	pthread_cond_broadcast(done ? &m_done : &m_wake);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+// Lock must be held
+void PointCloudExport::wait(bool done)
+{
+#ifdef _WIN32
+	SleepConditionVariableCS(done ? &m_done : &m_wake, &m_lock, INFINITE);
+#else
+	pthread_cond_wait(done ? &m_done : &m_wake, &m_lock);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+#ifdef _WIN32
+DWORD WINAPI PointCloudExport::threadEntry(LPVOID exporter)
+{
+	static_cast<PointCloudExport*>(exporter)->writerLoop();
+	return 0;
+}
+#else
+void* PointCloudExport::threadEntry(void* exporter)
+{
+	static_cast<PointCloudExport*>(exporter)->writerLoop();
+	return NULL;
+}
+#endif
+
+//--------------------------------------------------------------------------------------
+bool PointCloudExport::start(const char* prefix)
+{
+	stop();
+	if (strlen(prefix) >= (size_t)MAX_PREFIX)
+	{
+		return false;
+	}
+	strcpy(m_prefix, prefix);
+	m_quit = false;
+#ifdef _WIN32
+	m_thread = CreateThread(NULL, 0, threadEntry, this, 0, NULL);
+	m_running = m_thread != NULL;
+#else
+	m_running = pthread_create(&m_thread, NULL, threadEntry, this) == 0;
+#endif
+	return m_running;
+}
+
+//--------------------------------------------------------------------------------------
+void PointCloudExport::stop()
+{
+	if (!m_running)
+	{
+		return;
+	}
+	lock();
+	m_quit = true;
+	signal(false);
+	unlock();
+#ifdef _WIN32
+	WaitForSingleObject(m_thread, INFINITE);
+	CloseHandle(m_thread);
+	m_thread = NULL;
+#else
+	pthread_join(m_thread, NULL);
+#endif
+	m_running = false;
+}
+
+//--------------------------------------------------------------------------------------
+// Drains the queue before honouring m_quit so stop() loses nothing
+void PointCloudExport::writerLoop()
+{
+	lock();
+	for (;;)
+	{
+		while (m_queued < 0 && !m_quit)
+		{
+			wait(false);
+		}
+		if (m_queued < 0)
+		{
+			break;
+		}
+		m_writing = m_queued;
+		m_queued = -1;
+		unlock();
+
+		CpuTimer timer;
+		double bytes = 0.0;
+		const bool written = writeBuffer(m_buffers[m_writing], &bytes);
+		const double writeMs = timer.elapsedMs();
+
+		lock();
+		m_stats.writeMs = writeMs;
+		m_stats.bytesWritten += bytes;
+		++(written ? m_stats.framesWritten : m_stats.writeErrors);
+		m_writing = -1;
+		signal(true);
+	}
+	unlock();
+}
+
+//--------------------------------------------------------------------------------------
+bool PointCloudExport::writeBuffer(const Buffer& buffer, double* bytes)
+{
+	char path[MAX_PREFIX + 32];
+	sprintf(path, "%s%06u.%s", m_prefix, buffer.frameIndex, buffer.format == POINT_CLOUD_PLY ? "ply" : "bin");
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	int headerSize = 0;
+	if (buffer.format == POINT_CLOUD_PLY)
+	{
+		headerSize = fprintf(file,
+			"ply\n"
+			"format binary_little_endian 1.0\n"
+			"comment frame %u\n"
+			"element vertex %d\n"
+			"property float x\n"
+			"property float y\n"
+			"property float z\n"
+			"end_header\n", buffer.frameIndex, buffer.count);
+	}
+	const size_t written = fwrite(buffer.points, 3 * sizeof(float), buffer.count, file);
+	const bool ok = fclose(file) == 0 && headerSize >= 0 && written == (size_t)buffer.count;
+	*bytes = headerSize + (double)written * 3 * sizeof(float);
+	return ok;
+}
+
+//--------------------------------------------------------------------------------------
+// Open addressing on the integer voxel coordinate, true when the voxel was empty.
+// Entries from earlier frames have an older stamp and count as empty.
+bool PointCloudExport::insertVoxel(const float* point, float invVoxelSize)
+{
+	const int32_t key[3] =
+	{
+		(int32_t)floorf(point[0] * invVoxelSize),
+		(int32_t)floorf(point[1] * invVoxelSize),
+		(int32_t)floorf(point[2] * invVoxelSize)
+	};
+	const uint32_t mask = (uint32_t)m_voxelCapacity - 1;
+	uint32_t slot = ((uint32_t)key[0] * 73856093u ^ (uint32_t)key[1] * 19349663u ^ (uint32_t)key[2] * 83492791u) & mask;
+	for (;;)
+	{
+		VoxelEntry& entry = m_voxels[slot];
+		if (entry.stamp != m_voxelStamp)
+		{
+			entry.key[0] = key[0];
+			entry.key[1] = key[1];
+			entry.key[2] = key[2];
+			entry.stamp = m_voxelStamp;
+			return true;
+		}
+		if (entry.key[0] == key[0] && entry.key[1] == key[1] && entry.key[2] == key[2])
+		{
+			return false;
+		}
+		slot = (slot + 1) & mask;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Four sampled pixels at a time through the inverse view-projection, pixels at
+// the far plane (cleared background) are skipped
+void PointCloudExport::convert(const DepthImage& depth, const DepthMatrix& invViewProj, const PointCloudParams& params, Buffer& buffer)
+{
+	const int stride = maxi(params.stride, 1);
+	const int width = depth.getWidth();
+	const int height = depth.getHeight();
+	const int columns = (width + stride - 1) / stride;
+	const int capacity = columns * ((height + stride - 1) / stride);
+	if (capacity > buffer.capacity)
+	{
+		alignedFree(buffer.points);
+		buffer.points = (float*)alignedAlloc((capacity + 4) * 3 * sizeof(float), 16);
+		buffer.capacity = capacity;
+	}
+
+	const bool voxels = params.voxelSize > 0.0f;
+	if (voxels)
+	{
+		int voxelCapacity = 1024;
+		while (voxelCapacity < capacity * 2)
+		{
+			voxelCapacity *= 2;
+		}
+		if (voxelCapacity > m_voxelCapacity)
+		{
+			delete[] m_voxels;
+			m_voxels = new VoxelEntry[voxelCapacity];
+			memset(m_voxels, 0, voxelCapacity * sizeof(VoxelEntry));
+			m_voxelCapacity = voxelCapacity;
+		}
+		if (++m_voxelStamp == 0)
+		{
+			memset(m_voxels, 0, m_voxelCapacity * sizeof(VoxelEntry));
+			m_voxelStamp = 1;
+		}
+	}
+	const float invVoxelSize = voxels ? 1.0f / params.voxelSize : 0.0f;
+
+	const DepthMatrix& m = invViewProj;
+	const __m128 m0[4] = { _mm_set1_ps(m.m[0][0]), _mm_set1_ps(m.m[0][1]), _mm_set1_ps(m.m[0][2]), _mm_set1_ps(m.m[0][3]) };
+	const __m128 m1[4] = { _mm_set1_ps(m.m[1][0]), _mm_set1_ps(m.m[1][1]), _mm_set1_ps(m.m[1][2]), _mm_set1_ps(m.m[1][3]) };
+	const __m128 m2[4] = { _mm_set1_ps(m.m[2][0]), _mm_set1_ps(m.m[2][1]), _mm_set1_ps(m.m[2][2]), _mm_set1_ps(m.m[2][3]) };
+	const __m128 m3[4] = { _mm_set1_ps(m.m[3][0]), _mm_set1_ps(m.m[3][1]), _mm_set1_ps(m.m[3][2]), _mm_set1_ps(m.m[3][3]) };
+	const float scaleX = 2.0f / width;
+	const float scaleY = 2.0f / height;
+	const __m128 ndcStep = _mm_set1_ps(scaleX * stride * 4);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const float background = farDepth(params.reverseZ);
+
+	float* out = buffer.points;
+	ALIGN16 float world[3][4];
+	for (int y = 0; y < height; y += stride)
+	{
+		const float* row = depth.row(y);
+		const __m128 ndcY = _mm_set1_ps(1.0f - (y + 0.5f) * scaleY);
+		__m128 ndcX = _mm_setr_ps((0.5f) * scaleX - 1.0f, (stride + 0.5f) * scaleX - 1.0f,
+			(2 * stride + 0.5f) * scaleX - 1.0f, (3 * stride + 0.5f) * scaleX - 1.0f);
+		for (int column = 0; column < columns; column += 4, ndcX = _mm_add_ps(ndcX, ndcStep))
+		{
+			const int x = column * stride;
+			const int lanes = mini(4, columns - column);
+			ALIGN16 float zs[4] = { background, background, background, background };
+			for (int i = 0; i < lanes; ++i)
+			{
+				zs[i] = row[x + i * stride];
+			}
+			const __m128 z = _mm_load_ps(zs);
+			const int valid = _mm_movemask_ps(params.reverseZ ? _mm_cmpgt_ps(z, _mm_setzero_ps()) : _mm_cmplt_ps(z, one));
+			if (valid == 0)
+			{
+				continue;
+			}
+
+			__m128 p[4];
+			for (int i = 0; i < 4; ++i)
+			{
+				p[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ndcX, m0[i]), _mm_mul_ps(ndcY, m1[i])), _mm_add_ps(_mm_mul_ps(z, m2[i]), m3[i]));
+			}
+			const __m128 invW = _mm_div_ps(one, p[3]);
+			_mm_store_ps(world[0], _mm_mul_ps(p[0], invW));
+			_mm_store_ps(world[1], _mm_mul_ps(p[1], invW));
+			_mm_store_ps(world[2], _mm_mul_ps(p[2], invW));
+
+			for (int i = 0; i < 4; ++i)
+			{
+				if ((valid >> i & 1) == 0)
+				{
+					continue;
+				}
+				out[0] = world[0][i];
+				out[1] = world[1][i];
+				out[2] = world[2][i];
+				if (!voxels || insertVoxel(out, invVoxelSize))
+				{
+					out += 3;
+				}
+			}
+		}
+	}
+	buffer.count = (int)((out - buffer.points) / 3);
+}
+
+//--------------------------------------------------------------------------------------
+bool PointCloudExport::submit(const DepthImage& depth, unsigned int frameIndex, const DepthMatrix& viewProj, const PointCloudParams& params)
+{
+	if (!m_running)
+	{
+		return false;
+	}
+	DepthMatrix invViewProj;
+	if (!invertMatrix(viewProj, invViewProj))
+	{
+		return false;
+	}
+
+	// The free buffer is the one neither queued nor being written
+	lock();
+	int free = -1;
+	for (int i = 0; i < BUFFER_COUNT; ++i)
+	{
+		if (i != m_queued && i != m_writing)
+		{
+			free = i;
+			break;
+		}
+	}
+	if (free < 0 || m_queued >= 0)
+	{
+		++m_stats.framesDropped;
+		unlock();
+		return false;
+	}
+	unlock();
+
+	CpuTimer timer;
+	Buffer& buffer = m_buffers[free];
+	convert(depth, invViewProj, params, buffer);
+	buffer.frameIndex = frameIndex;
+	buffer.format = params.format;
+
+	lock();
+	m_stats.convertMs = timer.elapsedMs();
+	m_stats.pointCount = buffer.count;
+	m_queued = free;
+	signal(false);
+	unlock();
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+void PointCloudExport::flush()
+{
+	lock();
+	while (m_queued >= 0 || m_writing >= 0)
+	{
+		wait(true);
+	}
+	unlock();
+}
+
+//--------------------------------------------------------------------------------------
+PointCloudStats PointCloudExport::getStats()
+{
+	lock();
+	const PointCloudStats stats = m_stats;
+	unlock();
+	return stats;
+}
@@ -0,0 +1,126 @@
+//-----------------------------------------------------------------------------
+// File: PointCloudExport.h
+//
+// Streams world space point clouds reconstructed from read back depth, one
+// file per frame, as binary little endian PLY or bare float3 triples. Points
+// are built on the calling thread into one of two buffers and written by a
+// dedicated thread; when both buffers are taken the frame is dropped instead
+// of waiting, so exporting never blocks Render().
+//-----------------------------------------------------------------------------
+#ifndef POINT_CLOUD_EXPORT_H
+#define POINT_CLOUD_EXPORT_H
+
+#include "DepthImage.h"
+#include "DepthMath.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+//--------------------------------------------------------------------------------------
+enum PointCloudFormat
+{
+	POINT_CLOUD_PLY,
+	POINT_CLOUD_RAW				// x, y, z floats, no header
+};
+
+//--------------------------------------------------------------------------------------
+struct PointCloudParams
+{
+	PointCloudFormat		format;
+	int						stride;				// every stride-th pixel in x and y
+	float					voxelSize;			// world units, 0 keeps every point
+	bool					reverseZ;			// background at depth 0 rather than 1
+};
+
+//--------------------------------------------------------------------------------------
+struct PointCloudStats
+{
+	double					convertMs;			// last submitted frame, calling thread
+	double					writeMs;			// last written frame, writer thread
+	int						pointCount;			// last submitted frame
+	int						framesWritten;
+	int						framesDropped;
+	int						writeErrors;
+	double					bytesWritten;
+};
+
+//--------------------------------------------------------------------------------------
+class PointCloudExport
+{
+	static const int		BUFFER_COUNT = 2;
+	static const int		MAX_PREFIX = 240;
+
+	struct Buffer
+	{
+		float*				points;
+		int					count;
+		int					capacity;
+		unsigned int		frameIndex;
+		PointCloudFormat	format;
+	};
+
+	struct VoxelEntry
+	{
+		int32_t				key[3];
+		uint32_t			stamp;
+	};
+
+#ifdef _WIN32
+	HANDLE					m_thread;
+	CRITICAL_SECTION		m_lock;
+	CONDITION_VARIABLE		m_wake;
+	CONDITION_VARIABLE		m_done;
+#else
+	pthread_t				m_thread;
+	pthread_mutex_t			m_lock;
+	pthread_cond_t			m_wake;
+	pthread_cond_t			m_done;
+#endif
+	bool					m_running;
+	bool					m_quit;
+	int						m_queued;			// buffer waiting for the writer, -1 for none
+	int						m_writing;			// buffer the writer owns, -1 for none
+	Buffer					m_buffers[BUFFER_COUNT];
+	char					m_prefix[MAX_PREFIX];
+	VoxelEntry*				m_voxels;
+	int						m_voxelCapacity;
+	uint32_t				m_voxelStamp;
+	PointCloudStats			m_stats;
+
+	PointCloudExport(const PointCloudExport&);
+	PointCloudExport& operator=(const PointCloudExport&);
+
+	void				lock();
+	void				unlock();
+	void				signal(bool done);
+	void				wait(bool done);
+	void				writerLoop();
+	bool				writeBuffer(const Buffer& buffer, double* bytes);
+	void				convert(const DepthImage& depth, const DepthMatrix& invViewProj, const PointCloudParams& params, Buffer& buffer);
+	bool				insertVoxel(const float* point, float invVoxelSize);
+#ifdef _WIN32
+	static DWORD WINAPI	threadEntry(LPVOID exporter);
+#else
+	static void*		threadEntry(void* exporter);
+#endif
+public:
+
+	PointCloudExport();
+	~PointCloudExport();
+
+	// Files are named prefix + frame index + extension, prefix may include a directory
+	bool				start(const char* prefix);
+	// Writes whatever is queued, then stops the writer thread
+	void				stop();
+	bool				isRunning() const		{ return m_running; }
+
+	// viewProj is the view-projection depth was rendered with. Returns false when
+	// the frame was dropped because the writer is behind.
+	bool				submit(const DepthImage& depth, unsigned int frameIndex, const DepthMatrix& viewProj, const PointCloudParams& params);
+	// Blocks until nothing is queued or being written
+	void				flush();
+
+	PointCloudStats		getStats();
+};
+
+#endif // POINT_CLOUD_EXPORT_H
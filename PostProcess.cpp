@@ -0,0 +1,99 @@
+//-----------------------------------------------------------------------------
+// File: PostProcess.cpp
+//-----------------------------------------------------------------------------
+#include "PostProcess.h"
+
+// Vertex declaration for post-processing
+const D3DVERTEXELEMENT9 PPVERT::Decl[4] =
+{
+	{ 0, 0,  D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION,  0 },
+	{ 0, 16, D3DDECLTYPE_FLOAT2, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD,  0 },
+	{ 0, 24, D3DDECLTYPE_FLOAT2, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD,  1 },
+	D3DDECL_END()
+};
+
+//--------------------------------------------------------------------------------------
+PostProcess::PostProcess( const LPDIRECT3DDEVICE9 device, ID3DXEffect* effect )
+	: m_pDevice( device )
+	, m_pEffect( effect )
+	, m_pVertDecl( NULL )
+{
+	m_pDevice->CreateVertexDeclaration( PPVERT::Decl, &m_pVertDecl );
+	m_hTargetSize = m_pEffect->GetParameterByName( NULL, "TargetSize" );
+}
+
+//--------------------------------------------------------------------------------------
+PostProcess::~PostProcess()
+{
+	if (m_pVertDecl != NULL)
+	{
+		m_pVertDecl->Release();
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void PostProcess::drawQuad( D3DXHANDLE technique, float x, float y, float width, float height,
+	float targetWidth, float targetHeight )
+{
+	PPVERT quad[4] =
+	{
+		{ x - 0.5f,			y - 0.5f,			0.5f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+		{ x + width - 0.5f,	y - 0.5f,			0.5f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f },
+		{ x - 0.5f,			y + height - 0.5f,	0.5f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f },
+		{ x + width - 0.5f,	y + height - 0.5f,	0.5f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f }
+	};
+	const float targetSize[2] = { targetWidth, targetHeight };
+
+	m_pDevice->SetVertexDeclaration( m_pVertDecl );
+	m_pEffect->SetFloatArray( m_hTargetSize, targetSize, 2 );
+	m_pEffect->SetTechnique( technique );
+	UINT cPasses;
+	m_pEffect->Begin( &cPasses, 0 );
+	for( UINT p = 0; p < cPasses; ++p )
+	{
+		m_pEffect->BeginPass( p );
+		m_pDevice->DrawPrimitiveUP( D3DPT_TRIANGLESTRIP, 2, quad, sizeof( PPVERT ) );
+		m_pEffect->EndPass();
+	}
+	m_pEffect->End();
+}
+
+//--------------------------------------------------------------------------------------
+void PostProcess::renderTo( LPDIRECT3DTEXTURE9 target, D3DXHANDLE technique, LPDIRECT3DTEXTURE9 target1 )
+{
+	IDirect3DSurface9* pOldRT = NULL;
+	IDirect3DSurface9* pOldDSS = NULL;
+	IDirect3DSurface9* pTargetSurface = NULL;
+	m_pDevice->GetRenderTarget( 0, &pOldRT );
+	m_pDevice->GetDepthStencilSurface( &pOldDSS );
+	target->GetSurfaceLevel( 0, &pTargetSurface );
+
+	D3DSURFACE_DESC desc;
+	pTargetSurface->GetDesc( &desc );
+
+	// The multisampled depth buffer can not be used with a non multisampled target
+	m_pDevice->SetRenderTarget( 0, pTargetSurface );
+	m_pDevice->SetDepthStencilSurface( NULL );
+	m_pDevice->SetRenderState( D3DRS_ZENABLE, FALSE );
+
+	IDirect3DSurface9* pTargetSurface1 = NULL;
+	if (target1 != NULL)
+	{
+		target1->GetSurfaceLevel( 0, &pTargetSurface1 );
+		m_pDevice->SetRenderTarget( 1, pTargetSurface1 );
+	}
+
+	drawQuad( technique, 0.0f, 0.0f, (float)desc.Width, (float)desc.Height, (float)desc.Width, (float)desc.Height );
+
+	if (pTargetSurface1 != NULL)
+	{
+		m_pDevice->SetRenderTarget( 1, NULL );
+		pTargetSurface1->Release();
+	}
+	m_pDevice->SetRenderState( D3DRS_ZENABLE, TRUE );
+	m_pDevice->SetRenderTarget( 0, pOldRT );
+	m_pDevice->SetDepthStencilSurface( pOldDSS );
+	pTargetSurface->Release();
+	pOldRT->Release();
+	pOldDSS->Release();
+}
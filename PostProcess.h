@@ -0,0 +1,46 @@
+//-----------------------------------------------------------------------------
+// File: PostProcess.h
+//
+// Screen quad helpers shared by the depth consuming passes.
+//-----------------------------------------------------------------------------
+#ifndef POST_PROCESS_H
+#define POST_PROCESS_H
+
+#include <d3dx9.h>
+
+//--------------------------------------------------------------------------------------
+// This is the vertex format used with the quad during post-process.
+// Positions are in pixels, VSQuad maps them to the current render target.
+struct PPVERT
+{
+	float x, y, z, w;
+	float tu, tv;       // Texcoord for post-process source
+	float tu2, tv2;     // Texcoord for the original scene
+
+	const static D3DVERTEXELEMENT9 Decl[4];
+};
+
+//--------------------------------------------------------------------------------------
+class PostProcess
+{
+	LPDIRECT3DDEVICE9				m_pDevice;
+	ID3DXEffect*					m_pEffect;
+	IDirect3DVertexDeclaration9*	m_pVertDecl;
+	D3DXHANDLE						m_hTargetSize;
+public:
+
+	PostProcess( const LPDIRECT3DDEVICE9 device, ID3DXEffect* effect );
+	~PostProcess();
+
+	// Quad in pixels of a target of the given size, render target must already be bound
+	void				drawQuad( D3DXHANDLE technique, float x, float y, float width, float height,
+							float targetWidth, float targetHeight );
+	// Covers the whole texture, binds it and restores the previous targets.
+	// A second target of the same size is bound to COLOR1 for two output passes.
+	void				renderTo( LPDIRECT3DTEXTURE9 target, D3DXHANDLE technique, LPDIRECT3DTEXTURE9 target1 = NULL );
+
+	ID3DXEffect*		getEffect()		{ return m_pEffect; }
+	LPDIRECT3DDEVICE9	getDevice()		{ return m_pDevice; }
+};
+
+#endif // POST_PROCESS_H
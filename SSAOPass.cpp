@@ -0,0 +1,174 @@
+//-----------------------------------------------------------------------------
+// File: SSAOPass.cpp
+//-----------------------------------------------------------------------------
+#include "SSAOPass.h"
+
+//--------------------------------------------------------------------------------------
+static void releaseTexture( LPDIRECT3DTEXTURE9& texture )
+{
+	if (texture != NULL)
+	{
+		texture->Release();
+		texture = NULL;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+SSAOPass::SSAOPass()
+	: m_postProcess( NULL )
+	, m_pHalfDepth( NULL )
+	, m_pAO( NULL )
+	, m_pBlurTemp( NULL )
+	, m_pBlurred( NULL )
+	, m_pResult( NULL )
+	, m_pRotation( NULL )
+	, m_pResultSysmem( NULL )
+	, m_width( 0 )
+	, m_height( 0 )
+{
+}
+
+//--------------------------------------------------------------------------------------
+SSAOPass::~SSAOPass()
+{
+	releaseTexture( m_pHalfDepth );
+	releaseTexture( m_pAO );
+	releaseTexture( m_pBlurTemp );
+	releaseTexture( m_pBlurred );
+	releaseTexture( m_pResult );
+	releaseTexture( m_pRotation );
+	if (m_pResultSysmem != NULL)
+	{
+		m_pResultSysmem->Release();
+	}
+}
+
+//--------------------------------------------------------------------------------------
+HRESULT SSAOPass::create( PostProcess* postProcess, int width, int height, bool rawz )
+{
+	m_postProcess = postProcess;
+	m_width = width;
+	m_height = height;
+
+	LPDIRECT3DDEVICE9 device = postProcess->getDevice();
+	ID3DXEffect* effect = postProcess->getEffect();
+	const int halfWidth = (width + 1) / 2;
+	const int halfHeight = (height + 1) / 2;
+
+	if (FAILED( device->CreateTexture( halfWidth, halfHeight, 1, D3DUSAGE_RENDERTARGET, D3DFMT_R32F, D3DPOOL_DEFAULT, &m_pHalfDepth, NULL ) ) ||
+		FAILED( device->CreateTexture( halfWidth, halfHeight, 1, D3DUSAGE_RENDERTARGET, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &m_pAO, NULL ) ) ||
+		FAILED( device->CreateTexture( halfWidth, halfHeight, 1, D3DUSAGE_RENDERTARGET, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &m_pBlurTemp, NULL ) ) ||
+		FAILED( device->CreateTexture( halfWidth, halfHeight, 1, D3DUSAGE_RENDERTARGET, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &m_pBlurred, NULL ) ) ||
+		FAILED( device->CreateTexture( width, height, 1, D3DUSAGE_RENDERTARGET, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &m_pResult, NULL ) ) ||
+		FAILED( device->CreateTexture( 4, 4, 1, 0, D3DFMT_G32R32F, D3DPOOL_MANAGED, &m_pRotation, NULL ) ))
+	{
+		return E_FAIL;
+	}
+
+	// Same rotations as the CPU reference, uploaded rather than recomputed in the shader
+	float rotation[16][2];
+	AmbientOcclusion::buildRotationTable( rotation );
+	D3DLOCKED_RECT locked;
+	if (FAILED( m_pRotation->LockRect( 0, &locked, NULL, 0 ) ))
+	{
+		return E_FAIL;
+	}
+	for (int y = 0; y < 4; ++y)
+	{
+		memcpy( (BYTE*)locked.pBits + y * locked.Pitch, rotation[y * 4], 4 * 2 * sizeof(float) );
+	}
+	m_pRotation->UnlockRect( 0 );
+
+	m_hTDownsample = effect->GetTechniqueByName( rawz ? "SSAODownsampleRAWZ" : "SSAODownsample" );
+	m_hTCompute = effect->GetTechniqueByName( "SSAOCompute" );
+	m_hTBlur = effect->GetTechniqueByName( "SSAOBlur" );
+	m_hTUpsample = effect->GetTechniqueByName( rawz ? "SSAOUpsampleRAWZ" : "SSAOUpsample" );
+	m_hAOTexture = effect->GetParameterByName( NULL, "AOTexture" );
+	m_hBlurDirection = effect->GetParameterByName( NULL, "AOBlurDirection" );
+
+	effect->SetTexture( "HalfDepthTexture", m_pHalfDepth );
+	effect->SetTexture( "AORotationTexture", m_pRotation );
+	D3DXVECTOR4 halfTexelSize( 1.0f / halfWidth, 1.0f / halfHeight, (float)halfWidth, (float)halfHeight );
+	effect->SetVector( "HalfTexelSize", &halfTexelSize );
+
+	m_timer.create( device );
+	return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+void SSAOPass::setParams( const AOParams& params, const DepthProjection& projection )
+{
+	const int halfHeight = (m_height + 1) / 2;
+	D3DXVECTOR4 aoParams( params.radius, params.bias, params.intensity, params.maxRadiusPixels );
+	D3DXVECTOR4 aoParams2( projection.scaleY * halfHeight * 0.5f, 1.0f / (params.radius * params.radius),
+		params.blurSharpness, params.upsampleEpsilon );
+	m_postProcess->getEffect()->SetVector( "AOParams", &aoParams );
+	m_postProcess->getEffect()->SetVector( "AOParams2", &aoParams2 );
+}
+
+//--------------------------------------------------------------------------------------
+void SSAOPass::render()
+{
+	ID3DXEffect* effect = m_postProcess->getEffect();
+	const float horizontal[2] = { 1.0f, 0.0f };
+	const float vertical[2] = { 0.0f, 1.0f };
+
+	m_timer.beginFrame();
+
+	m_postProcess->renderTo( m_pHalfDepth, m_hTDownsample );
+	m_timer.endStage();
+
+	m_postProcess->renderTo( m_pAO, m_hTCompute );
+	m_timer.endStage();
+
+	effect->SetTexture( m_hAOTexture, m_pAO );
+	effect->SetFloatArray( m_hBlurDirection, horizontal, 2 );
+	m_postProcess->renderTo( m_pBlurTemp, m_hTBlur );
+	effect->SetTexture( m_hAOTexture, m_pBlurTemp );
+	effect->SetFloatArray( m_hBlurDirection, vertical, 2 );
+	m_postProcess->renderTo( m_pBlurred, m_hTBlur );
+	m_timer.endStage();
+
+	effect->SetTexture( m_hAOTexture, m_pBlurred );
+	m_postProcess->renderTo( m_pResult, m_hTUpsample );
+	m_timer.endStage();
+
+	m_timer.endFrame();
+}
+
+//--------------------------------------------------------------------------------------
+bool SSAOPass::readResult( uint8_t* dst )
+{
+	LPDIRECT3DDEVICE9 device = m_postProcess->getDevice();
+	if (m_pResultSysmem == NULL &&
+		FAILED( device->CreateOffscreenPlainSurface( m_width, m_height, D3DFMT_A8R8G8B8, D3DPOOL_SYSTEMMEM, &m_pResultSysmem, NULL ) ))
+	{
+		return false;
+	}
+
+	IDirect3DSurface9* pResultSurface = NULL;
+	m_pResult->GetSurfaceLevel( 0, &pResultSurface );
+	HRESULT hr = device->GetRenderTargetData( pResultSurface, m_pResultSysmem );
+	pResultSurface->Release();
+	if (FAILED( hr ))
+	{
+		return false;
+	}
+
+	D3DLOCKED_RECT locked;
+	if (FAILED( m_pResultSysmem->LockRect( &locked, NULL, D3DLOCK_READONLY ) ))
+	{
+		return false;
+	}
+	for (int y = 0; y < m_height; ++y)
+	{
+		const BYTE* src = (const BYTE*)locked.pBits + y * locked.Pitch;
+		for (int x = 0; x < m_width; ++x)
+		{
+			// A8R8G8B8 is stored B, G, R, A
+			dst[y * m_width + x] = src[x * 4 + 2];
+		}
+	}
+	m_pResultSysmem->UnlockRect();
+	return true;
+}
@@ -0,0 +1,65 @@
+//-----------------------------------------------------------------------------
+// File: SSAOPass.h
+//
+// GPU side of the SSAO pipeline: half resolution depth, AO with interleaved
+// rotations, separable depth aware blur and upsample to the full resolution.
+// AmbientOcclusion.cpp is the CPU reference of the same techniques.
+//-----------------------------------------------------------------------------
+#ifndef SSAO_PASS_H
+#define SSAO_PASS_H
+
+#include "PostProcess.h"
+#include "GpuTimer.h"
+#include "AmbientOcclusion.h"
+
+//--------------------------------------------------------------------------------------
+class SSAOPass
+{
+public:
+	enum Stage
+	{
+		STAGE_DOWNSAMPLE,
+		STAGE_AO,
+		STAGE_BLUR,
+		STAGE_UPSAMPLE,
+		STAGE_COUNT
+	};
+
+private:
+	PostProcess*			m_postProcess;
+	LPDIRECT3DTEXTURE9		m_pHalfDepth;
+	LPDIRECT3DTEXTURE9		m_pAO;
+	LPDIRECT3DTEXTURE9		m_pBlurTemp;
+	LPDIRECT3DTEXTURE9		m_pBlurred;
+	LPDIRECT3DTEXTURE9		m_pResult;
+	LPDIRECT3DTEXTURE9		m_pRotation;
+	IDirect3DSurface9*		m_pResultSysmem;
+	D3DXHANDLE				m_hTDownsample;
+	D3DXHANDLE				m_hTCompute;
+	D3DXHANDLE				m_hTBlur;
+	D3DXHANDLE				m_hTUpsample;
+	D3DXHANDLE				m_hAOTexture;
+	D3DXHANDLE				m_hBlurDirection;
+	GpuTimer				m_timer;
+	int						m_width;
+	int						m_height;
+public:
+
+	SSAOPass();
+	~SSAOPass();
+
+	HRESULT				create( PostProcess* postProcess, int width, int height, bool rawz );
+	void				setParams( const AOParams& params, const DepthProjection& projection );
+
+	// Expects DepthTargetTexture of the effect to be bound to the resolved depth
+	void				render();
+	// Blocking copy of the result, for validation against AmbientOcclusion only
+	bool				readResult( uint8_t* dst );
+
+	LPDIRECT3DTEXTURE9	getResult()					{ return m_pResult; }
+	LPDIRECT3DTEXTURE9	getHalfDepth()				{ return m_pHalfDepth; }
+	LPDIRECT3DTEXTURE9	getHalfAO()					{ return m_pBlurred; }
+	double				getStageMs( Stage stage )	{ return m_timer.getStageMs( stage ); }
+};
+
+#endif // SSAO_PASS_H
@@ -0,0 +1,58 @@
+//-----------------------------------------------------------------------------
+// File: SceneSetup.h
+//
+// Screen size, camera and tiger animation shared by SetupMatrices() and the
+// headless renderer so both draw the same frame for the same time.
+//-----------------------------------------------------------------------------
+#ifndef SCENE_SETUP_H
+#define SCENE_SETUP_H
+
+#include "DepthMath.h"
+
+//--------------------------------------------------------------------------------------
+const int						SCREEN_WIDTH = 640;
+const int						SCREEN_HEIGHT = 480;
+const float						Z_NEAR = 1.0f;
+const float						Z_FAR = 100.0f;
+const float						FOV_Y = 3.14159265f / 4;
+const float						ASPECT = 1.0f;
+
+// Eye five units back along the z-axis and up three units, looking at the origin
+const float						EYE_POSITION[3] = { 0.0f, 3.0f, -5.0f };
+const float						LOOKAT_POSITION[3] = { 0.0f, 0.0f, 0.0f };
+const float						UP_DIRECTION[3] = { 0.0f, 1.0f, 0.0f };
+
+// Render() clears to blue and lights with D3DRS_AMBIENT alone, both X8R8G8B8
+const uint32_t					BACKGROUND_COLOR = 0xFF0000FF;
+const uint32_t					AMBIENT_LIGHT = 0xFFFFFFFF;
+
+//--------------------------------------------------------------------------------------
+// The tiger turns once every 2 pi seconds of timeGetTime()
+inline float getTigerAngle(unsigned long timeMs)
+{
+	return timeMs / 1000.0f;
+}
+
+//--------------------------------------------------------------------------------------
+inline void getSceneMatrices(unsigned long timeMs, DepthMatrix& world, DepthMatrix& view, DepthMatrix& proj,
+	bool reversed = false)
+{
+	world = rotationYMatrix(getTigerAngle(timeMs));
+	view = lookAtMatrixLH(EYE_POSITION, LOOKAT_POSITION, UP_DIRECTION);
+	proj = reversed ? perspectiveFovMatrixLH(FOV_Y, ASPECT, Z_FAR, Z_NEAR) : perspectiveFovMatrixLH(FOV_Y, ASPECT, Z_NEAR, Z_FAR);
+}
+
+//--------------------------------------------------------------------------------------
+// What the CPU depth kernels need of the projection above
+inline DepthProjection getSceneProjection(bool reversed = false)
+{
+	DepthProjection projection;
+	projection.zNear = Z_NEAR;
+	projection.zFar = Z_FAR;
+	projection.scaleY = 1.0f / tanf(FOV_Y * 0.5f);
+	projection.scaleX = projection.scaleY / ASPECT;
+	projection.reversed = reversed;
+	return projection;
+}
+
+#endif // SCENE_SETUP_H
@@ -0,0 +1,352 @@
+//-----------------------------------------------------------------------------
+// File: ShadowCascades.cpp
+//-----------------------------------------------------------------------------
+#include "ShadowCascades.h"
+#include <float.h>
+
+//--------------------------------------------------------------------------------------
+// Everything a band task needs, shared by all bands of one reduction
+struct CascadeTaskContext
+{
+	const DepthImage*		depth;
+	DepthProjection			projection;
+	DepthMatrix				viewToLight;
+	float					splits[ShadowCascades::MAX_CASCADES + 1];
+	int						cascadeCount;
+	ShadowCascades::Partial* partials;
+};
+
+//--------------------------------------------------------------------------------------
+// Lanes something was drawn to, the background is 1 or, with reverse-Z, 0
+static FORCE_INLINE __m128 foregroundMask(__m128 z, bool reversed)
+{
+	return reversed ? _mm_cmpgt_ps(z, _mm_setzero_ps()) : _mm_cmplt_ps(z, _mm_set1_ps(1.0f));
+}
+
+//--------------------------------------------------------------------------------------
+static void reduceRangeTask(void* context, int index)
+{
+	const CascadeTaskContext& ctx = *(const CascadeTaskContext*)context;
+	const DepthImage& depth = *ctx.depth;
+	const int width = depth.getWidth();
+	const int y0 = index * ShadowCascades::ROWS_PER_TASK;
+	const int y1 = mini(y0 + ShadowCascades::ROWS_PER_TASK, depth.getHeight());
+
+	const bool reversed = ctx.projection.reversed;
+	const __m128 huge = _mm_set1_ps(FLT_MAX);
+	__m128 minZ = huge;
+	__m128 maxZ = _mm_setzero_ps();
+
+	for (int y = y0; y < y1; ++y)
+	{
+		const float* row = depth.row(y);
+		for (int x = 0; x < width; x += 4)
+		{
+			const __m128 z = _mm_load_ps(row + x);
+			const __m128 valid = _mm_and_ps(foregroundMask(z, reversed), columnMask(x, width));
+			// Hardware depth is monotonic in view z, linearize once per band at the end
+			minZ = _mm_min_ps(minZ, _mm_or_ps(_mm_and_ps(valid, z), _mm_andnot_ps(valid, huge)));
+			maxZ = _mm_max_ps(maxZ, _mm_and_ps(valid, z));
+		}
+	}
+
+	ShadowCascades::Partial& partial = ctx.partials[index];
+	partial.minZ = horizontalMin(minZ);
+	partial.maxZ = horizontalMax(maxZ);
+}
+
+//--------------------------------------------------------------------------------------
+// Four pixels at a time: view position, light space position, then min / max
+// into every cascade whose z range holds the pixel
+static void fitBoundsTask(void* context, int index)
+{
+	const CascadeTaskContext& ctx = *(const CascadeTaskContext*)context;
+	const DepthImage& depth = *ctx.depth;
+	const DepthMatrix& m = ctx.viewToLight;
+	const int width = depth.getWidth();
+	const int height = depth.getHeight();
+	const int y0 = index * ShadowCascades::ROWS_PER_TASK;
+	const int y1 = mini(y0 + ShadowCascades::ROWS_PER_TASK, height);
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 huge = _mm_set1_ps(FLT_MAX);
+	const __m128 negHuge = _mm_set1_ps(-FLT_MAX);
+	const __m128 ndcStep = _mm_set1_ps(8.0f / width);
+	const __m128 invScaleX = _mm_set1_ps(1.0f / ctx.projection.scaleX);
+
+	__m128 boundsMin[ShadowCascades::MAX_CASCADES][3];
+	__m128 boundsMax[ShadowCascades::MAX_CASCADES][3];
+	int sampleCount[ShadowCascades::MAX_CASCADES];
+	for (int c = 0; c < ctx.cascadeCount; ++c)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			boundsMin[c][i] = huge;
+			boundsMax[c][i] = negHuge;
+		}
+		sampleCount[c] = 0;
+	}
+
+	ALIGN16 float linear[4];
+	for (int y = y0; y < y1; ++y)
+	{
+		const float* row = depth.row(y);
+		const __m128 ndcYScaled = _mm_set1_ps((1.0f - (y + 0.5f) * 2.0f / height) / ctx.projection.scaleY);
+		__m128 ndcX = _mm_sub_ps(_mm_mul_ps(_mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), _mm_set1_ps(2.0f / width)), one);
+
+		for (int x = 0; x < width; x += 4, ndcX = _mm_add_ps(ndcX, ndcStep))
+		{
+			const __m128 z = _mm_load_ps(row + x);
+			const __m128 valid = _mm_and_ps(foregroundMask(z, ctx.projection.reversed), columnMask(x, width));
+			if (_mm_movemask_ps(valid) == 0)
+			{
+				continue;
+			}
+
+			const __m128 vz = linearizeDepth4(z, ctx.projection);
+			const __m128 vx = _mm_mul_ps(_mm_mul_ps(ndcX, invScaleX), vz);
+			const __m128 vy = _mm_mul_ps(ndcYScaled, vz);
+			__m128 light[3];
+			for (int i = 0; i < 3; ++i)
+			{
+				light[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_set1_ps(m.m[0][i])), _mm_mul_ps(vy, _mm_set1_ps(m.m[1][i]))),
+					_mm_add_ps(_mm_mul_ps(vz, _mm_set1_ps(m.m[2][i])), _mm_set1_ps(m.m[3][i])));
+			}
+			_mm_store_ps(linear, vz);
+
+			for (int c = 0; c < ctx.cascadeCount; ++c)
+			{
+				// Last cascade is closed at the far end so the farthest sample lands somewhere
+				const __m128 above = _mm_cmpge_ps(vz, _mm_set1_ps(ctx.splits[c]));
+				const __m128 below = c + 1 == ctx.cascadeCount ? _mm_cmple_ps(vz, _mm_set1_ps(ctx.splits[c + 1]))
+					: _mm_cmplt_ps(vz, _mm_set1_ps(ctx.splits[c + 1]));
+				const __m128 inside = _mm_and_ps(valid, _mm_and_ps(above, below));
+				const int insideMask = _mm_movemask_ps(inside);
+				if (insideMask == 0)
+				{
+					continue;
+				}
+				for (int i = 0; i < 3; ++i)
+				{
+					boundsMin[c][i] = _mm_min_ps(boundsMin[c][i], _mm_or_ps(_mm_and_ps(inside, light[i]), _mm_andnot_ps(inside, huge)));
+					boundsMax[c][i] = _mm_max_ps(boundsMax[c][i], _mm_or_ps(_mm_and_ps(inside, light[i]), _mm_andnot_ps(inside, negHuge)));
+				}
+				sampleCount[c] += popCount(insideMask);
+			}
+		}
+	}
+
+	ShadowCascades::Partial& partial = ctx.partials[index];
+	for (int c = 0; c < ctx.cascadeCount; ++c)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			partial.boundsMin[c][i] = horizontalMin(boundsMin[c][i]);
+			partial.boundsMax[c][i] = horizontalMax(boundsMax[c][i]);
+		}
+		partial.sampleCount[c] = sampleCount[c];
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// D3DXMatrixOrthoOffCenterLH
+static DepthMatrix orthoOffCenter(float l, float r, float b, float t, float zn, float zf)
+{
+	DepthMatrix m;
+	memset(&m, 0, sizeof(m));
+	m.m[0][0] = 2.0f / (r - l);
+	m.m[1][1] = 2.0f / (t - b);
+	m.m[2][2] = 1.0f / (zf - zn);
+	m.m[3][0] = (l + r) / (l - r);
+	m.m[3][1] = (t + b) / (b - t);
+	m.m[3][2] = zn / (zn - zf);
+	m.m[3][3] = 1.0f;
+	return m;
+}
+
+//--------------------------------------------------------------------------------------
+// Blend of logarithmic and uniform splits of [nearZ, farZ]
+static void computeSplits(float nearZ, float farZ, const CascadeParams& params, float* splits)
+{
+	for (int i = 0; i <= params.cascadeCount; ++i)
+	{
+		const float f = (float)i / params.cascadeCount;
+		const float logSplit = nearZ * powf(farZ / nearZ, f);
+		const float uniformSplit = nearZ + (farZ - nearZ) * f;
+		splits[i] = params.splitLambda * logSplit + (1.0f - params.splitLambda) * uniformSplit;
+	}
+	splits[0] = nearZ;
+	splits[params.cascadeCount] = farZ;
+}
+
+//--------------------------------------------------------------------------------------
+static void setCascadeProjection(Cascade& cascade, float casterExtension)
+{
+	cascade.lightProj = orthoOffCenter(cascade.boundsMin[0], cascade.boundsMax[0],
+		cascade.boundsMin[1], cascade.boundsMax[1], cascade.boundsMin[2] - casterExtension, cascade.boundsMax[2]);
+}
+
+//--------------------------------------------------------------------------------------
+ShadowCascades::ShadowCascades(TaskPool* pool)
+	: m_pool( pool )
+	, m_partials( NULL )
+	, m_partialCount( 0 )
+	, m_cascadeCount( 0 )
+{
+	memset(m_cascades, 0, sizeof(m_cascades));
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+ShadowCascades::~ShadowCascades()
+{
+	delete[] m_partials;
+}
+
+//--------------------------------------------------------------------------------------
+void ShadowCascades::allocatePartials(int count)
+{
+	if (count > m_partialCount)
+	{
+		delete[] m_partials;
+		m_partials = new Partial[count];
+		m_partialCount = count;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void ShadowCascades::reduceDepthRange(const DepthImage& depth, const DepthProjection& projection)
+{
+	CpuTimer timer;
+	const int taskCount = (depth.getHeight() + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+	allocatePartials(taskCount);
+
+	CascadeTaskContext ctx;
+	ctx.depth = &depth;
+	ctx.projection = projection;
+	ctx.cascadeCount = 0;
+	ctx.partials = m_partials;
+	TaskPool::runOn(m_pool, reduceRangeTask, &ctx, taskCount);
+
+	float minZ = 1.0f;
+	float maxZ = 0.0f;
+	for (int i = 0; i < taskCount; ++i)
+	{
+		minZ = minf(minZ, m_partials[i].minZ);
+		maxZ = maxf(maxZ, m_partials[i].maxZ);
+	}
+	if (minZ <= maxZ)
+	{
+		// The smallest depth is the farthest one with reverse-Z
+		m_stats.minZ = linearizeDepth(projection.reversed ? maxZ : minZ, projection);
+		m_stats.maxZ = linearizeDepth(projection.reversed ? minZ : maxZ, projection);
+	}
+	else
+	{
+		m_stats.minZ = m_stats.maxZ = 0.0f;
+	}
+	m_stats.reduceMs = timer.elapsedMs();
+}
+
+//--------------------------------------------------------------------------------------
+void ShadowCascades::setDepthRange(float minZ, float maxZ)
+{
+	m_stats.minZ = minZ;
+	m_stats.maxZ = maxZ;
+	m_stats.reduceMs = 0.0;
+}
+
+//--------------------------------------------------------------------------------------
+void ShadowCascades::fitCascades(const DepthImage& depth, const DepthProjection& projection,
+	const DepthMatrix& viewToLight, const CascadeParams& params)
+{
+	CpuTimer timer;
+	m_cascadeCount = mini(maxi(params.cascadeCount, 1), MAX_CASCADES);
+	memset(m_cascades, 0, sizeof(m_cascades));
+	if (m_stats.maxZ <= m_stats.minZ)
+	{
+		m_stats.boundsMs = timer.elapsedMs();
+		return;
+	}
+
+	const int taskCount = (depth.getHeight() + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+	allocatePartials(taskCount);
+
+	CascadeParams clamped = params;
+	clamped.cascadeCount = m_cascadeCount;
+	CascadeTaskContext ctx;
+	ctx.depth = &depth;
+	ctx.projection = projection;
+	ctx.viewToLight = viewToLight;
+	ctx.cascadeCount = m_cascadeCount;
+	ctx.partials = m_partials;
+	computeSplits(m_stats.minZ, m_stats.maxZ, clamped, ctx.splits);
+
+	TaskPool::runOn(m_pool, fitBoundsTask, &ctx, taskCount);
+
+	for (int c = 0; c < m_cascadeCount; ++c)
+	{
+		Cascade& cascade = m_cascades[c];
+		cascade.splitNear = ctx.splits[c];
+		cascade.splitFar = ctx.splits[c + 1];
+		for (int i = 0; i < 3; ++i)
+		{
+			cascade.boundsMin[i] = FLT_MAX;
+			cascade.boundsMax[i] = -FLT_MAX;
+		}
+		for (int t = 0; t < taskCount; ++t)
+		{
+			const Partial& partial = m_partials[t];
+			for (int i = 0; i < 3; ++i)
+			{
+				cascade.boundsMin[i] = minf(cascade.boundsMin[i], partial.boundsMin[c][i]);
+				cascade.boundsMax[i] = maxf(cascade.boundsMax[i], partial.boundsMax[c][i]);
+			}
+			cascade.sampleCount += partial.sampleCount[c];
+		}
+		if (cascade.sampleCount > 0)
+		{
+			setCascadeProjection(cascade, params.casterExtension);
+		}
+	}
+	m_stats.boundsMs = timer.elapsedMs();
+}
+
+//--------------------------------------------------------------------------------------
+void ShadowCascades::fitFrustumCascades(const DepthProjection& projection, const DepthMatrix& viewToLight,
+	const CascadeParams& params, Cascade* cascades)
+{
+	const int cascadeCount = mini(maxi(params.cascadeCount, 1), MAX_CASCADES);
+	CascadeParams clamped = params;
+	clamped.cascadeCount = cascadeCount;
+	float splits[MAX_CASCADES + 1];
+	computeSplits(projection.zNear, projection.zFar, clamped, splits);
+
+	const DepthMatrix& m = viewToLight;
+	for (int c = 0; c < cascadeCount; ++c)
+	{
+		Cascade& cascade = cascades[c];
+		cascade.splitNear = splits[c];
+		cascade.splitFar = splits[c + 1];
+		cascade.sampleCount = 0;
+		for (int i = 0; i < 3; ++i)
+		{
+			cascade.boundsMin[i] = FLT_MAX;
+			cascade.boundsMax[i] = -FLT_MAX;
+		}
+
+		// Eight corners of the frustum slice
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			const float z = corner & 4 ? splits[c + 1] : splits[c];
+			const float v[3] = { (corner & 1 ? z : -z) / projection.scaleX, (corner & 2 ? z : -z) / projection.scaleY, z };
+			for (int i = 0; i < 3; ++i)
+			{
+				const float l = v[0] * m.m[0][i] + v[1] * m.m[1][i] + v[2] * m.m[2][i] + m.m[3][i];
+				cascade.boundsMin[i] = minf(cascade.boundsMin[i], l);
+				cascade.boundsMax[i] = maxf(cascade.boundsMax[i], l);
+			}
+		}
+		setCascadeProjection(cascade, params.casterExtension);
+	}
+}
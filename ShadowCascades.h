@@ -0,0 +1,99 @@
+//-----------------------------------------------------------------------------
+// File: ShadowCascades.h
+//
+// Sample distribution shadow map cascades: the visible view z range is
+// reduced from the resolved depth, split into cascades inside that range, and
+// every cascade gets an orthographic projection fitted to the light space
+// bounds of the pixels that fall into it. Both reductions run in row bands on
+// a TaskPool, the depth range can instead come from DepthReductionPass.
+//-----------------------------------------------------------------------------
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include "DepthImage.h"
+#include "DepthMath.h"
+#include "TaskPool.h"
+
+//--------------------------------------------------------------------------------------
+struct CascadeParams
+{
+	int						cascadeCount;		// up to MAX_CASCADES
+	float					splitLambda;		// 1 = logarithmic, 0 = uniform splits
+	float					casterExtension;	// light space distance added towards the light for casters off screen
+};
+
+//--------------------------------------------------------------------------------------
+struct Cascade
+{
+	float					splitNear;			// view z range
+	float					splitFar;
+	float					boundsMin[3];		// light view space bounds of the samples
+	float					boundsMax[3];
+	DepthMatrix				lightProj;			// light view space to cascade clip space
+	int						sampleCount;
+};
+
+//--------------------------------------------------------------------------------------
+struct CascadeStats
+{
+	double					reduceMs;
+	double					boundsMs;
+	float					minZ;
+	float					maxZ;
+};
+
+//--------------------------------------------------------------------------------------
+class ShadowCascades
+{
+public:
+	static const int		MAX_CASCADES = 4;
+	static const int		ROWS_PER_TASK = 16;
+
+	// Partial results of one band of rows
+	struct Partial
+	{
+		float				minZ;
+		float				maxZ;
+		float				boundsMin[MAX_CASCADES][3];
+		float				boundsMax[MAX_CASCADES][3];
+		int					sampleCount[MAX_CASCADES];
+	};
+
+private:
+	TaskPool*				m_pool;
+	Partial*				m_partials;
+	int						m_partialCount;
+	Cascade					m_cascades[MAX_CASCADES];
+	int						m_cascadeCount;
+	CascadeStats			m_stats;
+
+	ShadowCascades(const ShadowCascades&);
+	ShadowCascades& operator=(const ShadowCascades&);
+
+	void				allocatePartials(int count);
+public:
+
+	// pool may be NULL to run on the calling thread only
+	explicit ShadowCascades(TaskPool* pool = NULL);
+	~ShadowCascades();
+
+	// Nearest and farthest view z of everything but the cleared background
+	void				reduceDepthRange(const DepthImage& depth, const DepthProjection& projection);
+	// Range from the GPU reduction instead
+	void				setDepthRange(float minZ, float maxZ);
+
+	// Splits the current range and fits every cascade, viewToLight maps camera
+	// view space to light view space
+	void				fitCascades(const DepthImage& depth, const DepthProjection& projection,
+							const DepthMatrix& viewToLight, const CascadeParams& params);
+
+	// Fixed split cascades over the whole frustum for comparison
+	static void			fitFrustumCascades(const DepthProjection& projection, const DepthMatrix& viewToLight,
+							const CascadeParams& params, Cascade* cascades);
+
+	const Cascade&		getCascade(int index) const		{ return m_cascades[index]; }
+	int					getCascadeCount() const			{ return m_cascadeCount; }
+	const CascadeStats&	getStats() const				{ return m_stats; }
+};
+
+#endif // SHADOW_CASCADES_H
@@ -0,0 +1,198 @@
+//-----------------------------------------------------------------------------
+// File: ShadowMap.cpp
+//-----------------------------------------------------------------------------
+#include "ShadowMap.h"
+
+#define FOURCC_NULL ((D3DFORMAT)(MAKEFOURCC('N','U','L','L')))
+
+//--------------------------------------------------------------------------------------
+ShadowMap::ShadowMap()
+	: m_postProcess( NULL )
+	, m_pDepth( NULL )
+	, m_pColor( NULL )
+	, m_pFloatTarget( NULL )
+	, m_pFloatDepth( NULL )
+	, m_nullColor( false )
+	, m_compareFloat( false )
+	, m_size( 0 )
+{
+	D3DXMatrixIdentity( &m_lightView );
+	D3DXMatrixIdentity( &m_lightProj );
+	memset( &m_worldLightViewProj, 0, sizeof( m_worldLightViewProj ) );
+}
+
+//--------------------------------------------------------------------------------------
+ShadowMap::~ShadowMap()
+{
+	if (m_pDepth != NULL)
+	{
+		m_pDepth->Release();
+	}
+	if (m_pColor != NULL)
+	{
+		m_pColor->Release();
+	}
+	if (m_pFloatTarget != NULL)
+	{
+		m_pFloatTarget->Release();
+	}
+	if (m_pFloatDepth != NULL)
+	{
+		m_pFloatDepth->Release();
+	}
+}
+
+//--------------------------------------------------------------------------------------
+HRESULT ShadowMap::create( PostProcess* postProcess, DepthTexture& depthTexture, int size )
+{
+	m_postProcess = postProcess;
+	m_size = size;
+
+	LPDIRECT3DDEVICE9 device = postProcess->getDevice();
+	m_pDepth = depthTexture.createDepthTarget( device, size, size );
+	if (m_pDepth == NULL)
+	{
+		return E_FAIL;
+	}
+
+	// D3D9 always needs a color target, the NULL format makes it free where supported
+	LPDIRECT3D9 d3d = NULL;
+	D3DDISPLAYMODE displayMode;
+	device->GetDirect3D( &d3d );
+	d3d->GetAdapterDisplayMode( D3DADAPTER_DEFAULT, &displayMode );
+	m_nullColor = d3d->CheckDeviceFormat( D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL,
+		displayMode.Format, D3DUSAGE_RENDERTARGET, D3DRTYPE_SURFACE, FOURCC_NULL ) == D3D_OK;
+	d3d->Release();
+
+	if (FAILED( device->CreateRenderTarget( size, size, m_nullColor ? FOURCC_NULL : D3DFMT_R5G6B5,
+			D3DMULTISAMPLE_NONE, 0, FALSE, &m_pColor, NULL ) ) ||
+		FAILED( device->CreateTexture( size, size, 1, D3DUSAGE_RENDERTARGET, D3DFMT_R32F, D3DPOOL_DEFAULT, &m_pFloatTarget, NULL ) ) ||
+		FAILED( device->CreateDepthStencilSurface( size, size, D3DFMT_D24X8, D3DMULTISAMPLE_NONE, 0, TRUE, &m_pFloatDepth, NULL ) ))
+	{
+		return E_FAIL;
+	}
+
+	ID3DXEffect* effect = postProcess->getEffect();
+	m_hTCasterFloat = effect->GetTechniqueByName( "ShadowCasterFloat" );
+	D3DXVECTOR4 shadowParams( 0.002f, 0.4f, 0.5f / size, 0.0f );
+	effect->SetVector( "ShadowParams", &shadowParams );
+
+	m_timer.create( device );
+	return S_OK;
+}
+
+//--------------------------------------------------------------------------------------
+void ShadowMap::setLight( const D3DXVECTOR3& direction, float radius )
+{
+	D3DXVECTOR3 dir;
+	D3DXVec3Normalize( &dir, &direction );
+	D3DXVECTOR3 eye = -dir * radius * 2.0f;
+	D3DXVECTOR3 at( 0.0f, 0.0f, 0.0f );
+	D3DXVECTOR3 up = fabsf( dir.y ) > 0.99f ? D3DXVECTOR3( 0.0f, 0.0f, 1.0f ) : D3DXVECTOR3( 0.0f, 1.0f, 0.0f );
+	D3DXMatrixLookAtLH( &m_lightView, &eye, &at, &up );
+	D3DXMatrixOrthoLH( &m_lightProj, radius * 2.0f, radius * 2.0f, radius, radius * 3.0f );
+}
+
+//--------------------------------------------------------------------------------------
+// Fixed function for the depth only pass, the caster technique for the R32F one
+void ShadowMap::drawMesh( LPD3DXMESH mesh, DWORD subsetCount, D3DXHANDLE technique )
+{
+	if (technique == NULL)
+	{
+		for (DWORD i = 0; i < subsetCount; ++i)
+		{
+			mesh->DrawSubset( i );
+		}
+		return;
+	}
+
+	ID3DXEffect* effect = m_postProcess->getEffect();
+	UINT passes;
+	effect->SetTechnique( technique );
+	effect->Begin( &passes, 0 );
+	effect->BeginPass( 0 );
+	for (DWORD i = 0; i < subsetCount; ++i)
+	{
+		mesh->DrawSubset( i );
+	}
+	effect->EndPass();
+	effect->End();
+}
+
+//--------------------------------------------------------------------------------------
+void ShadowMap::render( LPD3DXMESH mesh, DWORD subsetCount )
+{
+	LPDIRECT3DDEVICE9 device = m_postProcess->getDevice();
+	ID3DXEffect* effect = m_postProcess->getEffect();
+
+	D3DXMATRIXA16 world, view, proj;
+	device->GetTransform( D3DTS_WORLD, &world );
+	device->GetTransform( D3DTS_VIEW, &view );
+	device->GetTransform( D3DTS_PROJECTION, &proj );
+
+	D3DXMATRIXA16 worldLightViewProj = world * m_lightView * m_lightProj;
+	memcpy( &m_worldLightViewProj, &worldLightViewProj, sizeof( DepthMatrix ) );
+
+	IDirect3DSurface9* pOldRT = NULL;
+	IDirect3DSurface9* pOldDSS = NULL;
+	IDirect3DSurface9* pDepthSurface = NULL;
+	device->GetRenderTarget( 0, &pOldRT );
+	device->GetDepthStencilSurface( &pOldDSS );
+	m_pDepth->GetSurfaceLevel( 0, &pDepthSurface );
+	device->SetTransform( D3DTS_VIEW, &m_lightView );
+	device->SetTransform( D3DTS_PROJECTION, &m_lightProj );
+	device->SetRenderState( D3DRS_COLORWRITEENABLE, 0 );
+
+	m_timer.beginFrame();
+
+	device->SetRenderTarget( 0, m_pColor );
+	device->SetDepthStencilSurface( pDepthSurface );
+	device->Clear( 0, NULL, D3DCLEAR_ZBUFFER, 0, 1.0f, 0 );
+	drawMesh( mesh, subsetCount, NULL );
+	m_timer.endStage();
+
+	device->SetRenderState( D3DRS_COLORWRITEENABLE, 0x0F );
+	if (m_compareFloat)
+	{
+		IDirect3DSurface9* pFloatSurface = NULL;
+		m_pFloatTarget->GetSurfaceLevel( 0, &pFloatSurface );
+		device->SetRenderTarget( 0, pFloatSurface );
+		device->SetDepthStencilSurface( m_pFloatDepth );
+		device->Clear( 0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, 0xffffffff, 1.0f, 0 );
+		effect->SetMatrix( "ShadowWorldViewProj", &worldLightViewProj );
+		drawMesh( mesh, subsetCount, m_hTCasterFloat );
+		pFloatSurface->Release();
+	}
+	m_timer.endStage();
+
+	m_timer.endFrame();
+
+	device->SetRenderTarget( 0, pOldRT );
+	device->SetDepthStencilSurface( pOldDSS );
+	device->SetTransform( D3DTS_VIEW, &view );
+	device->SetTransform( D3DTS_PROJECTION, &proj );
+	pDepthSurface->Release();
+	pOldRT->Release();
+	pOldDSS->Release();
+
+	// Camera view space straight to light clip space for the shadow mask
+	D3DXMATRIXA16 invView;
+	D3DXMatrixInverse( &invView, NULL, &view );
+	D3DXMATRIXA16 viewToShadow = invView * m_lightView * m_lightProj;
+	effect->SetMatrix( "ViewToShadow", &viewToShadow );
+	effect->SetTexture( "ShadowTexture", m_pDepth );
+}
+
+//--------------------------------------------------------------------------------------
+UINT ShadowMap::getDepthTextureBytes() const
+{
+	const UINT texels = m_size * m_size;
+	return texels * 4 + (m_nullColor ? 0 : texels * 2);
+}
+
+//--------------------------------------------------------------------------------------
+UINT ShadowMap::getFloatTargetBytes() const
+{
+	// R32F color plus the D24X8 buffer it still needs for the depth test
+	return m_size * m_size * (4 + 4);
+}
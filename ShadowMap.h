@@ -0,0 +1,70 @@
+//-----------------------------------------------------------------------------
+// File: ShadowMap.h
+//
+// Light space shadow map rendered straight into a readable INTZ / RAWZ depth
+// texture created through DepthTexture, so the shaders sample hardware depth
+// and no color target is written. The R32F color target approach can be
+// rendered alongside for the memory and GPU time comparison.
+//-----------------------------------------------------------------------------
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+#include "PostProcess.h"
+#include "DepthTexture.h"
+#include "DepthMath.h"
+#include "GpuTimer.h"
+
+//--------------------------------------------------------------------------------------
+class ShadowMap
+{
+public:
+	enum Stage
+	{
+		STAGE_DEPTH_TEXTURE,
+		STAGE_FLOAT_TARGET,
+		STAGE_COUNT
+	};
+
+private:
+	PostProcess*			m_postProcess;
+	LPDIRECT3DTEXTURE9		m_pDepth;
+	IDirect3DSurface9*		m_pColor;			// NULL format when supported, never written
+	LPDIRECT3DTEXTURE9		m_pFloatTarget;		// comparison path: R32F color plus its own depth buffer
+	IDirect3DSurface9*		m_pFloatDepth;
+	D3DXHANDLE				m_hTCasterFloat;
+	D3DXMATRIXA16			m_lightView;
+	D3DXMATRIXA16			m_lightProj;
+	DepthMatrix				m_worldLightViewProj;
+	GpuTimer				m_timer;
+	bool					m_nullColor;
+	bool					m_compareFloat;
+	int						m_size;
+
+	void				drawMesh( LPD3DXMESH mesh, DWORD subsetCount, D3DXHANDLE technique );
+public:
+
+	ShadowMap();
+	~ShadowMap();
+
+	HRESULT				create( PostProcess* postProcess, DepthTexture& depthTexture, int size );
+
+	// Orthographic light looking along direction at a sphere around the origin
+	void				setLight( const D3DXVECTOR3& direction, float radius );
+	void				setCompareFloat( bool compare )		{ m_compareFloat = compare; }
+
+	// Renders mesh with the current world matrix, then sets ShadowTexture and
+	// ViewToShadow for the camera view matrix currently set on the device
+	void				render( LPD3DXMESH mesh, DWORD subsetCount );
+
+	// Video memory of the depth texture path and of the R32F + D24X8 path
+	UINT				getDepthTextureBytes() const;
+	UINT				getFloatTargetBytes() const;
+
+	LPDIRECT3DTEXTURE9	getTexture()					{ return m_pDepth; }
+	const D3DXMATRIXA16& getLightView() const			{ return m_lightView; }
+	const DepthMatrix&	getWorldLightViewProj() const	{ return m_worldLightViewProj; }
+	int					getSize() const					{ return m_size; }
+	double				getStageMs( Stage stage )		{ return m_timer.getStageMs( stage ); }
+};
+
+#endif // SHADOW_MAP_H
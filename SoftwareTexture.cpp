@@ -0,0 +1,261 @@
+//-----------------------------------------------------------------------------
+// File: SoftwareTexture.cpp
+//-----------------------------------------------------------------------------
+#include "SoftwareTexture.h"
+
+//--------------------------------------------------------------------------------------
+SoftwareTexture::SoftwareTexture()
+	: m_texels( NULL )
+	, m_width( 0 )
+	, m_height( 0 )
+	, m_widthShift( 0 )
+{
+}
+
+//--------------------------------------------------------------------------------------
+SoftwareTexture::~SoftwareTexture()
+{
+	alignedFree(m_texels);
+}
+
+//--------------------------------------------------------------------------------------
+void SoftwareTexture::clear()
+{
+	alignedFree(m_texels);
+	m_texels = NULL;
+	m_width = 0;
+	m_height = 0;
+	m_widthShift = 0;
+}
+
+//--------------------------------------------------------------------------------------
+// A tile row holds width / 4 tiles of 16 texels
+static FORCE_INLINE int tiledIndex(int x, int y, int widthShift)
+{
+	return ((y >> 2) << (widthShift + 2)) + ((x >> 2) << 4) + ((y & 3) << 2) + (x & 3);
+}
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE __m128i tiledIndex4(__m128i x, __m128i y, __m128i rowShift)
+{
+	const __m128i three = _mm_set1_epi32(3);
+	const __m128i tileRow = _mm_sll_epi32(_mm_srli_epi32(y, 2), rowShift);
+	const __m128i tileColumn = _mm_slli_epi32(_mm_srli_epi32(x, 2), 4);
+	const __m128i inner = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(y, three), 2), _mm_and_si128(x, three));
+	return _mm_or_si128(_mm_or_si128(tileRow, tileColumn), inner);
+}
+
+//--------------------------------------------------------------------------------------
+// SSE2 has no floor, the truncation is one too high for negative fractions
+static FORCE_INLINE __m128i floor4(__m128 x)
+{
+	const __m128i truncated = _mm_cvttps_epi32(x);
+	return _mm_add_epi32(truncated, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(truncated), x)));
+}
+
+//--------------------------------------------------------------------------------------
+// (a * (256 - w) + b * w) / 256 per 16 bit channel, w in [0, 256]
+static FORCE_INLINE __m128i lerp16(__m128i a, __m128i b, __m128i w)
+{
+	const __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(256), w);
+	const __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, inverse), _mm_mullo_epi16(b, w));
+	return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+}
+
+//--------------------------------------------------------------------------------------
+bool SoftwareTexture::create(const ColorImage& image)
+{
+	clear();
+	const int width = image.getWidth();
+	const int height = image.getHeight();
+	if (width < TILE_SIZE || height < TILE_SIZE || (width & (width - 1)) != 0 || (height & (height - 1)) != 0)
+	{
+		return false;
+	}
+	m_width = width;
+	m_height = height;
+	m_widthShift = bitScanForward(width);
+	m_texels = (uint32_t*)alignedAlloc(sizeof(uint32_t) * width * height, 64);
+	for (int y = 0; y < height; ++y)
+	{
+		const uint32_t* src = image.row(y);
+		for (int x = 0; x < width; ++x)
+		{
+			m_texels[tiledIndex(x, y, m_widthShift)] = src[x];
+		}
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+bool SoftwareTexture::load(const char* path)
+{
+	ColorImage image;
+	if (!loadBmp(path, image))
+	{
+		clear();
+		return false;
+	}
+	return create(image);
+}
+
+//--------------------------------------------------------------------------------------
+uint32_t SoftwareTexture::fetch(int x, int y) const
+{
+	return m_texels[tiledIndex(x & (m_width - 1), y & (m_height - 1), m_widthShift)];
+}
+
+//--------------------------------------------------------------------------------------
+void SoftwareTexture::sample(Filter filter, const float* u, const float* v, int count, uint32_t* dst) const
+{
+	if (filter == FILTER_LINEAR)
+	{
+		sampleBilinear(u, v, count, dst);
+	}
+	else
+	{
+		samplePoint(u, v, count, dst);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// The texel whose square holds u, v, floor(u * width) wrapped
+void SoftwareTexture::samplePoint(const float* u, const float* v, int count, uint32_t* dst) const
+{
+	const __m128 width = _mm_set1_ps((float)m_width);
+	const __m128 height = _mm_set1_ps((float)m_height);
+	const __m128i maskX = _mm_set1_epi32(m_width - 1);
+	const __m128i maskY = _mm_set1_epi32(m_height - 1);
+	const __m128i rowShift = _mm_cvtsi32_si128(m_widthShift + 2);
+
+	ALIGN16 float tailU[4];
+	ALIGN16 float tailV[4];
+	ALIGN16 int32_t index[4];
+	for (int i = 0; i < count; i += 4)
+	{
+		__m128 su;
+		__m128 sv;
+		if (i + 4 <= count)
+		{
+			su = _mm_loadu_ps(u + i);
+			sv = _mm_loadu_ps(v + i);
+		}
+		else
+		{
+			for (int k = 0; k < 4; ++k)
+			{
+				tailU[k] = u[i + k < count ? i + k : count - 1];
+				tailV[k] = v[i + k < count ? i + k : count - 1];
+			}
+			su = _mm_load_ps(tailU);
+			sv = _mm_load_ps(tailV);
+		}
+
+		// Wrapped into [0, 1) the truncation is the floor, a product rounded
+		// up to the size wraps to texel 0 like u = 1 does
+		su = _mm_sub_ps(su, _mm_cvtepi32_ps(floor4(su)));
+		sv = _mm_sub_ps(sv, _mm_cvtepi32_ps(floor4(sv)));
+		const __m128i x = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(su, width)), maskX);
+		const __m128i y = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(sv, height)), maskY);
+		_mm_store_si128((__m128i*)index, tiledIndex4(x, y, rowShift));
+		for (int k = 0; k < 4 && i + k < count; ++k)
+		{
+			dst[i + k] = m_texels[index[k]];
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void SoftwareTexture::sampleBilinear(const float* u, const float* v, int count, uint32_t* dst) const
+{
+	const __m128 size = _mm_setr_ps((float)m_width, (float)m_height, 0.0f, 0.0f);
+	const __m128 width = _mm_shuffle_ps(size, size, _MM_SHUFFLE(0, 0, 0, 0));
+	const __m128 height = _mm_shuffle_ps(size, size, _MM_SHUFFLE(1, 1, 1, 1));
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 weightScale = _mm_set1_ps(256.0f);
+	const __m128i maskX = _mm_set1_epi32(m_width - 1);
+	const __m128i maskY = _mm_set1_epi32(m_height - 1);
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i rowShift = _mm_cvtsi32_si128(m_widthShift + 2);
+	const __m128i zero = _mm_setzero_si128();
+
+	ALIGN16 float tailU[4];
+	ALIGN16 float tailV[4];
+	ALIGN16 int32_t index[16];
+	ALIGN16 uint32_t texels[16];
+	ALIGN16 uint32_t tail[4];
+	for (int i = 0; i < count; i += 4)
+	{
+		__m128 su;
+		__m128 sv;
+		if (i + 4 <= count)
+		{
+			su = _mm_loadu_ps(u + i);
+			sv = _mm_loadu_ps(v + i);
+		}
+		else
+		{
+			for (int k = 0; k < 4; ++k)
+			{
+				tailU[k] = u[i + k < count ? i + k : count - 1];
+				tailV[k] = v[i + k < count ? i + k : count - 1];
+			}
+			su = _mm_load_ps(tailU);
+			sv = _mm_load_ps(tailV);
+		}
+
+		// Wrap into [0, 1) first so the conversions stay in range, then to texels
+		su = _mm_sub_ps(su, _mm_cvtepi32_ps(floor4(su)));
+		sv = _mm_sub_ps(sv, _mm_cvtepi32_ps(floor4(sv)));
+		const __m128 tx = _mm_sub_ps(_mm_mul_ps(su, width), half);
+		const __m128 ty = _mm_sub_ps(_mm_mul_ps(sv, height), half);
+		const __m128i x0 = floor4(tx);
+		const __m128i y0 = floor4(ty);
+		const __m128i wx = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(tx, _mm_cvtepi32_ps(x0)), weightScale));
+		const __m128i wy = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(ty, _mm_cvtepi32_ps(y0)), weightScale));
+		const __m128i x1 = _mm_and_si128(_mm_add_epi32(x0, one), maskX);
+		const __m128i y1 = _mm_and_si128(_mm_add_epi32(y0, one), maskY);
+		const __m128i wrappedX0 = _mm_and_si128(x0, maskX);
+		const __m128i wrappedY0 = _mm_and_si128(y0, maskY);
+		_mm_store_si128((__m128i*)index, tiledIndex4(wrappedX0, wrappedY0, rowShift));
+		_mm_store_si128((__m128i*)(index + 4), tiledIndex4(x1, wrappedY0, rowShift));
+		_mm_store_si128((__m128i*)(index + 8), tiledIndex4(wrappedX0, y1, rowShift));
+		_mm_store_si128((__m128i*)(index + 12), tiledIndex4(x1, y1, rowShift));
+		for (int k = 0; k < 16; ++k)
+		{
+			texels[k] = m_texels[index[k]];
+		}
+
+		// Weights of samples 0, 1 and 2, 3 repeated over the four channels
+		const __m128i packedX = _mm_unpacklo_epi16(_mm_packs_epi32(wx, wx), _mm_packs_epi32(wx, wx));
+		const __m128i packedY = _mm_unpacklo_epi16(_mm_packs_epi32(wy, wy), _mm_packs_epi32(wy, wy));
+		const __m128i weightX[2] = { _mm_unpacklo_epi32(packedX, packedX), _mm_unpackhi_epi32(packedX, packedX) };
+		const __m128i weightY[2] = { _mm_unpacklo_epi32(packedY, packedY), _mm_unpackhi_epi32(packedY, packedY) };
+		const __m128i t00 = _mm_load_si128((const __m128i*)texels);
+		const __m128i t10 = _mm_load_si128((const __m128i*)(texels + 4));
+		const __m128i t01 = _mm_load_si128((const __m128i*)(texels + 8));
+		const __m128i t11 = _mm_load_si128((const __m128i*)(texels + 12));
+		__m128i filtered[2];
+		for (int h = 0; h < 2; ++h)
+		{
+			const __m128i a = h == 0 ? _mm_unpacklo_epi8(t00, zero) : _mm_unpackhi_epi8(t00, zero);
+			const __m128i b = h == 0 ? _mm_unpacklo_epi8(t10, zero) : _mm_unpackhi_epi8(t10, zero);
+			const __m128i c = h == 0 ? _mm_unpacklo_epi8(t01, zero) : _mm_unpackhi_epi8(t01, zero);
+			const __m128i d = h == 0 ? _mm_unpacklo_epi8(t11, zero) : _mm_unpackhi_epi8(t11, zero);
+			filtered[h] = lerp16(lerp16(a, b, weightX[h]), lerp16(c, d, weightX[h]), weightY[h]);
+		}
+		const __m128i result = _mm_packus_epi16(filtered[0], filtered[1]);
+		if (i + 4 <= count)
+		{
+			_mm_storeu_si128((__m128i*)(dst + i), result);
+		}
+		else
+		{
+			_mm_store_si128((__m128i*)tail, result);
+			for (int k = 0; i + k < count; ++k)
+			{
+				dst[i + k] = tail[k];
+			}
+		}
+	}
+}
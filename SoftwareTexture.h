@@ -0,0 +1,64 @@
+//-----------------------------------------------------------------------------
+// File: SoftwareTexture.h
+//
+// Texture for the CPU color path, sampled the way stage 0 of Render() samples
+// the tiger's texture: point or bilinear on the top mip level with WRAP
+// addressing and texel centers at (i + 0.5) / size, 8 bit filter weights like
+// the hardware.
+//
+// Texels are stored in 4x4 tiles of X8R8G8B8, so the 2x2 footprint of a
+// bilinear sample is one 64 byte line in most cases rather than two rows
+// pitch bytes apart. Sizes must be powers of two, so wrapping and the tiled
+// address are shifts and masks, and four samples are addressed and filtered
+// at a time with SSE2.
+//-----------------------------------------------------------------------------
+#ifndef SOFTWARE_TEXTURE_H
+#define SOFTWARE_TEXTURE_H
+
+#include "ColorImage.h"
+
+//--------------------------------------------------------------------------------------
+class SoftwareTexture
+{
+public:
+	static const int		TILE_SIZE = 4;
+
+	// D3DTEXF_POINT and D3DTEXF_LINEAR as MINFILTER and MAGFILTER
+	enum Filter
+	{
+		FILTER_POINT,
+		FILTER_LINEAR
+	};
+
+private:
+	uint32_t*				m_texels;			// tiles in rows, texels in rows inside a tile
+	int						m_width;
+	int						m_height;
+	int						m_widthShift;		// log2 of the width
+
+	SoftwareTexture(const SoftwareTexture&);
+	SoftwareTexture& operator=(const SoftwareTexture&);
+public:
+
+	SoftwareTexture();
+	~SoftwareTexture();
+
+	// False unless width and height are powers of two of at least TILE_SIZE
+	bool				create(const ColorImage& image);
+	bool				load(const char* path);
+	void				clear();
+
+	// Texel x, y wrapped into the texture
+	uint32_t			fetch(int x, int y) const;
+
+	// count samples at u, v into dst, count need not be a multiple of four
+	void				sample(Filter filter, const float* u, const float* v, int count, uint32_t* dst) const;
+	void				samplePoint(const float* u, const float* v, int count, uint32_t* dst) const;
+	void				sampleBilinear(const float* u, const float* v, int count, uint32_t* dst) const;
+
+	int					getWidth() const		{ return m_width; }
+	int					getHeight() const		{ return m_height; }
+	bool				isEmpty() const			{ return m_texels == NULL; }
+};
+
+#endif // SOFTWARE_TEXTURE_H
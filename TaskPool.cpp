@@ -0,0 +1,217 @@
+//-----------------------------------------------------------------------------
+// File: TaskPool.cpp
+//-----------------------------------------------------------------------------
+#include "TaskPool.h"
+
+//--------------------------------------------------------------------------------------
+TaskPool::TaskPool(int threadCount)
+	: m_workerCount( 0 )
+	, m_function( NULL )
+	, m_context( NULL )
+	, m_count( 0 )
+	, m_next( 0 )
+	, m_generation( 0 )
+	, m_busyWorkers( 0 )
+	, m_quit( false )
+{
+	if (threadCount <= 0)
+	{
+		threadCount = hardwareThreadCount();
+	}
+	const int workers = threadCount - 1 < MAX_WORKERS ? threadCount - 1 : MAX_WORKERS;
+
+#ifdef _WIN32
+	InitializeCriticalSection(&m_lock);
+	InitializeConditionVariable(&m_wake);
+	InitializeConditionVariable(&m_done);
+	for (int i = 0; i < workers; ++i)
+	{
+		m_threads[m_workerCount] = CreateThread(NULL, 0, threadEntry, this, 0, NULL);
+		if (m_threads[m_workerCount] != NULL)
+		{
+			++m_workerCount;
+		}
+	}
+#else
+	pthread_mutex_init(&m_lock, NULL);
+	pthread_cond_init(&m_wake, NULL);
+	pthread_cond_init(&m_done, NULL);
+	for (int i = 0; i < workers; ++i)
+	{
+		if (pthread_create(&m_threads[m_workerCount], NULL, threadEntry, this) == 0)
+		{
+			++m_workerCount;
+		}
+	}
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+TaskPool::~TaskPool()
+{
+	lock();
+	m_quit = true;
+#ifdef _WIN32
+	WakeAllConditionVariable(&m_wake);
+	unlock();
+	for (int i = 0; i < m_workerCount; ++i)
+	{
+		WaitForSingleObject(m_threads[i], INFINITE);
+		CloseHandle(m_threads[i]);
+	}
+	DeleteCriticalSection(&m_lock);
+#else
+	pthread_cond_broadcast(&m_wake);
+	unlock();
+	for (int i = 0; i < m_workerCount; ++i)
+	{
+		pthread_join(m_threads[i], NULL);
+	}
+	pthread_cond_destroy(&m_wake);
+	pthread_cond_destroy(&m_done);
+	pthread_mutex_destroy(&m_lock);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+void TaskPool::lock()
+{
+#ifdef _WIN32
+	EnterCriticalSection(&m_lock);
+#else
+	pthread_mutex_lock(&m_lock);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+void TaskPool::unlock()
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&m_lock);
+#else
+	pthread_mutex_unlock(&m_lock);
+#endif
+}
+
+//--------------------------------------------------------------------------------------
+void TaskPool::execute()
+{
+	for (;;)
+	{
+		const int index = (int)atomicIncrement(&m_next) - 1;
+		if (index >= m_count)
+		{
+			return;
+		}
+		m_function(m_context, index);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void TaskPool::workerLoop()
+{
+	unsigned int seen = 0;
+	for (;;)
+	{
+		lock();
+		while (m_generation == seen && !m_quit)
+		{
+#ifdef _WIN32
+			SleepConditionVariableCS(&m_wake, &m_lock, INFINITE);
+#else
+			pthread_cond_wait(&m_wake, &m_lock);
+#endif
+		}
+		if (m_quit)
+		{
+			unlock();
+			return;
+		}
+		seen = m_generation;
+		unlock();
+
+		execute();
+
+		lock();
+		if (--m_busyWorkers == 0)
+		{
+#ifdef _WIN32
+			WakeConditionVariable(&m_done);
+#else
+			pthread_cond_signal(&m_done);
+#endif
+		}
+		unlock();
+	}
+}
+
+//--------------------------------------------------------------------------------------
+#ifdef _WIN32
+DWORD WINAPI TaskPool::threadEntry(LPVOID pool)
+{
+	static_cast<TaskPool*>(pool)->workerLoop();
+	return 0;
+}
+#else
+void* TaskPool::threadEntry(void* pool)
+{
+	static_cast<TaskPool*>(pool)->workerLoop();
+	return NULL;
+}
+#endif
+
+//--------------------------------------------------------------------------------------
+void TaskPool::runOn(TaskPool* pool, TaskFunction function, void* context, int count)
+{
+	if (pool != NULL)
+	{
+		pool->run(function, context, count);
+	}
+	else
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			function(context, i);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void TaskPool::run(TaskFunction function, void* context, int count)
+{
+	if (m_workerCount == 0 || count <= 1)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			function(context, i);
+		}
+		return;
+	}
+
+	lock();
+	m_function = function;
+	m_context = context;
+	m_count = count;
+	m_next = 0;
+	m_busyWorkers = m_workerCount;
+	++m_generation;
+#ifdef _WIN32
+	WakeAllConditionVariable(&m_wake);
+#else
+	pthread_cond_broadcast(&m_wake);
+#endif
+	unlock();
+
+	execute();
+
+	lock();
+	while (m_busyWorkers > 0)
+	{
+#ifdef _WIN32
+		SleepConditionVariableCS(&m_done, &m_lock, INFINITE);
+#else
+		pthread_cond_wait(&m_done, &m_lock);
+#endif
+	}
+	unlock();
+}
@@ -0,0 +1,72 @@
+//-----------------------------------------------------------------------------
+// File: TaskPool.h
+//
+// Fixed set of worker threads running index ranges for the CPU depth kernels.
+// run() hands out indices one at a time from a shared counter, so uneven
+// tasks balance themselves, and the calling thread works along until every
+// index is done.
+//-----------------------------------------------------------------------------
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include "Platform.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+//--------------------------------------------------------------------------------------
+class TaskPool
+{
+public:
+	typedef void (*TaskFunction)(void* context, int index);
+	static const int		MAX_WORKERS = 31;
+
+private:
+#ifdef _WIN32
+	HANDLE					m_threads[MAX_WORKERS];
+	CRITICAL_SECTION		m_lock;
+	CONDITION_VARIABLE		m_wake;
+	CONDITION_VARIABLE		m_done;
+#else
+	pthread_t				m_threads[MAX_WORKERS];
+	pthread_mutex_t			m_lock;
+	pthread_cond_t			m_wake;
+	pthread_cond_t			m_done;
+#endif
+	int						m_workerCount;
+	TaskFunction			m_function;
+	void*					m_context;
+	int						m_count;
+	volatile long			m_next;
+	unsigned int			m_generation;
+	int						m_busyWorkers;
+	bool					m_quit;
+
+	TaskPool(const TaskPool&);
+	TaskPool& operator=(const TaskPool&);
+
+	void				lock();
+	void				unlock();
+	void				execute();
+	void				workerLoop();
+#ifdef _WIN32
+	static DWORD WINAPI	threadEntry(LPVOID pool);
+#else
+	static void*		threadEntry(void* pool);
+#endif
+public:
+
+	// threadCount includes the calling thread, 0 uses every hardware thread
+	explicit TaskPool(int threadCount = 0);
+	~TaskPool();
+
+	// Calls function(context, i) for i in [0, count) and returns when all are done
+	void				run(TaskFunction function, void* context, int count);
+
+	// pool->run(), or the same calls in order on the calling thread when pool is NULL
+	static void			runOn(TaskPool* pool, TaskFunction function, void* context, int count);
+
+	int					getThreadCount() const	{ return m_workerCount + 1; }
+};
+
+#endif // TASK_POOL_H
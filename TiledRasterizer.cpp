@@ -0,0 +1,902 @@
+//-----------------------------------------------------------------------------
+// File: TiledRasterizer.cpp
+//-----------------------------------------------------------------------------
+#include "TiledRasterizer.h"
+#include <stdlib.h>
+
+static const int			ONE = 1 << DepthRasterizer::SUBPIXEL_BITS;
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE int32_t min3(int32_t a, int32_t b, int32_t c)
+{
+	const int32_t m = a < b ? a : b;
+	return m < c ? m : c;
+}
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE int32_t max3(int32_t a, int32_t b, int32_t c)
+{
+	const int32_t m = a > b ? a : b;
+	return m > c ? m : c;
+}
+
+//--------------------------------------------------------------------------------------
+// Floor division by the subpixel scale, also right for negative coordinates
+static FORCE_INLINE int32_t toPixelFloor(int32_t value)
+{
+	return value >= 0 ? value >> DepthRasterizer::SUBPIXEL_BITS
+		: -((-value + ONE - 1) >> DepthRasterizer::SUBPIXEL_BITS);
+}
+
+//--------------------------------------------------------------------------------------
+// Edge i at the sample point of pixel (px, py), positive inside
+static FORCE_INLINE int64_t edgeAt(const int32_t* x, const int32_t* y, const int32_t* bias, int i, int px, int py)
+{
+	const int j = i == 2 ? 0 : i + 1;
+	const int64_t dx = x[j] - x[i];
+	const int64_t dy = y[j] - y[i];
+	return dx * ((int64_t)py * ONE - y[i]) - dy * ((int64_t)px * ONE - x[i]) + bias[i];
+}
+
+//--------------------------------------------------------------------------------------
+// Smallest and largest value of edge i over the pixel rectangle. The edge is
+// linear, so both sit at the corners picked by the signs of its direction.
+static FORCE_INLINE void edgeRange(const int32_t* x, const int32_t* y, const int32_t* bias, int i,
+	int x0, int y0, int x1, int y1, int64_t& minE, int64_t& maxE)
+{
+	const int j = i == 2 ? 0 : i + 1;
+	const int32_t dx = x[j] - x[i];
+	const int32_t dy = y[j] - y[i];
+	minE = edgeAt(x, y, bias, i, dy > 0 ? x1 : x0, dx > 0 ? y0 : y1);
+	maxE = edgeAt(x, y, bias, i, dy > 0 ? x0 : x1, dx > 0 ? y1 : y0);
+}
+
+//--------------------------------------------------------------------------------------
+// floorf(v * 16 + 0.5f) as setupTriangle snaps, exact in float because
+// positions inside the guard band stay within 2^24 after snapping
+static FORCE_INLINE __m128 snap4(__m128 v)
+{
+	v = _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps((float)ONE)), _mm_set1_ps(0.5f));
+	const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+	return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, v), _mm_set1_ps(1.0f)));
+}
+
+//--------------------------------------------------------------------------------------
+// Classifies the count <= 4 triangles at indices. rejected gets those with a
+// bit of planes in the clip codes of all vertices: for the sides their pixel
+// centers lie outside the target or on right or bottom edges, for near and
+// far outside 0 <= z <= 1. backfacing gets those the cull mode removes. The float area of
+// the snapped positions only decides beyond its worst rounding error, which
+// stays below 2^-22 of |p| + |q|, so setupTriangle is never overruled.
+static FORCE_INLINE void rejectTriangles4(const VertexPipeline& vertices, const uint32_t* indices, int count,
+	int planes, DepthRasterizer::CullMode cullMode, int& rejected, int& backfacing)
+{
+	const float* screenX = vertices.getScreenX();
+	const float* screenY = vertices.getScreenY();
+	const uint8_t* clipCodes = vertices.getClipCodes();
+	ALIGN16 int32_t codes[3][4];
+	ALIGN16 float x[3][4];
+	ALIGN16 float y[3][4];
+	for (int k = 0; k < 4; ++k)
+	{
+		// Lanes past count repeat the first triangle and are masked below
+		const uint32_t* triangle = indices + (k < count ? k : 0) * 3;
+		for (int i = 0; i < 3; ++i)
+		{
+			codes[i][k] = clipCodes[triangle[i]];
+			x[i][k] = screenX[triangle[i]];
+			y[i][k] = screenY[triangle[i]];
+		}
+	}
+	const int lanes = (1 << count) - 1;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c0 = _mm_load_si128((const __m128i*)codes[0]);
+	const __m128i c1 = _mm_load_si128((const __m128i*)codes[1]);
+	const __m128i c2 = _mm_load_si128((const __m128i*)codes[2]);
+	const __m128i shared = _mm_and_si128(_mm_and_si128(_mm_and_si128(c0, c1), c2), _mm_set1_epi32(planes));
+	rejected = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(shared, zero))) & lanes;
+	backfacing = 0;
+	if (cullMode == DepthRasterizer::CULL_NONE)
+	{
+		return;
+	}
+
+	// Vertices behind the near plane have no screen position, those beyond the
+	// guard band are left to the clipper
+	const __m128i any = _mm_or_si128(_mm_or_si128(c0, c1), c2);
+	const __m128i unclipped = _mm_and_si128(any, _mm_set1_epi32(VertexPipeline::CLIP_NEAR | VertexPipeline::CLIP_GUARD));
+	const __m128 projected = _mm_castsi128_ps(_mm_cmpeq_epi32(unclipped, zero));
+
+	const __m128 X0 = snap4(_mm_load_ps(x[0]));
+	const __m128 Y0 = snap4(_mm_load_ps(y[0]));
+	const __m128 dx1 = _mm_sub_ps(snap4(_mm_load_ps(x[1])), X0);
+	const __m128 dy1 = _mm_sub_ps(snap4(_mm_load_ps(y[1])), Y0);
+	const __m128 dx2 = _mm_sub_ps(snap4(_mm_load_ps(x[2])), X0);
+	const __m128 dy2 = _mm_sub_ps(snap4(_mm_load_ps(y[2])), Y0);
+	const __m128 p = _mm_mul_ps(dx1, dy2);
+	const __m128 q = _mm_mul_ps(dy1, dx2);
+	const __m128 area = _mm_sub_ps(p, q);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 error = _mm_mul_ps(_mm_add_ps(_mm_and_ps(p, absMask), _mm_and_ps(q, absMask)), _mm_set1_ps(1.0f / (1 << 20)));
+	const __m128 facing = cullMode == DepthRasterizer::CULL_CCW ? _mm_cmplt_ps(_mm_add_ps(area, error), _mm_setzero_ps())
+		: _mm_cmpgt_ps(_mm_sub_ps(area, error), _mm_setzero_ps());
+	backfacing = _mm_movemask_ps(_mm_and_ps(facing, projected)) & lanes & ~rejected;
+}
+
+//--------------------------------------------------------------------------------------
+TiledRasterizer::TiledRasterizer(TaskPool* pool)
+	: m_pool( pool )
+	, m_target( NULL )
+	, m_cullMode( DepthRasterizer::CULL_CCW )
+	, m_kernel( KERNEL_SCALAR )
+	, m_sampleX( 0 )
+	, m_sampleY( 0 )
+	, m_reversed( false )
+	, m_vertices( pool )
+	, m_triangles( NULL )
+	, m_triangleCount( 0 )
+	, m_triangleCapacity( 0 )
+	, m_bins( NULL )
+	, m_binCount( 0 )
+	, m_binCapacity( 0 )
+	, m_tileStart( NULL )
+	, m_tileTriangles( NULL )
+	, m_tileTriangleCapacity( 0 )
+	, m_tileStats( NULL )
+	, m_tilesX( 0 )
+	, m_tilesY( 0 )
+	, m_tileCapacity( 0 )
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	setKernel(KERNEL_AVX2);
+}
+
+//--------------------------------------------------------------------------------------
+TiledRasterizer::~TiledRasterizer()
+{
+	alignedFree(m_triangles);
+	for (int i = 0; i < m_binCapacity; ++i)
+	{
+		delete[] m_bins[i].entries;
+	}
+	delete[] m_bins;
+	delete[] m_tileStart;
+	delete[] m_tileTriangles;
+	delete[] m_tileStats;
+}
+
+//--------------------------------------------------------------------------------------
+bool TiledRasterizer::isKernelSupported(Kernel kernel)
+{
+	return kernel != KERNEL_AVX2 || (isAvx2Built() && cpuSupportsAvx2());
+}
+
+//--------------------------------------------------------------------------------------
+void TiledRasterizer::setKernel(Kernel kernel)
+{
+	m_kernel = isKernelSupported(kernel) ? kernel : KERNEL_SSE2;
+}
+
+//--------------------------------------------------------------------------------------
+void TiledRasterizer::reserveTriangles(int count)
+{
+	if (count <= m_triangleCapacity)
+	{
+		return;
+	}
+	const int capacity = maxi(count, m_triangleCapacity * 2);
+	Triangle* triangles = (Triangle*)alignedAlloc(capacity * sizeof(Triangle), 16);
+	if (m_triangleCount > 0)
+	{
+		memcpy(triangles, m_triangles, m_triangleCount * sizeof(Triangle));
+	}
+	alignedFree(m_triangles);
+	m_triangles = triangles;
+	m_triangleCapacity = capacity;
+}
+
+//--------------------------------------------------------------------------------------
+void TiledRasterizer::reserveBins(int count)
+{
+	if (count <= m_binCapacity)
+	{
+		return;
+	}
+	const int capacity = maxi(count, m_binCapacity * 2);
+	Bin* bins = new Bin[capacity];
+	memset(bins, 0, capacity * sizeof(Bin));
+	if (m_binCapacity > 0)
+	{
+		memcpy(bins, m_bins, m_binCapacity * sizeof(Bin));
+	}
+	delete[] m_bins;
+	m_bins = bins;
+	m_binCapacity = capacity;
+}
+
+//--------------------------------------------------------------------------------------
+void TiledRasterizer::begin(DepthImage& target)
+{
+	m_target = &target;
+	m_triangleCount = 0;
+	m_binCount = 0;
+	m_tilesX = (target.getWidth() + TILE_SIZE - 1) / TILE_SIZE;
+	m_tilesY = (target.getHeight() + TILE_SIZE - 1) / TILE_SIZE;
+	const int tileCount = m_tilesX * m_tilesY;
+	if (tileCount > m_tileCapacity)
+	{
+		delete[] m_tileStart;
+		delete[] m_tileStats;
+		m_tileStart = new uint32_t[tileCount + 1];
+		m_tileStats = new TileStats[tileCount];
+		m_tileCapacity = tileCount;
+	}
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+// Snapping, culling and the depth plane exactly as DepthRasterizer::drawTriangle.
+// The vertices are inside the guard band, or clipped to it, so every snapped
+// coordinate fits in 32 bits and their products in 64.
+bool TiledRasterizer::setupTriangle(const float* v0, const float* v1, const float* v2, Triangle& triangle) const
+{
+	const float snap = (float)ONE;
+	int32_t X0 = (int32_t)floorf(v0[0] * snap + 0.5f);
+	int32_t Y0 = (int32_t)floorf(v0[1] * snap + 0.5f);
+	int32_t X1 = (int32_t)floorf(v1[0] * snap + 0.5f);
+	int32_t Y1 = (int32_t)floorf(v1[1] * snap + 0.5f);
+	int32_t X2 = (int32_t)floorf(v2[0] * snap + 0.5f);
+	int32_t Y2 = (int32_t)floorf(v2[1] * snap + 0.5f);
+
+	// Moving the triangle against the sample offset moves every sample point onto it
+	X0 -= m_sampleX; X1 -= m_sampleX; X2 -= m_sampleX;
+	Y0 -= m_sampleY; Y1 -= m_sampleY; Y2 -= m_sampleY;
+	float z0 = v0[2];
+	float z1 = v1[2];
+	float z2 = v2[2];
+
+	int64_t area = (int64_t)(X1 - X0) * (Y2 - Y0) - (int64_t)(Y1 - Y0) * (X2 - X0);
+	if (area == 0 || (area < 0 && m_cullMode == DepthRasterizer::CULL_CCW) || (area > 0 && m_cullMode == DepthRasterizer::CULL_CW))
+	{
+		return false;
+	}
+	if (area < 0)
+	{
+		int32_t t = X1; X1 = X2; X2 = t;
+		t = Y1; Y1 = Y2; Y2 = t;
+		const float tz = z1; z1 = z2; z2 = tz;
+		area = -area;
+	}
+
+	const int32_t minX = toPixelFloor(min3(X0, X1, X2) + ONE - 1);
+	const int32_t minY = toPixelFloor(min3(Y0, Y1, Y2) + ONE - 1);
+	const int32_t maxX = toPixelFloor(max3(X0, X1, X2));
+	const int32_t maxY = toPixelFloor(max3(Y0, Y1, Y2));
+	triangle.minX = maxi(minX, 0);
+	triangle.minY = maxi(minY, 0);
+	triangle.maxX = mini(maxX, m_target->getWidth() - 1);
+	triangle.maxY = mini(maxY, m_target->getHeight() - 1);
+	if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+	{
+		return false;
+	}
+
+	triangle.x[0] = X0; triangle.x[1] = X1; triangle.x[2] = X2;
+	triangle.y[0] = Y0; triangle.y[1] = Y1; triangle.y[2] = Y2;
+	for (int i = 0; i < 3; ++i)
+	{
+		const int j = i == 2 ? 0 : i + 1;
+		const int32_t dx = triangle.x[j] - triangle.x[i];
+		const int32_t dy = triangle.y[j] - triangle.y[i];
+		triangle.bias[i] = dy < 0 || (dy == 0 && dx > 0) ? 0 : -1;
+	}
+
+	const float invArea = snap * snap / (float)area;
+	triangle.z0 = z0;
+	triangle.fx0 = X0 / snap;
+	triangle.fy0 = Y0 / snap;
+	triangle.dzdx = ((z1 - z0) * (float)(Y2 - Y0) - (z2 - z0) * (float)(Y1 - Y0)) * invArea / snap;
+	triangle.dzdy = ((z2 - z0) * (float)(X1 - X0) - (z1 - z0) * (float)(X2 - X0)) * invArea / snap;
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Appends the triangle to every tile of its bounds its edges do not exclude
+void TiledRasterizer::binTriangle(const Triangle& triangle, uint32_t index, Bin& bin) const
+{
+	const int tx0 = triangle.minX / TILE_SIZE;
+	const int ty0 = triangle.minY / TILE_SIZE;
+	const int tx1 = triangle.maxX / TILE_SIZE;
+	const int ty1 = triangle.maxY / TILE_SIZE;
+	const bool single = tx0 == tx1 && ty0 == ty1;
+
+	for (int ty = ty0; ty <= ty1; ++ty)
+	{
+		for (int tx = tx0; tx <= tx1; ++tx)
+		{
+			if (!single)
+			{
+				const int x0 = maxi(tx * TILE_SIZE, triangle.minX);
+				const int y0 = maxi(ty * TILE_SIZE, triangle.minY);
+				const int x1 = mini(tx * TILE_SIZE + TILE_SIZE - 1, triangle.maxX);
+				const int y1 = mini(ty * TILE_SIZE + TILE_SIZE - 1, triangle.maxY);
+				bool outside = false;
+				for (int i = 0; i < 3 && !outside; ++i)
+				{
+					int64_t minE, maxE;
+					edgeRange(triangle.x, triangle.y, triangle.bias, i, x0, y0, x1, y1, minE, maxE);
+					outside = maxE < 0;
+				}
+				if (outside)
+				{
+					++bin.tilesRejected;
+					continue;
+				}
+			}
+
+			if (bin.count == bin.capacity)
+			{
+				const int capacity = maxi(1024, bin.capacity * 2);
+				BinEntry* entries = new BinEntry[capacity];
+				if (bin.count > 0)
+				{
+					memcpy(entries, bin.entries, bin.count * sizeof(BinEntry));
+				}
+				delete[] bin.entries;
+				bin.entries = entries;
+				bin.capacity = capacity;
+			}
+			BinEntry& entry = bin.entries[bin.count++];
+			entry.tile = (uint32_t)(ty * m_tilesX + tx);
+			entry.triangle = index;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Near plane, the four guard band sides and one vertex more for each
+static const int			MAX_CLIPPED_VERTICES = 8;
+
+//--------------------------------------------------------------------------------------
+// Clips the triangle in clip space to z >= 0, z <= w for reverse-Z, when
+// nearPlane is set, then to the sides of the guard band, and fans the polygon
+// into triangles, all but the first in overflow slots. Vertices on the near
+// plane get depth 0, or 1, exactly so the depth test keeps them.
+void TiledRasterizer::clipTriangle(BinContext& ctx, const uint32_t* indices, bool nearPlane, uint32_t index, Bin& bin)
+{
+	const bool reversed = ctx.vertices->isReverseZ();
+	float planes[5][4] =
+	{
+		{ 0.0f, 0.0f, reversed ? -1.0f : 1.0f, reversed ? 1.0f : 0.0f },
+	};
+	ctx.vertices->getGuardPlanes(planes + 1);
+
+	// Two buffers clipped back and forth, one plane at a time
+	float polygon[2][MAX_CLIPPED_VERTICES][4];
+	bool onNear[2][MAX_CLIPPED_VERTICES];
+	int count = 3;
+	int current = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		ctx.vertices->getClipPosition(indices[i], polygon[0][i]);
+		onNear[0][i] = false;
+	}
+	for (int p = nearPlane ? 0 : 1; p < 5 && count >= 3; ++p)
+	{
+		float distance[MAX_CLIPPED_VERTICES];
+		bool outside = false;
+		for (int i = 0; i < count; ++i)
+		{
+			const float* v = polygon[current][i];
+			distance[i] = v[0] * planes[p][0] + v[1] * planes[p][1] + v[2] * planes[p][2] + v[3] * planes[p][3];
+			outside = outside || distance[i] < 0.0f;
+		}
+		if (!outside)
+		{
+			continue;
+		}
+
+		const float (*in)[4] = polygon[current];
+		float (*out)[4] = polygon[1 - current];
+		int clipped = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			const int j = i + 1 == count ? 0 : i + 1;
+			if (distance[i] >= 0.0f)
+			{
+				memcpy(out[clipped], in[i], sizeof(out[clipped]));
+				onNear[1 - current][clipped++] = onNear[current][i];
+			}
+			if ((distance[i] >= 0.0f) != (distance[j] >= 0.0f))
+			{
+				const float t = distance[i] / (distance[i] - distance[j]);
+				float* point = out[clipped];
+				point[0] = in[i][0] + (in[j][0] - in[i][0]) * t;
+				point[1] = in[i][1] + (in[j][1] - in[i][1]) * t;
+				point[3] = in[i][3] + (in[j][3] - in[i][3]) * t;
+				point[2] = p == 0 ? (reversed ? point[3] : 0.0f) : in[i][2] + (in[j][2] - in[i][2]) * t;
+				onNear[1 - current][clipped++] = p == 0 || (onNear[current][i] && onNear[current][j]);
+			}
+		}
+		count = clipped;
+		current = 1 - current;
+	}
+
+	// Only projections that put the eye inside the near plane get w <= 0 here
+	float screen[MAX_CLIPPED_VERTICES][3];
+	bool projected = count >= 3;
+	for (int i = 0; i < count && projected; ++i)
+	{
+		projected = polygon[current][i][3] > 0.0f;
+		ctx.vertices->toScreen(polygon[current][i], screen[i]);
+		if (onNear[current][i])
+		{
+			screen[i][2] = reversed ? 1.0f : 0.0f;
+		}
+	}
+	if (!projected)
+	{
+		++bin.culled;
+		return;
+	}
+	for (int k = 1; k + 1 < count; ++k)
+	{
+		uint32_t slot = index;
+		if (k > 1)
+		{
+			// Past the capacity addTriangles() bins again with more room
+			const int overflow = (int)atomicIncrement(&ctx.overflowCount) - 1;
+			if (overflow >= ctx.overflowCapacity)
+			{
+				continue;
+			}
+			slot = (uint32_t)(ctx.firstOverflow + overflow);
+		}
+		++bin.clippedTriangles;
+		if (!setupTriangle(screen[0], screen[k], screen[k + 1], m_triangles[slot]))
+		{
+			++bin.culled;
+			continue;
+		}
+		binTriangle(m_triangles[slot], slot, bin);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void TiledRasterizer::binTask(void* context, int index)
+{
+	BinContext& ctx = *(BinContext*)context;
+	TiledRasterizer& self = *ctx.rasterizer;
+	const VertexPipeline& vertices = *ctx.vertices;
+	const float* screenX = vertices.getScreenX();
+	const float* screenY = vertices.getScreenY();
+	const float* screenZ = vertices.getScreenZ();
+	const uint8_t* clipCodes = vertices.getClipCodes();
+	Bin& bin = self.m_bins[ctx.firstBin + index];
+	bin.count = 0;
+	bin.rejected = 0;
+	bin.backfacing = 0;
+	bin.inside = 0;
+	bin.guardBand = 0;
+	bin.nearClipped = 0;
+	bin.guardClipped = 0;
+	bin.clippedTriangles = 0;
+	bin.culled = 0;
+	bin.tilesRejected = 0;
+
+	// Samples off the pixel centers reach past the viewport edges
+	int planes = VertexPipeline::CLIP_NEAR | VertexPipeline::CLIP_FAR;
+	if (self.m_sampleX == 0)
+	{
+		planes |= VertexPipeline::CLIP_LEFT | VertexPipeline::CLIP_RIGHT;
+	}
+	if (self.m_sampleY == 0)
+	{
+		planes |= VertexPipeline::CLIP_BOTTOM | VertexPipeline::CLIP_TOP;
+	}
+
+	const int first = index * TRIANGLES_PER_TASK;
+	const int last = mini(first + TRIANGLES_PER_TASK, ctx.triangleCount);
+	for (int batch = first; batch < last; batch += 4)
+	{
+		const int count = mini(4, last - batch);
+		int rejected, backfacing;
+		rejectTriangles4(vertices, ctx.indices + batch * 3, count, planes, self.m_cullMode, rejected, backfacing);
+		bin.rejected += popCount(rejected);
+		bin.backfacing += popCount(backfacing);
+
+		for (int k = 0; k < count; ++k)
+		{
+			if (((rejected | backfacing) >> k) & 1)
+			{
+				continue;
+			}
+			const int t = batch + k;
+			const uint32_t* indices = ctx.indices + t * 3;
+			const uint32_t triangleIndex = (uint32_t)(ctx.firstTriangle + t);
+			const int codes = clipCodes[indices[0]] | clipCodes[indices[1]] | clipCodes[indices[2]];
+			if (codes & VertexPipeline::CLIP_NEAR)
+			{
+				++bin.nearClipped;
+				self.clipTriangle(ctx, indices, true, triangleIndex, bin);
+				continue;
+			}
+			if (codes & VertexPipeline::CLIP_GUARD)
+			{
+				++bin.guardClipped;
+				self.clipTriangle(ctx, indices, false, triangleIndex, bin);
+				continue;
+			}
+			if (codes == 0)
+			{
+				++bin.inside;
+			}
+			else
+			{
+				++bin.guardBand;
+			}
+
+			float v[3][3];
+			for (int i = 0; i < 3; ++i)
+			{
+				v[i][0] = screenX[indices[i]];
+				v[i][1] = screenY[indices[i]];
+				v[i][2] = screenZ[indices[i]];
+			}
+			Triangle& triangle = self.m_triangles[triangleIndex];
+			if (!self.setupTriangle(v[0], v[1], v[2], triangle))
+			{
+				++bin.culled;
+				continue;
+			}
+			self.binTriangle(triangle, triangleIndex, bin);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void TiledRasterizer::addMesh(const RasterMesh& mesh, const DepthMatrix& worldViewProj)
+{
+	m_vertices.setMesh(mesh);
+	m_vertices.begin(worldViewProj, m_target->getWidth(), m_target->getHeight());
+	m_vertices.transformAll();
+	m_stats.transformMs += m_vertices.getStats().transformMs;
+	addTriangles(m_vertices, mesh.indices, mesh.triangleCount);
+}
+
+//--------------------------------------------------------------------------------------
+void TiledRasterizer::addTriangles(const VertexPipeline& vertices, const uint32_t* indices, int triangleCount)
+{
+	CpuTimer timer;
+
+	// Room for two triangles per input, what a triangle clipped at the near
+	// plane only fans into. Clipping to the guard band as well can take more,
+	// then binning runs again with the overflow slots it asked for.
+	reserveTriangles(m_triangleCount + 2 * triangleCount);
+	const int binTasks = (triangleCount + TRIANGLES_PER_TASK - 1) / TRIANGLES_PER_TASK;
+	reserveBins(m_binCount + binTasks);
+
+	BinContext ctx;
+	ctx.rasterizer = this;
+	ctx.vertices = &vertices;
+	ctx.indices = indices;
+	ctx.triangleCount = triangleCount;
+	ctx.firstTriangle = m_triangleCount;
+	ctx.firstOverflow = m_triangleCount + triangleCount;
+	ctx.overflowCapacity = triangleCount;
+	ctx.overflowCount = 0;
+	ctx.firstBin = m_binCount;
+	TaskPool::runOn(m_pool, binTask, &ctx, binTasks);
+	if (ctx.overflowCount > ctx.overflowCapacity)
+	{
+		ctx.overflowCapacity = (int)ctx.overflowCount;
+		ctx.overflowCount = 0;
+		reserveTriangles(ctx.firstOverflow + ctx.overflowCapacity);
+		TaskPool::runOn(m_pool, binTask, &ctx, binTasks);
+	}
+
+	m_triangleCount += triangleCount + (int)ctx.overflowCount;
+	m_binCount += binTasks;
+	m_stats.trianglesIn += triangleCount;
+	m_stats.binMs += timer.elapsedMs();
+}
+
+//--------------------------------------------------------------------------------------
+// Edge deltas below this keep RasterBlockEdges in 32 bits
+static const int32_t		MAX_SIMD_EDGE = 1 << 22;
+
+//--------------------------------------------------------------------------------------
+// LESSEQUAL or, when greater, GREATEREQUAL test of four aligned pixels inside
+// [0, 1], returns the written lanes
+static FORCE_INLINE int depthTest4(float* dst, __m128 z, __m128 mask, bool greater)
+{
+	const __m128 depth = _mm_load_ps(dst);
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(z, _mm_setzero_ps()));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(z, _mm_set1_ps(1.0f)));
+	mask = _mm_and_ps(mask, greater ? _mm_cmpge_ps(z, depth) : _mm_cmple_ps(z, depth));
+	_mm_store_ps(dst, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, depth)));
+	return _mm_movemask_ps(mask);
+}
+
+//--------------------------------------------------------------------------------------
+// Rows py0..py1 of the block at column bx as two 4x1 halves, lanes outside
+// [lane0, lane1] are masked. edges is NULL for a fully covered block.
+static FORCE_INLINE int rasterBlockSse2(DepthImage& target, int bx, int py0, int py1, int lane0, int lane1,
+	float zBlock, float dzdx, float dzdy, const RasterBlockEdges* edges, bool greater)
+{
+	const __m128i index0 = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i index1 = _mm_setr_epi32(4, 5, 6, 7);
+	const __m128i first = _mm_set1_epi32(lane0 - 1);
+	const __m128i last = _mm_set1_epi32(lane1 + 1);
+	const __m128 columns0 = _mm_castsi128_ps(_mm_and_si128(_mm_cmpgt_epi32(index0, first), _mm_cmplt_epi32(index0, last)));
+	const __m128 columns1 = _mm_castsi128_ps(_mm_and_si128(_mm_cmpgt_epi32(index1, first), _mm_cmplt_epi32(index1, last)));
+	const bool left = lane0 < 4;
+	const bool right = lane1 >= 4;
+	const __m128 z0 = _mm_mul_ps(_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f), _mm_set1_ps(dzdx));
+	const __m128 z1 = _mm_mul_ps(_mm_setr_ps(4.0f, 5.0f, 6.0f, 7.0f), _mm_set1_ps(dzdx));
+
+	__m128i e0[3];
+	__m128i e1[3];
+	__m128i stepY[3];
+	if (edges != NULL)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			const int32_t o = edges->origin[i];
+			const int32_t s = edges->stepX[i];
+			e0[i] = _mm_setr_epi32(o, o + s, o + 2 * s, o + 3 * s);
+			e1[i] = _mm_add_epi32(e0[i], _mm_set1_epi32(4 * s));
+			stepY[i] = _mm_set1_epi32(edges->stepY[i]);
+		}
+	}
+
+	int written = 0;
+	for (int y = py0; y <= py1; ++y)
+	{
+		float* row = target.row(y) + bx;
+		const __m128 zRow = _mm_set1_ps(zBlock + (y - py0) * dzdy);
+		__m128 mask0 = columns0;
+		__m128 mask1 = columns1;
+		if (edges != NULL)
+		{
+			const __m128i minusOne = _mm_set1_epi32(-1);
+			mask0 = _mm_and_ps(mask0, _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(e0[0], e0[1]), e0[2]), minusOne)));
+			mask1 = _mm_and_ps(mask1, _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_or_si128(_mm_or_si128(e1[0], e1[1]), e1[2]), minusOne)));
+			for (int i = 0; i < 3; ++i)
+			{
+				e0[i] = _mm_add_epi32(e0[i], stepY[i]);
+				e1[i] = _mm_add_epi32(e1[i], stepY[i]);
+			}
+		}
+		if (left && _mm_movemask_ps(mask0) != 0)
+		{
+			written += popCount(depthTest4(row, _mm_add_ps(zRow, z0), mask0, greater));
+		}
+		if (right && _mm_movemask_ps(mask1) != 0)
+		{
+			written += popCount(depthTest4(row + 4, _mm_add_ps(zRow, z1), mask1, greater));
+		}
+	}
+	return written;
+}
+
+//--------------------------------------------------------------------------------------
+void TiledRasterizer::rasterTask(void* context, int index)
+{
+	static_cast<TiledRasterizer*>(context)->rasterTile(index);
+}
+
+//--------------------------------------------------------------------------------------
+// Every triangle of the tile is classified against the tile, then per 8x8 block
+void TiledRasterizer::rasterTile(int tile)
+{
+	TileStats& stats = m_tileStats[tile];
+	memset(&stats, 0, sizeof(stats));
+	DepthImage& target = *m_target;
+	const int tileX0 = (tile % m_tilesX) * TILE_SIZE;
+	const int tileY0 = (tile / m_tilesX) * TILE_SIZE;
+	const int tileX1 = mini(tileX0 + TILE_SIZE, target.getWidth()) - 1;
+	const int tileY1 = mini(tileY0 + TILE_SIZE, target.getHeight()) - 1;
+	const bool greater = m_reversed;
+
+	for (uint32_t n = m_tileStart[tile]; n < m_tileStart[tile + 1]; ++n)
+	{
+		const Triangle& tri = m_triangles[m_tileTriangles[n]];
+		const int x0 = maxi(tileX0, tri.minX);
+		const int y0 = maxi(tileY0, tri.minY);
+		const int x1 = mini(tileX1, tri.maxX);
+		const int y1 = mini(tileY1, tri.maxY);
+
+		// Locals, so depth stores cannot alias the plane
+		const float z0 = tri.z0;
+		const float fx0 = tri.fx0;
+		const float fy0 = tri.fy0;
+		const float dzdx = tri.dzdx;
+		const float dzdy = tri.dzdy;
+
+		// Guard band sized edges keep the 64 bit scalar loops
+		bool simd = m_kernel != KERNEL_SCALAR;
+		for (int i = 0; i < 3 && simd; ++i)
+		{
+			const int j = i == 2 ? 0 : i + 1;
+			simd = abs(tri.x[j] - tri.x[i]) < MAX_SIMD_EDGE && abs(tri.y[j] - tri.y[i]) < MAX_SIMD_EDGE;
+		}
+
+		for (int by = y0 & ~(BLOCK_SIZE - 1); by <= y1; by += BLOCK_SIZE)
+		{
+			for (int bx = x0 & ~(BLOCK_SIZE - 1); bx <= x1; bx += BLOCK_SIZE)
+			{
+				const int px0 = maxi(bx, x0);
+				const int py0 = maxi(by, y0);
+				const int px1 = mini(bx + BLOCK_SIZE - 1, x1);
+				const int py1 = mini(by + BLOCK_SIZE - 1, y1);
+
+				RasterBlockEdges edges;
+				bool outside = false;
+				bool inside = true;
+				for (int i = 0; i < 3 && !outside; ++i)
+				{
+					int64_t minE, maxE;
+					edgeRange(tri.x, tri.y, tri.bias, i, px0, py0, px1, py1, minE, maxE);
+					outside = maxE < 0;
+					inside = inside && minE >= 0;
+					if (simd)
+					{
+						const int j = i == 2 ? 0 : i + 1;
+						const bool crossing = minE < 0;
+						edges.origin[i] = crossing ? (int32_t)edgeAt(tri.x, tri.y, tri.bias, i, bx, py0) : 0;
+						edges.stepX[i] = crossing ? -(tri.y[j] - tri.y[i]) * ONE : 0;
+						edges.stepY[i] = crossing ? (tri.x[j] - tri.x[i]) * ONE : 0;
+					}
+				}
+				if (outside)
+				{
+					++stats.blocksRejected;
+					continue;
+				}
+				if (inside)
+				{
+					++stats.blocksAccepted;
+				}
+				else
+				{
+					++stats.blocksPartial;
+				}
+
+				int written = 0;
+				if (simd)
+				{
+					const float zBlock = z0 + (bx - fx0) * dzdx + (py0 - fy0) * dzdy;
+					const RasterBlockEdges* blockEdges = inside ? NULL : &edges;
+					if (m_kernel == KERNEL_AVX2 && bx + BLOCK_SIZE <= target.getPitch())
+					{
+						written = rasterBlockAvx2(target.row(py0) + bx, target.getPitch(), py0, py1, px0 - bx, px1 - bx,
+							zBlock, dzdx, dzdy, blockEdges, greater);
+					}
+					else
+					{
+						written = rasterBlockSse2(target, bx, py0, py1, px0 - bx, px1 - bx, zBlock, dzdx, dzdy, blockEdges, greater);
+					}
+				}
+				else if (inside)
+				{
+					for (int y = py0; y <= py1; ++y)
+					{
+						float* row = target.row(y);
+						float z = z0 + (px0 - fx0) * dzdx + (y - fy0) * dzdy;
+						for (int x = px0; x <= px1; ++x, z += dzdx)
+						{
+							if (z >= 0.0f && z <= 1.0f && (greater ? z >= row[x] : z <= row[x]))
+							{
+								row[x] = z;
+								++written;
+							}
+						}
+					}
+				}
+				else
+				{
+					int64_t rowE[3];
+					int64_t stepX[3];
+					int64_t stepY[3];
+					for (int i = 0; i < 3; ++i)
+					{
+						const int j = i == 2 ? 0 : i + 1;
+						rowE[i] = edgeAt(tri.x, tri.y, tri.bias, i, px0, py0);
+						stepX[i] = -(int64_t)(tri.y[j] - tri.y[i]) * ONE;
+						stepY[i] = (int64_t)(tri.x[j] - tri.x[i]) * ONE;
+					}
+					for (int y = py0; y <= py1; ++y)
+					{
+						int64_t e0 = rowE[0];
+						int64_t e1 = rowE[1];
+						int64_t e2 = rowE[2];
+						float* row = target.row(y);
+						float z = z0 + (px0 - fx0) * dzdx + (y - fy0) * dzdy;
+						for (int x = px0; x <= px1; ++x)
+						{
+							if ((e0 | e1 | e2) >= 0 && z >= 0.0f && z <= 1.0f && (greater ? z >= row[x] : z <= row[x]))
+							{
+								row[x] = z;
+								++written;
+							}
+							e0 += stepX[0];
+							e1 += stepX[1];
+							e2 += stepX[2];
+							z += dzdx;
+						}
+						rowE[0] += stepY[0];
+						rowE[1] += stepY[1];
+						rowE[2] += stepY[2];
+					}
+				}
+				stats.pixelsWritten += written;
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Counting sort of every bin entry by tile, then one raster job per tile
+void TiledRasterizer::end()
+{
+	CpuTimer timer;
+	const int tileCount = m_tilesX * m_tilesY;
+	memset(m_tileStart, 0, (tileCount + 1) * sizeof(uint32_t));
+	int entryCount = 0;
+	for (int b = 0; b < m_binCount; ++b)
+	{
+		const Bin& bin = m_bins[b];
+		for (int i = 0; i < bin.count; ++i)
+		{
+			++m_tileStart[bin.entries[i].tile + 1];
+		}
+		entryCount += bin.count;
+		m_stats.trianglesRejected += bin.rejected;
+		m_stats.trianglesBackfacing += bin.backfacing;
+		m_stats.trianglesInside += bin.inside;
+		m_stats.trianglesGuardBand += bin.guardBand;
+		m_stats.trianglesNearClipped += bin.nearClipped;
+		m_stats.trianglesGuardClipped += bin.guardClipped;
+		m_stats.clippedTriangles += bin.clippedTriangles;
+		m_stats.trianglesCulled += bin.culled;
+		m_stats.tilesRejected += bin.tilesRejected;
+	}
+	for (int t = 0; t < tileCount; ++t)
+	{
+		m_tileStart[t + 1] += m_tileStart[t];
+	}
+	if (entryCount > m_tileTriangleCapacity)
+	{
+		delete[] m_tileTriangles;
+		m_tileTriangleCapacity = maxi(entryCount, m_tileTriangleCapacity * 2);
+		m_tileTriangles = new uint32_t[m_tileTriangleCapacity];
+	}
+
+	// Scatter with the start offsets as cursors, then shift them back
+	for (int b = 0; b < m_binCount; ++b)
+	{
+		const Bin& bin = m_bins[b];
+		for (int i = 0; i < bin.count; ++i)
+		{
+			m_tileTriangles[m_tileStart[bin.entries[i].tile]++] = bin.entries[i].triangle;
+		}
+	}
+	for (int t = tileCount; t > 0; --t)
+	{
+		m_tileStart[t] = m_tileStart[t - 1];
+	}
+	m_tileStart[0] = 0;
+	m_stats.binnedTriangles = entryCount;
+
+	TaskPool::runOn(m_pool, rasterTask, this, tileCount);
+
+	for (int t = 0; t < tileCount; ++t)
+	{
+		m_stats.blocksAccepted += m_tileStats[t].blocksAccepted;
+		m_stats.blocksPartial += m_tileStats[t].blocksPartial;
+		m_stats.blocksRejected += m_tileStats[t].blocksRejected;
+		m_stats.pixelsWritten += m_tileStats[t].pixelsWritten;
+	}
+	m_stats.rasterMs = timer.elapsedMs();
+}
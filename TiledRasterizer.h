@@ -0,0 +1,223 @@
+//-----------------------------------------------------------------------------
+// File: TiledRasterizer.h
+//
+// Sort-middle version of DepthRasterizer for large targets and many draws.
+// addMesh() transforms the vertices with a VertexPipeline, then sets up and
+// bins triangles into 64x64 pixel tiles, every binning task appending to its
+// own bin so no locks are taken. end()
+// gathers the bins per tile and rasterizes tiles as independent TaskPool
+// jobs. Inside a tile every triangle is classified against the tile and
+// then 8x8 blocks: rejected blocks are skipped, fully covered blocks only
+// interpolate and test depth, partial blocks evaluate the edge functions.
+// Blocks run as 4x1 SSE2 halves or, on CPUs with AVX2, as 8x1 rows with
+// 32 bit edges stepped incrementally and masked depth stores; the scalar
+// loops stay selectable for comparison. The AVX2 loop is in
+// TiledRasterizerAvx2.cpp and picked at run time.
+//
+// Before setup, triangles are rejected four at a time with SSE2 when all
+// their vertices share a clip code bit or when they face away. The rest relies
+// on the guard band: triangles within VertexPipeline::GUARD_BAND pixels go
+// straight to setup, whose pixel bounds and per pixel 0 <= z <= 1 test do the
+// clipping. Triangles crossing the near plane or the guard band are clipped to
+// them in clip space and fanned into up to six triangles.
+//
+// Coverage follows the same snapping, top-left rule and LESSEQUAL test, or
+// GREATEREQUAL for reverse-Z, as DepthRasterizer, so both write the same
+// pixels for triangles in front of the near plane and inside the guard band.
+// DepthRasterizer drops the ones crossing the near plane.
+//-----------------------------------------------------------------------------
+#ifndef TILED_RASTERIZER_H
+#define TILED_RASTERIZER_H
+
+#include "VertexPipeline.h"
+
+//--------------------------------------------------------------------------------------
+struct TiledRasterStats
+{
+	double					transformMs;		// vertex stage of every addMesh
+	double					binMs;				// setup and binning
+	double					rasterMs;			// gather and tile raster in end()
+	int						trianglesIn;
+	int						trianglesRejected;	// every vertex outside the same clip plane
+	int						trianglesBackfacing;	// batched facing test before setup
+	int						trianglesInside;	// set up unclipped, inside the viewport
+	int						trianglesGuardBand;	// set up unclipped, partly outside the viewport
+	int						trianglesNearClipped;	// crossing the near plane
+	int						trianglesGuardClipped;	// in front of it with a vertex beyond the guard band
+	int						clippedTriangles;	// what the clipped polygons fan into
+	int						trianglesCulled;	// refused by setup, degenerate or without samples
+	int						binnedTriangles;	// triangle and tile pairs
+	int						tilesRejected;		// tiles in a triangle's bounds outside its edges
+	int						blocksAccepted;		// fully covered, no edge tests
+	int						blocksPartial;
+	int						blocksRejected;
+	int						pixelsWritten;
+};
+
+//--------------------------------------------------------------------------------------
+// Edges crossing one 8x8 block relative to its first pixel. Within a crossed
+// block an edge changes by at most 16 steps, so with every |dx|, |dy| below
+// 2^22 subpixels the values fit in 32 bits. Edges not crossing it are zero.
+struct RasterBlockEdges
+{
+	int32_t					origin[3];
+	int32_t					stepX[3];
+	int32_t					stepY[3];
+};
+
+//--------------------------------------------------------------------------------------
+class TiledRasterizer
+{
+public:
+	static const int		TILE_SIZE = 64;
+	static const int		BLOCK_SIZE = 8;
+	static const int		TRIANGLES_PER_TASK = 256;
+
+	// Block loops, KERNEL_AVX2 needs a CPU with AVX2 and a compiler that could
+	// build TiledRasterizerAvx2.cpp for it
+	enum Kernel
+	{
+		KERNEL_SCALAR,
+		KERNEL_SSE2,
+		KERNEL_AVX2
+	};
+
+private:
+	// Snapped triangle in clockwise order with its depth plane
+	struct Triangle
+	{
+		int32_t				x[3];				// 1/16 pixel
+		int32_t				y[3];
+		int32_t				bias[3];			// 0 for top-left edges, -1 otherwise
+		int32_t				minX;				// pixel bounds inside the target
+		int32_t				minY;
+		int32_t				maxX;
+		int32_t				maxY;
+		float				z0;
+		float				fx0;
+		float				fy0;
+		float				dzdx;
+		float				dzdy;
+	};
+
+	struct BinEntry
+	{
+		uint32_t			tile;
+		uint32_t			triangle;
+	};
+
+	// Output of one binning task, kept across frames to reuse the memory
+	struct Bin
+	{
+		BinEntry*			entries;
+		int					count;
+		int					capacity;
+		int					rejected;
+		int					backfacing;
+		int					inside;
+		int					guardBand;
+		int					nearClipped;
+		int					guardClipped;
+		int					clippedTriangles;
+		int					culled;
+		int					tilesRejected;
+	};
+
+	struct TileStats
+	{
+		int					blocksAccepted;
+		int					blocksPartial;
+		int					blocksRejected;
+		int					pixelsWritten;
+	};
+
+	struct BinContext
+	{
+		TiledRasterizer*	rasterizer;
+		const VertexPipeline* vertices;
+		const uint32_t*		indices;
+		int					triangleCount;
+		int					firstTriangle;
+		int					firstOverflow;		// slots for the other triangles of clipped polygons
+		int					overflowCapacity;
+		volatile long		overflowCount;		// slots asked for, may pass overflowCapacity
+		int					firstBin;
+	};
+
+	TaskPool*				m_pool;
+	DepthImage*				m_target;
+	DepthRasterizer::CullMode m_cullMode;
+	Kernel					m_kernel;
+	int						m_sampleX;			// 1/16 pixel from the pixel center
+	int						m_sampleY;
+	bool					m_reversed;
+	VertexPipeline			m_vertices;			// addMesh() vertex stage
+	Triangle*				m_triangles;
+	int						m_triangleCount;
+	int						m_triangleCapacity;
+	Bin*					m_bins;
+	int						m_binCount;
+	int						m_binCapacity;
+	uint32_t*				m_tileStart;		// tileCount + 1 offsets into m_tileTriangles
+	uint32_t*				m_tileTriangles;
+	int						m_tileTriangleCapacity;
+	TileStats*				m_tileStats;
+	int						m_tilesX;
+	int						m_tilesY;
+	int						m_tileCapacity;
+	TiledRasterStats		m_stats;
+
+	TiledRasterizer(const TiledRasterizer&);
+	TiledRasterizer& operator=(const TiledRasterizer&);
+
+	static void			binTask(void* context, int index);
+	static void			rasterTask(void* context, int index);
+
+	// TiledRasterizerAvx2.cpp. Rows py0..py1 of the block at row, pitch
+	// floats apart, each row must hold 8 floats.
+	static bool			isAvx2Built();
+	static int			rasterBlockAvx2(float* row, int pitch, int py0, int py1, int lane0, int lane1,
+							float zBlock, float dzdx, float dzdy, const RasterBlockEdges* edges, bool greater);
+
+	void				reserveTriangles(int count);
+	void				reserveBins(int count);
+	bool				setupTriangle(const float* v0, const float* v1, const float* v2, Triangle& triangle) const;
+	void				binTriangle(const Triangle& triangle, uint32_t index, Bin& bin) const;
+	void				clipTriangle(BinContext& ctx, const uint32_t* indices, bool nearPlane, uint32_t index, Bin& bin);
+	void				rasterTile(int tile);
+public:
+
+	// pool may be NULL to run on the calling thread only
+	explicit TiledRasterizer(TaskPool* pool = NULL);
+	~TiledRasterizer();
+
+	void				setCullMode(DepthRasterizer::CullMode mode)	{ m_cullMode = mode; }
+
+	// Unsupported kernels fall back to KERNEL_SSE2, the default is the widest one
+	static bool			isKernelSupported(Kernel kernel);
+	void				setKernel(Kernel kernel);
+	Kernel				getKernel() const		{ return m_kernel; }
+
+	// Samples every pixel at x, y 1/16 pixels from its center instead, for the
+	// MSAA sample positions. Applies to the triangles of later addMesh() calls.
+	void				setSampleOffset(int x, int y)	{ m_sampleX = x; m_sampleY = y; }
+
+	// Reverse-Z tests GREATEREQUAL and clips at z = w, the vertices passed to
+	// addTriangles() must be transformed with the same setting
+	void				setReverseZ(bool reversed)	{ m_reversed = reversed; m_vertices.setReverseZ(reversed); }
+
+	// Starts a frame, target is cleared to farDepth() by the caller and written in end()
+	void				begin(DepthImage& target);
+	void				addMesh(const RasterMesh& mesh, const DepthMatrix& worldViewProj);
+
+	// Triangles of vertices the caller transformed for this target, every index
+	// must be transformed. vertices and indices are read before returning.
+	void				addTriangles(const VertexPipeline& vertices, const uint32_t* indices, int triangleCount);
+	void				end();
+
+	int					getTilesX() const		{ return m_tilesX; }
+	int					getTilesY() const		{ return m_tilesY; }
+	const TiledRasterStats& getStats() const	{ return m_stats; }
+};
+
+#endif // TILED_RASTERIZER_H
@@ -0,0 +1,91 @@
+//-----------------------------------------------------------------------------
+// File: TiledRasterizerAvx2.cpp
+//
+// The AVX2 block loop of TiledRasterizer. Built with /arch:AVX2 by MSVC and
+// with AVX2_TARGET functions by GCC and Clang, it only runs once
+// TiledRasterizer::isKernelSupported() has seen AVX2 on the CPU.
+//-----------------------------------------------------------------------------
+#include "TiledRasterizer.h"
+#if AVX2_BUILT
+#include <immintrin.h>
+#endif
+
+//--------------------------------------------------------------------------------------
+bool TiledRasterizer::isAvx2Built()
+{
+	return AVX2_BUILT != 0;
+}
+
+#if AVX2_BUILT
+//--------------------------------------------------------------------------------------
+// Local stand-in for popCount(), see AVX2_TARGET in Platform.h
+static FORCE_INLINE int countLanes(int mask)
+{
+	int count = 0;
+	for (; mask != 0; mask &= mask - 1)
+	{
+		++count;
+	}
+	return count;
+}
+
+//--------------------------------------------------------------------------------------
+// Same as rasterBlockSse2 in TiledRasterizer.cpp with one 8x1 row per step
+AVX2_TARGET int TiledRasterizer::rasterBlockAvx2(float* row, int pitch, int py0, int py1, int lane0, int lane1,
+	float zBlock, float dzdx, float dzdy, const RasterBlockEdges* edges, bool greater)
+{
+	const __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256 columns = _mm256_castsi256_ps(_mm256_and_si256(
+		_mm256_cmpgt_epi32(index, _mm256_set1_epi32(lane0 - 1)),
+		_mm256_cmpgt_epi32(_mm256_set1_epi32(lane1 + 1), index)));
+	const __m256 zLanes = _mm256_mul_ps(_mm256_cvtepi32_ps(index), _mm256_set1_ps(dzdx));
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	__m256i e[3];
+	__m256i stepY[3];
+	if (edges != NULL)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			e[i] = _mm256_add_epi32(_mm256_set1_epi32(edges->origin[i]),
+				_mm256_mullo_epi32(index, _mm256_set1_epi32(edges->stepX[i])));
+			stepY[i] = _mm256_set1_epi32(edges->stepY[i]);
+		}
+	}
+
+	int written = 0;
+	for (int y = py0; y <= py1; ++y, row += pitch)
+	{
+		__m256 mask = columns;
+		if (edges != NULL)
+		{
+			const __m256i inside = _mm256_cmpgt_epi32(_mm256_or_si256(_mm256_or_si256(e[0], e[1]), e[2]), _mm256_set1_epi32(-1));
+			mask = _mm256_and_ps(mask, _mm256_castsi256_ps(inside));
+			for (int i = 0; i < 3; ++i)
+			{
+				e[i] = _mm256_add_epi32(e[i], stepY[i]);
+			}
+		}
+		if (_mm256_movemask_ps(mask) == 0)
+		{
+			continue;
+		}
+		const __m256 z = _mm256_add_ps(_mm256_set1_ps(zBlock + (y - py0) * dzdy), zLanes);
+		const __m256 depth = _mm256_loadu_ps(row);
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(z, zero, _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(z, one, _CMP_LE_OQ));
+		mask = _mm256_and_ps(mask, greater ? _mm256_cmp_ps(z, depth, _CMP_GE_OQ) : _mm256_cmp_ps(z, depth, _CMP_LE_OQ));
+		_mm256_storeu_ps(row, _mm256_blendv_ps(depth, z, mask));
+		written += countLanes(_mm256_movemask_ps(mask));
+	}
+	return written;
+}
+#else
+//--------------------------------------------------------------------------------------
+// Never called, isKernelSupported() refuses KERNEL_AVX2
+int TiledRasterizer::rasterBlockAvx2(float*, int, int, int, int, int, float, float, float, const RasterBlockEdges*, bool)
+{
+	return 0;
+}
+#endif
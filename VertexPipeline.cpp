@@ -0,0 +1,294 @@
+//-----------------------------------------------------------------------------
+// File: VertexPipeline.cpp
+//-----------------------------------------------------------------------------
+#include "VertexPipeline.h"
+
+static const int			STREAM_COUNT = 7;
+
+//--------------------------------------------------------------------------------------
+// One byte of clip code bits per lane, reverse-Z puts the near plane at z = w
+static FORCE_INLINE __m128i clipCodes4(__m128 x, __m128 y, __m128 z, __m128 w, bool reversed)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 negW = _mm_sub_ps(zero, w);
+	__m128i codes = _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(x, negW)), _mm_set1_epi32(VertexPipeline::CLIP_LEFT));
+	codes = _mm_or_si128(codes, _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(x, w)), _mm_set1_epi32(VertexPipeline::CLIP_RIGHT)));
+	codes = _mm_or_si128(codes, _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(y, negW)), _mm_set1_epi32(VertexPipeline::CLIP_BOTTOM)));
+	codes = _mm_or_si128(codes, _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(y, w)), _mm_set1_epi32(VertexPipeline::CLIP_TOP)));
+	const __m128 belowZero = _mm_cmplt_ps(z, zero);
+	const __m128 aboveW = _mm_cmpgt_ps(z, w);
+	const __m128 behind = _mm_or_ps(reversed ? aboveW : belowZero, _mm_cmple_ps(w, zero));
+	codes = _mm_or_si128(codes, _mm_and_si128(_mm_castps_si128(behind), _mm_set1_epi32(VertexPipeline::CLIP_NEAR)));
+	return _mm_or_si128(codes, _mm_and_si128(_mm_castps_si128(reversed ? belowZero : aboveW), _mm_set1_epi32(VertexPipeline::CLIP_FAR)));
+}
+
+//--------------------------------------------------------------------------------------
+// CLIP_GUARD of four screen positions
+static FORCE_INLINE __m128i guardCodes4(__m128 screenX, __m128 screenY)
+{
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 guard = _mm_set1_ps((float)VertexPipeline::GUARD_BAND);
+	const __m128 outside = _mm_or_ps(_mm_cmpgt_ps(_mm_and_ps(screenX, absMask), guard), _mm_cmpgt_ps(_mm_and_ps(screenY, absMask), guard));
+	return _mm_and_si128(_mm_castps_si128(outside), _mm_set1_epi32(VertexPipeline::CLIP_GUARD));
+}
+
+//--------------------------------------------------------------------------------------
+static FORCE_INLINE void storeClipCodes8(uint8_t* dst, __m128i low, __m128i high)
+{
+	const __m128i words = _mm_packs_epi32(low, high);
+	_mm_storel_epi64((__m128i*)dst, _mm_packus_epi16(words, words));
+}
+
+//--------------------------------------------------------------------------------------
+VertexPipeline::VertexPipeline(TaskPool* pool)
+	: m_pool( pool )
+	, m_source( NULL )
+	, m_sourceStride( 0 )
+	, m_streams( NULL )
+	, m_x( NULL )
+	, m_y( NULL )
+	, m_z( NULL )
+	, m_screenX( NULL )
+	, m_screenY( NULL )
+	, m_screenZ( NULL )
+	, m_clipW( NULL )
+	, m_clipCodes( NULL )
+	, m_groupStamps( NULL )
+	, m_stamp( 0 )
+	, m_vertexCount( 0 )
+	, m_groupCount( 0 )
+	, m_groupCapacity( 0 )
+	, m_halfWidth( 0.0f )
+	, m_halfHeight( 0.0f )
+	, m_reversed( false )
+	, m_avx2( isAvx2Built() && cpuSupportsAvx2() )
+{
+	memset(&m_matrix, 0, sizeof(m_matrix));
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+VertexPipeline::~VertexPipeline()
+{
+	alignedFree(m_streams);
+	delete[] m_clipCodes;
+	delete[] m_groupStamps;
+}
+
+//--------------------------------------------------------------------------------------
+void VertexPipeline::clear()
+{
+	m_source = NULL;
+	m_vertexCount = 0;
+	m_groupCount = 0;
+}
+
+//--------------------------------------------------------------------------------------
+void VertexPipeline::setMesh(const RasterMesh& mesh)
+{
+	if (mesh.positions == m_source && mesh.stride == m_sourceStride && mesh.vertexCount == m_vertexCount)
+	{
+		return;
+	}
+
+	const int groupCount = (mesh.vertexCount + GROUP_SIZE - 1) / GROUP_SIZE;
+	if (groupCount > m_groupCapacity)
+	{
+		alignedFree(m_streams);
+		delete[] m_clipCodes;
+		delete[] m_groupStamps;
+		m_groupCapacity = groupCount;
+		const int capacity = m_groupCapacity * GROUP_SIZE;
+		m_streams = (float*)alignedAlloc(sizeof(float) * STREAM_COUNT * capacity, 32);
+		m_x = m_streams;
+		m_y = m_x + capacity;
+		m_z = m_y + capacity;
+		m_screenX = m_z + capacity;
+		m_screenY = m_screenX + capacity;
+		m_screenZ = m_screenY + capacity;
+		m_clipW = m_screenZ + capacity;
+		m_clipCodes = new uint8_t[capacity];
+		m_groupStamps = new uint32_t[m_groupCapacity];
+	}
+
+	m_source = mesh.positions;
+	m_sourceStride = mesh.stride;
+	m_vertexCount = mesh.vertexCount;
+	m_groupCount = groupCount;
+	for (int i = 0; i < m_vertexCount; ++i)
+	{
+		const float* p = mesh.positions + i * mesh.stride;
+		m_x[i] = p[0];
+		m_y[i] = p[1];
+		m_z[i] = p[2];
+	}
+
+	// The padding of the last group transforms like the origin
+	for (int i = m_vertexCount; i < m_groupCount * GROUP_SIZE; ++i)
+	{
+		m_x[i] = 0.0f;
+		m_y[i] = 0.0f;
+		m_z[i] = 0.0f;
+	}
+	memset(m_groupStamps, 0, m_groupCount * sizeof(uint32_t));
+	m_stamp = 0;
+}
+
+//--------------------------------------------------------------------------------------
+void VertexPipeline::begin(const DepthMatrix& worldViewProj, int width, int height)
+{
+	m_matrix = worldViewProj;
+	m_halfWidth = width * 0.5f;
+	m_halfHeight = height * 0.5f;
+	if (++m_stamp == 0)
+	{
+		memset(m_groupStamps, 0, m_groupCount * sizeof(uint32_t));
+		m_stamp = 1;
+	}
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//--------------------------------------------------------------------------------------
+// Same operations in the same order as DepthRasterizer::transform, so both
+// produce the same screen positions
+void VertexPipeline::transformGroups(int first, int last)
+{
+	if (m_avx2)
+	{
+		transformGroupsAvx2(first, last);
+		return;
+	}
+
+	const DepthMatrix& m = m_matrix;
+	const __m128 m00 = _mm_set1_ps(m.m[0][0]), m10 = _mm_set1_ps(m.m[1][0]), m20 = _mm_set1_ps(m.m[2][0]), m30 = _mm_set1_ps(m.m[3][0]);
+	const __m128 m01 = _mm_set1_ps(m.m[0][1]), m11 = _mm_set1_ps(m.m[1][1]), m21 = _mm_set1_ps(m.m[2][1]), m31 = _mm_set1_ps(m.m[3][1]);
+	const __m128 m02 = _mm_set1_ps(m.m[0][2]), m12 = _mm_set1_ps(m.m[1][2]), m22 = _mm_set1_ps(m.m[2][2]), m32 = _mm_set1_ps(m.m[3][2]);
+	const __m128 m03 = _mm_set1_ps(m.m[0][3]), m13 = _mm_set1_ps(m.m[1][3]), m23 = _mm_set1_ps(m.m[2][3]), m33 = _mm_set1_ps(m.m[3][3]);
+	const __m128 halfWidth = _mm_set1_ps(m_halfWidth);
+	const __m128 halfHeight = _mm_set1_ps(m_halfHeight);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	for (int group = first; group < last; ++group)
+	{
+		__m128i codes[2];
+		for (int half = 0; half < 2; ++half)
+		{
+			const int i = group * GROUP_SIZE + half * 4;
+			const __m128 px = _mm_load_ps(m_x + i);
+			const __m128 py = _mm_load_ps(m_y + i);
+			const __m128 pz = _mm_load_ps(m_z + i);
+			const __m128 x = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m00), _mm_mul_ps(py, m10)), _mm_mul_ps(pz, m20)), m30);
+			const __m128 y = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m01), _mm_mul_ps(py, m11)), _mm_mul_ps(pz, m21)), m31);
+			const __m128 z = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m02), _mm_mul_ps(py, m12)), _mm_mul_ps(pz, m22)), m32);
+			const __m128 w = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m03), _mm_mul_ps(py, m13)), _mm_mul_ps(pz, m23)), m33);
+
+			const __m128 invW = _mm_and_ps(_mm_cmpgt_ps(w, zero), _mm_div_ps(one, w));
+			const __m128 screenX = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(x, invW), one), halfWidth);
+			const __m128 screenY = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(y, invW)), halfHeight);
+			_mm_store_ps(m_screenX + i, screenX);
+			_mm_store_ps(m_screenY + i, screenY);
+			_mm_store_ps(m_screenZ + i, _mm_mul_ps(z, invW));
+			_mm_store_ps(m_clipW + i, w);
+			codes[half] = _mm_or_si128(clipCodes4(x, y, z, w, m_reversed), guardCodes4(screenX, screenY));
+		}
+		storeClipCodes8(m_clipCodes + group * GROUP_SIZE, codes[0], codes[1]);
+		m_groupStamps[group] = m_stamp;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void VertexPipeline::transformTask(void* context, int index)
+{
+	VertexPipeline& self = *static_cast<VertexPipeline*>(context);
+	const int first = index * GROUPS_PER_TASK;
+	self.transformGroups(first, mini(first + GROUPS_PER_TASK, self.m_groupCount));
+}
+
+//--------------------------------------------------------------------------------------
+void VertexPipeline::transformAll()
+{
+	CpuTimer timer;
+	const int taskCount = (m_groupCount + GROUPS_PER_TASK - 1) / GROUPS_PER_TASK;
+	if (m_pool != NULL && taskCount > 1)
+	{
+		m_pool->run(transformTask, this, taskCount);
+	}
+	else
+	{
+		transformGroups(0, m_groupCount);
+	}
+	m_stats.verticesTransformed += m_groupCount * GROUP_SIZE;
+	m_stats.transformMs += timer.elapsedMs();
+}
+
+//--------------------------------------------------------------------------------------
+// Runs on the calling thread, the stamps are not shared
+void VertexPipeline::transformIndexed(const uint32_t* indices, int indexCount)
+{
+	CpuTimer timer;
+	int misses = 0;
+	for (int i = 0; i < indexCount; ++i)
+	{
+		const int group = (int)(indices[i] / GROUP_SIZE);
+		if (m_groupStamps[group] != m_stamp)
+		{
+			transformGroups(group, group + 1);
+			++misses;
+		}
+	}
+	m_stats.cacheLookups += indexCount;
+	m_stats.cacheHits += indexCount - misses;
+	m_stats.verticesTransformed += misses * GROUP_SIZE;
+	m_stats.transformMs += timer.elapsedMs();
+}
+
+//--------------------------------------------------------------------------------------
+void VertexPipeline::getClipPosition(uint32_t vertex, float* clip) const
+{
+	const DepthMatrix& m = m_matrix;
+	const float x = m_x[vertex];
+	const float y = m_y[vertex];
+	const float z = m_z[vertex];
+	for (int i = 0; i < 4; ++i)
+	{
+		clip[i] = x * m.m[0][i] + y * m.m[1][i] + z * m.m[2][i] + m.m[3][i];
+	}
+}
+
+//--------------------------------------------------------------------------------------
+void VertexPipeline::toScreen(const float* clip, float* screen) const
+{
+	const float invW = 1.0f / clip[3];
+	screen[0] = (clip[0] * invW + 1.0f) * m_halfWidth;
+	screen[1] = (1.0f - clip[1] * invW) * m_halfHeight;
+	screen[2] = clip[2] * invW;
+}
+
+//--------------------------------------------------------------------------------------
+// (x / w + 1) * halfWidth >= -GUARD_BAND and <= GUARD_BAND, the same for
+// (1 - y / w) * halfHeight
+void VertexPipeline::getGuardPlanes(float planes[4][4]) const
+{
+	const float guardX = (float)GUARD_BAND / m_halfWidth;
+	const float guardY = (float)GUARD_BAND / m_halfHeight;
+	const float sides[4][4] =
+	{
+		{ 1.0f, 0.0f, 0.0f, guardX + 1.0f },
+		{ -1.0f, 0.0f, 0.0f, guardX - 1.0f },
+		{ 0.0f, -1.0f, 0.0f, guardY + 1.0f },
+		{ 0.0f, 1.0f, 0.0f, guardY - 1.0f },
+	};
+	memcpy(planes, sides, sizeof(sides));
+}
+
+//--------------------------------------------------------------------------------------
+void VertexPipeline::writeTransformed(float* dst, int stride) const
+{
+	for (int i = 0; i < m_vertexCount; ++i, dst += stride)
+	{
+		dst[0] = m_screenX[i];
+		dst[1] = m_screenY[i];
+		dst[2] = m_screenZ[i];
+		dst[3] = m_clipW[i] > 0.0f ? 1.0f / m_clipW[i] : 0.0f;
+	}
+}
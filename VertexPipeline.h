@@ -0,0 +1,134 @@
+//-----------------------------------------------------------------------------
+// File: VertexPipeline.h
+//
+// Vertex stage of the CPU depth path, in place of the runtime's software
+// vertex processing. Positions are kept as separate x, y and z streams and
+// transformed eight vertices at a time (two SSE2 halves, or one AVX2 step
+// on CPUs with AVX2, see VertexPipelineAvx2.cpp) into D3D9 screen space plus
+// clip codes.
+//
+// The outputs form a post-transform cache indexed by vertex id. Either every
+// vertex is transformed at once, or transformIndexed() transforms only the
+// groups of eight the given indices touch, each at most once per begin().
+//
+// Outputs also fill D3DFVF_XYZRHW vertex buffers. Pre-transformed vertices
+// skip clipping, so triangles with CLIP_NEAR vertices must not be drawn.
+//-----------------------------------------------------------------------------
+#ifndef VERTEX_PIPELINE_H
+#define VERTEX_PIPELINE_H
+
+#include "DepthRasterizer.h"
+#include "TaskPool.h"
+
+//--------------------------------------------------------------------------------------
+struct VertexStats
+{
+	double					transformMs;		// since begin()
+	int						verticesTransformed;	// whole groups, padding included
+	int						cacheLookups;		// indices passed to transformIndexed()
+	int						cacheHits;
+};
+
+//--------------------------------------------------------------------------------------
+class VertexPipeline
+{
+public:
+	static const int		GROUP_SIZE = 8;
+	static const int		GROUPS_PER_TASK = 128;
+	static const int		GUARD_BAND = 1 << 20;	// pixels from the origin
+
+	// Outside the D3D clip volume -w <= x, y <= w, 0 <= z <= w. CLIP_NEAR also
+	// marks w <= 0, those vertices have no screen position. With reverse-Z
+	// CLIP_NEAR is z > w and CLIP_FAR z < 0. CLIP_GUARD marks screen positions
+	// beyond GUARD_BAND pixels in x or y, rasterizers clip those first.
+	enum ClipCode
+	{
+		CLIP_LEFT = 1,
+		CLIP_RIGHT = 2,
+		CLIP_BOTTOM = 4,
+		CLIP_TOP = 8,
+		CLIP_NEAR = 16,
+		CLIP_FAR = 32,
+		CLIP_GUARD = 64
+	};
+
+private:
+	TaskPool*				m_pool;
+	const float*			m_source;			// positions the streams were filled from
+	int						m_sourceStride;
+	float*					m_streams;			// one allocation for the streams below
+	float*					m_x;
+	float*					m_y;
+	float*					m_z;
+	float*					m_screenX;			// pixels, pixel centers at integers
+	float*					m_screenY;
+	float*					m_screenZ;			// z / w
+	float*					m_clipW;
+	uint8_t*				m_clipCodes;
+	uint32_t*				m_groupStamps;
+	uint32_t				m_stamp;
+	int						m_vertexCount;
+	int						m_groupCount;
+	int						m_groupCapacity;
+	DepthMatrix				m_matrix;
+	float					m_halfWidth;
+	float					m_halfHeight;
+	bool					m_reversed;
+	bool					m_avx2;				// transformGroupsAvx2() runs on this CPU
+	VertexStats				m_stats;
+
+	VertexPipeline(const VertexPipeline&);
+	VertexPipeline& operator=(const VertexPipeline&);
+
+	static void			transformTask(void* context, int index);
+
+	static bool			isAvx2Built();
+
+	void				transformGroups(int first, int last);
+	void				transformGroupsAvx2(int first, int last);
+public:
+
+	// pool may be NULL to run on the calling thread only
+	explicit VertexPipeline(TaskPool* pool = NULL);
+	~VertexPipeline();
+
+	// Copies the positions into the streams. Skipped when the mesh is the one
+	// already loaded, call clear() first after editing positions in place.
+	void				setMesh(const RasterMesh& mesh);
+	void				clear();
+
+	// Which clip plane is the near one, applies from the next begin()
+	void				setReverseZ(bool reversed)	{ m_reversed = reversed; }
+	bool				isReverseZ() const			{ return m_reversed; }
+
+	// Starts a frame, every cached vertex becomes stale
+	void				begin(const DepthMatrix& worldViewProj, int width, int height);
+	void				transformAll();
+	void				transformIndexed(const uint32_t* indices, int indexCount);
+
+	bool				isTransformed(uint32_t vertex) const	{ return m_groupStamps[vertex / GROUP_SIZE] == m_stamp; }
+
+	// x, y, z, rhw at the start of every stride floats, D3DFVF_XYZRHW order.
+	// Every vertex must be transformed.
+	void				writeTransformed(float* dst, int stride) const;
+
+	// Clip space x, y, z, w of one vertex, recomputed for the few triangles
+	// that need clipping, and the screen position of a clip space point with
+	// w > 0. Same operations as the transform.
+	void				getClipPosition(uint32_t vertex, float* clip) const;
+	void				toScreen(const float* clip, float* screen) const;
+
+	// Clip space planes of the guard band sides as a, b, c, d of
+	// a x + b y + c z + d w >= 0 inside, for points with w > 0
+	void				getGuardPlanes(float planes[4][4]) const;
+
+	const float*		getScreenX() const			{ return m_screenX; }
+	const float*		getScreenY() const			{ return m_screenY; }
+	const float*		getScreenZ() const			{ return m_screenZ; }
+	const float*		getClipW() const			{ return m_clipW; }
+	const uint8_t*		getClipCodes() const		{ return m_clipCodes; }
+	int					getVertexCount() const		{ return m_vertexCount; }
+	const VertexStats&	getStats() const			{ return m_stats; }
+};
+
+#endif // VERTEX_PIPELINE_H
@@ -0,0 +1,91 @@
+//-----------------------------------------------------------------------------
+// File: VertexPipelineAvx2.cpp
+//
+// The AVX2 transform of VertexPipeline, built like TiledRasterizerAvx2.cpp.
+// Only called when the constructor found AVX2 on the CPU.
+//-----------------------------------------------------------------------------
+#include "VertexPipeline.h"
+#if AVX2_BUILT
+#include <immintrin.h>
+#endif
+
+//--------------------------------------------------------------------------------------
+bool VertexPipeline::isAvx2Built()
+{
+	return AVX2_BUILT != 0;
+}
+
+#if AVX2_BUILT
+//--------------------------------------------------------------------------------------
+// clipCodes4 of VertexPipeline.cpp over eight lanes
+static FORCE_INLINE AVX2_TARGET __m256i clipCodes8(__m256 x, __m256 y, __m256 z, __m256 w, bool reversed)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 negW = _mm256_sub_ps(zero, w);
+	__m256i codes = _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(x, negW, _CMP_LT_OQ)), _mm256_set1_epi32(VertexPipeline::CLIP_LEFT));
+	codes = _mm256_or_si256(codes, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(x, w, _CMP_GT_OQ)), _mm256_set1_epi32(VertexPipeline::CLIP_RIGHT)));
+	codes = _mm256_or_si256(codes, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(y, negW, _CMP_LT_OQ)), _mm256_set1_epi32(VertexPipeline::CLIP_BOTTOM)));
+	codes = _mm256_or_si256(codes, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(y, w, _CMP_GT_OQ)), _mm256_set1_epi32(VertexPipeline::CLIP_TOP)));
+	const __m256 belowZero = _mm256_cmp_ps(z, zero, _CMP_LT_OQ);
+	const __m256 aboveW = _mm256_cmp_ps(z, w, _CMP_GT_OQ);
+	const __m256 behind = _mm256_or_ps(reversed ? aboveW : belowZero, _mm256_cmp_ps(w, zero, _CMP_LE_OQ));
+	codes = _mm256_or_si256(codes, _mm256_and_si256(_mm256_castps_si256(behind), _mm256_set1_epi32(VertexPipeline::CLIP_NEAR)));
+	return _mm256_or_si256(codes, _mm256_and_si256(_mm256_castps_si256(reversed ? belowZero : aboveW), _mm256_set1_epi32(VertexPipeline::CLIP_FAR)));
+}
+
+//--------------------------------------------------------------------------------------
+// guardCodes4 of VertexPipeline.cpp over eight lanes
+static FORCE_INLINE AVX2_TARGET __m256i guardCodes8(__m256 screenX, __m256 screenY)
+{
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 guard = _mm256_set1_ps((float)VertexPipeline::GUARD_BAND);
+	const __m256 outside = _mm256_or_ps(_mm256_cmp_ps(_mm256_and_ps(screenX, absMask), guard, _CMP_GT_OQ),
+		_mm256_cmp_ps(_mm256_and_ps(screenY, absMask), guard, _CMP_GT_OQ));
+	return _mm256_and_si256(_mm256_castps_si256(outside), _mm256_set1_epi32(VertexPipeline::CLIP_GUARD));
+}
+
+//--------------------------------------------------------------------------------------
+// Same as transformGroups in VertexPipeline.cpp with one 8-wide step per group
+AVX2_TARGET void VertexPipeline::transformGroupsAvx2(int first, int last)
+{
+	const DepthMatrix& m = m_matrix;
+	const __m256 m00 = _mm256_set1_ps(m.m[0][0]), m10 = _mm256_set1_ps(m.m[1][0]), m20 = _mm256_set1_ps(m.m[2][0]), m30 = _mm256_set1_ps(m.m[3][0]);
+	const __m256 m01 = _mm256_set1_ps(m.m[0][1]), m11 = _mm256_set1_ps(m.m[1][1]), m21 = _mm256_set1_ps(m.m[2][1]), m31 = _mm256_set1_ps(m.m[3][1]);
+	const __m256 m02 = _mm256_set1_ps(m.m[0][2]), m12 = _mm256_set1_ps(m.m[1][2]), m22 = _mm256_set1_ps(m.m[2][2]), m32 = _mm256_set1_ps(m.m[3][2]);
+	const __m256 m03 = _mm256_set1_ps(m.m[0][3]), m13 = _mm256_set1_ps(m.m[1][3]), m23 = _mm256_set1_ps(m.m[2][3]), m33 = _mm256_set1_ps(m.m[3][3]);
+	const __m256 halfWidth = _mm256_set1_ps(m_halfWidth);
+	const __m256 halfHeight = _mm256_set1_ps(m_halfHeight);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	for (int group = first; group < last; ++group)
+	{
+		const int i = group * GROUP_SIZE;
+		const __m256 px = _mm256_load_ps(m_x + i);
+		const __m256 py = _mm256_load_ps(m_y + i);
+		const __m256 pz = _mm256_load_ps(m_z + i);
+		const __m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m00), _mm256_mul_ps(py, m10)), _mm256_mul_ps(pz, m20)), m30);
+		const __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m01), _mm256_mul_ps(py, m11)), _mm256_mul_ps(pz, m21)), m31);
+		const __m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m02), _mm256_mul_ps(py, m12)), _mm256_mul_ps(pz, m22)), m32);
+		const __m256 w = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m03), _mm256_mul_ps(py, m13)), _mm256_mul_ps(pz, m23)), m33);
+
+		const __m256 invW = _mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_GT_OQ), _mm256_div_ps(one, w));
+		const __m256 screenX = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(x, invW), one), halfWidth);
+		const __m256 screenY = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(y, invW)), halfHeight);
+		_mm256_store_ps(m_screenX + i, screenX);
+		_mm256_store_ps(m_screenY + i, screenY);
+		_mm256_store_ps(m_screenZ + i, _mm256_mul_ps(z, invW));
+		_mm256_store_ps(m_clipW + i, w);
+
+		const __m256i codes = _mm256_or_si256(clipCodes8(x, y, z, w, m_reversed), guardCodes8(screenX, screenY));
+		const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(codes), _mm256_extracti128_si256(codes, 1));
+		_mm_storel_epi64((__m128i*)(m_clipCodes + i), _mm_packus_epi16(words, words));
+		m_groupStamps[group] = m_stamp;
+	}
+}
+#else
+//--------------------------------------------------------------------------------------
+// Never called, m_avx2 stays false
+void VertexPipeline::transformGroupsAvx2(int, int)
+{
+}
+#endif
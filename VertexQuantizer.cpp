@@ -0,0 +1,467 @@
+//-----------------------------------------------------------------------------
+// File: VertexQuantizer.cpp
+//-----------------------------------------------------------------------------
+#include "VertexQuantizer.h"
+#include <math.h>
+#include <string.h>
+
+static const int			SHORT_LEVELS = 32767;
+static const int			OCT8_LEVELS = 127;
+static const int			OCT8_PACK_BIAS = 32512;		// 127 + 255 * 127, the packed zero normal
+static const int			POSITION14_LEVELS = 8191;
+static const int			TEXCOORD11_LEVELS = 1023;
+static const int			WORD_BIAS = 32768;			// SHORT4 value of the packed word 0
+
+//--------------------------------------------------------------------------------------
+// Round to nearest even. Magnitudes past the largest half clamp to it, texture
+// coordinates have no use for infinity.
+static uint16_t floatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	const uint32_t sign = (bits >> 16) & 0x8000;
+	const int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+	if (((bits >> 23) & 0xFF) == 0xFF)
+	{
+		return (uint16_t)(sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0));
+	}
+	if (exponent <= 0)
+	{
+		// Denormal half, the implicit bit shifted in
+		if (exponent < -10)
+		{
+			return (uint16_t)sign;
+		}
+		mantissa |= 0x800000;
+		const int shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		const uint32_t rest = mantissa & ((1u << shift) - 1);
+		const uint32_t halfway = 1u << (shift - 1);
+		half += rest > halfway || (rest == halfway && (half & 1) != 0);
+		return (uint16_t)(sign | half);
+	}
+	uint32_t half = exponent >= 31 ? 0x7C00 : ((uint32_t)exponent << 10) | (mantissa >> 13);
+	const uint32_t rest = mantissa & 0x1FFF;
+	half += exponent < 31 && (rest > 0x1000 || (rest == 0x1000 && (half & 1) != 0));
+	return (uint16_t)(sign | (half >= 0x7C00 ? 0x7BFF : half));
+}
+
+//--------------------------------------------------------------------------------------
+static float halfToFloat(uint16_t half)
+{
+	const uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+	const int exponent = (half >> 10) & 0x1F;
+	const uint32_t mantissa = half & 0x3FF;
+	uint32_t bits;
+	if (exponent == 0)
+	{
+		const float value = mantissa * (1.0f / 16777216.0f);
+		return sign != 0 ? -value : value;
+	}
+	if (exponent == 31)
+	{
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	}
+	else
+	{
+		bits = sign | ((uint32_t)(exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+//--------------------------------------------------------------------------------------
+// Unit normal from octahedral u, v in [-1, 1], as DecodeOctahedral() in the effect
+static void decodeOctahedral(float u, float v, float* normal)
+{
+	float x = u;
+	float y = v;
+	const float z = 1.0f - fabsf(u) - fabsf(v);
+	const float t = z < 0.0f ? -z : 0.0f;
+	x += x >= 0.0f ? -t : t;
+	y += y >= 0.0f ? -t : t;
+	const float length = sqrtf(x * x + y * y + z * z);
+	normal[0] = x / length;
+	normal[1] = y / length;
+	normal[2] = z / length;
+}
+
+//--------------------------------------------------------------------------------------
+// u, v in -levels to levels, of the four roundings the one decoding closest
+static void encodeOctahedral(const float* normal, int levels, int& qu, int& qv)
+{
+	const float sum = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+	float u = sum > 0.0f ? normal[0] / sum : 0.0f;
+	float v = sum > 0.0f ? normal[1] / sum : 0.0f;
+	if (normal[2] < 0.0f)
+	{
+		const float foldedU = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+		const float foldedV = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+		u = foldedU;
+		v = foldedV;
+	}
+	const int baseU = (int)floorf(u * levels);
+	const int baseV = (int)floorf(v * levels);
+	float bestDot = -2.0f;
+	qu = 0;
+	qv = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		const int cu = baseU + (i & 1) < levels ? baseU + (i & 1) : levels;
+		const int cv = baseV + (i >> 1) < levels ? baseV + (i >> 1) : levels;
+		float decoded[3];
+		decodeOctahedral(cu / (float)levels, cv / (float)levels, decoded);
+		const float dot = decoded[0] * normal[0] + decoded[1] * normal[1] + decoded[2] * normal[2];
+		if (dot > bestDot)
+		{
+			bestDot = dot;
+			qu = cu;
+			qv = cv;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+static int16_t quantizeSnorm16(double value)
+{
+	const double scaled = value * SHORT_LEVELS;
+	const int rounded = (int)(scaled >= 0.0 ? scaled + 0.5 : scaled - 0.5);
+	return (int16_t)(rounded < -SHORT_LEVELS ? -SHORT_LEVELS : rounded > SHORT_LEVELS ? SHORT_LEVELS : rounded);
+}
+
+//--------------------------------------------------------------------------------------
+// value in [-1, 1] to 0 .. 2 levels, the center at levels
+static int quantizeBiased(double value, int levels)
+{
+	const int rounded = (int)(value * levels + levels + 0.5);
+	return rounded < 0 ? 0 : rounded > 2 * levels ? 2 * levels : rounded;
+}
+
+//--------------------------------------------------------------------------------------
+// Center and half extent of component a over vertices first to end, a scale of
+// 1 where they are all the same
+static void findBounds(const float* values, int components, int a, int first, int end, float& offset, float& scale)
+{
+	float lowest = first < end ? values[first * components + a] : 0.0f;
+	float highest = lowest;
+	for (int v = first + 1; v < end; ++v)
+	{
+		const float value = values[v * components + a];
+		lowest = value < lowest ? value : lowest;
+		highest = value > highest ? value : highest;
+	}
+	offset = (lowest + highest) * 0.5f;
+	scale = highest > lowest ? (highest - lowest) * 0.5f : 1.0f;
+}
+
+//--------------------------------------------------------------------------------------
+static double angleDegrees(const float* a, const float* b)
+{
+	const double lengths = sqrt(((double)a[0] * a[0] + (double)a[1] * a[1] + (double)a[2] * a[2]) *
+		((double)b[0] * b[0] + (double)b[1] * b[1] + (double)b[2] * b[2]));
+	if (lengths <= 0.0)
+	{
+		return 0.0;
+	}
+	double cosine = ((double)a[0] * b[0] + (double)a[1] * b[1] + (double)a[2] * b[2]) / lengths;
+	cosine = cosine > 1.0 ? 1.0 : cosine < -1.0 ? -1.0 : cosine;
+	return acos(cosine) * (180.0 / 3.14159265358979);
+}
+
+//--------------------------------------------------------------------------------------
+VertexQuantizer::VertexQuantizer()
+	: m_vertices( NULL )
+	, m_vertexCount( 0 )
+	, m_stride( 0 )
+	, m_normalOffset( -1 )
+	, m_texcoordOffset( 0 )
+	, m_hasNormals( false )
+	, m_normalEncoding( NORMAL_OCT8 )
+	, m_decode( NULL )
+	, m_groupStart( NULL )
+	, m_groupCount( 0 )
+	, m_subsetGroup( NULL )
+	, m_subsetCount( 0 )
+{
+}
+
+//--------------------------------------------------------------------------------------
+VertexQuantizer::~VertexQuantizer()
+{
+	clear();
+}
+
+//--------------------------------------------------------------------------------------
+void VertexQuantizer::clear()
+{
+	delete[] m_vertices;
+	delete[] m_decode;
+	delete[] m_groupStart;
+	delete[] m_subsetGroup;
+	m_vertices = NULL;
+	m_decode = NULL;
+	m_groupStart = NULL;
+	m_subsetGroup = NULL;
+	m_vertexCount = 0;
+	m_stride = 0;
+	m_normalOffset = -1;
+	m_texcoordOffset = 0;
+	m_hasNormals = false;
+	m_groupCount = 0;
+	m_subsetCount = 0;
+}
+
+//--------------------------------------------------------------------------------------
+void VertexQuantizer::quantize(const float* positions, const float* normals, const float* texcoords, int vertexCount,
+	const XSubset* subsets, int subsetCount, NormalEncoding encoding)
+{
+	clear();
+	m_vertexCount = vertexCount;
+	m_hasNormals = normals != NULL;
+	m_normalEncoding = encoding;
+	m_normalOffset = m_hasNormals && encoding == NORMAL_OCT16 ? 8 : -1;
+	m_texcoordOffset = m_hasNormals && encoding == NORMAL_OCT8 ? 8 : -1;
+	m_stride = m_normalOffset >= 0 || m_texcoordOffset >= 0 ? 12 : 8;
+	m_vertices = new uint8_t[vertexCount * m_stride];
+
+	// Subsets by first vertex, merged into groups while their ranges overlap.
+	// A group reaches to the start of the next, so vertices no subset uses are
+	// encoded too.
+	int* order = new int[subsetCount + 1];
+	for (int i = 0; i < subsetCount; ++i)
+	{
+		int j = i;
+		for (; j > 0 && subsets[order[j - 1]].firstVertex > subsets[i].firstVertex; --j)
+		{
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+	}
+	m_subsetCount = subsetCount;
+	m_subsetGroup = new int[subsetCount + 1];
+	m_groupStart = new int[subsetCount + 2];
+	m_groupStart[0] = 0;
+	m_groupCount = 0;
+	int groupEnd = 0;
+	for (int i = 0; i < subsetCount; ++i)
+	{
+		const XSubset& subset = subsets[order[i]];
+		if (subset.vertexCount > 0 && m_groupCount > 0 && subset.firstVertex >= groupEnd)
+		{
+			m_groupStart[m_groupCount++] = subset.firstVertex;
+		}
+		else if (m_groupCount == 0)
+		{
+			m_groupCount = 1;
+		}
+		m_subsetGroup[order[i]] = m_groupCount - 1;
+		groupEnd = subset.firstVertex + subset.vertexCount > groupEnd ? subset.firstVertex + subset.vertexCount : groupEnd;
+	}
+	m_groupCount = m_groupCount > 0 ? m_groupCount : 1;
+	m_groupStart[m_groupCount] = vertexCount;
+	delete[] order;
+
+	m_decode = new VertexDecode[m_groupCount];
+	for (int g = 0; g < m_groupCount; ++g)
+	{
+		const int first = m_groupStart[g];
+		const int end = m_groupStart[g + 1];
+		VertexDecode& decode = m_decode[g];
+		for (int a = 0; a < 3; ++a)
+		{
+			findBounds(positions, 3, a, first, end, decode.offset[a], decode.scale[a]);
+		}
+		for (int a = 0; a < 2; ++a)
+		{
+			decode.texcoordOffset[a] = 0.0f;
+			decode.texcoordScale[a] = 1.0f;
+			if (isPacked() && texcoords != NULL)
+			{
+				findBounds(texcoords, 2, a, first, end, decode.texcoordOffset[a], decode.texcoordScale[a]);
+			}
+		}
+
+		for (int v = first; v < end; ++v)
+		{
+			uint8_t* vertex = m_vertices + v * m_stride;
+			int16_t position[4];
+			if (isPacked())
+			{
+				int q[5];
+				for (int a = 0; a < 3; ++a)
+				{
+					q[a] = quantizeBiased((positions[v * 3 + a] - (double)decode.offset[a]) / decode.scale[a], POSITION14_LEVELS);
+				}
+				for (int a = 0; a < 2; ++a)
+				{
+					const double texcoord = texcoords != NULL ? texcoords[v * 2 + a] : 0.0;
+					q[3 + a] = quantizeBiased((texcoord - decode.texcoordOffset[a]) / decode.texcoordScale[a], TEXCOORD11_LEVELS);
+				}
+				const int words[4] =
+				{
+					(q[0] << 2) | (q[4] & 3),
+					(q[1] << 2) | ((q[4] >> 2) & 3),
+					(q[2] << 2) | ((q[4] >> 4) & 3),
+					(q[3] << 5) | (q[4] >> 6),
+				};
+				for (int i = 0; i < 4; ++i)
+				{
+					position[i] = (int16_t)(words[i] - WORD_BIAS);
+				}
+			}
+			else
+			{
+				for (int a = 0; a < 3; ++a)
+				{
+					position[a] = quantizeSnorm16((positions[v * 3 + a] - (double)decode.offset[a]) / decode.scale[a]);
+				}
+				int qu, qv;
+				encodeOctahedral(normals + v * 3, OCT8_LEVELS, qu, qv);
+				position[3] = (int16_t)((qu + OCT8_LEVELS) + 255 * (qv + OCT8_LEVELS) - OCT8_PACK_BIAS);
+			}
+			memcpy(vertex, position, sizeof(position));
+			if (m_normalOffset >= 0)
+			{
+				int qu, qv;
+				encodeOctahedral(normals + v * 3, SHORT_LEVELS, qu, qv);
+				const int16_t normal[2] = { (int16_t)qu, (int16_t)qv };
+				memcpy(vertex + m_normalOffset, normal, sizeof(normal));
+			}
+			if (m_texcoordOffset >= 0)
+			{
+				const uint16_t texcoord[2] =
+				{
+					floatToHalf(texcoords != NULL ? texcoords[v * 2] : 0.0f),
+					floatToHalf(texcoords != NULL ? texcoords[v * 2 + 1] : 0.0f),
+				};
+				memcpy(vertex + m_texcoordOffset, texcoord, sizeof(texcoord));
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Float operations in the order the vertex shader does them
+void VertexQuantizer::decode(float* positions, float* normals, float* texcoords) const
+{
+	for (int g = 0; g < m_groupCount; ++g)
+	{
+		const VertexDecode& decode = m_decode[g];
+		for (int v = m_groupStart[g]; v < m_groupStart[g + 1]; ++v)
+		{
+			const uint8_t* vertex = m_vertices + v * m_stride;
+			int16_t position[4];
+			memcpy(position, vertex, sizeof(position));
+			if (isPacked())
+			{
+				float word[4];
+				for (int i = 0; i < 4; ++i)
+				{
+					word[i] = position[i] + (float)WORD_BIAS;
+				}
+				float low[3];
+				for (int a = 0; a < 3; ++a)
+				{
+					const float high = floorf(word[a] * 0.25f);
+					low[a] = word[a] - high * 4.0f;
+					positions[v * 3 + a] = decode.offset[a] + decode.scale[a] * ((high - POSITION14_LEVELS) / (float)POSITION14_LEVELS);
+				}
+				if (texcoords != NULL)
+				{
+					const float qu = floorf(word[3] * (1.0f / 32.0f));
+					const float qv = (word[3] - qu * 32.0f) * 64.0f + (low[0] + low[1] * 4.0f + low[2] * 16.0f);
+					texcoords[v * 2] = decode.texcoordOffset[0] + decode.texcoordScale[0] * ((qu - TEXCOORD11_LEVELS) / (float)TEXCOORD11_LEVELS);
+					texcoords[v * 2 + 1] = decode.texcoordOffset[1] + decode.texcoordScale[1] * ((qv - TEXCOORD11_LEVELS) / (float)TEXCOORD11_LEVELS);
+				}
+			}
+			else
+			{
+				for (int a = 0; a < 3; ++a)
+				{
+					positions[v * 3 + a] = decode.offset[a] + decode.scale[a] * (position[a] / (float)SHORT_LEVELS);
+				}
+			}
+			if (normals != NULL && m_hasNormals)
+			{
+				float u, w;
+				if (m_normalOffset >= 0)
+				{
+					int16_t normal[2];
+					memcpy(normal, vertex + m_normalOffset, sizeof(normal));
+					u = normal[0] / (float)SHORT_LEVELS;
+					w = normal[1] / (float)SHORT_LEVELS;
+				}
+				else
+				{
+					const float packed = floorf(position[3] / (float)SHORT_LEVELS * SHORT_LEVELS + 0.5f) + OCT8_PACK_BIAS;
+					const float high = floorf(packed / 255.0f);
+					u = (packed - high * 255.0f - OCT8_LEVELS) / OCT8_LEVELS;
+					w = (high - OCT8_LEVELS) / OCT8_LEVELS;
+				}
+				decodeOctahedral(u, w, normals + v * 3);
+			}
+			if (texcoords != NULL && m_texcoordOffset >= 0)
+			{
+				uint16_t texcoord[2];
+				memcpy(texcoord, vertex + m_texcoordOffset, sizeof(texcoord));
+				texcoords[v * 2] = halfToFloat(texcoord[0]);
+				texcoords[v * 2 + 1] = halfToFloat(texcoord[1]);
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+QuantizationErrors VertexQuantizer::measureErrors(const float* positions, const float* normals, const float* texcoords) const
+{
+	QuantizationErrors errors;
+	memset(&errors, 0, sizeof(errors));
+	if (m_vertexCount == 0)
+	{
+		return errors;
+	}
+	float* decodedPositions = new float[m_vertexCount * 3];
+	float* decodedNormals = m_hasNormals && normals != NULL ? new float[m_vertexCount * 3] : NULL;
+	float* decodedTexcoords = new float[m_vertexCount * 2];
+	decode(decodedPositions, decodedNormals, decodedTexcoords);
+
+	double squaredSum = 0.0;
+	double degreesSum = 0.0;
+	double texcoordSum = 0.0;
+	for (int v = 0; v < m_vertexCount; ++v)
+	{
+		double squared = 0.0;
+		for (int a = 0; a < 3; ++a)
+		{
+			const double d = (double)decodedPositions[v * 3 + a] - positions[v * 3 + a];
+			squared += d * d;
+		}
+		squaredSum += squared;
+		errors.maxPositionError = sqrt(squared) > errors.maxPositionError ? sqrt(squared) : errors.maxPositionError;
+		if (decodedNormals != NULL)
+		{
+			const double degrees = angleDegrees(decodedNormals + v * 3, normals + v * 3);
+			degreesSum += degrees;
+			errors.maxNormalDegrees = degrees > errors.maxNormalDegrees ? degrees : errors.maxNormalDegrees;
+		}
+		if (texcoords != NULL)
+		{
+			for (int a = 0; a < 2; ++a)
+			{
+				const double d = fabs((double)decodedTexcoords[v * 2 + a] - texcoords[v * 2 + a]);
+				texcoordSum += d;
+				errors.maxTexcoordError = d > errors.maxTexcoordError ? d : errors.maxTexcoordError;
+			}
+		}
+	}
+	errors.rmsPositionError = sqrt(squaredSum / m_vertexCount);
+	errors.meanNormalDegrees = degreesSum / m_vertexCount;
+	errors.meanTexcoordError = texcoordSum / (m_vertexCount * 2.0);
+
+	delete[] decodedPositions;
+	delete[] decodedNormals;
+	delete[] decodedTexcoords;
+	return errors;
+}
@@ -0,0 +1,114 @@
+//-----------------------------------------------------------------------------
+// File: VertexQuantizer.h
+//
+// Compact vertex formats for the tiger's main pass, decoded by the
+// QuantizedMesh techniques. With 8 bit normals:
+//
+//   SHORT4N    position x, y, z relative to the bounds of its subset, w the
+//              2x8 bit octahedral normal
+//   FLOAT16_2  texture coordinates
+//
+// With NORMAL_OCT16, or without normals, the texture coordinates move into the
+// position instead:
+//
+//   SHORT4     14 bit position x, y, z and 11 bit texture coordinates, both
+//              relative to the bounds of the subset
+//   SHORT2N    2x16 bit octahedral normal, if there is one
+//
+// 12 bytes a vertex with normals against 32 for float position, normal and
+// texture coordinates, 8 without normals against 20.
+//
+// SHORT4N decodes to short / 32767, so the position of a subset is
+// offset + scale * decoded. The 8 bit normal packs two 255 level snorm values
+// into w as u = x + 255 y - 32512, which stays clear of -32768 that D3D10
+// class hardware reads as -1 too. The packed SHORT4 holds 16 bit words biased
+// by -32768: x, y, z each in the top 14 bits of a word over 8191 levels either
+// side of the center, u in the top 11 bits of w and v over 1023 levels either
+// side, made of the low 5 bits of w above the low 2 bits of z, y and x.
+// Octahedral values are rounded whichever way decodes closest to the normal.
+// Subsets whose vertex ranges overlap share their bounds, so every vertex has
+// one encoding.
+//-----------------------------------------------------------------------------
+#ifndef VERTEX_QUANTIZER_H
+#define VERTEX_QUANTIZER_H
+
+#include "XMesh.h"
+
+//--------------------------------------------------------------------------------------
+enum NormalEncoding
+{
+	NORMAL_OCT8,
+	NORMAL_OCT16,
+};
+
+//--------------------------------------------------------------------------------------
+// position = offset + scale * decoded position in [-1, 1], texture coordinates
+// likewise where they are packed into the position
+struct VertexDecode
+{
+	float					offset[3];
+	float					scale[3];
+	float					texcoordOffset[2];	// 0, 0 and 1, 1 with FLOAT16_2 texture coordinates
+	float					texcoordScale[2];
+};
+
+//--------------------------------------------------------------------------------------
+// Decoded against the float input, over every vertex
+struct QuantizationErrors
+{
+	double					maxPositionError;	// distance in object units
+	double					rmsPositionError;
+	double					maxNormalDegrees;	// 0 without normals
+	double					meanNormalDegrees;
+	double					maxTexcoordError;	// largest of u and v, 0 without texture coordinates
+	double					meanTexcoordError;
+};
+
+//--------------------------------------------------------------------------------------
+class VertexQuantizer
+{
+	uint8_t*				m_vertices;
+	int						m_vertexCount;
+	int						m_stride;			// bytes
+	int						m_normalOffset;		// -1 when the normal is in w or absent
+	int						m_texcoordOffset;	// -1 when the texture coordinates are packed into the position
+	bool					m_hasNormals;
+	NormalEncoding			m_normalEncoding;
+	VertexDecode*			m_decode;			// per group of subsets sharing vertices
+	int*					m_groupStart;		// first vertex of every group, vertex count at the end
+	int						m_groupCount;
+	int*					m_subsetGroup;
+	int						m_subsetCount;
+
+	VertexQuantizer(const VertexQuantizer&);
+	VertexQuantizer& operator=(const VertexQuantizer&);
+public:
+
+	VertexQuantizer();
+	~VertexQuantizer();
+
+	void				clear();
+
+	// normals and texcoords may be NULL, missing texture coordinates are 0, 0
+	void				quantize(const float* positions, const float* normals, const float* texcoords, int vertexCount,
+							const XSubset* subsets, int subsetCount, NormalEncoding encoding);
+
+	// What the vertex shader sees, normals may be NULL
+	void				decode(float* positions, float* normals, float* texcoords) const;
+	QuantizationErrors	measureErrors(const float* positions, const float* normals, const float* texcoords) const;
+
+	// Bytes a vertex of float position, normal if present and texture coordinates takes
+	int					getFloatStride() const		{ return (m_hasNormals ? 8 : 5) * (int)sizeof(float); }
+
+	const uint8_t*		getVertices() const			{ return m_vertices; }
+	int					getVertexCount() const		{ return m_vertexCount; }
+	int					getStride() const			{ return m_stride; }
+	int					getNormalOffset() const		{ return m_normalOffset; }
+	int					getTexcoordOffset() const	{ return m_texcoordOffset; }
+	bool				hasNormals() const			{ return m_hasNormals; }
+	NormalEncoding		getNormalEncoding() const	{ return m_normalEncoding; }
+	bool				isPacked() const			{ return m_texcoordOffset < 0; }
+	const VertexDecode&	getVertexDecode(int subset) const	{ return m_decode[m_subsetGroup[subset]]; }
+};
+
+#endif // VERTEX_QUANTIZER_H
@@ -0,0 +1,1176 @@
+//-----------------------------------------------------------------------------
+// File: XMesh.cpp
+//-----------------------------------------------------------------------------
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#include "XMesh.h"
+#include "MeshOptimizer.h"
+#include <stdio.h>
+#include <string.h>
+
+//--------------------------------------------------------------------------------------
+// Powers of ten a double holds exactly
+static const double			EXACT_POWERS_OF_TEN[23] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+//--------------------------------------------------------------------------------------
+// Bump on any change to the layout below, to XMaterial and XSubset, or to what
+// optimize() does
+static const uint32_t		CACHE_VERSION = 2;
+static const int			CACHE_ALIGNMENT = 64;
+static const uint32_t		CACHE_NORMALS = 1;
+static const uint32_t		CACHE_TEXCOORDS = 2;
+
+// Offsets are from the start of the file, zero for absent arrays
+struct CacheHeader
+{
+	char					magic[4];			// "XMSC"
+	uint32_t				version;
+	uint64_t				sourceHash;
+	uint64_t				sourceSize;
+	uint64_t				fileSize;
+	uint32_t				materialSize;		// sizeof(XMaterial), catches packing differences
+	uint32_t				flags;
+	uint32_t				vertexCount;
+	uint32_t				triangleCount;
+	uint32_t				materialCount;
+	uint32_t				positions;
+	uint32_t				normals;
+	uint32_t				texcoords;
+	uint32_t				indices;
+	uint32_t				subsets;
+	uint32_t				materials;
+};
+
+//--------------------------------------------------------------------------------------
+// MurmurHash64A, eight bytes a step, so hashing the .x file costs a fraction of
+// mapping the cache
+static uint64_t hashContent(const char* data, size_t size)
+{
+	const uint64_t m = ((uint64_t)0xC6A4A793 << 32) | 0x5BD1E995;
+	const int r = 47;
+	uint64_t h = 0x9747B28C ^ (size * m);
+	const char* end = data + (size & ~(size_t)7);
+	for (const char* p = data; p < end; p += 8)
+	{
+		uint64_t k;
+		memcpy(&k, p, 8);
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+	const int tail = (int)(size & 7);
+	if (tail > 0)
+	{
+		for (int i = tail - 1; i >= 0; --i)
+		{
+			h ^= (uint64_t)(uint8_t)end[i] << (i * 8);
+		}
+		h *= m;
+	}
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+//--------------------------------------------------------------------------------------
+static uint32_t alignOffset(uint64_t offset)
+{
+	return (uint32_t)((offset + CACHE_ALIGNMENT - 1) & ~(uint64_t)(CACHE_ALIGNMENT - 1));
+}
+
+//--------------------------------------------------------------------------------------
+// Commas and semicolons only separate values, so they are skipped like spaces.
+// Nothing reads past end, the mapped file has no terminator.
+struct XTokenizer
+{
+	const char*				p;
+	const char*				end;
+
+	void skip()
+	{
+		while (p < end)
+		{
+			const char c = *p;
+			if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',' || c == ';')
+			{
+				++p;
+			}
+			else if (c == '#' || (c == '/' && p + 1 < end && p[1] == '/'))
+			{
+				while (p < end && *p != '\n')
+				{
+					++p;
+				}
+			}
+			else if (c == '<')
+			{
+				// GUID
+				while (p < end && *p != '>')
+				{
+					++p;
+				}
+				p += p < end;
+			}
+			else
+			{
+				break;
+			}
+		}
+	}
+
+	bool isNameStart()
+	{
+		skip();
+		return p < end && (*p == '_' || (*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z'));
+	}
+
+	bool is(char c)
+	{
+		skip();
+		return p < end && *p == c;
+	}
+
+	bool expect(char c)
+	{
+		if (!is(c))
+		{
+			return false;
+		}
+		++p;
+		return true;
+	}
+
+	bool readName(const char*& name, int& length)
+	{
+		if (!isNameStart())
+		{
+			return false;
+		}
+		name = p;
+		while (p < end && (*p == '_' || *p == '-' || (*p >= '0' && *p <= '9') || (*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')))
+		{
+			++p;
+		}
+		length = (int)(p - name);
+		return true;
+	}
+
+	void skipName()
+	{
+		const char* name;
+		int length;
+		readName(name, length);
+	}
+
+	// Copies a quoted string, truncated to size - 1 characters
+	bool readString(char* dst, int size)
+	{
+		if (!expect('"'))
+		{
+			return false;
+		}
+		const char* start = p;
+		while (p < end && *p != '"')
+		{
+			++p;
+		}
+		if (p == end)
+		{
+			return false;
+		}
+		const int length = mini((int)(p - start), size - 1);
+		memcpy(dst, start, length);
+		dst[length] = '\0';
+		++p;
+		return true;
+	}
+
+	// Decimal DWORD, a leading minus is kept so indices can be range checked
+	bool readInt(long& value)
+	{
+		skip();
+		const char* s = p;
+		const bool negative = s < end && *s == '-';
+		s += negative;
+		int64_t result = 0;
+		const char* digits = s;
+		while (s < end && *s >= '0' && *s <= '9' && result <= 0xFFFFFFFF)
+		{
+			result = result * 10 + (*s++ - '0');
+		}
+		if (s == digits || result > 0x7FFFFFFF)
+		{
+			return false;
+		}
+		value = negative ? -(long)result : (long)result;
+		p = s;
+		return true;
+	}
+
+	// Up to 19 significant digits are kept in an integer, which one multiply or
+	// divide by an exact power of ten turns into the correctly rounded double
+	// for anything up to 15 digits and exponents up to 22, as exporters write.
+	// Longer mantissas and larger exponents round a few times more.
+	bool readFloat(float& value)
+	{
+		skip();
+		const char* s = p;
+		const bool negative = s < end && *s == '-';
+		s += s < end && (*s == '-' || *s == '+');
+		uint64_t mantissa = 0;
+		int significant = 0;
+		int exponent = 0;
+		bool anyDigit = false;
+		for (; s < end && *s >= '0' && *s <= '9'; ++s)
+		{
+			anyDigit = true;
+			if (significant < 19)
+			{
+				mantissa = mantissa * 10 + (*s - '0');
+				significant += mantissa != 0;
+			}
+			else
+			{
+				++exponent;
+			}
+		}
+		if (s < end && *s == '.')
+		{
+			for (++s; s < end && *s >= '0' && *s <= '9'; ++s)
+			{
+				anyDigit = true;
+				if (significant < 19)
+				{
+					mantissa = mantissa * 10 + (*s - '0');
+					significant += mantissa != 0;
+					--exponent;
+				}
+			}
+		}
+		if (!anyDigit)
+		{
+			return false;
+		}
+		if (s < end && (*s == 'e' || *s == 'E'))
+		{
+			// Only taken as an exponent with at least one digit
+			const char* e = s + 1;
+			const bool negativeExponent = e < end && *e == '-';
+			e += e < end && (*e == '-' || *e == '+');
+			if (e < end && *e >= '0' && *e <= '9')
+			{
+				int power = 0;
+				for (; e < end && *e >= '0' && *e <= '9'; ++e)
+				{
+					power = mini(power * 10 + (*e - '0'), 1000);
+				}
+				exponent += negativeExponent ? -power : power;
+				s = e;
+			}
+		}
+
+		double result = (double)mantissa;
+		for (; exponent > 22 && result != 0.0; exponent -= 22)
+		{
+			result *= EXACT_POWERS_OF_TEN[22];
+		}
+		for (; exponent < -22 && result != 0.0; exponent += 22)
+		{
+			result /= EXACT_POWERS_OF_TEN[22];
+		}
+		if (result != 0.0)
+		{
+			result = exponent < 0 ? result / EXACT_POWERS_OF_TEN[-exponent] : result * EXACT_POWERS_OF_TEN[exponent];
+		}
+		value = (float)(negative ? -result : result);
+		p = s;
+		return true;
+	}
+
+	bool readFloats(float* values, int count)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			if (!readFloat(values[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Consumes up to and including the brace closing the current block
+	bool skipToBlockEnd()
+	{
+		int depth = 1;
+		while (p < end)
+		{
+			const char c = *p++;
+			if (c == '{')
+			{
+				++depth;
+			}
+			else if (c == '}' && --depth == 0)
+			{
+				return true;
+			}
+			else if (c == '"')
+			{
+				while (p < end && *p++ != '"')
+				{
+				}
+			}
+		}
+		return false;
+	}
+
+	bool skipBlock()
+	{
+		return expect('{') && skipToBlockEnd();
+	}
+};
+
+//--------------------------------------------------------------------------------------
+static bool nameIs(const char* name, int length, const char* keyword)
+{
+	return (int)strlen(keyword) == length && memcmp(name, keyword, length) == 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Body of a Material after its opening brace, up to and including the closing one
+static bool parseMaterial(XTokenizer& tokens, XMaterial& material)
+{
+	material.textureFilename[0] = '\0';
+	if (!tokens.readFloats(material.diffuse, 4) || !tokens.readFloat(material.power) ||
+		!tokens.readFloats(material.specular, 3) || !tokens.readFloats(material.emissive, 3))
+	{
+		return false;
+	}
+	for (;;)
+	{
+		if (tokens.expect('}'))
+		{
+			return true;
+		}
+		const char* name;
+		int length;
+		if (!tokens.readName(name, length))
+		{
+			return false;
+		}
+		tokens.skipName();
+		if (nameIs(name, length, "TextureFilename") || nameIs(name, length, "TextureFileName"))
+		{
+			if (!tokens.expect('{') || !tokens.readString(material.textureFilename, XMaterial::MAX_PATH_LENGTH) ||
+				!tokens.skipToBlockEnd())
+			{
+				return false;
+			}
+		}
+		else if (!tokens.skipBlock())
+		{
+			return false;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+static void setDefaultMaterial(XMaterial& material)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		material.diffuse[i] = 1.0f;
+	}
+	material.power = 0.0f;
+	for (int i = 0; i < 3; ++i)
+	{
+		material.specular[i] = 0.0f;
+		material.emissive[i] = 0.0f;
+	}
+	material.textureFilename[0] = '\0';
+}
+
+//--------------------------------------------------------------------------------------
+XMesh::XMesh()
+	: m_positions( NULL )
+	, m_normals( NULL )
+	, m_texcoords( NULL )
+	, m_indices( NULL )
+	, m_triangleMaterials( NULL )
+	, m_vertexCount( 0 )
+	, m_triangleCount( 0 )
+	, m_vertexCapacity( 0 )
+	, m_indexCapacity( 0 )
+	, m_hasNormals( false )
+	, m_hasTexcoords( false )
+	, m_materials( NULL )
+	, m_materialCount( 0 )
+	, m_materialCapacity( 0 )
+	, m_library( NULL )
+	, m_libraryCount( 0 )
+	, m_libraryCapacity( 0 )
+	, m_subsets( NULL )
+{
+}
+
+//--------------------------------------------------------------------------------------
+XMesh::~XMesh()
+{
+	clear();
+}
+
+//--------------------------------------------------------------------------------------
+void XMesh::clear()
+{
+	if (!isMapped())
+	{
+		delete[] m_positions;
+		delete[] m_normals;
+		delete[] m_texcoords;
+		delete[] m_indices;
+		delete[] m_materials;
+		delete[] m_subsets;
+	}
+	delete[] m_triangleMaterials;
+	delete[] m_library;
+	m_cache.close();
+	m_positions = NULL;
+	m_normals = NULL;
+	m_texcoords = NULL;
+	m_indices = NULL;
+	m_triangleMaterials = NULL;
+	m_materials = NULL;
+	m_library = NULL;
+	m_subsets = NULL;
+	m_vertexCount = 0;
+	m_triangleCount = 0;
+	m_vertexCapacity = 0;
+	m_indexCapacity = 0;
+	m_materialCount = 0;
+	m_materialCapacity = 0;
+	m_libraryCount = 0;
+	m_libraryCapacity = 0;
+	m_hasNormals = false;
+	m_hasTexcoords = false;
+}
+
+//--------------------------------------------------------------------------------------
+// Grows to hold the given totals, keeping what is loaded
+void XMesh::reserve(int vertexCount, int indexCount)
+{
+	if (vertexCount > m_vertexCapacity)
+	{
+		const int capacity = maxi(vertexCount, m_vertexCapacity * 2);
+		float* positions = new float[capacity * 3];
+		float* normals = new float[capacity * 3];
+		float* texcoords = new float[capacity * 2];
+		if (m_vertexCount > 0)
+		{
+			memcpy(positions, m_positions, m_vertexCount * 3 * sizeof(float));
+			memcpy(normals, m_normals, m_vertexCount * 3 * sizeof(float));
+			memcpy(texcoords, m_texcoords, m_vertexCount * 2 * sizeof(float));
+		}
+		delete[] m_positions;
+		delete[] m_normals;
+		delete[] m_texcoords;
+		m_positions = positions;
+		m_normals = normals;
+		m_texcoords = texcoords;
+		m_vertexCapacity = capacity;
+	}
+	if (indexCount > m_indexCapacity)
+	{
+		const int capacity = maxi(indexCount, m_indexCapacity * 2);
+		uint32_t* indices = new uint32_t[capacity];
+		uint32_t* materials = new uint32_t[capacity / 3];
+		if (m_triangleCount > 0)
+		{
+			memcpy(indices, m_indices, m_triangleCount * 3 * sizeof(uint32_t));
+			memcpy(materials, m_triangleMaterials, m_triangleCount * sizeof(uint32_t));
+		}
+		delete[] m_indices;
+		delete[] m_triangleMaterials;
+		m_indices = indices;
+		m_triangleMaterials = materials;
+		m_indexCapacity = capacity;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+XMaterial& XMesh::addMaterial()
+{
+	if (m_materialCount == m_materialCapacity)
+	{
+		m_materialCapacity = maxi(4, m_materialCapacity * 2);
+		XMaterial* materials = new XMaterial[m_materialCapacity];
+		if (m_materialCount > 0)
+		{
+			memcpy(materials, m_materials, m_materialCount * sizeof(XMaterial));
+		}
+		delete[] m_materials;
+		m_materials = materials;
+	}
+	// Zeroed past the texture name too, so caches of the same file are identical
+	memset(&m_materials[m_materialCount], 0, sizeof(XMaterial));
+	return m_materials[m_materialCount++];
+}
+
+//--------------------------------------------------------------------------------------
+XMesh::NamedMaterial& XMesh::addLibraryMaterial()
+{
+	if (m_libraryCount == m_libraryCapacity)
+	{
+		m_libraryCapacity = maxi(4, m_libraryCapacity * 2);
+		NamedMaterial* library = new NamedMaterial[m_libraryCapacity];
+		if (m_libraryCount > 0)
+		{
+			memcpy(library, m_library, m_libraryCount * sizeof(NamedMaterial));
+		}
+		delete[] m_library;
+		m_library = library;
+	}
+	return m_library[m_libraryCount++];
+}
+
+//--------------------------------------------------------------------------------------
+bool XMesh::load(const char* path)
+{
+	clear();
+	MappedFile file;
+	return file.open(path) && loadFromMemory(file.getData(), file.getSize());
+}
+
+//--------------------------------------------------------------------------------------
+bool XMesh::loadFromMemory(const char* data, size_t size)
+{
+	clear();
+
+	// "xof 0302txt 0032", only the text format is handled
+	const bool ok = size >= 16 && memcmp(data, "xof ", 4) == 0 && memcmp(data + 8, "txt ", 4) == 0 &&
+		parse(data + 16, data + size) && sortSubsets();
+	delete[] m_library;
+	m_library = NULL;
+	m_libraryCount = 0;
+	m_libraryCapacity = 0;
+	if (!ok)
+	{
+		clear();
+	}
+	return ok;
+}
+
+//--------------------------------------------------------------------------------------
+bool XMesh::loadCached(const char* path, const char* cachePath)
+{
+	clear();
+	MappedFile source;
+	if (!source.open(path))
+	{
+		return false;
+	}
+	const uint64_t hash = hashContent(source.getData(), source.getSize());
+	if (mapCache(cachePath, hash, source.getSize()))
+	{
+		return true;
+	}
+	if (!loadFromMemory(source.getData(), source.getSize()))
+	{
+		return false;
+	}
+	optimize();
+	saveCache(cachePath, hash, source.getSize());
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Every array has to lie inside the file. The subsets have to cover the
+// triangles in order, as sortSubsets() leaves them, with vertex ranges inside
+// the vertex arrays, every index of a subset inside its range, and every
+// texture name terminated. That one pass over the indices is all the checking
+// the mapped mesh gets, whoever wrote the file.
+bool XMesh::mapCache(const char* cachePath, uint64_t sourceHash, uint64_t sourceSize)
+{
+	if (!m_cache.open(cachePath))
+	{
+		return false;
+	}
+	const char* data = m_cache.getData();
+	const uint64_t size = m_cache.getSize();
+	CacheHeader header;
+	bool ok = size >= sizeof(header);
+	if (ok)
+	{
+		memcpy(&header, data, sizeof(header));
+		const uint64_t vertices = header.vertexCount;
+		const uint64_t triangles = header.triangleCount;
+		const uint64_t materials = header.materialCount;
+		ok = memcmp(header.magic, "XMSC", 4) == 0 && header.version == CACHE_VERSION &&
+			header.sourceHash == sourceHash && header.sourceSize == sourceSize && header.fileSize == size &&
+			header.materialSize == sizeof(XMaterial) && vertices > 0 && triangles > 0 && materials > 0 &&
+			vertices <= 0x7FFFFFFF && triangles <= 0x7FFFFFFF && materials <= 0x7FFFFFFF &&
+			header.positions != 0 && header.positions + vertices * 3 * sizeof(float) <= size &&
+			((header.flags & CACHE_NORMALS) == 0 || (header.normals != 0 && header.normals + vertices * 3 * sizeof(float) <= size)) &&
+			((header.flags & CACHE_TEXCOORDS) == 0 || (header.texcoords != 0 && header.texcoords + vertices * 2 * sizeof(float) <= size)) &&
+			header.indices != 0 && header.indices + triangles * 3 * sizeof(uint32_t) <= size &&
+			header.subsets != 0 && header.subsets + materials * sizeof(XSubset) <= size &&
+			header.materials != 0 && header.materials + materials * sizeof(XMaterial) <= size;
+	}
+	if (ok)
+	{
+		m_subsets = (XSubset*)(data + header.subsets);
+		const XMaterial* materials = (const XMaterial*)(data + header.materials);
+		const uint32_t* indices = (const uint32_t*)(data + header.indices);
+		uint64_t nextTriangle = 0;
+		for (uint32_t i = 0; i < header.materialCount && ok; ++i)
+		{
+			const XSubset& subset = m_subsets[i];
+			ok = memchr(materials[i].textureFilename, 0, XMaterial::MAX_PATH_LENGTH) != NULL && subset.material == (int)i && (uint64_t)subset.firstTriangle == nextTriangle && subset.triangleCount >= 0 &&
+				(uint64_t)subset.firstTriangle + subset.triangleCount <= header.triangleCount &&
+				subset.firstVertex >= 0 && subset.vertexCount >= 0 &&
+				(uint64_t)subset.firstVertex + subset.vertexCount <= header.vertexCount;
+			const uint32_t* index = indices + (ok ? (size_t)subset.firstTriangle * 3 : 0);
+			const uint32_t* end = index + (ok ? (size_t)subset.triangleCount * 3 : 0);
+			for (; index < end && ok; ++index)
+			{
+				ok = *index - (uint32_t)subset.firstVertex < (uint32_t)subset.vertexCount;
+			}
+			nextTriangle += subset.triangleCount;
+		}
+		ok = ok && nextTriangle == header.triangleCount;
+	}
+	if (!ok)
+	{
+		m_subsets = NULL;
+		m_cache.close();
+		return false;
+	}
+
+	// The mapping is read-only, nothing writes through these after loading
+	m_positions = (float*)(data + header.positions);
+	m_normals = (header.flags & CACHE_NORMALS) != 0 ? (float*)(data + header.normals) : NULL;
+	m_texcoords = (header.flags & CACHE_TEXCOORDS) != 0 ? (float*)(data + header.texcoords) : NULL;
+	m_indices = (uint32_t*)(data + header.indices);
+	m_materials = (XMaterial*)(data + header.materials);
+	m_vertexCount = (int)header.vertexCount;
+	m_triangleCount = (int)header.triangleCount;
+	m_materialCount = (int)header.materialCount;
+	m_hasNormals = m_normals != NULL;
+	m_hasTexcoords = m_texcoords != NULL;
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+bool XMesh::saveCache(const char* cachePath, uint64_t sourceHash, uint64_t sourceSize) const
+{
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "XMSC", 4);
+	header.version = CACHE_VERSION;
+	header.sourceHash = sourceHash;
+	header.sourceSize = sourceSize;
+	header.materialSize = sizeof(XMaterial);
+	header.flags = (m_hasNormals ? CACHE_NORMALS : 0) | (m_hasTexcoords ? CACHE_TEXCOORDS : 0);
+	header.vertexCount = m_vertexCount;
+	header.triangleCount = m_triangleCount;
+	header.materialCount = m_materialCount;
+
+	// Header, then each array at the next aligned offset
+	const void* arrays[6] = { m_positions, m_hasNormals ? m_normals : NULL, m_hasTexcoords ? m_texcoords : NULL,
+		m_indices, m_subsets, m_materials };
+	const uint64_t vertices = m_vertexCount;
+	const uint64_t sizes[6] = { vertices * 3 * sizeof(float), vertices * 3 * sizeof(float), vertices * 2 * sizeof(float),
+		(uint64_t)m_triangleCount * 3 * sizeof(uint32_t), m_materialCount * sizeof(XSubset), m_materialCount * sizeof(XMaterial) };
+	uint32_t* offsets[6] = { &header.positions, &header.normals, &header.texcoords, &header.indices,
+		&header.subsets, &header.materials };
+	uint64_t end = sizeof(header);
+	for (int i = 0; i < 6; ++i)
+	{
+		if (arrays[i] != NULL)
+		{
+			if (alignOffset(end) + sizes[i] > 0xFFFFFFFF)
+			{
+				return false;
+			}
+			*offsets[i] = alignOffset(end);
+			end = *offsets[i] + sizes[i];
+		}
+	}
+	header.fileSize = end;
+
+	// Written next to the cache and renamed over it when complete, so a
+	// concurrent start maps the old file or the new one and never a torn one
+	const size_t pathLength = strlen(cachePath);
+	char* tempPath = new char[pathLength + 5];
+	memcpy(tempPath, cachePath, pathLength);
+	memcpy(tempPath + pathLength, ".tmp", 5);
+	FILE* file = fopen(tempPath, "wb");
+	if (file == NULL)
+	{
+		delete[] tempPath;
+		return false;
+	}
+	static const char padding[CACHE_ALIGNMENT] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	uint64_t written = sizeof(header);
+	for (int i = 0; i < 6 && ok; ++i)
+	{
+		if (arrays[i] != NULL)
+		{
+			ok = fwrite(padding, 1, (size_t)(*offsets[i] - written), file) == *offsets[i] - written &&
+				fwrite(arrays[i], 1, (size_t)sizes[i], file) == sizes[i];
+			written = *offsets[i] + sizes[i];
+		}
+	}
+	ok = fclose(file) == 0 && ok;
+	ok = ok && replaceFile(tempPath, cachePath);
+	if (!ok)
+	{
+		remove(tempPath);
+	}
+	delete[] tempPath;
+	return ok;
+}
+
+//--------------------------------------------------------------------------------------
+bool XMesh::parse(const char* text, const char* end)
+{
+	XTokenizer tokens = { text, end };
+	for (;;)
+	{
+		tokens.skip();
+		if (tokens.p >= end)
+		{
+			return m_triangleCount > 0;
+		}
+		if (tokens.is('}'))
+		{
+			// End of a Frame whose body was entered
+			++tokens.p;
+			continue;
+		}
+
+		const char* name;
+		int length;
+		if (!tokens.readName(name, length))
+		{
+			return false;
+		}
+		if (nameIs(name, length, "Frame"))
+		{
+			// Children are parsed in place, the frame transform is ignored
+			tokens.skipName();
+			if (!tokens.expect('{'))
+			{
+				return false;
+			}
+			continue;
+		}
+		if (nameIs(name, length, "Material"))
+		{
+			// Named for references from material lists
+			NamedMaterial& named = addLibraryMaterial();
+			const char* materialName = "";
+			int materialLength = 0;
+			tokens.readName(materialName, materialLength);
+			materialLength = mini(materialLength, (int)sizeof(named.name) - 1);
+			memcpy(named.name, materialName, materialLength);
+			named.name[materialLength] = '\0';
+			if (!tokens.expect('{') || !parseMaterial(tokens, named.material))
+			{
+				return false;
+			}
+			continue;
+		}
+		if (!nameIs(name, length, "Mesh"))
+		{
+			// Templates, Header, FrameTransformMatrix, animation
+			tokens.skipName();
+			if (!tokens.skipBlock())
+			{
+				return false;
+			}
+			continue;
+		}
+		tokens.skipName();
+		if (!parseMesh(tokens))
+		{
+			return false;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// From the opening brace of a Mesh to its closing one
+bool XMesh::parseMesh(XTokenizer& tokens)
+{
+	long vertexCount;
+	if (!tokens.expect('{') || !tokens.readInt(vertexCount) || vertexCount <= 0 || vertexCount > 0x1000000)
+	{
+		return false;
+	}
+	const int baseVertex = m_vertexCount;
+	const int baseTriangle = m_triangleCount;
+	reserve(baseVertex + (int)vertexCount, m_triangleCount * 3);
+	if (!tokens.readFloats(m_positions + baseVertex * 3, (int)vertexCount * 3))
+	{
+		return false;
+	}
+	memset(m_normals + baseVertex * 3, 0, vertexCount * 3 * sizeof(float));
+	memset(m_texcoords + baseVertex * 2, 0, vertexCount * 2 * sizeof(float));
+	m_vertexCount += (int)vertexCount;
+
+	// First triangle of every face, plus one past the last
+	long faceCount;
+	if (!tokens.readInt(faceCount) || faceCount < 0 || faceCount > 0x1000000)
+	{
+		return false;
+	}
+	int* faceTriangles = new int[faceCount + 1];
+	bool ok = true;
+	for (long face = 0; face < faceCount && ok; ++face)
+	{
+		faceTriangles[face] = m_triangleCount;
+		long cornerCount;
+		long first, previous;
+		ok = tokens.readInt(cornerCount) && cornerCount >= 3 && cornerCount <= 0x10000 &&
+			tokens.readInt(first) && tokens.readInt(previous) &&
+			first >= 0 && first < vertexCount && previous >= 0 && previous < vertexCount;
+		if (ok)
+		{
+			reserve(m_vertexCount, (m_triangleCount + (int)cornerCount - 2) * 3);
+		}
+		for (long corner = 2; corner < cornerCount && ok; ++corner)
+		{
+			long index;
+			ok = tokens.readInt(index) && index >= 0 && index < vertexCount;
+			uint32_t* triangle = m_indices + m_triangleCount * 3;
+			triangle[0] = (uint32_t)(baseVertex + first);
+			triangle[1] = (uint32_t)(baseVertex + previous);
+			triangle[2] = (uint32_t)(baseVertex + index);
+			m_triangleMaterials[m_triangleCount] = 0;
+			++m_triangleCount;
+			previous = index;
+		}
+	}
+	faceTriangles[faceCount] = m_triangleCount;
+
+	// Child blocks of the mesh. A vertex whose corners name different normals is
+	// split, copies are chained from the original and keep their normal index.
+	int* normalOf = NULL;
+	int* nextCopy = NULL;
+	int* original = NULL;
+	bool hasMaterials = false;
+	while (ok)
+	{
+		if (tokens.expect('}'))
+		{
+			break;
+		}
+		if (tokens.is('{'))
+		{
+			// Reference to a named object
+			ok = tokens.skipBlock();
+			continue;
+		}
+		const char* name;
+		int length;
+		if (!tokens.readName(name, length))
+		{
+			ok = false;
+			break;
+		}
+		tokens.skipName();
+		if (nameIs(name, length, "MeshTextureCoords"))
+		{
+			long texcoordCount;
+			ok = tokens.expect('{') && tokens.readInt(texcoordCount) && texcoordCount == vertexCount &&
+				tokens.readFloats(m_texcoords + baseVertex * 2, (int)texcoordCount * 2) && tokens.skipToBlockEnd();
+			m_hasTexcoords = true;
+		}
+		else if (nameIs(name, length, "MeshNormals") && normalOf == NULL)
+		{
+			long normalCount;
+			long faceNormalCount;
+			ok = tokens.expect('{') && tokens.readInt(normalCount) && normalCount >= 0 && normalCount <= 0x1000000;
+			float* normals = ok ? new float[normalCount * 3 + 1] : NULL;
+			ok = ok && tokens.readFloats(normals, (int)normalCount * 3) && tokens.readInt(faceNormalCount) &&
+				faceNormalCount == faceCount;
+
+			// A copy per corner at most
+			const int maxVertices = (int)vertexCount + (faceTriangles[faceCount] - baseTriangle) * 3;
+			normalOf = new int[maxVertices];
+			nextCopy = new int[maxVertices];
+			original = new int[maxVertices];
+			for (int i = 0; i < maxVertices; ++i)
+			{
+				normalOf[i] = -1;
+				nextCopy[i] = -1;
+				original[i] = i;
+			}
+			for (long face = 0; face < faceNormalCount && ok; ++face)
+			{
+				const int firstTriangle = faceTriangles[face];
+				const int triangleCount = faceTriangles[face + 1] - firstTriangle;
+				long cornerCount;
+				ok = tokens.readInt(cornerCount) && cornerCount == triangleCount + 2;
+				for (long corner = 0; corner < cornerCount && ok; ++corner)
+				{
+					long normal;
+					ok = tokens.readInt(normal) && normal >= 0 && normal < normalCount;
+					if (!ok)
+					{
+						break;
+					}
+
+					// Fan slots of the corner: 0 of every triangle, or 1 and 2 of two neighbours
+					uint32_t* slots[2];
+					int slotCount = 0;
+					if (corner == 0)
+					{
+						slots[slotCount++] = m_indices + firstTriangle * 3;
+					}
+					else
+					{
+						if (corner - 1 < triangleCount)
+							slots[slotCount++] = m_indices + (firstTriangle + corner - 1) * 3 + 1;
+						if (corner >= 2)
+							slots[slotCount++] = m_indices + (firstTriangle + corner - 2) * 3 + 2;
+					}
+					const int vertex = (int)*slots[0] - baseVertex;
+					int target = vertex;
+					while (target >= 0 && normalOf[target] >= 0 && normalOf[target] != normal)
+					{
+						target = nextCopy[target];
+					}
+					if (target < 0)
+					{
+						target = m_vertexCount - baseVertex;
+						reserve(m_vertexCount + 1, m_triangleCount * 3);
+						memcpy(m_positions + m_vertexCount * 3, m_positions + (baseVertex + vertex) * 3, 3 * sizeof(float));
+						original[target] = vertex;
+						nextCopy[target] = nextCopy[vertex];
+						nextCopy[vertex] = target;
+						++m_vertexCount;
+					}
+					normalOf[target] = (int)normal;
+					memcpy(m_normals + (baseVertex + target) * 3, normals + normal * 3, 3 * sizeof(float));
+					const uint32_t index = (uint32_t)(baseVertex + target);
+					if (corner == 0)
+					{
+						for (int t = 0; t < triangleCount; ++t)
+						{
+							slots[0][t * 3] = index;
+						}
+					}
+					else
+					{
+						for (int s = 0; s < slotCount; ++s)
+						{
+							*slots[s] = index;
+						}
+					}
+				}
+			}
+			delete[] normals;
+			ok = ok && tokens.skipToBlockEnd();
+			m_hasNormals = true;
+		}
+		else if (nameIs(name, length, "MeshMaterialList") && !hasMaterials)
+		{
+			// Faces past the listed ones repeat the last material, as D3DX does
+			long materialCount;
+			long indexCount;
+			ok = tokens.expect('{') && tokens.readInt(materialCount) && materialCount > 0 && materialCount <= 0x10000 &&
+				tokens.readInt(indexCount) && indexCount >= 0 && indexCount <= faceCount;
+			long material = 0;
+			for (long face = 0; face < faceCount && ok; ++face)
+			{
+				if (face < indexCount)
+				{
+					ok = tokens.readInt(material) && material >= 0 && material < materialCount;
+				}
+				for (int t = faceTriangles[face]; t < faceTriangles[face + 1]; ++t)
+				{
+					m_triangleMaterials[t] = (uint32_t)(m_materialCount + material);
+				}
+			}
+			for (long i = 0; i < materialCount && ok; ++i)
+			{
+				XMaterial& added = addMaterial();
+				if (tokens.expect('{'))
+				{
+					// { name } of a top level Material
+					const char* reference;
+					int referenceLength;
+					ok = tokens.readName(reference, referenceLength) && tokens.expect('}');
+					int found = -1;
+					for (int j = 0; j < m_libraryCount && ok; ++j)
+					{
+						found = nameIs(reference, referenceLength, m_library[j].name) ? j : found;
+					}
+					ok = ok && found >= 0;
+					if (ok)
+					{
+						added = m_library[found].material;
+					}
+				}
+				else
+				{
+					ok = tokens.readName(name, length) && nameIs(name, length, "Material");
+					tokens.skipName();
+					ok = ok && tokens.expect('{') && parseMaterial(tokens, added);
+				}
+			}
+			ok = ok && tokens.skipToBlockEnd();
+			hasMaterials = true;
+		}
+		else
+		{
+			ok = tokens.skipBlock();
+		}
+	}
+
+	if (ok && !hasMaterials)
+	{
+		setDefaultMaterial(addMaterial());
+		for (int t = baseTriangle; t < m_triangleCount; ++t)
+		{
+			m_triangleMaterials[t] = (uint32_t)(m_materialCount - 1);
+		}
+	}
+	if (ok && original != NULL)
+	{
+		// Copies take the texture coordinates wherever MeshTextureCoords came
+		for (int i = (int)vertexCount; i < m_vertexCount - baseVertex; ++i)
+		{
+			memcpy(m_texcoords + (baseVertex + i) * 2, m_texcoords + (baseVertex + original[i]) * 2, 2 * sizeof(float));
+		}
+	}
+	delete[] faceTriangles;
+	delete[] normalOf;
+	delete[] nextCopy;
+	delete[] original;
+	return ok;
+}
+
+//--------------------------------------------------------------------------------------
+// Counting sort of the triangles by material, stable so every subset keeps the
+// file order
+bool XMesh::sortSubsets()
+{
+	m_subsets = new XSubset[m_materialCount];
+	for (int i = 0; i < m_materialCount; ++i)
+	{
+		m_subsets[i].material = i;
+		m_subsets[i].triangleCount = 0;
+	}
+	for (int t = 0; t < m_triangleCount; ++t)
+	{
+		++m_subsets[m_triangleMaterials[t]].triangleCount;
+	}
+	int first = 0;
+	for (int i = 0; i < m_materialCount; ++i)
+	{
+		m_subsets[i].firstTriangle = first;
+		first += m_subsets[i].triangleCount;
+	}
+
+	uint32_t* sorted = new uint32_t[m_indexCapacity];
+	int* next = new int[m_materialCount];
+	for (int i = 0; i < m_materialCount; ++i)
+	{
+		next[i] = m_subsets[i].firstTriangle;
+	}
+	for (int t = 0; t < m_triangleCount; ++t)
+	{
+		memcpy(sorted + next[m_triangleMaterials[t]]++ * 3, m_indices + t * 3, 3 * sizeof(uint32_t));
+	}
+	delete[] m_indices;
+	delete[] m_triangleMaterials;
+	delete[] next;
+	m_indices = sorted;
+	m_triangleMaterials = NULL;
+	updateVertexRanges();
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Lowest and highest vertex every subset references
+void XMesh::updateVertexRanges()
+{
+	for (int i = 0; i < m_materialCount; ++i)
+	{
+		XSubset& subset = m_subsets[i];
+		int lowest = m_vertexCount;
+		int highest = -1;
+		for (int k = subset.firstTriangle * 3; k < (subset.firstTriangle + subset.triangleCount) * 3; ++k)
+		{
+			lowest = mini(lowest, (int)m_indices[k]);
+			highest = maxi(highest, (int)m_indices[k]);
+		}
+		subset.firstVertex = highest < 0 ? 0 : lowest;
+		subset.vertexCount = highest + 1 - subset.firstVertex;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Subsets are optimized one at a time, so every subset stays one range. The
+// vertex arrays are permuted after, in the order the subsets use them.
+void XMesh::optimize()
+{
+	if (isMapped() || m_triangleCount == 0)
+	{
+		return;
+	}
+	int* clusters = new int[m_triangleCount];
+	for (int i = 0; i < m_materialCount; ++i)
+	{
+		uint32_t* indices = m_indices + m_subsets[i].firstTriangle * 3;
+		const int triangleCount = m_subsets[i].triangleCount;
+		const int clusterCount = optimizeVertexCache(indices, triangleCount, m_vertexCount, VERTEX_CACHE_SIZE, clusters);
+		optimizeOverdraw(indices, triangleCount, m_positions, 3, m_vertexCount, clusters, clusterCount, VERTEX_CACHE_SIZE,
+			OVERDRAW_THRESHOLD);
+	}
+	delete[] clusters;
+
+	uint32_t* remap = new uint32_t[m_vertexCount];
+	optimizeVertexFetch(m_indices, m_triangleCount, m_vertexCount, remap);
+	float* positions = new float[m_vertexCount * 3];
+	float* normals = new float[m_vertexCount * 3];
+	float* texcoords = new float[m_vertexCount * 2];
+	for (int v = 0; v < m_vertexCount; ++v)
+	{
+		memcpy(positions + remap[v] * 3, m_positions + v * 3, 3 * sizeof(float));
+		memcpy(normals + remap[v] * 3, m_normals + v * 3, 3 * sizeof(float));
+		memcpy(texcoords + remap[v] * 2, m_texcoords + v * 2, 2 * sizeof(float));
+	}
+	delete[] remap;
+	delete[] m_positions;
+	delete[] m_normals;
+	delete[] m_texcoords;
+	m_positions = positions;
+	m_normals = normals;
+	m_texcoords = texcoords;
+	m_vertexCapacity = m_vertexCount;
+	updateVertexRanges();
+}
+
+//--------------------------------------------------------------------------------------
+RasterMesh XMesh::getRasterMesh() const
+{
+	RasterMesh mesh;
+	mesh.positions = m_positions;
+	mesh.stride = 3;
+	mesh.vertexCount = m_vertexCount;
+	mesh.indices = m_indices;
+	mesh.triangleCount = m_triangleCount;
+	return mesh;
+}
@@ -0,0 +1,130 @@
+//-----------------------------------------------------------------------------
+// File: XMesh.h
+//
+// Loader for text DirectX .x files (xof 0302txt) without D3DX, in place of
+// D3DXLoadMeshFromX. The file is memory mapped and read in one pass: Mesh
+// positions and faces, MeshNormals, MeshTextureCoords, MeshMaterialList with
+// inline or referenced Materials and their TextureFilename. Numbers are
+// parsed in place without allocating or needing a terminator. Polygons are
+// fanned into triangles the way D3DXLoadMeshFromX does, and vertices whose
+// corners use different normals are split like it splits them.
+//
+// Triangles are sorted by material at the end, so subset i is the range of
+// triangles drawn with material i, as DrawSubset(i) expects. Meshes without
+// a material list get a white untextured material. Templates and frame
+// transforms are skipped.
+//
+// loadCached() keeps a binary copy of what load() and optimize() built next
+// to the .x file, keyed by a hash of the .x contents. The arrays in it are 64 byte aligned in
+// the layout XMesh keeps them in, so a later start maps the cache and points
+// at them without copying or parsing. A cache of another version, another
+// source, one cut short or with indices outside its subsets is rewritten,
+// into a temporary file renamed over it.
+//-----------------------------------------------------------------------------
+#ifndef X_MESH_H
+#define X_MESH_H
+
+#include "DepthRasterizer.h"
+
+//--------------------------------------------------------------------------------------
+struct XMaterial
+{
+	static const int		MAX_PATH_LENGTH = 260;
+
+	float					diffuse[4];			// faceColor
+	float					power;
+	float					specular[3];
+	float					emissive[3];
+	char					textureFilename[MAX_PATH_LENGTH];	// empty without TextureFilename
+};
+
+//--------------------------------------------------------------------------------------
+// Same fields as D3DXATTRIBUTERANGE
+struct XSubset
+{
+	int						material;
+	int						firstTriangle;
+	int						triangleCount;
+	int						firstVertex;		// lowest and
+	int						vertexCount;		// highest index referenced
+};
+
+struct XTokenizer;
+
+//--------------------------------------------------------------------------------------
+class XMesh
+{
+	struct NamedMaterial
+	{
+		char				name[64];
+		XMaterial			material;
+	};
+
+	float*					m_positions;
+	float*					m_normals;			// zero for meshes without MeshNormals
+	float*					m_texcoords;		// zero for meshes without MeshTextureCoords
+	uint32_t*				m_indices;
+	uint32_t*				m_triangleMaterials;	// while parsing, until the sort
+	int						m_vertexCount;
+	int						m_triangleCount;
+	int						m_vertexCapacity;
+	int						m_indexCapacity;
+	bool					m_hasNormals;
+	bool					m_hasTexcoords;
+	XMaterial*				m_materials;
+	int						m_materialCount;
+	int						m_materialCapacity;
+	NamedMaterial*			m_library;			// top level Materials, while parsing
+	int						m_libraryCount;
+	int						m_libraryCapacity;
+	XSubset*				m_subsets;			// one per material
+	MappedFile				m_cache;			// the arrays point into it when mapped
+
+	XMesh(const XMesh&);
+	XMesh& operator=(const XMesh&);
+
+	void				reserve(int vertexCount, int indexCount);
+	XMaterial&			addMaterial();
+	NamedMaterial&		addLibraryMaterial();
+	bool				parse(const char* text, const char* end);
+	bool				parseMesh(XTokenizer& tokens);
+	bool				sortSubsets();
+	void				updateVertexRanges();
+	bool				mapCache(const char* cachePath, uint64_t sourceHash, uint64_t sourceSize);
+	bool				saveCache(const char* cachePath, uint64_t sourceHash, uint64_t sourceSize) const;
+public:
+
+	XMesh();
+	~XMesh();
+
+	void				clear();
+	bool				load(const char* path);
+
+	// load() of a whole file already in memory, data need not be zero terminated
+	bool				loadFromMemory(const char* data, size_t size);
+
+	// load() through the cache file, which is written when missing or stale.
+	// Failing to write it only costs the next start another parse.
+	bool				loadCached(const char* path, const char* cachePath);
+
+	// Reorders the triangles of every subset for the post-transform cache and
+	// for less overdraw, then the vertices in the order they are first used,
+	// see MeshOptimizer.h. Mapped meshes were optimized before being cached.
+	void				optimize();
+
+	// True when the arrays are the ones in a mapped cache file
+	bool				isMapped() const			{ return m_cache.getData() != NULL; }
+
+	const float*		getPositions() const		{ return m_positions; }
+	const float*		getNormals() const			{ return m_hasNormals ? m_normals : NULL; }
+	const float*		getTexcoords() const		{ return m_hasTexcoords ? m_texcoords : NULL; }
+	const uint32_t*		getIndices() const			{ return m_indices; }
+	int					getVertexCount() const		{ return m_vertexCount; }
+	int					getTriangleCount() const	{ return m_triangleCount; }
+	const XMaterial*	getMaterials() const		{ return m_materials; }
+	int					getMaterialCount() const	{ return m_materialCount; }
+	const XSubset*		getSubsets() const			{ return m_subsets; }
+	RasterMesh			getRasterMesh() const;
+};
+
+#endif // X_MESH_H